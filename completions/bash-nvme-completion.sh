@@ -10,8 +10,9 @@ _cmds="list id-ctrl id-ns list-ns create-ns delete-ns \
 	security-recv resv-acquire resv-register resv-release \
 	resv-report dsm flush compare read write write-zeroes \
 	write-uncor reset subsystem-reset show-regs discover \
-	connect-all connect disconnect version help \
-	intel lnvm memblaze list-subsys"
+	connect-all connect disconnect disconnect-all version help \
+	intel lnvm memblaze list-subsys monitor ana-check path-bench top history daemon metrics \
+	export-metrics latency-stats trace irq-map pcie-health"
 
 nvme_list_opts () {
         local opts=""
@@ -36,7 +37,7 @@ nvme_list_opts () {
 		;;
 		"id-ctrl")
 		opts+=" --raw-binary -b --human-readable -H \
-			--vendor-specific -v --output-format= -o"
+			--vendor-specific -v --output-format= -o --via-daemon"
 		;;
 		"id-ns")
 		opts+=" --namespace-id= -n --raw-binary -b \
@@ -73,14 +74,16 @@ nvme_list_opts () {
 			;;
 		"smart-log")
 		opts+=" --namespace-id= -n --raw-binary -b \
-			--output-format= -o"
+			--output-format= -o --interval= -i --count= -c \
+			--via-daemon"
 			;;
 		"smart-log-add")
-		opts+=" --namespace-id= -n --raw-binary -b"
+		opts+=" --namespace-id= -n --raw-binary -b --json -j \
+			--output-format= -o"
 			;;
 		"error-log")
 		opts+=" --namespace-id= -n --raw-binary -b --log-entries= -e \
-			--output-format= -o"
+			--output-format= -o --via-daemon"
 			;;
 		"get-feature")
 		opts+=" --namespace-id= -n --feature-id= -f --sel= -s \
@@ -193,19 +196,69 @@ nvme_list_opts () {
 			;;
 		"discover")
 		opts+=" --transport= -t -traddr= -a -trsvcid= -s \
-			--hostnqn= -q --raw= -r"
+			--hostnqn= -q --raw= -r --parallel= -j --deadline= -e"
 			;;
 		"connect-all")
 		opts+=" --transport= -t --traddr= -a --trsvcid= -s
-			--hostnqn= -q --raw= -r"
+			--hostnqn= -q --raw= -r --parallel= -j --deadline= -e \
+			--incremental -N --disconnect-removed \
+			--daemon --notify --window= --auto-queues --dry-run"
 			;;
 		"connect")
 		opts+=" --transport= -t --nqn= -n --traddr= -a --trsvcid -s \
 			--hostnqn= -q --nr-io-queues= -i --keep-alive-tmo -k \
-			--reconnect-delay -r"
+			--reconnect-delay -r --auto-queues --dry-run"
 			;;
 		"disconnect")
-		opts+=" --nqn -n --device -d"
+		opts+=" --nqn -n --device -d --parallel= -j --deadline= -e"
+			;;
+		"disconnect-all")
+		opts+=" --transport= -t --traddr= -a --nqn= -n \
+			--parallel= -j --deadline= -e"
+			;;
+		"monitor")
+		opts+=" --interval= -i --record= -R --replay= -r --live -L"
+			;;
+		"ana-check")
+		opts+=" --nqn= -n --wait -w --output-format= -o"
+			;;
+		"path-bench")
+		opts+=" --count= -c --size= -s --mode= -m --interval= -i \
+			--output-format= -o"
+			;;
+		"top")
+		opts+=" --interval= -i --count= -c --smart-interval= -S \
+			--output-format= -o"
+			;;
+		"history")
+		opts+=" --record -r --interval= -i --count= -c --records= -N \
+			--since= -s --until= -u --step= -S --dir= -d --file= -f \
+			--output-format= -o"
+			;;
+		"daemon")
+		opts+=" --socket= -s --smart-interval= -S --error-interval= -E \
+			--ana-interval= -A --scan-interval= -r --shm= -m \
+			--group= -g"
+			;;
+		"metrics")
+		opts+=" --shm= -m --output-format= -o"
+			;;
+		"export-metrics")
+		opts+=" --textfile= -f"
+			;;
+		"latency-stats")
+		opts+=" --write -w --interval= -i --count= -c \
+			--buckets -B --output-format= -o"
+			;;
+		"trace")
+		opts+=" --duration= -d --input= -i --save= -s \
+			--outliers= -n --output-format= -o"
+			;;
+		"irq-map")
+		opts+=" --interval= -i --output-format= -o"
+			;;
+		"pcie-health")
+		opts+=" --sysfs= -r --output-format= -o"
 			;;
 		"version")
 		opts+=""
@@ -31,7 +31,16 @@
 #include <inttypes.h>
 #include <libgen.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <stddef.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
 
 #include "util/parser.h"
 #include "nvme-ioctl.h"
@@ -80,6 +89,15 @@ static struct config {
 	int  data_digest;
 	bool persistent;
 	bool quiet;
+	int  parallel;
+	int  deadline;
+	bool incremental;
+	bool disconnect_removed;
+	bool daemon;
+	bool notify;
+	int  window;
+	bool auto_queues;
+	bool dry_run;
 } cfg = { NULL };
 
 struct connect_args {
@@ -93,10 +111,16 @@ struct connect_args {
 #define BUF_SIZE		4096
 #define PATH_NVME_FABRICS	"/dev/nvme-fabrics"
 #define PATH_NVMF_DISC		"/etc/nvme/discovery.conf"
+#define PATH_NVMF_DISC_STATE	"/run/nvme/discovery"
+#define PATH_NVMF_AUTOCONNECT	"/run/nvme/autoconnect.sock"
 #define PATH_NVMF_HOSTNQN	"/etc/nvme/hostnqn"
 #define PATH_NVMF_HOSTID	"/etc/nvme/hostid"
 #define MAX_DISC_ARGS		10
 #define MAX_DISC_RETRIES	10
+#define NVMF_DEF_QUEUE_SIZE	128
+#define NVMF_MAX_QUEUE_SIZE	1024
+#define NVMF_DEF_WINDOW		500	/* ms */
+#define NVMF_DEF_PARALLEL	8
 
 enum {
 	OPT_INSTANCE,
@@ -208,8 +232,6 @@ static const char *cms_str(__u8 cm)
 	return arg_str(cms, ARRAY_SIZE(cms), cm);
 }
 
-static int do_discover(char *argstr, bool connect);
-
 /*
  * parse strings with connect arguments to find a particular field.
  * If field found, return string containing field value. If field
@@ -274,84 +296,296 @@ static int ctrl_instance(char *device)
 	return instance;
 }
 
+static int space_strip_len(int max, const char *str)
+{
+	int i;
+
+	for (i = max - 1; i >= 0; i--)
+		if (str[i] != '\0' && str[i] != ' ')
+			break;
+
+	return i + 1;
+}
+
 /*
- * Given a controller name, create a connect_args with its
- * attributes and compare the attributes against the connect args
- * given.
- * Return true/false based on whether it matches
+ * Existing controllers, indexed by the connect arguments the kernel
+ * compares when it refuses a duplicate connection. The index is built from
+ * sysfs once per discover or connect-all run and kept up to date as
+ * controllers are added, so matching discovery log entries against the
+ * controllers takes no sysfs reads, and entries that are connected already
+ * need no write to /dev/nvme-fabrics to find out.
  */
-static bool ctrl_matches_connectargs(char *name, struct connect_args *args)
+#define CTRL_INDEX_BUCKETS	256
+
+struct ctrl_index_entry {
+	struct ctrl_index_entry *next;
+	char name[32];
+	char *hostnqn;		/* NULL if the kernel does not export it */
+	struct connect_args args;
+};
+
+static struct ctrl_index_entry *ctrl_index[CTRL_INDEX_BUCKETS];
+static bool ctrl_index_built;
+
+/* FNV-1a, continuing from hash; start with 2166136261 */
+static unsigned int str_hash(unsigned int hash, const char *str)
 {
-	struct connect_args cargs;
-	bool found = false;
-	char *path, *addr;
-	int ret;
+	for (; *str; str++)
+		hash = (hash ^ (unsigned char)*str) * 16777619u;
+	return (hash ^ '\n') * 16777619u;
+}
+
+static unsigned int connect_args_hash(struct connect_args *args)
+{
+	const char *fields[] = {
+		args->subsysnqn, args->transport, args->traddr,
+		args->trsvcid, args->host_traddr,
+	};
+	unsigned int hash = 2166136261u;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fields); i++)
+		hash = str_hash(hash, fields[i]);
+	return hash % CTRL_INDEX_BUCKETS;
+}
+
+static void ctrl_index_add(const char *name, struct connect_args *args,
+			   const char *hostnqn)
+{
+	struct ctrl_index_entry *c;
+	unsigned int hash;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return;
+
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->args.subsysnqn = strdup(args->subsysnqn);
+	c->args.transport = strdup(args->transport);
+	c->args.traddr = strdup(args->traddr);
+	c->args.trsvcid = strdup(args->trsvcid);
+	c->args.host_traddr = strdup(args->host_traddr);
+	c->hostnqn = hostnqn ? strdup(hostnqn) : NULL;
+	if (!c->args.subsysnqn || !c->args.transport || !c->args.traddr ||
+	    !c->args.trsvcid || !c->args.host_traddr) {
+		free(c->args.subsysnqn);
+		free(c->args.transport);
+		free(c->args.traddr);
+		free(c->args.trsvcid);
+		free(c->args.host_traddr);
+		free(c->hostnqn);
+		free(c);
+		return;
+	}
 
-	ret = asprintf(&path, "%s/%s", SYS_NVME, name);
+	hash = connect_args_hash(&c->args);
+	c->next = ctrl_index[hash];
+	ctrl_index[hash] = c;
+}
+
+static int ctrl_attr(int dfd, const char *attr, char *buf, size_t len)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = openat(dfd, attr, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	ret = read(fd, buf, len - 1);
+	close(fd);
 	if (ret < 0)
-		return found;
-
-	addr = nvme_get_ctrl_attr(path, "address");
-	cargs.subsysnqn = nvme_get_ctrl_attr(path, "subsysnqn");
-	cargs.transport = nvme_get_ctrl_attr(path, "transport");
-	cargs.traddr = parse_conn_arg(addr, ' ', conarg_traddr);
-	cargs.trsvcid = parse_conn_arg(addr, ' ', conarg_trsvcid);
-	cargs.host_traddr = parse_conn_arg(addr, ' ', conarg_host_traddr);
-
-	if (!strcmp(cargs.subsysnqn, args->subsysnqn) &&
-	    !strcmp(cargs.transport, args->transport) &&
-	    (!strcmp(cargs.traddr, args->traddr) ||
-	     !strcmp(args->traddr, "none")) &&
-	    (!strcmp(cargs.trsvcid, args->trsvcid) ||
-	     !strcmp(args->trsvcid, "none")) &&
-	    (!strcmp(cargs.host_traddr, args->host_traddr) ||
-	     !strcmp(args->host_traddr, "none")))
-		found = true;
+		return -errno;
+	buf[ret] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
 
-	free(cargs.subsysnqn);
-	free(cargs.transport);
-	free(cargs.traddr);
-	free(cargs.trsvcid);
-	free(cargs.host_traddr);
+static void ctrl_index_build(void)
+{
+	char nqn[NVMF_NQN_SIZE + 1], hostnqn[NVMF_NQN_SIZE + 1];
+	char transport[32], address[512], state[32];
+	struct connect_args args;
+	struct dirent *d;
+	int dfd;
+	DIR *dir;
+
+	if (ctrl_index_built)
+		return;
+	ctrl_index_built = true;
+
+	dir = opendir(SYS_NVME);
+	if (!dir)
+		return;
+
+	while ((d = readdir(dir))) {
+		if (!scan_ctrls_filter(d))
+			continue;
+		dfd = openat(dirfd(dir), d->d_name, O_RDONLY | O_DIRECTORY);
+		if (dfd < 0)
+			continue;
+
+		/* the kernel ignores controllers on their way out */
+		if (!ctrl_attr(dfd, "state", state, sizeof(state)) &&
+		    (!strncmp(state, "deleting", 8) || !strcmp(state, "dead")))
+			goto next;
+		if (ctrl_attr(dfd, "subsysnqn", nqn, sizeof(nqn)) ||
+		    ctrl_attr(dfd, "transport", transport, sizeof(transport)) ||
+		    ctrl_attr(dfd, "address", address, sizeof(address)))
+			goto next;
+
+		args.subsysnqn = nqn;
+		args.transport = transport;
+		args.traddr = parse_conn_arg(address, ',', conarg_traddr);
+		args.trsvcid = parse_conn_arg(address, ',', conarg_trsvcid);
+		args.host_traddr = parse_conn_arg(address, ',',
+						  conarg_host_traddr);
+		if (args.traddr && args.trsvcid && args.host_traddr)
+			ctrl_index_add(d->d_name, &args,
+				       ctrl_attr(dfd, "hostnqn", hostnqn,
+						 sizeof(hostnqn)) ?
+				       NULL : hostnqn);
+		free(args.traddr);
+		free(args.trsvcid);
+		free(args.host_traddr);
+next:
+		close(dfd);
+	}
+	closedir(dir);
+}
+
+static void ctrl_index_entry_free(struct ctrl_index_entry *c)
+{
+	free(c->args.subsysnqn);
+	free(c->args.transport);
+	free(c->args.traddr);
+	free(c->args.trsvcid);
+	free(c->args.host_traddr);
+	free(c->hostnqn);
+	free(c);
+}
+
+static void ctrl_index_del(struct ctrl_index_entry *c)
+{
+	struct ctrl_index_entry **p;
+
+	for (p = &ctrl_index[connect_args_hash(&c->args)]; *p; p = &(*p)->next) {
+		if (*p == c) {
+			*p = c->next;
+			ctrl_index_entry_free(c);
+			return;
+		}
+	}
+}
+
+static void ctrl_index_free(void)
+{
+	struct ctrl_index_entry *c, *next;
+	int i;
+
+	for (i = 0; i < CTRL_INDEX_BUCKETS; i++) {
+		for (c = ctrl_index[i]; c; c = next) {
+			next = c->next;
+			ctrl_index_entry_free(c);
+		}
+		ctrl_index[i] = NULL;
+	}
+	ctrl_index_built = false;
+}
+
+/* An empty or "none" field in args matches any value */
+static bool wildcard_match(const char *ctrl, const char *arg)
+{
+	return !*arg || !strcmp(arg, "none") || !strcmp(ctrl, arg);
+}
 
-	return found;
+static bool ctrl_matches_connectargs(struct ctrl_index_entry *c,
+				     struct connect_args *args)
+{
+	return !strcmp(c->args.subsysnqn, args->subsysnqn) &&
+	       !strcmp(c->args.transport, args->transport) &&
+	       wildcard_match(c->args.traddr, args->traddr) &&
+	       wildcard_match(c->args.trsvcid, args->trsvcid) &&
+	       wildcard_match(c->args.host_traddr, args->host_traddr);
 }
 
 /*
- * Look through the system to find an existing controller whose
- * attributes match the connect arguments specified
- * If found, a string containing the controller name (ex: "nvme?")
- * is returned.
- * If not found, a NULL is returned.
+ * Finds a controller the kernel would consider a duplicate of one created
+ * with args and hostnqn. All fields have to match exactly, except for the
+ * host NQN when either side's is not known.
  */
-static char *find_ctrl_with_connectargs(struct connect_args *args)
+static struct ctrl_index_entry *ctrl_index_find_exact(struct connect_args *args,
+						      const char *hostnqn)
 {
-	struct dirent **devices;
-	char *devname = NULL;
-	int i, n;
-
-	n = scandir(SYS_NVME, &devices, scan_ctrls_filter, alphasort);
-	if (n < 0) {
-		fprintf(stderr, "no NVMe controller(s) detected.\n");
-		return NULL;
+	struct ctrl_index_entry *c;
+
+	ctrl_index_build();
+	for (c = ctrl_index[connect_args_hash(args)]; c; c = c->next) {
+		if (strcmp(c->args.subsysnqn, args->subsysnqn) ||
+		    strcmp(c->args.transport, args->transport) ||
+		    strcmp(c->args.traddr, args->traddr) ||
+		    strcmp(c->args.trsvcid, args->trsvcid) ||
+		    strcmp(c->args.host_traddr, args->host_traddr))
+			continue;
+		if (hostnqn && c->hostnqn && strcmp(hostnqn, c->hostnqn))
+			continue;
+		return c;
 	}
+	return NULL;
+}
+
+/*
+ * Look through the existing controllers for one whose attributes match
+ * the connect arguments specified, preferring the controller name given.
+ * If found, the controller name (ex: "nvme?") is returned.
+ * If not found, a NULL is returned.
+ */
+static char *find_ctrl_with_connectargs(const char *name,
+					struct connect_args *args)
+{
+	struct ctrl_index_entry *c, *found = NULL;
+	int i;
 
-	for (i = 0; i < n; i++) {
-		if (ctrl_matches_connectargs(devices[i]->d_name, args)) {
-			devname = strdup(devices[i]->d_name);
-			if (devname == NULL)
-				fprintf(stderr, "no memory for ctrl name %s\n",
-						devices[i]->d_name);
-			goto cleanup_devices;
+	ctrl_index_build();
+	for (i = 0; i < CTRL_INDEX_BUCKETS; i++) {
+		for (c = ctrl_index[i]; c; c = c->next) {
+			if (!ctrl_matches_connectargs(c, args))
+				continue;
+			if (name && !strcmp(c->name, name))
+				return c->name;
+			if (!found)
+				found = c;
 		}
 	}
+	return found ? found->name : NULL;
+}
 
-cleanup_devices:
-	for (i = 0; i < n; i++)
-		free(devices[i]);
-	free(devices);
+/* The arguments connect_ctrl() creates a controller for entry e with */
+static void entry_connect_args(struct nvmf_disc_rsp_page_entry *e,
+			       const struct config *c,
+			       struct connect_args *args, char *traddr,
+			       char *trsvcid)
+{
+	traddr[0] = trsvcid[0] = '\0';
+	switch (e->trtype) {
+	case NVMF_TRTYPE_RDMA:
+	case NVMF_TRTYPE_TCP:
+		sprintf(trsvcid, "%.*s",
+			space_strip_len(NVMF_TRSVCID_SIZE, e->trsvcid),
+			e->trsvcid);
+		/* fall through */
+	case NVMF_TRTYPE_FC:
+		sprintf(traddr, "%.*s",
+			space_strip_len(NVMF_TRADDR_SIZE, e->traddr),
+			e->traddr);
+		break;
+	}
 
-	return devname;
+	args->subsysnqn = e->subnqn;
+	args->transport = (char *)trtype_str(e->trtype);
+	args->traddr = traddr;
+	args->trsvcid = trsvcid;
+	args->host_traddr = c->host_traddr && strcmp(c->host_traddr, "none") ?
+			    c->host_traddr : "";
 }
 
 static int add_ctrl(const char *argstr)
@@ -461,10 +695,16 @@ enum {
 	DISC_GET_LOG,
 	DISC_RETRY_EXHAUSTED,
 	DISC_NOT_EQUAL,
+	DISC_UNCHANGED,
 };
 
+/*
+ * If known_genctr is given and the log still has that generation, the
+ * entries are not fetched and DISC_UNCHANGED is returned.
+ */
 static int nvmf_get_log_page_discovery(const char *dev_path,
-		struct nvmf_disc_rsp_page_hdr **logp, int *numrec, int *status)
+		const __u64 *known_genctr, struct nvmf_disc_rsp_page_hdr **logp,
+		int *numrec, int *status)
 {
 	struct nvmf_disc_rsp_page_hdr *log;
 	unsigned int hdr_size;
@@ -509,6 +749,11 @@ static int nvmf_get_log_page_discovery(const char *dev_path,
 		genctr = le64_to_cpu(log->genctr);
 		free(log);
 
+		if (!retries && known_genctr && genctr == *known_genctr) {
+			error = DISC_UNCHANGED;
+			goto out_close;
+		}
+
 		if (*numrec == 0) {
 			error = DISC_NO_LOG;
 			goto out_close;
@@ -583,17 +828,6 @@ out:
 	return error;
 }
 
-static int space_strip_len(int max, const char *str)
-{
-	int i;
-
-	for (i = max - 1; i >= 0; i--)
-		if (str[i] != '\0' && str[i] != ' ')
-			break;
-
-	return i + 1;
-}
-
 static void print_discovery_log(struct nvmf_disc_rsp_page_hdr *log, int numrec)
 {
 	int i;
@@ -856,16 +1090,14 @@ static int build_options(char *argstr, int max_len, bool discover)
 	return 0;
 }
 
-static int connect_ctrl(struct nvmf_disc_rsp_page_entry *e)
+/* Builds the arguments to create a controller for log entry e with */
+static int entry_argstr(struct nvmf_disc_rsp_page_entry *e, char *argstr,
+			bool disable_sqflow)
 {
-	char argstr[BUF_SIZE], *p;
 	const char *transport;
-	bool discover, disable_sqflow = true;
-	int len, ret;
-
-retry:
-	p = argstr;
-	discover = false;
+	bool discover = false;
+	char *p = argstr;
+	int len;
 
 	switch (e->subtype) {
 	case NVME_NQN_DISC:
@@ -1029,11 +1261,23 @@ retry:
 		p += len;
 	}
 
-	if (discover)
-		ret = do_discover(argstr, true);
-	else
-		ret = add_ctrl(argstr);
-	if (ret == -EINVAL && e->treq & NVMF_TREQ_DISABLE_SQFLOW) {
+	return 0;
+}
+
+static int connect_ctrl(struct nvmf_disc_rsp_page_entry *e)
+{
+	char argstr[BUF_SIZE];
+	bool disable_sqflow = true;
+	int ret;
+
+retry:
+	ret = entry_argstr(e, argstr, disable_sqflow);
+	if (ret)
+		return ret;
+
+	ret = add_ctrl(argstr);
+	if (ret == -EINVAL && e->treq & NVMF_TREQ_DISABLE_SQFLOW &&
+	    disable_sqflow) {
 		/* disable_sqflow param might not be supported, try without it */
 		disable_sqflow = false;
 		goto retry;
@@ -1041,143 +1285,1516 @@ retry:
 	return ret;
 }
 
-static int connect_ctrls(struct nvmf_disc_rsp_page_hdr *log, int numrec)
+/*
+ * Queue profiles are discovery.conf lines starting with --profile, which
+ * set the queue options for the subsystems whose NQN matches the pattern
+ * following it, e.g.
+ *
+ *	--profile=nqn.2014-08.com.example:db* --nr-poll-queues=2 --auto-queues
+ *
+ * The first matching profile wins. Its values take precedence over those
+ * of the command line, or the discovery.conf line the subsystem was
+ * discovered through.
+ */
+struct queue_profile {
+	struct queue_profile *next;
+	char *pattern;
+	char *line;
+	bool auto_queues;
+	int nr_io_queues;
+	int nr_write_queues;
+	int nr_poll_queues;
+	int queue_size;
+};
+
+static struct queue_profile *queue_profiles, **queue_profiles_tail;
+
+static void queue_profiles_load(void)
 {
-	int i;
-	int instance;
-	int ret = 0;
+	struct queue_profile *p;
+	char line[256], *ptr, *args, *argv[MAX_DISC_ARGS * 4];
+	int argc;
+	FILE *f;
 
-	for (i = 0; i < numrec; i++) {
-		instance = connect_ctrl(&log->entries[i]);
+	if (queue_profiles_tail)
+		return;
+	queue_profiles_tail = &queue_profiles;
+
+	f = fopen(PATH_NVMF_DISC, "r");
+	if (!f)
+		return;
 
-		/* clean success */
-		if (instance >= 0)
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "--profile", 9))
 			continue;
 
-		/* already connected print message	*/
-		if (instance == -EALREADY) {
-			const char *traddr = log->entries[i].traddr;
+		p = calloc(1, sizeof(*p));
+		args = strdup(line);
+		if (!p || !args) {
+			free(p);
+			free(args);
+			break;
+		}
 
-			if (!cfg.quiet)
-				fprintf(stderr,
-					"traddr=%.*s is already connected\n",
-					space_strip_len(NVMF_TRADDR_SIZE,
-							traddr),
-					traddr);
+		OPT_ARGS(opts) = {
+			OPT_LIST("profile",         0,   &p->pattern,         ""),
+			OPT_FLAG("auto-queues",     0,   &p->auto_queues,     ""),
+			OPT_INT("nr-io-queues",    'i', &p->nr_io_queues,    ""),
+			OPT_INT("nr-write-queues", 'W', &p->nr_write_queues, ""),
+			OPT_INT("nr-poll-queues",  'P', &p->nr_poll_queues,  ""),
+			OPT_INT("queue-size",      'Q', &p->queue_size,      ""),
+			OPT_END()
+		};
+
+		p->line = args;
+		argc = 0;
+		argv[argc++] = "profile";
+		while ((ptr = strsep(&args, " =\n")) && argc < ARRAY_SIZE(argv))
+			if (*ptr)
+				argv[argc++] = ptr;
+
+		if (argconfig_parse(argc, argv, "queue profile", opts) ||
+		    !p->pattern) {
+			fprintf(stderr, "ignoring malformed profile in %s\n",
+				PATH_NVMF_DISC);
+			free(p->line);
+			free(p);
 			continue;
 		}
-
-		/*
-		 * don't error out. The Discovery Log may contain
-		 * devices that aren't necessarily connectable via
-		 * the system/host transport port. Let those items
-		 * fail and continue on to the next log element.
-		 */
+		*queue_profiles_tail = p;
+		queue_profiles_tail = &p->next;
 	}
+	fclose(f);
+}
 
-	return ret;
+static struct queue_profile *queue_profile_find(const char *nqn)
+{
+	struct queue_profile *p;
+
+	queue_profiles_load();
+	for (p = queue_profiles; p; p = p->next)
+		if (!fnmatch(p->pattern, nqn, 0))
+			return p;
+	return NULL;
 }
 
-static int do_discover(char *argstr, bool connect)
+static int sysfs_str(const char *path, char *buf, size_t len)
 {
-	struct nvmf_disc_rsp_page_hdr *log = NULL;
-	char *dev_name;
-	int instance, numrec = 0, ret, err;
-	int status = 0;
+	ssize_t n;
+	int fd;
 
-	if (cfg.device) {
-		struct connect_args cargs;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n <= 0)
+		return -EINVAL;
+	buf[n] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
 
-		memset(&cargs, 0, sizeof(cargs));
-		cargs.subsysnqn = parse_conn_arg(argstr, '.', conarg_nqn);
-		cargs.transport = parse_conn_arg(argstr, '.', conarg_transport);
-		cargs.traddr = parse_conn_arg(argstr, '.', conarg_traddr);
-		cargs.trsvcid = parse_conn_arg(argstr, '.', conarg_trsvcid);
-		cargs.host_traddr = parse_conn_arg(argstr, '.', conarg_host_traddr);
+static int cpulist_count(const char *path)
+{
+	char buf[BUF_SIZE], *p = buf, *end;
+	int nr = 0;
+	long a, b;
 
-		/*
-		 * if the cfg.device passed in matches the connect args
-		 *    cfg.device is left as-is
-		 * else if there exists a controller that matches the
-		 *         connect args
-		 *    cfg.device is the matching ctrl name
-		 * else if no ctrl matches the connect args
-		 *    cfg.device is set to null. This will attempt to
-		 *    create a new ctrl.
-		 * endif
-		 */
-		if (!ctrl_matches_connectargs(cfg.device, &cargs))
-			cfg.device = find_ctrl_with_connectargs(&cargs);
+	if (sysfs_str(path, buf, sizeof(buf)))
+		return -EINVAL;
 
-		free(cargs.subsysnqn);
-		free(cargs.transport);
-		free(cargs.traddr);
-		free(cargs.trsvcid);
-		free(cargs.host_traddr);
+	while (*p) {
+		a = b = strtol(p, &end, 10);
+		if (end == p)
+			return -EINVAL;
+		if (*end == '-')
+			b = strtol(end + 1, &end, 10);
+		nr += b - a + 1;
+		p = *end == ',' ? end + 1 : end;
 	}
+	return nr;
+}
 
-	if (!cfg.device)
-		instance = add_ctrl(argstr);
-	else
-		instance = ctrl_instance(cfg.device);
-	if (instance < 0)
-		return instance;
+/*
+ * Finds the host port behind host_traddr: the network interface with
+ * that address for IP transports, the FC host with that port name for
+ * FC. Returns its NUMA node, or -1 if it is not known.
+ */
+static int host_port_node(const char *transport, const char *host_traddr,
+			  char *port, size_t len)
+{
+	char path[PATH_MAX], buf[64];
+	int node = -1;
+
+	snprintf(port, len, "?");
+	if (!host_traddr || !strcmp(host_traddr, "none"))
+		return -1;
+
+	if (!strcmp(transport, "fc")) {
+		const char *pn = strstr(host_traddr, "pn-");
+		bool found = false;
+		struct dirent *d;
+		DIR *dir;
+
+		if (!pn)
+			return -1;
+		dir = opendir("/sys/class/fc_host");
+		if (!dir)
+			return -1;
+		while ((d = readdir(dir))) {
+			if (d->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path),
+				 "/sys/class/fc_host/%s/port_name", d->d_name);
+			if (sysfs_str(path, buf, sizeof(buf)))
+				continue;
+			if (strcasecmp(buf, pn + 3))
+				continue;
+			snprintf(port, len, "%s", d->d_name);
+			snprintf(path, sizeof(path),
+				 "/sys/class/fc_host/%s/device/../numa_node",
+				 d->d_name);
+			found = true;
+			break;
+		}
+		closedir(dir);
+		if (!found)
+			return -1;
+	} else {
+		struct ifaddrs *ifas, *ifa;
+		char addr[INET6_ADDRSTRLEN];
 
-	if (asprintf(&dev_name, "/dev/nvme%d", instance) < 0)
-		return -errno;
-	ret = nvmf_get_log_page_discovery(dev_name, &log, &numrec, &status);
-	free(dev_name);
-	if (!cfg.device && !cfg.persistent) {
-		err = remove_ctrl(instance);
-		if (err)
-			return err;
+		if (getifaddrs(&ifas))
+			return -1;
+		for (ifa = ifas; ifa; ifa = ifa->ifa_next) {
+			if (!ifa->ifa_addr)
+				continue;
+			if (ifa->ifa_addr->sa_family == AF_INET)
+				inet_ntop(AF_INET,
+					  &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr,
+					  addr, sizeof(addr));
+			else if (ifa->ifa_addr->sa_family == AF_INET6)
+				inet_ntop(AF_INET6,
+					  &((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr,
+					  addr, sizeof(addr));
+			else
+				continue;
+			if (!strcmp(addr, host_traddr))
+				break;
+		}
+		if (ifa) {
+			snprintf(port, len, "%s", ifa->ifa_name);
+			snprintf(path, sizeof(path),
+				 "/sys/class/net/%s/device/numa_node",
+				 ifa->ifa_name);
+		}
+		freeifaddrs(ifas);
+		if (!ifa)
+			return -1;
 	}
 
-	switch (ret) {
-	case DISC_OK:
-		if (connect)
-			ret = connect_ctrls(log, numrec);
-		else if (cfg.raw)
-			save_discovery_log(log, numrec);
-		else
-			print_discovery_log(log, numrec);
-		break;
-	case DISC_GET_NUMRECS:
-		fprintf(stderr,
-			"Get number of discovery log entries failed.\n");
-		ret = status;
-		break;
-	case DISC_GET_LOG:
-		fprintf(stderr, "Get discovery log entries failed.\n");
-		ret = status;
-		break;
-	case DISC_NO_LOG:
-		fprintf(stdout, "No discovery log entries to fetch.\n");
-		ret = DISC_OK;
-		break;
-	case DISC_RETRY_EXHAUSTED:
-		fprintf(stdout, "Discovery retries exhausted.\n");
-		ret = -EAGAIN;
-		break;
-	case DISC_NOT_EQUAL:
-		fprintf(stderr,
-		"Numrec values of last two get discovery log page not equal\n");
-		ret = -EBADSLT;
-		break;
-	default:
-		fprintf(stderr, "Get discovery log page failed: %d\n", ret);
-		break;
-	}
+	if (sysfs_str(path, buf, sizeof(buf)))
+		return -1;
+	node = atoi(buf);
+	return node < 0 ? -1 : node;
+}
 
-	return ret;
+static const char *host_traddr_str(const struct config *c)
+{
+	return c->host_traddr && strcmp(c->host_traddr, "none") ?
+	       c->host_traddr : "";
 }
 
-static int discover_from_conf_file(const char *desc, char *argstr,
-		const struct argconfig_commandline_options *opts, bool connect)
+static int host_port_ctrls(const char *transport, const char *host_traddr)
 {
-	FILE *f;
-	char line[256], *ptr, *args, **argv;
-	int argc, err, ret = 0;
+	struct ctrl_index_entry *c;
+	int i, nr = 0;
+
+	ctrl_index_build();
+	for (i = 0; i < CTRL_INDEX_BUCKETS; i++)
+		for (c = ctrl_index[i]; c; c = c->next)
+			if (!strcmp(c->args.transport, transport) &&
+			    !strcmp(c->args.host_traddr, host_traddr))
+				nr++;
+	return nr;
+}
+
+/*
+ * Applies the queue profile of subsystem nqn to c and, with auto_queues,
+ * fills in the queue count and depth c leaves to the kernel.
+ *
+ * The kernel defaults to one I/O queue per online CPU for every
+ * controller, so hundreds of controllers behind one port allocate far
+ * more queues than there are CPUs to drive them. Instead the CPUs local
+ * to the port are shared out between the controllers using it, which are
+ * the ones connected already plus the new ones being connected in this
+ * run. The queue depth grows with the number of CPUs mapped to each queue.
+ */
+static void tune_queues(struct config *c, const char *transport,
+			const char *nqn, int new_ctrls)
+{
+	struct queue_profile *p = queue_profile_find(nqn);
+	const char *host_traddr = host_traddr_str(c);
+	char port[NAME_MAX + 1], path[NAME_MAX + 32];
+	int online, cpus, node, ctrls, size;
+
+	if (p) {
+		if (p->nr_io_queues)
+			c->nr_io_queues = p->nr_io_queues;
+		if (p->nr_write_queues)
+			c->nr_write_queues = p->nr_write_queues;
+		if (p->nr_poll_queues)
+			c->nr_poll_queues = p->nr_poll_queues;
+		if (p->queue_size)
+			c->queue_size = p->queue_size;
+		c->auto_queues |= p->auto_queues;
+	}
+	if (!c->auto_queues || (c->nr_io_queues && c->queue_size))
+		return;
+
+	online = sysconf(_SC_NPROCESSORS_ONLN);
+	if (online < 1)
+		online = 1;
+	cpus = online;
+	node = host_port_node(transport, host_traddr, port, sizeof(port));
+	if (node >= 0) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist", node);
+		cpus = cpulist_count(path);
+		if (cpus < 1 || cpus > online)
+			cpus = online;
+	}
+	ctrls = host_port_ctrls(transport, host_traddr) + new_ctrls;
+
+	if (!c->nr_io_queues) {
+		c->nr_io_queues = cpus / ctrls - c->nr_write_queues -
+				  c->nr_poll_queues;
+		if (c->nr_io_queues < 1)
+			c->nr_io_queues = 1;
+	}
+	if (!c->queue_size) {
+		size = NVMF_DEF_QUEUE_SIZE * (online / c->nr_io_queues);
+		for (c->queue_size = NVMF_DEF_QUEUE_SIZE;
+		     c->queue_size < size && c->queue_size < NVMF_MAX_QUEUE_SIZE;
+		     c->queue_size *= 2)
+			;
+	}
+
+	if (c->quiet)
+		return;
+	if (node >= 0)
+		snprintf(path, sizeof(path), "node %d (%s)", node, port);
+	else
+		snprintf(path, sizeof(path), "the host");
+	printf("%s: nr_io_queues=%d queue_size=%d, %d CPUs of %s for %d "
+	       "controllers\n", nqn, c->nr_io_queues, c->queue_size, cpus,
+	       path, ctrls);
+}
+
+/*
+ * A connect blocks in the write to /dev/nvme-fabrics until the controller
+ * is up or the transport gives up, which for an unreachable portal can
+ * take minutes. Entries are therefore connected from child processes, up
+ * to cfg.parallel at a time, which report the result through a pipe. A
+ * child that misses the deadline is killed. The write may not return to
+ * let it die right away, and waiting for it is what the deadline avoids,
+ * so it is reaped once it has exited; those still stuck when the jobs are
+ * done are left to init.
+ * Each child runs with the options of the configuration the entry was
+ * discovered with.
+ *
+ * Deleting a controller blocks the same way while its outstanding I/O
+ * drains, so jobs with ctrl set delete that controller instead.
+ */
+enum {
+	CONNECT_PENDING,
+	CONNECT_RUNNING,
+	CONNECT_DONE,
+	CONNECT_TIMEDOUT,
+};
+
+struct connect_job {
+	struct nvmf_disc_rsp_page_entry *e;
+	struct ctrl_index_entry *ctrl;
+	struct config *cfg;
+	struct config tuned;	/* cfg with the queues tune_queues() picked */
+	struct disc_record *record;
+	int state;
+	int ret;
+	int fd;
+	pid_t pid;
+	long long start;	/* in ms */
+	long long end;
+};
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int connect_job_run(struct connect_job *job)
+{
+	if (job->ctrl)
+		return remove_ctrl(ctrl_instance(job->ctrl->name));
+	return connect_ctrl(job->e);
+}
+
+static void connect_job_start(struct connect_job *job)
+{
+	struct config saved;
+	int fds[2];
+
+	job->state = CONNECT_RUNNING;
+	job->start = now_ms();
+	job->fd = -1;
+
+	/* nothing buffered may be printed twice by the child */
+	fflush(NULL);
+	if (pipe(fds) < 0)
+		goto inline_connect;
+	job->pid = fork();
+	if (job->pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		goto inline_connect;
+	}
+	if (!job->pid) {
+		int ret;
+
+		close(fds[0]);
+		cfg = *job->cfg;
+		ret = connect_job_run(job);
+		if (write(fds[1], &ret, sizeof(ret)) != sizeof(ret))
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	job->fd = fds[0];
+	return;
+
+inline_connect:
+	saved = cfg;
+	cfg = *job->cfg;
+	job->ret = connect_job_run(job);
+	cfg = saved;
+	job->state = CONNECT_DONE;
+	job->end = now_ms();
+}
+
+static void connect_job_finish(struct connect_job *job)
+{
+	if (read(job->fd, &job->ret, sizeof(job->ret)) != sizeof(job->ret))
+		job->ret = -EIO;
+	close(job->fd);
+	waitpid(job->pid, NULL, 0);
+	job->state = CONNECT_DONE;
+	job->end = now_ms();
+}
+
+/* Waits for at least one running job to finish or to miss its deadline */
+static void connect_jobs_wait(struct connect_job *jobs, int nr)
+{
+	struct pollfd *fds;
+	int i, n = 0, timeout = -1;
+	long long now = now_ms();
+
+	fds = calloc(nr, sizeof(*fds));
+	if (!fds) {
+		/* no memory to poll with, wait for the oldest job */
+		for (i = 0; i < nr; i++)
+			if (jobs[i].state == CONNECT_RUNNING) {
+				connect_job_finish(&jobs[i]);
+				return;
+			}
+		return;
+	}
+
+	for (i = 0; i < nr; i++) {
+		struct connect_job *job = &jobs[i];
+
+		if (job->state != CONNECT_RUNNING)
+			continue;
+		if (cfg.deadline > 0) {
+			long long left = job->start + cfg.deadline * 1000LL - now;
+
+			if (left <= 0) {
+				close(job->fd);
+				kill(job->pid, SIGKILL);
+				if (waitpid(job->pid, NULL, WNOHANG) > 0)
+					job->pid = 0;
+				job->state = CONNECT_TIMEDOUT;
+				job->end = now;
+				timeout = 0;
+				continue;
+			}
+			if (timeout < 0 || left < timeout)
+				timeout = left;
+		}
+		fds[n].fd = job->fd;
+		fds[n++].events = POLLIN;
+	}
+
+	if (n && poll(fds, n, timeout) > 0) {
+		for (i = 0; i < nr; i++) {
+			struct connect_job *job = &jobs[i];
+			int j;
+
+			if (job->state != CONNECT_RUNNING)
+				continue;
+			for (j = 0; j < n; j++)
+				if (fds[j].fd == job->fd && fds[j].revents)
+					connect_job_finish(job);
+		}
+	}
+	free(fds);
+}
+
+/* Runs jobs, up to cfg.parallel at a time; those already done are skipped */
+static void connect_jobs_run(struct connect_job *jobs, int nr)
+{
+	int i, next = 0, running = 0, done = 0;
+
+	while (done < nr) {
+		while (next < nr && running < cfg.parallel) {
+			if (jobs[next].state == CONNECT_DONE) {
+				next++;
+				continue;
+			}
+			connect_job_start(&jobs[next++]);
+			running++;
+		}
+
+		connect_jobs_wait(jobs, next);
+
+		for (running = 0, done = 0, i = 0; i < next; i++) {
+			if (jobs[i].state == CONNECT_RUNNING)
+				running++;
+			else
+				done++;
+		}
+	}
+
+	for (i = 0; i < nr; i++)
+		if (jobs[i].state == CONNECT_TIMEDOUT && jobs[i].pid > 0 &&
+		    waitpid(jobs[i].pid, NULL, WNOHANG) > 0)
+			jobs[i].pid = 0;
+}
+
+/* Prints what connect_jobs_run() would write to /dev/nvme-fabrics */
+static void connect_jobs_dry_run(struct connect_job *jobs, int nr)
+{
+	struct config saved = cfg;
+	char argstr[BUF_SIZE];
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (jobs[i].state == CONNECT_DONE)
+			continue;
+		cfg = *jobs[i].cfg;
+		if (!entry_argstr(jobs[i].e, argstr, true))
+			printf("%s\n", argstr);
+	}
+	cfg = saved;
+}
+
+static void connect_job_report(struct connect_job *job)
+{
+	struct nvmf_disc_rsp_page_entry *e = job->e;
+	char result[64];
+
+	if (job->state == CONNECT_TIMEDOUT)
+		snprintf(result, sizeof(result), "timed out after %ds",
+			 cfg.deadline);
+	else if (job->ret >= 0)
+		snprintf(result, sizeof(result), "connected as nvme%d",
+			 job->ret);
+	else if (job->ret == -EALREADY)
+		snprintf(result, sizeof(result), "already connected");
+	else
+		snprintf(result, sizeof(result), "failed: %s",
+			 strerror(-job->ret));
+
+	printf("%-5s traddr=%-20.*s trsvcid=%-6.*s %s: %s\n",
+	       trtype_str(e->trtype),
+	       space_strip_len(NVMF_TRADDR_SIZE, e->traddr), e->traddr,
+	       space_strip_len(NVMF_TRSVCID_SIZE, e->trsvcid), e->trsvcid,
+	       e->subnqn, result);
+}
+
+/*
+ * Fetches the log of the discovery controller created with argstr. If
+ * known_genctr is given and the log still has that generation, *numrecp
+ * is set to -1 and no log is returned.
+ */
+static int fetch_discovery_log(char *argstr, const __u64 *known_genctr,
+			       struct nvmf_disc_rsp_page_hdr **logp,
+			       int *numrecp)
+{
+	struct nvmf_disc_rsp_page_hdr *log = NULL;
+	struct connect_args cargs;
+	char *dev_name;
+	int instance, numrec = 0, ret, err;
+	int status = 0;
+
+	cargs.subsysnqn = parse_conn_arg(argstr, ',', conarg_nqn);
+	cargs.transport = parse_conn_arg(argstr, ',', conarg_transport);
+	cargs.traddr = parse_conn_arg(argstr, ',', conarg_traddr);
+	cargs.trsvcid = parse_conn_arg(argstr, ',', conarg_trsvcid);
+	cargs.host_traddr = parse_conn_arg(argstr, ',', conarg_host_traddr);
+
+	if (cfg.device) {
+		/*
+		 * if the cfg.device passed in matches the connect args
+		 *    cfg.device is left as-is
+		 * else if there exists a controller that matches the
+		 *         connect args
+		 *    cfg.device is the matching ctrl name
+		 * else if no ctrl matches the connect args
+		 *    cfg.device is set to null. This will attempt to
+		 *    create a new ctrl.
+		 * endif
+		 */
+		cfg.device = find_ctrl_with_connectargs(basename(cfg.device),
+							&cargs);
+	}
+
+	if (!cfg.device) {
+		instance = add_ctrl(argstr);
+		if (instance >= 0 && cfg.persistent) {
+			char name[32];
+
+			sprintf(name, "nvme%d", instance);
+			ctrl_index_add(name, &cargs, cfg.hostnqn);
+		}
+	} else
+		instance = ctrl_instance(cfg.device);
+
+	free(cargs.subsysnqn);
+	free(cargs.transport);
+	free(cargs.traddr);
+	free(cargs.trsvcid);
+	free(cargs.host_traddr);
+	if (instance < 0)
+		return instance;
+
+	if (asprintf(&dev_name, "/dev/nvme%d", instance) < 0)
+		return -errno;
+	ret = nvmf_get_log_page_discovery(dev_name, known_genctr, &log, &numrec,
+					  &status);
+	free(dev_name);
+	if (!cfg.device && !cfg.persistent) {
+		err = remove_ctrl(instance);
+		if (err) {
+			if (ret == DISC_OK)
+				free(log);
+			return err;
+		}
+	}
+
+	switch (ret) {
+	case DISC_OK:
+		*logp = log;
+		*numrecp = numrec;
+		break;
+	case DISC_GET_NUMRECS:
+		fprintf(stderr,
+			"Get number of discovery log entries failed.\n");
+		ret = status;
+		break;
+	case DISC_GET_LOG:
+		fprintf(stderr, "Get discovery log entries failed.\n");
+		ret = status;
+		break;
+	case DISC_NO_LOG:
+		fprintf(stdout, "No discovery log entries to fetch.\n");
+		ret = DISC_OK;
+		break;
+	case DISC_UNCHANGED:
+		*numrecp = -1;
+		ret = DISC_OK;
+		break;
+	case DISC_RETRY_EXHAUSTED:
+		fprintf(stdout, "Discovery retries exhausted.\n");
+		ret = -EAGAIN;
+		break;
+	case DISC_NOT_EQUAL:
+		fprintf(stderr,
+		"Numrec values of last two get discovery log page not equal\n");
+		ret = -EBADSLT;
+		break;
+	default:
+		fprintf(stderr, "Get discovery log page failed: %d\n", ret);
+		break;
+	}
+
+	return ret;
+}
+
+/*
+ * Discovery crawls the graph of discovery controllers: the ones given on
+ * the command line or in discovery.conf, and those their logs refer to.
+ * Controllers are visited from child processes, up to cfg.parallel at a
+ * time, which send the log back through a pipe. Each controller is only
+ * visited once, and each log entry is recorded once however many
+ * discovery controllers return it. Both are keyed by transport, traddr,
+ * trsvcid, host_traddr and NQN; the host_traddr keeps the paths through
+ * different host ports apart.
+ *
+ * connect-all remembers the generation counter and entries of each
+ * discovery controller under PATH_NVMF_DISC_STATE. With --incremental,
+ * the log of a controller whose generation has not changed is not fetched
+ * again, and only entries that are new or changed since the last run are
+ * connected. Entries that failed to connect are left out of the state, and
+ * the state marked stale, so that they are tried again on the next run.
+ */
+struct disc_node {
+	struct config cfg;	/* options the node was reached with */
+	char *conf;		/* discovery.conf line the options point into */
+	char argstr[BUF_SIZE];
+	struct nvmf_disc_rsp_page_entry e;	/* referral, if referral */
+	bool referral;
+	char *key;
+	int idx;
+	int state;
+	int fd;
+	pid_t pid;
+	long long start;	/* in ms */
+	char *buf;
+	size_t len;
+	size_t size;
+	struct nvmf_disc_rsp_page_entry *old;	/* as of the last run */
+	int nr_old;
+	__u64 old_genctr;
+	bool old_genctr_valid;
+	struct nvmf_disc_rsp_page_entry *cur;	/* fetched in this run */
+	int nr_cur;
+	__u64 cur_genctr;
+	bool fetched;
+};
+
+struct disc_record {
+	struct disc_record *next;
+	struct nvmf_disc_rsp_page_entry e;
+	struct disc_node *node;
+	int idx;		/* in the log of node */
+	char *key;
+	bool fresh;		/* new or changed since the last run */
+	bool failed;
+};
+
+struct disc_crawl {
+	struct disc_node **nodes;
+	int nr_nodes;
+	struct disc_record **records;
+	int nr_records;
+	struct disc_record *buckets[CTRL_INDEX_BUCKETS];
+	__le64 genctr;
+	bool connect;
+	int ret;
+};
+
+#define NVMF_DISC_STATE_MAGIC	"NVMFDISC"
+#define NVMF_DISC_STATE_VERSION	1
+#define NVMF_DISC_STATE_STALE	(1 << 0)
+
+struct nvmf_disc_state_hdr {
+	char	magic[8];
+	__u32	version;
+	__u32	flags;
+	__u64	genctr;
+	__u32	numrec;
+	__u32	rsvd;
+	char	key[1024];
+};
+
+static size_t disc_log_size(int numrec)
+{
+	return sizeof(struct nvmf_disc_rsp_page_hdr) +
+		numrec * sizeof(struct nvmf_disc_rsp_page_entry);
+}
+
+static char *disc_key(const struct config *c, const char *transport,
+		      const char *traddr, const char *trsvcid, const char *nqn)
+{
+	char *key;
+
+	if (asprintf(&key, "transport=%s traddr=%s trsvcid=%s host_traddr=%s nqn=%s",
+		     transport ? transport : "", traddr ? traddr : "",
+		     trsvcid ? trsvcid : "",
+		     c->host_traddr && strcmp(c->host_traddr, "none") ?
+		     c->host_traddr : "", nqn ? nqn : "") < 0)
+		return NULL;
+	return key;
+}
+
+static char *entry_key(const struct config *c,
+		       struct nvmf_disc_rsp_page_entry *e)
+{
+	char traddr[NVMF_TRADDR_SIZE + 1], trsvcid[NVMF_TRSVCID_SIZE + 1];
+	char nqn[NVMF_NQN_SIZE + 1];
+
+	sprintf(traddr, "%.*s", space_strip_len(NVMF_TRADDR_SIZE, e->traddr),
+		e->traddr);
+	sprintf(trsvcid, "%.*s", space_strip_len(NVMF_TRSVCID_SIZE, e->trsvcid),
+		e->trsvcid);
+	sprintf(nqn, "%.*s", NVMF_NQN_SIZE, e->subnqn);
+	return disc_key(c, trtype_str(e->trtype), traddr, trsvcid, nqn);
+}
+
+static int crawl_add_node(struct disc_crawl *crawl, const struct config *c,
+			  const char *argstr,
+			  struct nvmf_disc_rsp_page_entry *referral)
+{
+	struct disc_node *n, **nodes;
+	char *key;
+	int i;
+
+	if (referral)
+		key = entry_key(c, referral);
+	else
+		key = disc_key(c, c->transport, c->traddr, c->trsvcid, c->nqn);
+	if (!key)
+		return -ENOMEM;
+
+	for (i = 0; i < crawl->nr_nodes; i++) {
+		if (!strcmp(crawl->nodes[i]->key, key)) {
+			free(key);
+			return 0;
+		}
+	}
+
+	nodes = realloc(crawl->nodes, (crawl->nr_nodes + 1) * sizeof(*nodes));
+	if (!nodes)
+		goto free_key;
+	crawl->nodes = nodes;
+
+	n = calloc(1, sizeof(*n));
+	if (!n)
+		goto free_key;
+	n->cfg = *c;
+	n->key = key;
+	n->idx = crawl->nr_nodes;
+	n->fd = -1;
+	if (referral) {
+		/* the device given is the controller we started from */
+		n->cfg.device = NULL;
+		n->e = *referral;
+		n->referral = true;
+	} else
+		snprintf(n->argstr, sizeof(n->argstr), "%s", argstr);
+	crawl->nodes[crawl->nr_nodes++] = n;
+	return 0;
+
+free_key:
+	free(key);
+	return -ENOMEM;
+}
+
+static struct disc_record *crawl_find_record(struct disc_crawl *crawl,
+					     const char *key)
+{
+	struct disc_record *r;
+	unsigned int hash;
+
+	hash = str_hash(2166136261u, key) % CTRL_INDEX_BUCKETS;
+	for (r = crawl->buckets[hash]; r; r = r->next)
+		if (!strcmp(r->key, key))
+			return r;
+	return NULL;
+}
+
+static int crawl_add_record(struct disc_crawl *crawl, struct disc_node *n,
+			    int idx, struct nvmf_disc_rsp_page_entry *e,
+			    bool fresh)
+{
+	struct disc_record *r, **records;
+	unsigned int hash;
+	char *key;
+
+	key = entry_key(&n->cfg, e);
+	if (!key)
+		return -ENOMEM;
+
+	r = crawl_find_record(crawl, key);
+	if (r) {
+		/* keep the entry of the node listed first, for a stable order */
+		if (n->idx < r->node->idx) {
+			r->e = *e;
+			r->node = n;
+			r->idx = idx;
+		}
+		r->fresh |= fresh;
+		free(key);
+		return 0;
+	}
+
+	records = realloc(crawl->records,
+			  (crawl->nr_records + 1) * sizeof(*records));
+	if (!records)
+		goto free_key;
+	crawl->records = records;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		goto free_key;
+	r->e = *e;
+	r->node = n;
+	r->idx = idx;
+	r->key = key;
+	r->fresh = fresh;
+	hash = str_hash(2166136261u, key) % CTRL_INDEX_BUCKETS;
+	r->next = crawl->buckets[hash];
+	crawl->buckets[hash] = r;
+	crawl->records[crawl->nr_records++] = r;
+	return 0;
+
+free_key:
+	free(key);
+	return -ENOMEM;
+}
+
+static bool disc_node_knows(struct disc_node *n,
+			    struct nvmf_disc_rsp_page_entry *e)
+{
+	int i;
+
+	for (i = 0; i < n->nr_old; i++)
+		if (!memcmp(&n->old[i], e, sizeof(*e)))
+			return true;
+	return false;
+}
+
+/* numrec is -1 if the log of n has not changed since the last run */
+static int crawl_process(struct disc_crawl *crawl, struct disc_node *n,
+			 int ret, struct nvmf_disc_rsp_page_hdr *log,
+			 int numrec)
+{
+	struct nvmf_disc_rsp_page_entry *entries;
+	bool unchanged = numrec < 0;
+	int i, err;
+
+	if (ret) {
+		crawl->ret = ret;
+		return 0;
+	}
+
+	if (unchanged) {
+		entries = n->old;
+		numrec = n->nr_old;
+		if (!n->idx)
+			crawl->genctr = cpu_to_le64(n->old_genctr);
+	} else {
+		entries = log ? log->entries : NULL;
+		if (!n->idx && log)
+			crawl->genctr = log->genctr;
+		if (crawl->connect && numrec) {
+			n->cur = malloc(numrec * sizeof(*entries));
+			if (!n->cur)
+				return -ENOMEM;
+			memcpy(n->cur, entries, numrec * sizeof(*entries));
+		}
+		n->nr_cur = numrec;
+		n->cur_genctr = log ? le64_to_cpu(log->genctr) : 0;
+		n->fetched = true;
+	}
+
+	for (i = 0; i < numrec; i++) {
+		struct nvmf_disc_rsp_page_entry *e = &entries[i];
+
+		if (e->subtype == NVME_NQN_DISC) {
+			err = crawl_add_node(crawl, &n->cfg, NULL, e);
+			if (err)
+				return err;
+		}
+		err = crawl_add_record(crawl, n, i, e,
+				       !unchanged && !disc_node_knows(n, e));
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static void disc_state_path(struct disc_node *n, char *path, size_t len)
+{
+	snprintf(path, len, "%s/%08x", PATH_NVMF_DISC_STATE,
+		 str_hash(2166136261u, n->key));
+}
+
+static void disc_state_load(struct disc_node *n)
+{
+	struct nvmf_disc_state_hdr hdr;
+	struct stat st;
+	char path[64];
+	size_t len;
+	int fd;
+
+	disc_state_path(n, path, sizeof(path));
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	/* only trust state we could have written ourselves */
+	if (fstat(fd, &st) || st.st_uid != geteuid() ||
+	    read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    memcmp(hdr.magic, NVMF_DISC_STATE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != NVMF_DISC_STATE_VERSION ||
+	    strncmp(hdr.key, n->key, sizeof(hdr.key)))
+		goto close_fd;
+
+	len = (size_t)hdr.numrec * sizeof(*n->old);
+	if (st.st_size != sizeof(hdr) + len)
+		goto close_fd;
+	if (len) {
+		n->old = malloc(len);
+		if (!n->old)
+			goto close_fd;
+		if (read(fd, n->old, len) != len) {
+			free(n->old);
+			n->old = NULL;
+			goto close_fd;
+		}
+	}
+	n->nr_old = hdr.numrec;
+	n->old_genctr = hdr.genctr;
+	n->old_genctr_valid = !(hdr.flags & NVMF_DISC_STATE_STALE);
+close_fd:
+	close(fd);
+}
+
+/*
+ * Records the log fetched from n, less the entries that could not be
+ * connected. Those make the state stale, so the next run fetches the log
+ * and tries them again.
+ */
+static void disc_state_store(struct disc_crawl *crawl, struct disc_node *n)
+{
+	char tmp[80], path[64], *key;
+	struct nvmf_disc_state_hdr hdr;
+	struct disc_record *r;
+	int i, fd;
+
+	if ((mkdir("/run/nvme", 0755) && errno != EEXIST) ||
+	    (mkdir(PATH_NVMF_DISC_STATE, 0755) && errno != EEXIST))
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, NVMF_DISC_STATE_MAGIC, sizeof(hdr.magic));
+	hdr.version = NVMF_DISC_STATE_VERSION;
+	hdr.genctr = n->cur_genctr;
+	snprintf(hdr.key, sizeof(hdr.key), "%s", n->key);
+	/* an empty log comes without a generation counter */
+	if (!n->nr_cur)
+		hdr.flags |= NVMF_DISC_STATE_STALE;
+
+	disc_state_path(n, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return;
+
+	if (lseek(fd, sizeof(hdr), SEEK_SET) < 0)
+		goto unlink_tmp;
+	for (i = 0; i < n->nr_cur; i++) {
+		struct nvmf_disc_rsp_page_entry *e = &n->cur[i];
+
+		key = entry_key(&n->cfg, e);
+		if (!key)
+			goto unlink_tmp;
+		r = crawl_find_record(crawl, key);
+		free(key);
+		if (r && r->failed) {
+			hdr.flags |= NVMF_DISC_STATE_STALE;
+			continue;
+		}
+		if (write_all(fd, e, sizeof(*e)))
+			goto unlink_tmp;
+		hdr.numrec++;
+	}
+
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    fchmod(fd, 0644) || rename(tmp, path))
+		goto unlink_tmp;
+	close(fd);
+	return;
+
+unlink_tmp:
+	unlink(tmp);
+	close(fd);
+}
+
+/*
+ * Disconnects the controllers of entries that a discovery controller
+ * returned in the last run but not in this one, unless another discovery
+ * controller still returns them.
+ */
+static void crawl_disconnect_removed(struct disc_crawl *crawl)
+{
+	char traddr[NVMF_TRADDR_SIZE + 1], trsvcid[NVMF_TRSVCID_SIZE + 1];
+	struct connect_args args;
+	struct ctrl_index_entry *c;
+	bool offered;
+	char *key;
+	int i, j, ret;
+
+	for (i = 0; i < crawl->nr_nodes; i++) {
+		struct disc_node *n = crawl->nodes[i];
+
+		if (!n->fetched)
+			continue;
+
+		for (j = 0; j < n->nr_old; j++) {
+			struct nvmf_disc_rsp_page_entry *e = &n->old[j];
+
+			if (e->subtype != NVME_NQN_NVME)
+				continue;
+			key = entry_key(&n->cfg, e);
+			if (!key)
+				continue;
+			offered = crawl_find_record(crawl, key);
+			free(key);
+			if (offered)
+				continue;
+
+			entry_connect_args(e, &n->cfg, &args, traddr, trsvcid);
+			c = ctrl_index_find_exact(&args, n->cfg.hostnqn);
+			if (!c)
+				continue;
+
+			ret = remove_ctrl(ctrl_instance(c->name));
+			if (!cfg.quiet)
+				printf("%-5s traddr=%-20s trsvcid=%-6s %s: %s %s\n",
+				       args.transport, traddr, trsvcid,
+				       args.subsysnqn,
+				       ret ? "failed to disconnect" :
+				       "removed, disconnected", c->name);
+			ctrl_index_del(c);
+		}
+	}
+}
+
+static int disc_node_fetch(struct disc_node *n,
+			   struct nvmf_disc_rsp_page_hdr **logp, int *numrec)
+{
+	bool disable_sqflow = true;
+	int ret;
+
+retry:
+	if (n->referral) {
+		ret = entry_argstr(&n->e, n->argstr, disable_sqflow);
+		if (ret)
+			return ret;
+	}
+
+	ret = fetch_discovery_log(n->argstr,
+				  cfg.incremental && n->old_genctr_valid ?
+				  &n->old_genctr : NULL, logp, numrec);
+	if (ret == -EINVAL && n->referral &&
+	    n->e.treq & NVMF_TREQ_DISABLE_SQFLOW && disable_sqflow) {
+		/* disable_sqflow param might not be supported, try without it */
+		disable_sqflow = false;
+		goto retry;
+	}
+	return ret;
+}
+
+/* The child sends the result, the number of records and the log */
+static int disc_node_start(struct disc_crawl *crawl, struct disc_node *n)
+{
+	struct nvmf_disc_rsp_page_hdr *log = NULL;
+	int fds[2], numrec = 0, ret;
+	struct config saved;
+
+	n->state = CONNECT_RUNNING;
+	n->start = now_ms();
+	if (cfg.incremental || cfg.disconnect_removed)
+		disc_state_load(n);
+
+	/* nothing buffered may be printed twice by the child */
+	fflush(NULL);
+	if (pipe(fds) < 0)
+		goto inline_fetch;
+	n->pid = fork();
+	if (n->pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		goto inline_fetch;
+	}
+	if (!n->pid) {
+		close(fds[0]);
+		cfg = n->cfg;
+		ret = disc_node_fetch(n, &log, &numrec);
+		if (ret || (!log && numrec > 0))
+			numrec = 0;
+		if (write_all(fds[1], &ret, sizeof(ret)) ||
+		    write_all(fds[1], &numrec, sizeof(numrec)) ||
+		    (numrec > 0 &&
+		     write_all(fds[1], log, disc_log_size(numrec))))
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	n->fd = fds[0];
+	return 0;
+
+inline_fetch:
+	saved = cfg;
+	cfg = n->cfg;
+	ret = disc_node_fetch(n, &log, &numrec);
+	cfg = saved;
+	n->state = CONNECT_DONE;
+	ret = crawl_process(crawl, n, ret, log, ret ? 0 : numrec);
+	free(log);
+	return ret;
+}
+
+static int disc_node_finish(struct disc_crawl *crawl, struct disc_node *n)
+{
+	struct nvmf_disc_rsp_page_hdr *log = NULL;
+	int ret = -EIO, numrec = 0, err;
+	size_t off = 2 * sizeof(int);
+
+	close(n->fd);
+	waitpid(n->pid, NULL, 0);
+	n->state = CONNECT_DONE;
+
+	if (n->len >= off) {
+		memcpy(&ret, n->buf, sizeof(ret));
+		memcpy(&numrec, n->buf + sizeof(ret), sizeof(numrec));
+		if (numrec < -1 || (numrec > 0 &&
+				    n->len != off + disc_log_size(numrec))) {
+			ret = -EIO;
+			numrec = 0;
+		} else if (numrec > 0)
+			log = (struct nvmf_disc_rsp_page_hdr *)(n->buf + off);
+	}
+
+	err = crawl_process(crawl, n, ret, log, numrec);
+	free(n->buf);
+	n->buf = NULL;
+	return err;
+}
+
+static int disc_node_read(struct disc_crawl *crawl, struct disc_node *n)
+{
+	ssize_t ret;
+
+	if (n->len == n->size) {
+		size_t size = n->size ? n->size * 2 : disc_log_size(64);
+		char *buf = realloc(n->buf, size);
+
+		if (!buf) {
+			n->len = 0;
+			return disc_node_finish(crawl, n);
+		}
+		n->buf = buf;
+		n->size = size;
+	}
+
+	ret = read(n->fd, n->buf + n->len, n->size - n->len);
+	if (ret < 0 && errno == EINTR)
+		return 0;
+	if (ret > 0) {
+		n->len += ret;
+		return 0;
+	}
+	return disc_node_finish(crawl, n);
+}
+
+static int crawl_run(struct disc_crawl *crawl)
+{
+	struct disc_node **polled = NULL;
+	struct pollfd *fds = NULL;
+	int i, nr, next = 0, running, timeout, err = 0;
+	long long now;
+
+	while (!err) {
+		for (running = 0, i = 0; i < next; i++)
+			if (crawl->nodes[i]->state == CONNECT_RUNNING)
+				running++;
+
+		while (next < crawl->nr_nodes && running < cfg.parallel) {
+			struct disc_node *n = crawl->nodes[next++];
+
+			err = disc_node_start(crawl, n);
+			if (err)
+				break;
+			if (n->state == CONNECT_RUNNING)
+				running++;
+		}
+		if (err || !running)
+			break;
+
+		free(fds);
+		free(polled);
+		fds = calloc(running, sizeof(*fds));
+		polled = calloc(running, sizeof(*polled));
+		if (!fds || !polled) {
+			err = -ENOMEM;
+			break;
+		}
+
+		now = now_ms();
+		timeout = -1;
+		for (nr = 0, i = 0; i < next; i++) {
+			struct disc_node *n = crawl->nodes[i];
+
+			if (n->state != CONNECT_RUNNING)
+				continue;
+			if (cfg.deadline > 0) {
+				long long left = n->start +
+					cfg.deadline * 1000LL - now;
+
+				if (left <= 0) {
+					fprintf(stderr,
+						"%s: discovery timed out after %ds\n",
+						n->key, cfg.deadline);
+					close(n->fd);
+					kill(n->pid, SIGKILL);
+					if (waitpid(n->pid, NULL, WNOHANG) > 0)
+						n->pid = 0;
+					free(n->buf);
+					n->buf = NULL;
+					n->state = CONNECT_TIMEDOUT;
+					crawl->ret = -ETIMEDOUT;
+					timeout = 0;
+					continue;
+				}
+				if (timeout < 0 || left < timeout)
+					timeout = left;
+			}
+			fds[nr].fd = n->fd;
+			fds[nr].events = POLLIN;
+			polled[nr++] = n;
+		}
+
+		if (nr && poll(fds, nr, timeout) > 0) {
+			for (i = 0; i < nr && !err; i++)
+				if (fds[i].revents)
+					err = disc_node_read(crawl, polled[i]);
+		}
+	}
+
+	/* on error, children still running go away with their pipe */
+	for (i = 0; i < next; i++) {
+		struct disc_node *n = crawl->nodes[i];
+
+		if (n->state == CONNECT_TIMEDOUT && n->pid > 0 &&
+		    waitpid(n->pid, NULL, WNOHANG) > 0)
+			n->pid = 0;
+		if (n->state != CONNECT_RUNNING)
+			continue;
+		close(n->fd);
+		n->state = CONNECT_DONE;
+	}
+	free(fds);
+	free(polled);
+	return err;
+}
+
+static int disc_record_cmp(const void *a, const void *b)
+{
+	const struct disc_record *ra = *(const struct disc_record **)a;
+	const struct disc_record *rb = *(const struct disc_record **)b;
+
+	if (ra->node->idx != rb->node->idx)
+		return ra->node->idx - rb->node->idx;
+	return ra->idx - rb->idx;
+}
+
+static void crawl_free(struct disc_crawl *crawl)
+{
+	int i;
+
+	for (i = 0; i < crawl->nr_nodes; i++) {
+		free(crawl->nodes[i]->key);
+		free(crawl->nodes[i]->buf);
+		free(crawl->nodes[i]->old);
+		free(crawl->nodes[i]->cur);
+		free(crawl->nodes[i]->conf);
+		free(crawl->nodes[i]);
+	}
+	for (i = 0; i < crawl->nr_records; i++) {
+		free(crawl->records[i]->key);
+		free(crawl->records[i]);
+	}
+	free(crawl->nodes);
+	free(crawl->records);
+}
+
+static int connect_ctrls(struct disc_crawl *crawl)
+{
+	char traddr[NVMF_TRADDR_SIZE + 1], trsvcid[NVMF_TRSVCID_SIZE + 1];
+	struct connect_args args;
+	struct connect_job *jobs;
+	int i, nr = 0, ret = 0;
+
+	jobs = calloc(crawl->nr_records, sizeof(*jobs));
+	if (crawl->nr_records && !jobs)
+		return -ENOMEM;
+
+	for (i = 0; i < crawl->nr_records; i++) {
+		struct disc_record *r = crawl->records[i];
+
+		/* referrals have been crawled already */
+		if (r->e.subtype == NVME_NQN_DISC)
+			continue;
+		if (cfg.incremental && !r->fresh)
+			continue;
+
+		jobs[nr].e = &r->e;
+		jobs[nr].cfg = &r->node->cfg;
+		jobs[nr].record = r;
+
+		/* the kernel would refuse a duplicate with EALREADY anyway */
+		entry_connect_args(&r->e, &r->node->cfg, &args, traddr,
+				   trsvcid);
+		if (ctrl_index_find_exact(&args, r->node->cfg.hostnqn)) {
+			jobs[nr].state = CONNECT_DONE;
+			jobs[nr].ret = -EALREADY;
+		}
+		nr++;
+	}
+
+	for (i = 0; i < nr; i++) {
+		struct connect_job *job = &jobs[i];
+		const char *host_traddr = host_traddr_str(job->cfg);
+		int j, new_ctrls = 0;
+
+		if (job->state == CONNECT_DONE)
+			continue;
+		for (j = 0; j < nr; j++)
+			if (jobs[j].state != CONNECT_DONE &&
+			    jobs[j].e->trtype == job->e->trtype &&
+			    !strcmp(host_traddr_str(jobs[j].cfg), host_traddr))
+				new_ctrls++;
+
+		job->tuned = *job->cfg;
+		tune_queues(&job->tuned, trtype_str(job->e->trtype),
+			    job->e->subnqn, new_ctrls);
+		job->cfg = &job->tuned;
+	}
+
+	if (cfg.dry_run) {
+		connect_jobs_dry_run(jobs, nr);
+		goto out;
+	}
+	connect_jobs_run(jobs, nr);
+
+	for (i = 0; i < nr; i++) {
+		struct connect_job *job = &jobs[i];
+
+		if (job->state == CONNECT_DONE && job->ret >= 0) {
+			char name[32];
+
+			sprintf(name, "nvme%d", job->ret);
+			entry_connect_args(job->e, job->cfg, &args, traddr,
+					   trsvcid);
+			ctrl_index_add(name, &args, job->cfg->hostnqn);
+		}
+
+		if (job->state == CONNECT_TIMEDOUT ||
+		    (job->ret < 0 && job->ret != -EALREADY))
+			job->record->failed = true;
+
+		/*
+		 * don't error out. The Discovery Log may contain
+		 * devices that aren't necessarily connectable via
+		 * the system/host transport port. Let those items
+		 * fail and continue on to the next log element.
+		 */
+		if (!cfg.quiet)
+			connect_job_report(job);
+	}
+
+out:
+	free(jobs);
+	return ret;
+}
+
+static void crawl_print(struct disc_crawl *crawl)
+{
+	struct nvmf_disc_rsp_page_hdr *log;
+	int i;
+
+	log = calloc(1, disc_log_size(crawl->nr_records));
+	if (!log) {
+		fprintf(stderr, "failed to allocate discovery log\n");
+		return;
+	}
+	log->genctr = crawl->genctr;
+	log->numrec = cpu_to_le64(crawl->nr_records);
+	for (i = 0; i < crawl->nr_records; i++)
+		log->entries[i] = crawl->records[i]->e;
+
+	if (cfg.raw)
+		save_discovery_log(log, crawl->nr_records);
+	else
+		print_discovery_log(log, crawl->nr_records);
+	free(log);
+}
+
+static int do_discover(struct disc_crawl *crawl, bool connect)
+{
+	int i, ret;
+
+	/* children share the index built before they are started */
+	ctrl_index_build();
+
+	crawl->connect = connect;
+	ret = crawl_run(crawl);
+	if (ret)
+		goto out;
+
+	qsort(crawl->records, crawl->nr_records, sizeof(*crawl->records),
+	      disc_record_cmp);
+	if (connect) {
+		ret = connect_ctrls(crawl);
+		if (cfg.dry_run)
+			goto out;
+		if (cfg.disconnect_removed)
+			crawl_disconnect_removed(crawl);
+		for (i = 0; i < crawl->nr_nodes; i++)
+			if (crawl->nodes[i]->fetched)
+				disc_state_store(crawl, crawl->nodes[i]);
+	} else if (crawl->nr_records)
+		crawl_print(crawl);
+	if (!ret)
+		ret = crawl->ret;
+out:
+	crawl_free(crawl);
+	return ret;
+}
+
+static int discover_from_conf_file(const char *desc, char *argstr,
+		const struct argconfig_commandline_options *opts,
+		struct disc_crawl *crawl)
+{
+	struct config saved = cfg;
+	FILE *f;
+	char line[256], *ptr, *conf, *args, **argv;
+	int argc, nr, err, ret = 0;
 
 	f = fopen(PATH_NVMF_DISC, "r");
 	if (f == NULL) {
@@ -1189,9 +2806,12 @@ static int discover_from_conf_file(const char *desc, char *argstr,
 	while (fgets(line, sizeof(line), f) != NULL) {
 		if (line[0] == '#' || line[0] == '\n')
 			continue;
+		/* see queue_profiles_load() */
+		if (!strncmp(line, "--profile", 9))
+			continue;
 
-		args = strdup(line);
-		if (!args) {
+		conf = args = strdup(line);
+		if (!conf) {
 			fprintf(stderr, "failed to strdup args\n");
 			ret = -ENOMEM;
 			goto out;
@@ -1200,7 +2820,7 @@ static int discover_from_conf_file(const char *desc, char *argstr,
 		argv = calloc(MAX_DISC_ARGS, BUF_SIZE);
 		if (!argv) {
 			fprintf(stderr, "failed to allocate argv vector\n");
-			free(args);
+			free(conf);
 			ret = -ENOMEM;
 			goto out;
 		}
@@ -1210,9 +2830,21 @@ static int discover_from_conf_file(const char *desc, char *argstr,
 		while ((ptr = strsep(&args, " =\n")) != NULL)
 			argv[argc++] = ptr;
 
+		/* each line starts from the options of the command line */
+		cfg = saved;
+		cfg.disconnect_removed = false;
 		err = argconfig_parse(argc, argv, desc, opts);
 		if (err)
-			continue;
+			goto next;
+
+		/* only the command line decides what gets disconnected */
+		if (cfg.disconnect_removed) {
+			fprintf(stderr,
+				"ignoring %s line with --disconnect-removed\n",
+				PATH_NVMF_DISC);
+			goto next;
+		}
+		cfg.disconnect_removed = saved.disconnect_removed;
 
 		if (cfg.persistent && !cfg.keep_alive_tmo)
 			cfg.keep_alive_tmo = NVMF_DEF_DISC_TMO;
@@ -1220,28 +2852,246 @@ static int discover_from_conf_file(const char *desc, char *argstr,
 		err = build_options(argstr, BUF_SIZE, true);
 		if (err) {
 			ret = err;
-			continue;
+			goto next;
 		}
 
-		err = do_discover(argstr, connect);
+		nr = crawl->nr_nodes;
+		err = crawl_add_node(crawl, &cfg, argstr, NULL);
 		if (err) {
 			ret = err;
-			continue;
+			free(conf);
+			free(argv);
+			goto out;
 		}
-
-		free(args);
+		/* the options of the node point into the line */
+		if (crawl->nr_nodes > nr) {
+			crawl->nodes[nr]->conf = conf;
+			conf = NULL;
+		}
+next:
+		free(conf);
 		free(argv);
 	}
 
 out:
+	/* the crawl itself runs with the options of the command line */
+	cfg = saved;
 	fclose(f);
 	return ret;
 }
 
+/*
+ * connect-all --daemon stays resident and connects on behalf of the udev
+ * rules, which only send it the connect-all arguments of each event with
+ * connect-all --notify. Events are collected for cfg.window milliseconds
+ * after the first one arrives, identical ones only once, and then crawled
+ * together; discovery controllers named by several events are only
+ * visited once, and entries are connected through one pool of at most
+ * cfg.parallel workers. Events that arrive meanwhile wait in the socket.
+ */
+static volatile sig_atomic_t autoconnect_stop;
+
+static void autoconnect_signal(int sig)
+{
+	autoconnect_stop = 1;
+}
+
+static int autoconnect_notify(int argc, char **argv)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char msg[BUF_SIZE];
+	int i, fd, len = 0, ret = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--notify") || !strcmp(argv[i], "-notify"))
+			continue;
+		len += snprintf(msg + len, sizeof(msg) - len, "%s%s",
+				len ? "\t" : "", argv[i]);
+		if (len >= sizeof(msg)) {
+			fprintf(stderr, "connect-all arguments too long\n");
+			return -EINVAL;
+		}
+	}
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+		 PATH_NVMF_AUTOCONNECT);
+	if (sendto(fd, msg, len, 0, (struct sockaddr *)&addr,
+		   sizeof(addr)) < 0) {
+		ret = -errno;
+		fprintf(stderr, "failed to notify %s: %s\n",
+			PATH_NVMF_AUTOCONNECT, strerror(errno));
+	}
+	close(fd);
+	return ret;
+}
+
+/* Adds the discovery controllers an event names to the crawl */
+static int autoconnect_add_event(const char *desc,
+		const struct argconfig_commandline_options *opts,
+		struct disc_crawl *crawl, char *msg)
+{
+	char argstr[BUF_SIZE], *argv[MAX_DISC_ARGS * 4], *p;
+	int argc = 0, ret;
+
+	argv[argc++] = "connect-all";
+	while ((p = strsep(&msg, "\t\n")) && argc < ARRAY_SIZE(argv))
+		if (*p)
+			argv[argc++] = p;
+
+	ret = argconfig_parse(argc, argv, desc, opts);
+	if (ret)
+		return ret;
+
+	if (cfg.device && !strcmp(cfg.device, "none"))
+		cfg.device = NULL;
+	cfg.nqn = NVME_DISC_SUBSYS_NAME;
+
+	if (!cfg.transport && !cfg.traddr)
+		return discover_from_conf_file(desc, argstr, opts, crawl);
+
+	if (cfg.persistent && !cfg.keep_alive_tmo)
+		cfg.keep_alive_tmo = NVMF_DEF_DISC_TMO;
+	ret = build_options(argstr, BUF_SIZE, true);
+	if (ret)
+		return ret;
+	return crawl_add_node(crawl, &cfg, argstr, NULL);
+}
+
+static void autoconnect_run(const char *desc,
+		const struct argconfig_commandline_options *opts,
+		const struct config *base, char **events, int nr_events)
+{
+	struct disc_crawl crawl = { NULL };
+	int i;
+
+	for (i = 0; i < nr_events; i++) {
+		cfg = *base;
+		if (autoconnect_add_event(desc, opts, &crawl, events[i]))
+			fprintf(stderr, "ignoring malformed event\n");
+	}
+	cfg = *base;
+
+	if (!cfg.quiet)
+		printf("autoconnect: %d events, %d discovery controllers\n",
+		       nr_events, crawl.nr_nodes);
+	if (crawl.nr_nodes)
+		do_discover(&crawl, true);
+	else
+		crawl_free(&crawl);
+
+	/* the sysfs view is only good for one run */
+	ctrl_index_free();
+	/* children that missed their deadline */
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+	fflush(NULL);
+}
+
+static int autoconnect_daemon(const char *desc,
+		const struct argconfig_commandline_options *opts)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct sigaction sa = { .sa_handler = autoconnect_signal };
+	struct config base = cfg;
+	char **events = NULL, buf[BUF_SIZE];
+	int i, fd, nr_events = 0, timeout, ret = 0;
+	long long first = 0;
+	mode_t umask_saved;
+	ssize_t len;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+		 PATH_NVMF_AUTOCONNECT);
+	if (mkdir("/run/nvme", 0755) && errno != EEXIST) {
+		ret = -errno;
+		goto close_fd;
+	}
+	unlink(addr.sun_path);
+	/* no window in which others could send events */
+	umask_saved = umask(0177);
+	ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(umask_saved);
+	if (ret < 0 || chmod(addr.sun_path, 0600) < 0) {
+		ret = -errno;
+		fprintf(stderr, "failed to bind %s: %s\n", addr.sun_path,
+			strerror(errno));
+		goto close_fd;
+	}
+
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	while (!autoconnect_stop) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+		timeout = -1;
+		if (nr_events) {
+			timeout = first + cfg.window - now_ms();
+			if (timeout < 0)
+				timeout = 0;
+		}
+
+		ret = poll(&pfd, 1, timeout);
+		if (ret < 0 && errno != EINTR) {
+			ret = -errno;
+			break;
+		}
+		ret = 0;
+
+		if (pfd.revents & POLLIN) {
+			char **tmp;
+
+			len = recv(fd, buf, sizeof(buf) - 1, 0);
+			if (len <= 0)
+				continue;
+			buf[len] = '\0';
+
+			for (i = 0; i < nr_events; i++)
+				if (!strcmp(events[i], buf))
+					break;
+			if (i < nr_events)
+				continue;
+
+			tmp = realloc(events, (nr_events + 1) * sizeof(*events));
+			if (!tmp)
+				continue;
+			events = tmp;
+			events[nr_events] = strdup(buf);
+			if (!events[nr_events])
+				continue;
+			if (!nr_events++)
+				first = now_ms();
+			continue;
+		}
+
+		if (nr_events && now_ms() - first >= cfg.window) {
+			autoconnect_run(desc, opts, &base, events, nr_events);
+			for (i = 0; i < nr_events; i++)
+				free(events[i]);
+			nr_events = 0;
+		}
+	}
+
+	for (i = 0; i < nr_events; i++)
+		free(events[i]);
+	free(events);
+	unlink(addr.sun_path);
+close_fd:
+	close(fd);
+	return ret;
+}
+
 int discover(const char *desc, int argc, char **argv, bool connect)
 {
+	struct disc_crawl crawl = { NULL };
 	char argstr[BUF_SIZE];
-	int ret;
+	int ret, err;
 
 	OPT_ARGS(opts) = {
 		OPT_LIST("transport",      't', &cfg.transport,       "transport type"),
@@ -1264,36 +3114,68 @@ int discover(const char *desc, int argc, char **argv, bool connect)
 		OPT_INT("queue-size",      'Q', &cfg.queue_size,      "number of io queue elements to use (default 128)"),
 		OPT_FLAG("persistent",     'p', &cfg.persistent,      "persistent discovery connection"),
 		OPT_FLAG("quiet",          'S', &cfg.quiet,           "suppress already connected errors"),
+		OPT_INT("parallel",        'j', &cfg.parallel,        "number of controllers to discover or connect at the same time (default 8)"),
+		OPT_INT("deadline",        'e', &cfg.deadline,        "seconds to wait for each controller (default no limit)"),
+		OPT_FLAG("incremental",    'N', &cfg.incremental,     "only connect entries new or changed since the last run"),
+		OPT_FLAG("disconnect-removed", 0, &cfg.disconnect_removed, "disconnect entries removed since the last run"),
+		OPT_FLAG("daemon",         0,   &cfg.daemon,          "stay resident and connect on events from --notify"),
+		OPT_FLAG("notify",         0,   &cfg.notify,          "pass the arguments on to the resident connect-all"),
+		OPT_INT("window",          0,   &cfg.window,          "milliseconds to collect events for (default 500)"),
+		OPT_FLAG("auto-queues",    0,   &cfg.auto_queues,     "size io queues after the CPUs local to the host port"),
+		OPT_FLAG("dry-run",        0,   &cfg.dry_run,         "print the connect arguments instead of connecting"),
 		OPT_END()
 	};
 
 	cfg.tos = -1;
+	cfg.parallel = NVMF_DEF_PARALLEL;
+	cfg.window = NVMF_DEF_WINDOW;
 	ret = argconfig_parse(argc, argv, desc, opts);
 	if (ret)
 		goto out;
 
+	if (cfg.parallel < 1)
+		cfg.parallel = 1;
+
+	if (cfg.daemon || cfg.notify) {
+		if (!connect) {
+			fprintf(stderr,
+				"--daemon and --notify are for connect-all only\n");
+			ret = -EINVAL;
+		} else if (cfg.notify)
+			ret = autoconnect_notify(argc, argv);
+		else
+			ret = autoconnect_daemon(desc, opts);
+		goto out;
+	}
+
 	if (cfg.device && !strcmp(cfg.device, "none"))
 		cfg.device = NULL;
 
 	cfg.nqn = NVME_DISC_SUBSYS_NAME;
 
 	if (!cfg.transport && !cfg.traddr) {
-		ret = discover_from_conf_file(desc, argstr, opts, connect);
+		ret = discover_from_conf_file(desc, argstr, opts, &crawl);
 	} else {
 		if (cfg.persistent && !cfg.keep_alive_tmo)
 			cfg.keep_alive_tmo = NVMF_DEF_DISC_TMO;
 		ret = build_options(argstr, BUF_SIZE, true);
-		if (ret)
-			goto out;
+		if (!ret)
+			ret = crawl_add_node(&crawl, &cfg, argstr, NULL);
+	}
 
-		ret = do_discover(argstr, connect);
+	/* nodes that could be added are visited despite earlier errors */
+	if (crawl.nr_nodes) {
+		err = do_discover(&crawl, connect);
+		if (err)
+			ret = err;
 	}
 
 out:
+	ctrl_index_free();
 	return nvme_status_to_errno(ret, true);
 }
 
-int connect(const char *desc, int argc, char **argv)
+int fabrics_connect(const char *desc, int argc, char **argv)
 {
 	char argstr[BUF_SIZE];
 	int instance, ret;
@@ -1318,6 +3200,8 @@ int connect(const char *desc, int argc, char **argv)
 		OPT_FLAG("disable-sqflow",    'd', &cfg.disable_sqflow,    "disable controller sq flow control (default false)"),
 		OPT_FLAG("hdr-digest",        'g', &cfg.hdr_digest,        "enable transport protocol header digest (TCP transport)"),
 		OPT_FLAG("data-digest",       'G', &cfg.data_digest,       "enable transport protocol data digest (TCP transport)"),
+		OPT_FLAG("auto-queues",       0,   &cfg.auto_queues,       "size io queues after the CPUs local to the host port"),
+		OPT_FLAG("dry-run",           0,   &cfg.dry_run,           "print the connect arguments instead of connecting"),
 		OPT_END()
 	};
 
@@ -1326,13 +3210,22 @@ int connect(const char *desc, int argc, char **argv)
 	if (ret)
 		goto out;
 
+	if (!cfg.nqn) {
+		fprintf(stderr, "need a -n argument\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (cfg.transport)
+		tune_queues(&cfg, cfg.transport, cfg.nqn, 1);
+	ctrl_index_free();
+
 	ret = build_options(argstr, BUF_SIZE, false);
 	if (ret)
 		goto out;
 
-	if (!cfg.nqn) {
-		fprintf(stderr, "need a -n argument\n");
-		ret = -EINVAL;
+	if (cfg.dry_run) {
+		printf("%s\n", argstr);
 		goto out;
 	}
 
@@ -1344,76 +3237,128 @@ out:
 	return nvme_status_to_errno(ret, true);
 }
 
-static int scan_sys_nvme_filter(const struct dirent *d)
+/* Orders controllers by instance, which is the order they were created in */
+static int ctrl_index_entry_cmp(const void *a, const void *b)
 {
-	if (!strcmp(d->d_name, "."))
-		return 0;
-	if (!strcmp(d->d_name, ".."))
-		return 0;
-	return 1;
+	struct ctrl_index_entry *ca = *(struct ctrl_index_entry **)a;
+	struct ctrl_index_entry *cb = *(struct ctrl_index_entry **)b;
+
+	return ctrl_instance(ca->name) - ctrl_instance(cb->name);
+}
+
+/* Returns the number of controllers in *ctrlsp that match() accepted */
+static int ctrl_index_select(bool (*match)(struct ctrl_index_entry *c),
+			     struct ctrl_index_entry ***ctrlsp)
+{
+	struct ctrl_index_entry *c, **ctrls = NULL, **tmp;
+	int i, nr = 0;
+
+	ctrl_index_build();
+	for (i = 0; i < CTRL_INDEX_BUCKETS; i++) {
+		for (c = ctrl_index[i]; c; c = c->next) {
+			if (!match(c))
+				continue;
+			tmp = realloc(ctrls, (nr + 1) * sizeof(*ctrls));
+			if (!tmp) {
+				free(ctrls);
+				return -ENOMEM;
+			}
+			ctrls = tmp;
+			ctrls[nr++] = c;
+		}
+	}
+
+	if (nr)
+		qsort(ctrls, nr, sizeof(*ctrls), ctrl_index_entry_cmp);
+	*ctrlsp = ctrls;
+	return nr;
+}
+
+static void delete_job_report(struct connect_job *job)
+{
+	struct ctrl_index_entry *c = job->ctrl;
+	long long ms = job->end - job->start;
+	char result[64];
+
+	if (job->state == CONNECT_TIMEDOUT)
+		snprintf(result, sizeof(result),
+			 "still disconnecting after %ds", cfg.deadline);
+	else if (job->ret)
+		snprintf(result, sizeof(result), "failed after %lld.%03llds: %s",
+			 ms / 1000, ms % 1000, strerror(-job->ret));
+	else
+		snprintf(result, sizeof(result), "disconnected in %lld.%03llds",
+			 ms / 1000, ms % 1000);
+
+	printf("%-7s %-5s traddr=%-20s trsvcid=%-6s %s: %s\n", c->name,
+	       c->args.transport, c->args.traddr, c->args.trsvcid,
+	       c->args.subsysnqn, result);
 }
 
 /*
- * Returns 1 if disconnect occurred, 0 otherwise.
+ * Deletes controllers, up to cfg.parallel at a time. Returns the number
+ * deleted, and the first error in *err.
  */
-static int disconnect_subsys(char *nqn, char *ctrl)
+static int delete_ctrls(struct ctrl_index_entry **ctrls, int nr, int *err)
 {
-	char *sysfs_nqn_path = NULL, *sysfs_del_path = NULL;
-	char subsysnqn[NVMF_NQN_SIZE] = {};
-	int fd, ret = 0;
-
-	if (asprintf(&sysfs_nqn_path, "%s/%s/subsysnqn", SYS_NVME, ctrl) < 0)
-		goto free;
-	if (asprintf(&sysfs_del_path, "%s/%s/delete_controller", SYS_NVME, ctrl) < 0)
-		goto free;
+	struct connect_job *jobs;
+	int i, deleted = 0;
 
-	fd = open(sysfs_nqn_path, O_RDONLY);
-	if (fd < 0) {
-		fprintf(stderr, "Failed to open %s: %s\n",
-				sysfs_nqn_path, strerror(errno));
-		goto free;
+	*err = 0;
+	jobs = calloc(nr, sizeof(*jobs));
+	if (nr && !jobs) {
+		*err = -ENOMEM;
+		return 0;
 	}
 
-	if (read(fd, subsysnqn, NVMF_NQN_SIZE) < 0)
-		goto close;
-
-	subsysnqn[strcspn(subsysnqn, "\n")] = '\0';
-	if (strcmp(subsysnqn, nqn))
-		goto close;
+	for (i = 0; i < nr; i++) {
+		jobs[i].ctrl = ctrls[i];
+		jobs[i].cfg = &cfg;
+	}
+	connect_jobs_run(jobs, nr);
+
+	for (i = 0; i < nr; i++) {
+		struct connect_job *job = &jobs[i];
+
+		delete_job_report(job);
+		if (job->state == CONNECT_TIMEDOUT) {
+			if (!*err)
+				*err = -ETIMEDOUT;
+		} else if (job->ret) {
+			if (!*err)
+				*err = job->ret;
+		} else
+			deleted++;
+	}
+	free(jobs);
+	return deleted;
+}
 
-	if (!remove_ctrl_by_path(sysfs_del_path))
-		ret = 1;
- close:
-	close(fd);
- free:
-	free(sysfs_del_path);
-	free(sysfs_nqn_path);
-	return ret;
+static bool ctrl_matches_nqn(struct ctrl_index_entry *c)
+{
+	return !strcmp(c->args.subsysnqn, cfg.nqn);
 }
 
 /*
- * Returns the number of controllers successfully disconnected.
+ * Returns the number of controllers successfully disconnected, or the
+ * first error if any of them could not be.
  */
 static int disconnect_by_nqn(char *nqn)
 {
-	struct dirent **devices = NULL;
-	int i, n, ret = 0;
+	struct ctrl_index_entry **ctrls;
+	int n, ret;
 
 	if (strlen(nqn) > NVMF_NQN_SIZE)
 		return -EINVAL;
 
-	n = scandir(SYS_NVME, &devices, scan_sys_nvme_filter, alphasort);
+	n = ctrl_index_select(ctrl_matches_nqn, &ctrls);
 	if (n < 0)
 		return n;
 
-	for (i = 0; i < n; i++)
-		ret += disconnect_subsys(nqn, devices[i]->d_name);
-
-	for (i = 0; i < n; i++)
-		free(devices[i]);
-	free(devices);
-
-	return ret;
+	n = delete_ctrls(ctrls, n, &ret);
+	free(ctrls);
+	ctrl_index_free();
+	return ret ? ret : n;
 }
 
 static int disconnect_by_device(char *device)
@@ -1430,18 +3375,26 @@ int disconnect(const char *desc, int argc, char **argv)
 {
 	const char *nqn = "nqn name";
 	const char *device = "nvme device";
+	const char *parallel = "number of controllers to disconnect at the same time (default 8)";
+	const char *deadline = "seconds to wait for each controller (default no limit)";
 	int ret;
 
 	OPT_ARGS(opts) = {
-		OPT_LIST("nqn",    'n', &cfg.nqn,    nqn),
-		OPT_LIST("device", 'd', &cfg.device, device),
+		OPT_LIST("nqn",      'n', &cfg.nqn,      nqn),
+		OPT_LIST("device",   'd', &cfg.device,   device),
+		OPT_INT("parallel",  'j', &cfg.parallel, parallel),
+		OPT_INT("deadline",  'e', &cfg.deadline, deadline),
 		OPT_END()
 	};
 
+	cfg.parallel = NVMF_DEF_PARALLEL;
 	ret = argconfig_parse(argc, argv, desc, opts);
 	if (ret)
 		goto out;
 
+	if (cfg.parallel < 1)
+		cfg.parallel = 1;
+
 	if (!cfg.nqn && !cfg.device) {
 		fprintf(stderr, "need a -n or -d argument\n");
 		ret = -EINVAL;
@@ -1471,40 +3424,52 @@ out:
 	return nvme_status_to_errno(ret, true);
 }
 
+/* Fabrics controllers matching the patterns given to disconnect-all */
+static bool ctrl_matches_patterns(struct ctrl_index_entry *c)
+{
+	if (!strcmp(c->args.transport, "pcie"))
+		return false;
+	return (!cfg.transport || !fnmatch(cfg.transport, c->args.transport, 0)) &&
+	       (!cfg.traddr || !fnmatch(cfg.traddr, c->args.traddr, 0)) &&
+	       (!cfg.nqn || !fnmatch(cfg.nqn, c->args.subsysnqn, 0));
+}
+
 int disconnect_all(const char *desc, int argc, char **argv)
 {
-	struct nvme_topology t = { };
-	int i, j, err;
+	const char *transport = "only controllers whose transport matches this pattern";
+	const char *traddr = "only controllers whose traddr matches this pattern";
+	const char *nqn = "only controllers whose subsystem NQN matches this pattern";
+	const char *parallel = "number of controllers to disconnect at the same time (default 8)";
+	const char *deadline = "seconds to wait for each controller (default no limit)";
+	struct ctrl_index_entry **ctrls;
+	int n, err;
 
 	OPT_ARGS(opts) = {
+		OPT_LIST("transport", 't', &cfg.transport, transport),
+		OPT_LIST("traddr",    'a', &cfg.traddr,    traddr),
+		OPT_LIST("nqn",       'n', &cfg.nqn,       nqn),
+		OPT_INT("parallel",   'j', &cfg.parallel,  parallel),
+		OPT_INT("deadline",   'e', &cfg.deadline,  deadline),
 		OPT_END()
 	};
 
+	cfg.parallel = NVMF_DEF_PARALLEL;
 	err = argconfig_parse(argc, argv, desc, opts);
 	if (err)
 		goto out;
 
-	err = scan_subsystems(&t, NULL, 0);
-	if (err) {
-		fprintf(stderr, "Failed to scan namespaces\n");
+	if (cfg.parallel < 1)
+		cfg.parallel = 1;
+
+	n = ctrl_index_select(ctrl_matches_patterns, &ctrls);
+	if (n < 0) {
+		err = n;
 		goto out;
 	}
 
-	for (i = 0; i < t.nr_subsystems; i++) {
-		struct nvme_subsystem *s = &t.subsystems[i];
-
-		for (j = 0; j < s->nr_ctrls; j++) {
-			struct nvme_ctrl *c = &s->ctrls[j];
-
-			if (!strcmp(c->transport, "pcie"))
-				continue;
-			err = disconnect_by_device(c->name);
-			if (err)
-				goto free;
-		}
-	}
-free:
-	free_topology(&t);
+	delete_ctrls(ctrls, n, &err);
+	free(ctrls);
+	ctrl_index_free();
 out:
 	return nvme_status_to_errno(err, true);
 }
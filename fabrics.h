@@ -6,7 +6,7 @@
 extern char *hostnqn_read(void);
 
 extern int discover(const char *desc, int argc, char **argv, bool connect);
-extern int connect(const char *desc, int argc, char **argv);
+extern int fabrics_connect(const char *desc, int argc, char **argv);
 extern int disconnect(const char *desc, int argc, char **argv);
 extern int disconnect_all(const char *desc, int argc, char **argv);
 
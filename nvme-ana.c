@@ -0,0 +1,1067 @@
+/*
+ * nvme ana-check: correlates the ANA logs of all controllers of each
+ * subsystem with the paths the native multipath driver has for them.
+ *
+ * Every controller of a subsystem reports the ANA group and state of the
+ * namespaces it can reach in its own log, while the kernel keeps a state
+ * per path in sysfs. Looking at one of them at a time does not show
+ * namespaces left without a good path, groups the controllers disagree
+ * about or transitions that never finish, so they are put side by side
+ * here.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-print.h"
+#include "nvme-status.h"
+#include "nvme-ana.h"
+
+#define ANA_STATE_UNKNOWN	-1
+
+struct ana_log {
+	struct nvme_ctrl *ctrl;
+	struct nvme_ana_rsp_hdr *log;
+	size_t len;
+	int anatt;		/* seconds a transition may take */
+	int err;
+};
+
+struct ana_path {
+	struct ana_log *log;
+	char name[NAME_MAX + 1];	/* the path device, or the namespace */
+	char sysfs_state[32];		/* what the kernel uses, if known */
+	__u32 grpid;			/* 0 if the log does not have the nsid */
+	int state;			/* according to the log */
+	bool in_use;
+};
+
+struct ana_ns {
+	struct nvme_namespace *ns;
+	int nr_paths;
+	struct ana_path *paths;
+};
+
+struct ana_subsys {
+	struct nvme_subsystem *s;
+	char iopolicy[32];
+	int nr_logs;
+	struct ana_log *logs;
+	int nr_ns;
+	struct ana_ns *ns;
+	struct json_array *problems;	/* JSON only */
+	int nr_problems;
+};
+
+static struct config {
+	char *nqn;
+	char *output_format;
+	bool wait;
+	__u32 count;
+	__u32 size;
+	char *mode;
+	__u32 interval;
+} cfg = {
+	.output_format = "normal",
+	.count = 1000,
+	.mode = "read",
+};
+
+static enum nvme_print_flags flags;
+
+static const char *output_format = "Output format: normal|json";
+
+static int read_attr(const char *path, char *buf, size_t len)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	ret = read(fd, buf, len - 1);
+	close(fd);
+	if (ret < 0)
+		return -errno;
+	while (ret && buf[ret - 1] == '\n')
+		ret--;
+	buf[ret] = '\0';
+	return ret;
+}
+
+static const char *ana_state_str(int state)
+{
+	switch (state) {
+	case NVME_ANA_OPTIMIZED:
+		return "optimized";
+	case NVME_ANA_NONOPTIMIZED:
+		return "non-optimized";
+	case NVME_ANA_INACCESSIBLE:
+		return "inaccessible";
+	case NVME_ANA_PERSISTENT_LOSS:
+		return "persistent-loss";
+	case NVME_ANA_CHANGE:
+		return "change";
+	case ANA_STATE_UNKNOWN:
+		return "unknown";
+	}
+	return "invalid";
+}
+
+static void ana_log_fetch(struct ana_log *l)
+{
+	struct nvme_id_ctrl *id;
+	char path[NAME_MAX + 8];
+	int fd;
+
+	free(l->log);
+	l->log = NULL;
+
+	id = nvme_ctrl_get_id(l->ctrl);
+	if (!id) {
+		l->err = -ENODEV;
+		return;
+	}
+	/* the controller does not report ANA */
+	if (!(id->cmic & (1 << 3))) {
+		l->err = -EOPNOTSUPP;
+		return;
+	}
+	l->anatt = id->anatt;
+	l->len = sizeof(struct nvme_ana_rsp_hdr) +
+		le32_to_cpu(id->nanagrpid) * sizeof(struct nvme_ana_group_desc);
+	if (!(id->anacap & (1 << 6)))
+		l->len += le32_to_cpu(id->mnan) * sizeof(__le32);
+
+	l->log = malloc(l->len);
+	if (!l->log) {
+		l->err = -ENOMEM;
+		return;
+	}
+
+	snprintf(path, sizeof(path), "/dev/%s", l->ctrl->name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		l->err = -errno;
+		goto free;
+	}
+	l->err = nvme_ana_log(fd, l->log, l->len, 0);
+	close(fd);
+	if (!l->err)
+		return;
+free:
+	free(l->log);
+	l->log = NULL;
+}
+
+/* Looks nsid up in the log, returns its group or 0 */
+static __u32 ana_log_lookup(struct ana_log *l, __u32 nsid, int *state)
+{
+	void *base = l->log, *end = base + l->len;
+	struct nvme_ana_group_desc *desc;
+	size_t offset = sizeof(*l->log);
+	int i, j, ngrps;
+
+	*state = ANA_STATE_UNKNOWN;
+	if (!l->log)
+		return 0;
+
+	ngrps = le16_to_cpu(l->log->ngrps);
+	for (i = 0; i < ngrps; i++) {
+		__u32 nnsids;
+
+		desc = base + offset;
+		if ((void *)desc->nsids > end)
+			break;
+		nnsids = le32_to_cpu(desc->nnsids);
+		if ((void *)&desc->nsids[nnsids] > end)
+			break;
+		for (j = 0; j < nnsids; j++) {
+			if (le32_to_cpu(desc->nsids[j]) == nsid) {
+				*state = desc->state & 0xf;
+				return le32_to_cpu(desc->grpid);
+			}
+		}
+		offset += sizeof(*desc) + nnsids * sizeof(__le32);
+	}
+	return 0;
+}
+
+static struct ana_log *ana_subsys_log(struct ana_subsys *as,
+				      struct nvme_ctrl *c)
+{
+	int i;
+
+	for (i = 0; i < as->nr_logs; i++)
+		if (as->logs[i].ctrl == c)
+			return &as->logs[i];
+	return NULL;
+}
+
+static int ana_ns_add_path(struct ana_ns *an, struct ana_log *l,
+			   const char *name, bool multipath)
+{
+	struct ana_path *p, *tmp;
+	char path[PATH_MAX];
+
+	tmp = realloc(an->paths, (an->nr_paths + 1) * sizeof(*p));
+	if (!tmp)
+		return -ENOMEM;
+	an->paths = tmp;
+	p = &an->paths[an->nr_paths++];
+	memset(p, 0, sizeof(*p));
+
+	p->log = l;
+	snprintf(p->name, sizeof(p->name), "%s", name);
+	snprintf(path, sizeof(path), "%s/%s/%s/ana_state", SYS_NVME,
+		 l->ctrl->name, name);
+	if (!multipath || read_attr(path, p->sysfs_state,
+				    sizeof(p->sysfs_state)) < 0)
+		p->sysfs_state[0] = '\0';
+	p->grpid = ana_log_lookup(l, an->ns->nsid, &p->state);
+	return 0;
+}
+
+/*
+ * The path devices nvme<subsys>c<ctrl>n<ns> of controller c. They are
+ * children of the controller in sysfs, and not kept in the topology.
+ */
+static int ana_ctrl_paths(struct nvme_ctrl *c, struct dirent ***paths)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), SYS_NVME "/%s", c->name);
+	return scandir(path, paths, scan_ctrl_paths_filter, alphasort);
+}
+
+static void ana_free_dirents(struct dirent **ents, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		free(ents[i]);
+	free(ents);
+}
+
+/*
+ * Finds the paths to namespace n: nvme<subsys>c<ctrl>n<ns> devices for a
+ * multipath head nvme<subsys>n<ns>, or the namespace itself otherwise.
+ */
+static int ana_ns_scan(struct ana_subsys *as, struct ana_ns *an)
+{
+	struct nvme_subsystem *s = as->s;
+	int i, j, nr, ret = 0, head_id, head_ns;
+	struct dirent **paths;
+
+	if (sscanf(an->ns->name, "nvme%dn%d", &head_id, &head_ns) != 2)
+		return -EINVAL;
+
+	for (i = 0; i < s->nr_ctrls && !ret; i++) {
+		struct nvme_ctrl *c = &s->ctrls[i];
+		struct ana_log *l = ana_subsys_log(as, c);
+
+		for (j = 0; j < c->nr_namespaces && !ret; j++)
+			if (!strcmp(c->namespaces[j].name, an->ns->name))
+				ret = ana_ns_add_path(an, l, an->ns->name,
+						      false);
+
+		nr = ana_ctrl_paths(c, &paths);
+		for (j = 0; j < nr && !ret; j++) {
+			int id, cntlid, ns;
+
+			if (sscanf(paths[j]->d_name, "nvme%dc%dn%d", &id,
+				   &cntlid, &ns) == 3 &&
+			    id == head_id && ns == head_ns)
+				ret = ana_ns_add_path(an, l, paths[j]->d_name,
+						      true);
+		}
+		if (nr > 0)
+			ana_free_dirents(paths, nr);
+	}
+	return ret;
+}
+
+/*
+ * The state the kernel routes I/O by: its own if it has one, the log's
+ * otherwise. Without ANA reporting every path counts as optimized.
+ */
+static int ana_path_state(struct ana_path *p)
+{
+	int state;
+
+	if (!p->sysfs_state[0])
+		return p->log->err == -EOPNOTSUPP ? NVME_ANA_OPTIMIZED :
+		       p->state;
+	for (state = NVME_ANA_OPTIMIZED; state <= NVME_ANA_CHANGE; state++)
+		if (!strcmp(p->sysfs_state, ana_state_str(state)))
+			return state;
+	return ANA_STATE_UNKNOWN;
+}
+
+static bool ana_path_live(struct ana_path *p)
+{
+	const char *state = p->log->ctrl->state;
+
+	return !state || !strcmp(state, "live");
+}
+
+/*
+ * The native multipath driver sends I/O to the optimized paths of live
+ * controllers, and falls back to the non-optimized ones if there are
+ * none. With the numa policy every node uses the closest of them, with
+ * round-robin and queue-depth all of them take turns.
+ */
+static void ana_ns_mark_in_use(struct ana_ns *an)
+{
+	int i, state;
+
+	for (state = NVME_ANA_OPTIMIZED; state <= NVME_ANA_NONOPTIMIZED;
+	     state++) {
+		bool found = false;
+
+		for (i = 0; i < an->nr_paths; i++) {
+			struct ana_path *p = &an->paths[i];
+
+			if (ana_path_live(p) && ana_path_state(p) == state)
+				p->in_use = found = true;
+		}
+		if (found)
+			return;
+	}
+}
+
+static void __attribute__((format(printf, 3, 4)))
+ana_problem(struct ana_subsys *as, struct ana_ns *an, const char *fmt, ...)
+{
+	char msg[256];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+
+	as->nr_problems++;
+	if (flags == JSON) {
+		struct json_object *o = json_create_object();
+
+		if (an)
+			json_object_add_value_string(o, "namespace",
+						     an->ns->name);
+		json_object_add_value_string(o, "problem", msg);
+		json_array_add_value_object(as->problems, o);
+	} else
+		printf("  ! %s%s%s\n", an ? an->ns->name : "", an ? ": " : "",
+		       msg);
+}
+
+static void ana_ns_check(struct ana_subsys *as, struct ana_ns *an)
+{
+	int i, nr_optimized = 0, nr_usable = 0;
+	__u32 grpid = 0;
+
+	for (i = 0; i < an->nr_paths; i++) {
+		struct ana_path *p = &an->paths[i];
+		int state = ana_path_state(p);
+
+		if (!ana_path_live(p))
+			continue;
+		if (state == NVME_ANA_OPTIMIZED)
+			nr_optimized++;
+		if (state == NVME_ANA_OPTIMIZED ||
+		    state == NVME_ANA_NONOPTIMIZED)
+			nr_usable++;
+	}
+	if (!nr_usable)
+		ana_problem(as, an, "no usable path");
+	else if (!nr_optimized)
+		ana_problem(as, an, "no optimized path");
+
+	for (i = 0; i < an->nr_paths; i++) {
+		struct ana_path *p = &an->paths[i];
+		struct ana_log *l = p->log;
+
+		if (!l->log)
+			continue;
+		if (!p->grpid) {
+			ana_problem(as, an, "not in the ANA log of %s",
+				    l->ctrl->name);
+			continue;
+		}
+		if (grpid && p->grpid != grpid)
+			ana_problem(as, an,
+				    "in ANA group %u on %s, but %u on %s",
+				    p->grpid, l->ctrl->name, grpid,
+				    an->paths[0].log->ctrl->name);
+		if (!grpid)
+			grpid = p->grpid;
+
+		if (p->state == NVME_ANA_CHANGE)
+			ana_problem(as, an, cfg.wait ?
+				    "%s still in change state after ANATT (%ds)" :
+				    "%s in change state (ANATT %ds)",
+				    p->name, l->anatt);
+		else if (p->sysfs_state[0] &&
+			 ana_path_state(p) != p->state)
+			ana_problem(as, an,
+				    "%s is %s to the kernel, but %s in the ANA log",
+				    p->name, p->sysfs_state,
+				    ana_state_str(p->state));
+	}
+}
+
+static void ana_ns_print(struct ana_ns *an, struct json_array *array)
+{
+	struct json_object *ns_obj = NULL;
+	struct json_array *paths = NULL;
+	int i;
+
+	if (flags == JSON) {
+		ns_obj = json_create_object();
+		paths = json_create_array();
+		json_object_add_value_string(ns_obj, "name", an->ns->name);
+		json_object_add_value_uint(ns_obj, "nsid", an->ns->nsid);
+	} else
+		printf("  %s nsid %u\n", an->ns->name, an->ns->nsid);
+
+	for (i = 0; i < an->nr_paths; i++) {
+		struct ana_path *p = &an->paths[i];
+		struct nvme_ctrl *c = p->log->ctrl;
+
+		if (flags == JSON) {
+			struct json_object *o = json_create_object();
+
+			json_object_add_value_string(o, "path", p->name);
+			json_object_add_value_string(o, "controller", c->name);
+			json_object_add_value_string(o, "transport",
+						     c->transport ?: "");
+			json_object_add_value_string(o, "address",
+						     c->address ?: "");
+			json_object_add_value_string(o, "state",
+						     c->state ?: "");
+			json_object_add_value_uint(o, "ana_group", p->grpid);
+			json_object_add_value_string(o, "ana_state",
+						     ana_state_str(p->state));
+			if (p->sysfs_state[0])
+				json_object_add_value_string(o,
+					"kernel_ana_state", p->sysfs_state);
+			json_object_add_value_int(o, "in_use", p->in_use);
+			json_array_add_value_object(paths, o);
+			continue;
+		}
+
+		printf("    %-12s %-8s %-5s %-40s %-10s group %-4u %-15s%s\n",
+		       p->name, c->name, c->transport ?: "-",
+		       c->address ?: "-", c->state ?: "-", p->grpid,
+		       ana_state_str(p->state), p->in_use ? " in use" : "");
+	}
+
+	if (flags == JSON) {
+		json_object_add_value_array(ns_obj, "paths", paths);
+		json_array_add_value_object(array, ns_obj);
+	}
+}
+
+static int ana_subsys_add_ns(struct ana_subsys *as, struct nvme_namespace *n)
+{
+	struct ana_ns *tmp;
+	int i;
+
+	for (i = 0; i < as->nr_ns; i++)
+		if (!strcmp(as->ns[i].ns->name, n->name))
+			return 0;
+
+	tmp = realloc(as->ns, (as->nr_ns + 1) * sizeof(*tmp));
+	if (!tmp)
+		return -ENOMEM;
+	as->ns = tmp;
+	memset(&as->ns[as->nr_ns], 0, sizeof(*tmp));
+	as->ns[as->nr_ns++].ns = n;
+	return 0;
+}
+
+/*
+ * The multipath heads of the subsystem, and the namespaces of controllers
+ * that are not behind one.
+ */
+static int ana_subsys_collect_ns(struct ana_subsys *as)
+{
+	struct nvme_subsystem *s = as->s;
+	int i, j, ret = 0;
+
+	for (i = 0; i < s->nr_namespaces && !ret; i++)
+		ret = ana_subsys_add_ns(as, &s->namespaces[i]);
+
+	for (i = 0; i < s->nr_ctrls && !ret; i++) {
+		struct nvme_ctrl *c = &s->ctrls[i];
+
+		for (j = 0; j < c->nr_namespaces && !ret; j++)
+			ret = ana_subsys_add_ns(as, &c->namespaces[j]);
+	}
+	return ret;
+}
+
+static void ana_subsys_free(struct ana_subsys *as)
+{
+	int i;
+
+	for (i = 0; i < as->nr_ns; i++)
+		free(as->ns[i].paths);
+	for (i = 0; i < as->nr_logs; i++)
+		free(as->logs[i].log);
+	free(as->ns);
+	free(as->logs);
+}
+
+/*
+ * Reads the iopolicy and the ANA logs of subsystem s. Returns 1 if any of
+ * its controllers reports ANA.
+ */
+static int ana_subsys_init(struct ana_subsys *as, struct nvme_subsystem *s)
+{
+	char path[PATH_MAX];
+	bool ana = false;
+	int i;
+
+	memset(as, 0, sizeof(*as));
+	as->s = s;
+	snprintf(path, sizeof(path), "/sys/class/nvme-subsystem/%s/iopolicy",
+		 s->name);
+	if (read_attr(path, as->iopolicy, sizeof(as->iopolicy)) < 0)
+		snprintf(as->iopolicy, sizeof(as->iopolicy), "none");
+
+	as->logs = calloc(s->nr_ctrls, sizeof(*as->logs));
+	if (s->nr_ctrls && !as->logs)
+		return -ENOMEM;
+
+	for (i = 0; i < s->nr_ctrls; i++) {
+		struct ana_log *l = &as->logs[as->nr_logs++];
+
+		l->ctrl = &s->ctrls[i];
+		ana_log_fetch(l);
+		if (l->err != -EOPNOTSUPP)
+			ana = true;
+	}
+	return ana;
+}
+
+static int ana_subsys_check(struct nvme_subsystem *s, struct json_array *array)
+{
+	struct json_object *s_obj = NULL;
+	struct json_array *ns_array = NULL;
+	struct ana_subsys as;
+	int i, anatt = 0, ret;
+	bool changing = false;
+
+	ret = ana_subsys_init(&as, s);
+	/* nothing to correlate */
+	if (ret <= 0)
+		goto free;
+
+	ret = ana_subsys_collect_ns(&as);
+	if (ret)
+		goto free;
+	for (i = 0; i < as.nr_ns; i++) {
+		ret = ana_ns_scan(&as, &as.ns[i]);
+		if (ret)
+			goto free;
+	}
+
+	/* give transitions the time the controllers allow for them */
+	for (i = 0; i < as.nr_ns; i++) {
+		int j;
+
+		for (j = 0; j < as.ns[i].nr_paths; j++) {
+			struct ana_path *p = &as.ns[i].paths[j];
+
+			if (p->state != NVME_ANA_CHANGE)
+				continue;
+			changing = true;
+			if (p->log->anatt > anatt)
+				anatt = p->log->anatt;
+		}
+	}
+	if (cfg.wait && changing) {
+		sleep(anatt + 1);
+		for (i = 0; i < as.nr_logs; i++)
+			ana_log_fetch(&as.logs[i]);
+		for (i = 0; i < as.nr_ns; i++) {
+			int j;
+
+			for (j = 0; j < as.ns[i].nr_paths; j++) {
+				struct ana_path *p = &as.ns[i].paths[j];
+
+				p->grpid = ana_log_lookup(p->log,
+						as.ns[i].ns->nsid, &p->state);
+			}
+		}
+	}
+
+	if (flags == JSON) {
+		s_obj = json_create_object();
+		ns_array = json_create_array();
+		as.problems = json_create_array();
+		json_object_add_value_string(s_obj, "name", s->name);
+		json_object_add_value_string(s_obj, "nqn", s->subsysnqn);
+		json_object_add_value_string(s_obj, "iopolicy", as.iopolicy);
+	} else
+		printf("%s %s iopolicy=%s\n", s->name, s->subsysnqn,
+		       as.iopolicy);
+
+	for (i = 0; i < as.nr_logs; i++) {
+		struct ana_log *l = &as.logs[i];
+
+		if (l->err && l->err != -EOPNOTSUPP)
+			ana_problem(&as, NULL, "failed to read the ANA log of %s: %s",
+				    l->ctrl->name, l->err > 0 ?
+				    "controller error" : strerror(-l->err));
+	}
+
+	for (i = 0; i < as.nr_ns; i++) {
+		ana_ns_mark_in_use(&as.ns[i]);
+		ana_ns_print(&as.ns[i], ns_array);
+		ana_ns_check(&as, &as.ns[i]);
+	}
+
+	if (flags == JSON) {
+		json_object_add_value_array(s_obj, "namespaces", ns_array);
+		json_object_add_value_array(s_obj, "problems", as.problems);
+		json_array_add_value_object(array, s_obj);
+	}
+	ret = as.nr_problems;
+free:
+	ana_subsys_free(&as);
+	return ret;
+}
+
+int ana_check(const char *desc, int argc, char **argv)
+{
+	const char *nqn = "only check the subsystem with this NQN";
+	const char *wait = "wait out the ANA transition time of paths in change state";
+	struct nvme_topology t = { };
+	struct json_object *root = NULL;
+	struct json_array *array = NULL;
+	int i, ret, problems = 0;
+
+	OPT_ARGS(opts) = {
+		OPT_LIST("nqn",          'n', &cfg.nqn,           nqn),
+		OPT_FLAG("wait",         'w', &cfg.wait,          wait),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_END()
+	};
+
+	ret = argconfig_parse(argc, argv, desc, opts);
+	if (ret)
+		return ret;
+
+	ret = flags = validate_output_format(cfg.output_format);
+	if (ret < 0)
+		return ret;
+	if (flags != JSON && flags != NORMAL) {
+		fprintf(stderr, "invalid output format\n");
+		return -EINVAL;
+	}
+
+	ret = scan_subsystems(&t, cfg.nqn, 0);
+	if (ret) {
+		fprintf(stderr, "Failed to scan subsystems\n");
+		return ret;
+	}
+
+	if (flags == JSON) {
+		root = json_create_object();
+		array = json_create_array();
+	}
+
+	for (i = 0; i < t.nr_subsystems; i++) {
+		ret = ana_subsys_check(&t.subsystems[i], array);
+		if (ret < 0)
+			break;
+		problems += ret;
+		ret = 0;
+	}
+
+	if (flags == JSON) {
+		json_object_add_value_array(root, "subsystems", array);
+		json_object_add_value_uint(root, "problems", problems);
+		json_print_object(root, NULL);
+		printf("\n");
+		json_free_object(root);
+	}
+	free_topology(&t);
+
+	if (ret < 0)
+		return ret;
+	/* problems are reported through the exit status as well */
+	return problems ? 1 : 0;
+}
+
+/*
+ * nvme path-bench: times small I/Os sent to a namespace through the
+ * character device of each controller with a path to it. I/O submitted on
+ * /dev/nvmeN goes to that controller only, whatever the multipath driver
+ * would pick for the head, so slow links and target ports stand out.
+ */
+#define BENCH_BUCKETS		32	/* log2 of microseconds */
+
+struct bench_path {
+	struct ana_path *p;
+	int nr_ios;
+	int errors;
+	int first_err;
+	__u64 *lat;		/* in us, sorted once done */
+	__u64 sum;
+	int hist[BENCH_BUCKETS];
+};
+
+static __u64 bench_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int bench_opcode(const char *mode)
+{
+	if (!strcmp(mode, "read"))
+		return nvme_cmd_read;
+	if (!strcmp(mode, "verify"))
+		return nvme_cmd_verify;
+	if (!strcmp(mode, "flush"))
+		return nvme_cmd_flush;
+	return -EINVAL;
+}
+
+/*
+ * Opens the device I/O is sent to through path p. The hidden path devices
+ * nvme<subsys>c<ctrl>n<ns> have no device node, but kernels from 5.13 on
+ * create a generic character device ng<ctrl>n<ns> for each of them. Older
+ * kernels only take I/O commands on the controller device while it has a
+ * single namespace.
+ */
+static int bench_path_open(struct ana_path *p)
+{
+	struct nvme_ctrl *c = p->log->ctrl;
+	char path[NAME_MAX + 8];
+	struct dirent **paths;
+	int id, cntlid, ns, fd, nr;
+
+	if (sscanf(p->name, "nvme%dc%dn%d", &id, &cntlid, &ns) != 3) {
+		/* not behind a multipath head, the namespace is the path */
+		snprintf(path, sizeof(path), "/dev/%s", p->name);
+		return open(path, O_RDONLY);
+	}
+
+	snprintf(path, sizeof(path), "/dev/ng%dn%d", cntlid, ns);
+	fd = open(path, O_RDONLY);
+	if (fd >= 0 || errno != ENOENT)
+		return fd;
+
+	/* the namespaces of the controller are behind multipath heads */
+	nr = ana_ctrl_paths(c, &paths);
+	if (nr > 0)
+		ana_free_dirents(paths, nr);
+	if (nr > 1) {
+		fprintf(stderr, "%s: no %s, and I/O commands cannot be sent "
+			"to %s while it has several namespaces\n", p->name,
+			path, c->name);
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	snprintf(path, sizeof(path), "/dev/%s", c->name);
+	return open(path, O_RDONLY);
+}
+
+static void bench_path_run(struct bench_path *b, struct nvme_namespace *n,
+			   int opcode, void *buf, __u32 nlb)
+{
+	unsigned int seed = cfg.count;
+	__u64 lba, start, us;
+	int fd, i, err, bucket;
+
+	fd = bench_path_open(b->p);
+	if (fd < 0) {
+		b->first_err = -errno;
+		b->errors = cfg.count;
+		return;
+	}
+
+	for (i = 0; i < cfg.count; i++) {
+		struct nvme_passthru_cmd cmd = {
+			.opcode		= opcode,
+			.nsid		= n->nsid,
+		};
+
+		/* the same offsets on every path */
+		lba = ((__u64)rand_r(&seed) << 31 | rand_r(&seed)) %
+		      (n->nsze > nlb ? n->nsze - nlb : 1);
+		if (opcode != nvme_cmd_flush) {
+			cmd.cdw10 = lba & 0xffffffff;
+			cmd.cdw11 = lba >> 32;
+			cmd.cdw12 = nlb - 1;
+		}
+		if (opcode == nvme_cmd_read) {
+			cmd.addr = (__u64)(uintptr_t)buf;
+			cmd.data_len = nlb << n->lba_shift;
+		}
+
+		start = bench_now_us();
+		err = nvme_submit_io_passthru(fd, &cmd);
+		us = bench_now_us() - start;
+		if (err) {
+			if (!b->errors++)
+				b->first_err = err < 0 ? -errno : err;
+		} else {
+			b->lat[b->nr_ios++] = us;
+			b->sum += us;
+			for (bucket = 0; bucket < BENCH_BUCKETS - 1 &&
+			     us >= (2ULL << bucket); bucket++)
+				;
+			b->hist[bucket]++;
+		}
+		if (cfg.interval)
+			usleep(cfg.interval);
+	}
+	close(fd);
+}
+
+static int bench_lat_cmp(const void *a, const void *b)
+{
+	__u64 la = *(const __u64 *)a, lb = *(const __u64 *)b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+static __u64 bench_percentile(struct bench_path *b, int pct)
+{
+	int i = (b->nr_ios * pct + 99) / 100;
+
+	return b->lat[i ? i - 1 : 0];
+}
+
+static void bench_path_print(struct bench_path *b, struct json_array *array)
+{
+	struct ana_path *p = b->p;
+	struct nvme_ctrl *c = p->log->ctrl;
+	const char *ana_state = p->sysfs_state[0] ? p->sysfs_state :
+				ana_state_str(ana_path_state(p));
+	char err[256] = "";
+	int i, max;
+
+	qsort(b->lat, b->nr_ios, sizeof(*b->lat), bench_lat_cmp);
+	if (b->errors)
+		snprintf(err, sizeof(err), "%s", b->first_err < 0 ?
+			 strerror(-b->first_err) :
+			 nvme_status_to_string(b->first_err));
+
+	if (flags == JSON) {
+		struct json_object *o = json_create_object();
+		struct json_array *hist = json_create_array();
+
+		json_object_add_value_string(o, "path", p->name);
+		json_object_add_value_string(o, "controller", c->name);
+		json_object_add_value_string(o, "transport", c->transport ?: "");
+		json_object_add_value_string(o, "address", c->address ?: "");
+		json_object_add_value_string(o, "ana_state", ana_state);
+		json_object_add_value_int(o, "ios", b->nr_ios);
+		json_object_add_value_int(o, "errors", b->errors);
+		if (b->errors)
+			json_object_add_value_string(o, "error", err);
+		if (b->nr_ios) {
+			json_object_add_value_uint(o, "min_us", b->lat[0]);
+			json_object_add_value_uint(o, "avg_us",
+						   b->sum / b->nr_ios);
+			json_object_add_value_uint(o, "p50_us",
+						   bench_percentile(b, 50));
+			json_object_add_value_uint(o, "p99_us",
+						   bench_percentile(b, 99));
+			json_object_add_value_uint(o, "max_us",
+						   b->lat[b->nr_ios - 1]);
+		}
+		for (i = 0; i < BENCH_BUCKETS; i++) {
+			struct json_object *h;
+
+			if (!b->hist[i])
+				continue;
+			h = json_create_object();
+			json_object_add_value_uint(h, "below_us", 2ULL << i);
+			json_object_add_value_int(h, "ios", b->hist[i]);
+			json_array_add_value_object(hist, h);
+		}
+		json_object_add_value_array(o, "histogram", hist);
+		json_array_add_value_object(array, o);
+		return;
+	}
+
+	printf("%s %s %s %s %s\n", p->name, c->name, c->transport ?: "-",
+	       c->address ?: "-", ana_state);
+	if (b->nr_ios)
+		printf("  min %"PRIu64"us avg %"PRIu64"us p50 %"PRIu64"us "
+		       "p99 %"PRIu64"us max %"PRIu64"us\n", (uint64_t)b->lat[0],
+		       (uint64_t)(b->sum / b->nr_ios),
+		       (uint64_t)bench_percentile(b, 50),
+		       (uint64_t)bench_percentile(b, 99),
+		       (uint64_t)b->lat[b->nr_ios - 1]);
+	if (b->errors)
+		printf("  %d of %d failed: %s\n", b->errors, cfg.count, err);
+
+	for (max = 0, i = 0; i < BENCH_BUCKETS; i++)
+		if (b->hist[i] > max)
+			max = b->hist[i];
+	for (i = 0; i < BENCH_BUCKETS; i++) {
+		if (!b->hist[i])
+			continue;
+		printf("  %8llu - %8lluus %7d %.*s\n", i ? 1ULL << i : 0,
+		       (2ULL << i) - 1, b->hist[i],
+		       (b->hist[i] * 40 + max - 1) / max,
+		       "########################################");
+	}
+}
+
+int path_bench(const char *desc, int argc, char **argv)
+{
+	const char *count = "I/Os to send through each path (default 1000)";
+	const char *size = "bytes per I/O, rounded up to blocks (default one block)";
+	const char *mode = "I/O to send: read, verify or flush (default read)";
+	const char *interval = "microseconds to wait between I/Os (default 0)";
+	struct nvme_topology t = { };
+	struct nvme_namespace *n = NULL;
+	struct json_object *root = NULL;
+	struct json_array *array = NULL;
+	struct bench_path *bench = NULL;
+	struct ana_subsys as = { };
+	struct ana_ns *an = NULL;
+	int i, fd, opcode, ret;
+	void *buf = NULL;
+	__u32 nlb;
+
+	OPT_ARGS(opts) = {
+		OPT_UINT("count",        'c', &cfg.count,         count),
+		OPT_UINT("size",         's', &cfg.size,          size),
+		OPT_FMT("mode",          'm', &cfg.mode,          mode),
+		OPT_UINT("interval",     'i', &cfg.interval,      interval),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_END()
+	};
+
+	ret = fd = parse_and_open(argc, argv, desc, opts);
+	if (fd < 0)
+		return ret;
+	close(fd);
+
+	ret = flags = validate_output_format(cfg.output_format);
+	if (ret < 0)
+		return ret;
+	opcode = bench_opcode(cfg.mode);
+	if ((flags != JSON && flags != NORMAL) || opcode < 0 || !cfg.count) {
+		fprintf(stderr, "invalid argument\n");
+		return -EINVAL;
+	}
+
+	ret = scan_subsystems(&t, NULL, 0);
+	if (ret) {
+		fprintf(stderr, "Failed to scan subsystems\n");
+		return ret;
+	}
+
+	for (i = 0; i < t.nr_subsystems && !n; i++) {
+		struct nvme_subsystem *s = &t.subsystems[i];
+		int j;
+
+		ana_subsys_free(&as);
+		ret = ana_subsys_init(&as, s);
+		if (ret >= 0)
+			ret = ana_subsys_collect_ns(&as);
+		if (ret < 0)
+			goto free;
+		for (j = 0; j < as.nr_ns; j++) {
+			if (!strcmp(as.ns[j].ns->name, devicename)) {
+				an = &as.ns[j];
+				n = an->ns;
+				break;
+			}
+		}
+	}
+	if (!n) {
+		fprintf(stderr, "%s is not a namespace (or multipath head)\n",
+			devicename);
+		ret = -ENODEV;
+		goto free;
+	}
+	ret = ana_ns_scan(&as, an);
+	if (ret)
+		goto free;
+	if (!an->nr_paths) {
+		fprintf(stderr, "no path to %s found\n", n->name);
+		ret = -ENODEV;
+		goto free;
+	}
+
+	nlb = cfg.size ? (cfg.size + (1 << n->lba_shift) - 1) >> n->lba_shift : 1;
+	if (nlb > 0x10000) {
+		fprintf(stderr, "I/O size too large\n");
+		ret = -EINVAL;
+		goto free;
+	}
+	bench = calloc(an->nr_paths, sizeof(*bench));
+	if (posix_memalign(&buf, getpagesize(), nlb << n->lba_shift) || !bench) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	if (flags == JSON) {
+		root = json_create_object();
+		array = json_create_array();
+		json_object_add_value_string(root, "namespace", n->name);
+		json_object_add_value_uint(root, "nsid", n->nsid);
+		json_object_add_value_string(root, "mode", cfg.mode);
+		json_object_add_value_uint(root, "io_size", nlb << n->lba_shift);
+	} else
+		printf("%s nsid %u: %u %s of %u bytes per path\n", n->name,
+		       n->nsid, cfg.count, cfg.mode, nlb << n->lba_shift);
+
+	/* one path at a time, so they do not slow each other down */
+	for (i = 0; i < an->nr_paths; i++) {
+		struct bench_path *b = &bench[i];
+
+		b->p = &an->paths[i];
+		b->lat = calloc(cfg.count, sizeof(*b->lat));
+		if (!b->lat) {
+			ret = -ENOMEM;
+			break;
+		}
+		if (ana_path_live(b->p))
+			bench_path_run(b, n, opcode, buf, nlb);
+		else {
+			b->errors = cfg.count;
+			b->first_err = -ENOTCONN;
+		}
+		bench_path_print(b, array);
+	}
+
+	if (flags == JSON) {
+		json_object_add_value_array(root, "paths", array);
+		json_print_object(root, NULL);
+		printf("\n");
+		json_free_object(root);
+	}
+free:
+	if (bench)
+		for (i = 0; i < an->nr_paths; i++)
+			free(bench[i].lat);
+	free(bench);
+	free(buf);
+	ana_subsys_free(&as);
+	free_topology(&t);
+	return ret;
+}
@@ -0,0 +1,7 @@
+#ifndef _NVME_ANA_H
+#define _NVME_ANA_H
+
+extern int ana_check(const char *desc, int argc, char **argv);
+extern int path_bench(const char *desc, int argc, char **argv);
+
+#endif
@@ -69,6 +69,18 @@ COMMAND_LIST(
 	ENTRY("connect", "Connect to NVMeoF subsystem", connect_cmd)
 	ENTRY("disconnect", "Disconnect from NVMeoF subsystem", disconnect_cmd)
 	ENTRY("disconnect-all", "Disconnect from all connected NVMeoF subsystems", disconnect_all_cmd)
+	ENTRY("monitor", "Monitor NVMe topology changes", monitor_cmd)
+	ENTRY("ana-check", "Check the ANA paths of multipath subsystems", ana_check_cmd)
+	ENTRY("path-bench", "Compare the I/O latency of the paths to a namespace", path_bench_cmd)
+	ENTRY("top", "Show live I/O statistics of NVMe devices", top_cmd)
+	ENTRY("history", "Record or show the SMART log history of a device", history_cmd)
+	ENTRY("daemon", "Poll the controllers and serve cached data to other commands", daemon_cmd)
+	ENTRY("metrics", "Show the controller health published by nvme daemon --shm", metrics_cmd)
+	ENTRY("export-metrics", "Export the health of all controllers as Prometheus metrics", export_metrics_cmd)
+	ENTRY("latency-stats", "Show command latency percentiles of a drive", latency_stats_cmd)
+	ENTRY("trace", "Trace the latency of the commands of the host", trace_cmd)
+	ENTRY("irq-map", "Show the queue, interrupt and NUMA affinity of controllers", irq_map_cmd)
+	ENTRY("pcie-health", "Show the PCIe link, NUMA node and AER errors of controllers", pcie_health_cmd)
 	ENTRY("gen-hostnqn", "Generate NVMeoF host NQN", gen_hostnqn_cmd)
 	ENTRY("show-hostnqn", "Show NVMeoF host NQN", show_hostnqn_cmd)
 	ENTRY("dir-receive", "Submit a Directive Receive command, return results", dir_receive)
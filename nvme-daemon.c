@@ -0,0 +1,890 @@
+/*
+ * nvme daemon: polls every controller on a schedule and answers queries for
+ * the cached state over a Unix domain socket, so that the admin command
+ * load on the drives stays the same however many tools ask for it.
+ *
+ * Identify Controller is read once per controller, the SMART / Health,
+ * Error Information and ANA logs at their own intervals. A query is a
+ * single line, "<request> <controller> <print flags> <argument>", and the
+ * answer a line with the status and the age of the data in milliseconds,
+ * followed by the output of the same printer the command would have used,
+ * so that --via-daemon is transparent to whoever reads it.
+ *
+ * With --shm, each controller's health is also published to a shared
+ * memory page after every poll, for readers that cannot afford a system
+ * call; see nvme-metrics-shm.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <grp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/un.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-print.h"
+#include "nvme-daemon.h"
+#include "nvme-metrics-shm.h"
+
+#define DAEMON_REQ_MAX		256
+#define DAEMON_MAX_ERRORS	256
+#define DAEMON_MAX_CLIENTS	64
+#define DAEMON_CLIENT_TIMEOUT	1	/* seconds */
+
+struct dctrl {
+	char name[32];
+	int fd;
+	bool seen;
+	int slot;			/* in the metrics page */
+	struct nvme_metrics_lat admin_lat;
+
+	bool have_id;
+	struct nvme_id_ctrl id;
+
+	__u64 smart_at;
+	int smart_err;
+	struct nvme_smart_log smart;
+
+	__u64 errors_at;
+	int errors_err;
+	int nr_errors;
+	struct nvme_error_log_page *errors;
+
+	__u64 ana_at;
+	int ana_err;
+	size_t ana_len;
+	void *ana;
+};
+
+/* A query: the request line is read, then the answer written */
+struct dclient {
+	int fd;
+	__u64 deadline;
+	char in[DAEMON_REQ_MAX];
+	size_t in_len;
+	char *out;
+	size_t out_len;
+	size_t out_off;
+};
+
+struct nvme_daemon {
+	int sock;
+	int nr_clients;
+	struct dclient clients[DAEMON_MAX_CLIENTS];
+	int nr_ctrls;
+	struct dctrl *ctrls;
+	__u64 scanned_at;
+	struct nvme_metrics *metrics;
+};
+
+static struct config {
+	char *socket;
+	char *shm;
+	char *group;
+	__u32 smart_interval;
+	__u32 error_interval;
+	__u32 ana_interval;
+	__u32 scan_interval;
+} cfg = {
+	.socket = NVME_DAEMON_SOCK,
+	.smart_interval = 60,
+	.error_interval = 300,
+	.ana_interval = 30,
+	.scan_interval = 10,
+};
+
+static volatile sig_atomic_t daemon_stop;
+
+static void daemon_signal(int sig)
+{
+	daemon_stop = 1;
+}
+
+static __u64 daemon_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static __u64 daemon_usecs(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static const char *daemon_sock_path(void)
+{
+	const char *path = getenv("NVME_DAEMON_SOCK");
+
+	return path && *path ? path : NVME_DAEMON_SOCK;
+}
+
+static void daemon_id_str(char *buf, size_t len, const char *src,
+			  size_t src_len)
+{
+	size_t i;
+
+	while (src_len && (src[src_len - 1] == ' ' || !src[src_len - 1]))
+		src_len--;
+	for (i = 0; i < src_len && i < len - 1; i++)
+		buf[i] = src[i];
+	buf[i] = '\0';
+}
+
+static void dctrl_free(struct dctrl *c)
+{
+	if (c->fd >= 0)
+		close(c->fd);
+	free(c->errors);
+	free(c->ana);
+}
+
+/* The lowest metrics slot no controller has, or -1 */
+static int daemon_slot(struct nvme_daemon *d)
+{
+	int slot, i;
+
+	if (!d->metrics)
+		return -1;
+	for (slot = 0; slot < nvme_metrics_nr_slots(d->metrics); slot++) {
+		for (i = 0; i < d->nr_ctrls && d->ctrls[i].slot != slot; i++)
+			;
+		if (i == d->nr_ctrls)
+			return slot;
+	}
+	return -1;
+}
+
+static void daemon_publish(struct nvme_daemon *d, struct dctrl *c, __u64 now)
+{
+	struct nvme_metrics_ctrl m = { .flags = NVME_METRICS_VALID };
+	__u64 wall = daemon_usecs(CLOCK_REALTIME);
+
+	if (c->slot < 0)
+		return;
+
+	strcpy(m.name, c->name);
+	if (c->have_id) {
+		m.flags |= NVME_METRICS_ID;
+		daemon_id_str(m.sn, sizeof(m.sn), c->id.sn, sizeof(c->id.sn));
+		daemon_id_str(m.mn, sizeof(m.mn), c->id.mn, sizeof(c->id.mn));
+		daemon_id_str(m.fr, sizeof(m.fr), c->id.fr, sizeof(c->id.fr));
+	}
+	m.updated = wall;
+	m.smart_err = c->smart_err;
+	if (!c->smart_err) {
+		m.flags |= NVME_METRICS_SMART;
+		m.smart_at = wall - (now - c->smart_at) * 1000;
+		m.temperature = c->smart.temperature[1] << 8 |
+				c->smart.temperature[0];
+		m.critical_warning = c->smart.critical_warning;
+		memcpy(m.smart, &c->smart, sizeof(m.smart));
+	}
+	m.admin_lat = c->admin_lat;
+	nvme_metrics_publish(d->metrics, c->slot, &m);
+}
+
+static struct dctrl *daemon_find(struct nvme_daemon *d, const char *name)
+{
+	int i;
+
+	for (i = 0; i < d->nr_ctrls; i++)
+		if (!strcmp(d->ctrls[i].name, name))
+			return &d->ctrls[i];
+	return NULL;
+}
+
+/*
+ * Controllers come and go, a new instance is polled from scratch. Only
+ * sysfs is read here, no command is sent to the drives.
+ */
+static void daemon_scan(struct nvme_daemon *d)
+{
+	struct nvme_metrics_ctrl empty = { };
+	struct dirent **ents;
+	struct dctrl *c, *ctrls;
+	int i, n, slot;
+
+	n = scandir(SYS_NVME, &ents, scan_ctrls_filter, alphasort);
+	if (n < 0)
+		return;
+
+	for (i = 0; i < d->nr_ctrls; i++)
+		d->ctrls[i].seen = false;
+	for (i = 0; i < n; i++) {
+		c = daemon_find(d, ents[i]->d_name);
+		if (c) {
+			c->seen = true;
+			continue;
+		}
+		if (strlen(ents[i]->d_name) >= sizeof(c->name))
+			continue;
+		slot = daemon_slot(d);
+		ctrls = realloc(d->ctrls, (d->nr_ctrls + 1) * sizeof(*ctrls));
+		if (!ctrls)
+			break;
+		d->ctrls = ctrls;
+		c = &d->ctrls[d->nr_ctrls++];
+		memset(c, 0, sizeof(*c));
+		strcpy(c->name, ents[i]->d_name);
+		c->fd = -1;
+		c->slot = slot;
+		c->seen = true;
+		c->smart_err = c->errors_err = c->ana_err = -EAGAIN;
+	}
+	for (i = 0; i < n; i++)
+		free(ents[i]);
+	free(ents);
+
+	for (i = 0; i < d->nr_ctrls; ) {
+		if (d->ctrls[i].seen) {
+			i++;
+			continue;
+		}
+		if (d->ctrls[i].slot >= 0)
+			nvme_metrics_publish(d->metrics, d->ctrls[i].slot,
+					     &empty);
+		dctrl_free(&d->ctrls[i]);
+		d->ctrls[i] = d->ctrls[--d->nr_ctrls];
+	}
+}
+
+static int dctrl_open(struct dctrl *c)
+{
+	char path[64];
+
+	if (c->fd >= 0)
+		return 0;
+	snprintf(path, sizeof(path), "/dev/%s", c->name);
+	c->fd = open(path, O_RDONLY | O_CLOEXEC);
+	return c->fd < 0 ? -errno : 0;
+}
+
+/* Accounts the latency of a command that made it to the controller */
+static void dctrl_lat(struct dctrl *c, __u64 start, int err)
+{
+	if (err >= 0)
+		nvme_metrics_lat_add(&c->admin_lat,
+				     daemon_usecs(CLOCK_MONOTONIC) - start);
+}
+
+static bool dctrl_due(__u64 at, __u32 interval, __u64 now)
+{
+	return !at || now - at >= interval * 1000ULL;
+}
+
+static void dctrl_poll_errors(struct dctrl *c)
+{
+	struct nvme_error_log_page *log;
+	int entries = c->id.elpe + 1;
+	__u64 start;
+
+	if (entries > DAEMON_MAX_ERRORS)
+		entries = DAEMON_MAX_ERRORS;
+	if (!c->errors) {
+		c->errors = calloc(entries, sizeof(*c->errors));
+		if (!c->errors) {
+			c->errors_err = -ENOMEM;
+			return;
+		}
+	}
+	log = c->errors;
+	start = daemon_usecs(CLOCK_MONOTONIC);
+	c->errors_err = nvme_error_log(c->fd, entries, log);
+	dctrl_lat(c, start, c->errors_err);
+	c->nr_errors = entries;
+}
+
+static void dctrl_poll_ana(struct dctrl *c)
+{
+	__u64 start;
+	size_t len;
+
+	if (!(c->id.cmic & (1 << 3))) {
+		c->ana_err = -EOPNOTSUPP;
+		return;
+	}
+	if (!c->ana) {
+		len = sizeof(struct nvme_ana_rsp_hdr) +
+			le32_to_cpu(c->id.nanagrpid) *
+			sizeof(struct nvme_ana_group_desc);
+		if (!(c->id.anacap & (1 << 6)))
+			len += le32_to_cpu(c->id.mnan) * sizeof(__le32);
+		c->ana = malloc(len);
+		if (!c->ana) {
+			c->ana_err = -ENOMEM;
+			return;
+		}
+		c->ana_len = len;
+	}
+	start = daemon_usecs(CLOCK_MONOTONIC);
+	c->ana_err = nvme_ana_log(c->fd, c->ana, c->ana_len, 0);
+	dctrl_lat(c, start, c->ana_err);
+}
+
+/* Polls what is due, returns when the next poll of this controller is */
+static __u64 dctrl_poll(struct dctrl *c, __u64 now)
+{
+	__u64 next, start;
+	int err;
+
+	err = dctrl_open(c);
+	if (err) {
+		c->smart_err = c->errors_err = c->ana_err = err;
+		return now + cfg.scan_interval * 1000ULL;
+	}
+
+	if (!c->have_id) {
+		start = daemon_usecs(CLOCK_MONOTONIC);
+		err = nvme_identify_ctrl(c->fd, &c->id);
+		dctrl_lat(c, start, err);
+		if (err) {
+			c->smart_err = c->errors_err = c->ana_err = err;
+			return now + cfg.scan_interval * 1000ULL;
+		}
+		c->have_id = true;
+	}
+
+	if (dctrl_due(c->smart_at, cfg.smart_interval, now)) {
+		start = daemon_usecs(CLOCK_MONOTONIC);
+		c->smart_err = nvme_smart_log(c->fd, NVME_NSID_ALL, &c->smart);
+		dctrl_lat(c, start, c->smart_err);
+		c->smart_at = now;
+	}
+	if (dctrl_due(c->errors_at, cfg.error_interval, now)) {
+		dctrl_poll_errors(c);
+		c->errors_at = now;
+	}
+	if (dctrl_due(c->ana_at, cfg.ana_interval, now)) {
+		dctrl_poll_ana(c);
+		c->ana_at = now;
+	}
+
+	next = c->smart_at + cfg.smart_interval * 1000ULL;
+	if (c->errors_at + cfg.error_interval * 1000ULL < next)
+		next = c->errors_at + cfg.error_interval * 1000ULL;
+	if (c->ana_err != -EOPNOTSUPP &&
+	    c->ana_at + cfg.ana_interval * 1000ULL < next)
+		next = c->ana_at + cfg.ana_interval * 1000ULL;
+	return next;
+}
+
+static __u64 daemon_poll(struct nvme_daemon *d)
+{
+	__u64 now = daemon_now(), next, due;
+	int i;
+
+	if (dctrl_due(d->scanned_at, cfg.scan_interval, now)) {
+		daemon_scan(d);
+		d->scanned_at = now;
+	}
+	next = d->scanned_at + cfg.scan_interval * 1000ULL;
+	for (i = 0; i < d->nr_ctrls; i++) {
+		due = dctrl_poll(&d->ctrls[i], now);
+		if (due < next)
+			next = due;
+		daemon_publish(d, &d->ctrls[i], now);
+	}
+	return next;
+}
+
+static void daemon_state(struct nvme_daemon *d, __u64 now)
+{
+	struct json_object *root = json_create_object();
+	struct json_array *ctrls = json_create_array();
+	char buf[64];
+	int i;
+
+	for (i = 0; i < d->nr_ctrls; i++) {
+		struct dctrl *c = &d->ctrls[i];
+		struct json_object *o = json_create_object();
+
+		json_object_add_value_string(o, "name", c->name);
+		if (c->have_id) {
+			daemon_id_str(buf, sizeof(buf), c->id.sn,
+				      sizeof(c->id.sn));
+			json_object_add_value_string(o, "serial", buf);
+			daemon_id_str(buf, sizeof(buf), c->id.mn,
+				      sizeof(c->id.mn));
+			json_object_add_value_string(o, "model", buf);
+		}
+		if (!c->smart_err) {
+			json_object_add_value_int(o, "temperature",
+				((c->smart.temperature[1] << 8) |
+				 c->smart.temperature[0]) - 273);
+			json_object_add_value_uint(o, "critical_warning",
+				c->smart.critical_warning);
+			json_object_add_value_uint(o, "percent_used",
+				c->smart.percent_used);
+			json_object_add_value_string(o, "media_errors",
+				nvme_u128_to_string(nvme_u128_from_le(
+					c->smart.media_errors), buf,
+					sizeof(buf)));
+			json_object_add_value_uint(o, "smart_age_ms",
+						   now - c->smart_at);
+		} else
+			json_object_add_value_int(o, "smart_error",
+						  c->smart_err);
+		json_array_add_value_object(ctrls, o);
+	}
+	json_object_add_value_array(root, "controllers", ctrls);
+	json_print_object(root, NULL);
+	printf("\n");
+	json_free_object(root);
+}
+
+/*
+ * Renders the answer to the request in line into a buffer. The printers
+ * write to stdout, so it is pointed at a temporary file around them; the
+ * daemon is single threaded and flushes around the switch, so nothing
+ * else can end up there. Returns the length of *out, or a negative errno.
+ */
+static ssize_t daemon_answer(struct nvme_daemon *d, char *line, char **out)
+{
+	char req[32], name[32];
+	struct dctrl *c = NULL;
+	int flags = 0, saved, err;
+	__u64 now = daemon_now(), at = now;
+	unsigned int arg = 0;
+	ssize_t len;
+	FILE *f;
+
+	if (sscanf(line, "%31s %31s %d %u", req, name, &flags, &arg) < 2)
+		err = -EINVAL;
+	else if (strcmp(req, "state")) {
+		c = daemon_find(d, name);
+		err = c ? 0 : -ENODEV;
+	} else
+		err = 0;
+
+	if (!c || err)
+		;
+	else if (!strcmp(req, "id-ctrl")) {
+		err = c->have_id ? 0 : c->smart_err;
+		at = 0;
+	} else if (!strcmp(req, "smart-log")) {
+		err = c->smart_err;
+		at = c->smart_at;
+	} else if (!strcmp(req, "error-log")) {
+		err = c->errors_err;
+		at = c->errors_at;
+	} else if (!strcmp(req, "ana-log")) {
+		err = c->ana_err;
+		at = c->ana_at;
+	} else
+		err = -EINVAL;
+
+	f = tmpfile();
+	if (!f)
+		return -errno;
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	if (saved < 0 || dup2(fileno(f), STDOUT_FILENO) < 0) {
+		len = -errno;
+		goto restore;
+	}
+
+	printf("%d %llu\n", err, err || !at ? 0ULL : now - at);
+	if (err)
+		;
+	else if (!c)
+		daemon_state(d, now);
+	else if (!strcmp(req, "id-ctrl"))
+		nvme_show_id_ctrl(&c->id, flags);
+	else if (!strcmp(req, "smart-log"))
+		nvme_show_smart_log(&c->smart, NVME_NSID_ALL, name, flags);
+	else if (!strcmp(req, "error-log"))
+		nvme_show_error_log(c->errors, arg && arg < c->nr_errors ?
+				    arg : c->nr_errors, name, flags);
+	else if (!strcmp(req, "ana-log"))
+		nvme_show_ana_log(c->ana, name, flags, c->ana_len);
+	fflush(stdout);
+
+	len = lseek(fileno(f), 0, SEEK_END);
+	*out = len > 0 ? malloc(len) : NULL;
+	if (len < 0)
+		len = -errno;
+	else if (!*out)
+		len = -ENOMEM;
+	else if (pread(fileno(f), *out, len, 0) != len) {
+		free(*out);
+		*out = NULL;
+		len = -EIO;
+	}
+restore:
+	if (saved >= 0) {
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+	}
+	fclose(f);
+	return len;
+}
+
+static void dclient_close(struct nvme_daemon *d, int i)
+{
+	struct dclient *cl = &d->clients[i];
+
+	close(cl->fd);
+	free(cl->out);
+	d->clients[i] = d->clients[--d->nr_clients];
+}
+
+static void daemon_accept(struct nvme_daemon *d, __u64 now)
+{
+	struct dclient *cl;
+	int fd;
+
+	fd = accept4(d->sock, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd < 0)
+		return;
+	if (d->nr_clients == DAEMON_MAX_CLIENTS) {
+		close(fd);
+		return;
+	}
+	cl = &d->clients[d->nr_clients++];
+	memset(cl, 0, sizeof(*cl));
+	cl->fd = fd;
+	cl->deadline = now + DAEMON_CLIENT_TIMEOUT * 1000ULL;
+}
+
+/*
+ * Reads the request line, then writes the answer, as far as the socket
+ * lets us without blocking. Returns false once the client is done with.
+ */
+static bool dclient_io(struct nvme_daemon *d, struct dclient *cl)
+{
+	ssize_t ret;
+
+	if (!cl->out) {
+		ret = read(cl->fd, cl->in + cl->in_len,
+			   sizeof(cl->in) - 1 - cl->in_len);
+		if (ret < 0)
+			return errno == EAGAIN || errno == EINTR;
+		if (!ret)
+			return false;
+		cl->in_len += ret;
+		cl->in[cl->in_len] = '\0';
+		if (!memchr(cl->in, '\n', cl->in_len))
+			return cl->in_len < sizeof(cl->in) - 1;
+
+		ret = daemon_answer(d, cl->in, &cl->out);
+		if (ret <= 0)
+			return false;
+		cl->out_len = ret;
+	}
+
+	while (cl->out_off < cl->out_len) {
+		ret = write(cl->fd, cl->out + cl->out_off,
+			    cl->out_len - cl->out_off);
+		if (ret < 0)
+			return errno == EAGAIN || errno == EINTR;
+		cl->out_off += ret;
+	}
+	return false;
+}
+
+/*
+ * Waits until the next poll is due at most, serving the clients that are
+ * ready meanwhile. A client that stalls is dropped after
+ * DAEMON_CLIENT_TIMEOUT, and never holds up the others.
+ */
+static void daemon_wait(struct nvme_daemon *d, __u64 next)
+{
+	struct pollfd pfd[DAEMON_MAX_CLIENTS + 1];
+	__u64 now = daemon_now(), until = next;
+	int i, n;
+
+	for (i = 0; i < d->nr_clients; ) {
+		if (d->clients[i].deadline <= now) {
+			dclient_close(d, i);
+			continue;
+		}
+		if (d->clients[i].deadline < until)
+			until = d->clients[i].deadline;
+		i++;
+	}
+
+	pfd[0].fd = d->sock;
+	pfd[0].events = POLLIN;
+	for (i = 0; i < d->nr_clients; i++) {
+		pfd[i + 1].fd = d->clients[i].fd;
+		pfd[i + 1].events = d->clients[i].out ? POLLOUT : POLLIN;
+	}
+	n = d->nr_clients;
+	if (poll(pfd, n + 1, until > now ? until - now : 0) <= 0)
+		return;
+
+	/* backwards, so that closing a client does not move one not seen */
+	for (i = n - 1; i >= 0; i--)
+		if (pfd[i + 1].revents && !dclient_io(d, &d->clients[i]))
+			dclient_close(d, i);
+	if (pfd[0].revents & POLLIN)
+		daemon_accept(d, daemon_now());
+}
+
+/*
+ * The answers include the identity and error logs of the drives, so only
+ * root may query by default, and the members of group if one is given.
+ */
+static int daemon_listen(const char *path, struct group *gr)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	mode_t umask_saved;
+	int sock, ret;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr.sun_path, path);
+
+	if (!strcmp(path, NVME_DAEMON_SOCK) && mkdir("/run/nvme", 0755) &&
+	    errno != EEXIST)
+		return -errno;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -errno;
+	unlink(path);
+	/* no window in which others could connect */
+	umask_saved = umask(0177);
+	ret = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	umask(umask_saved);
+	if (ret || (gr && chown(path, -1, gr->gr_gid)) ||
+	    chmod(path, gr ? 0660 : 0600) || listen(sock, 64)) {
+		int err = -errno;
+
+		close(sock);
+		return err;
+	}
+	return sock;
+}
+
+int run_daemon(const char *desc, int argc, char **argv)
+{
+	const char *socket = "socket to listen on (default " NVME_DAEMON_SOCK ")";
+	const char *smart_interval = "seconds between SMART log reads (default 60)";
+	const char *error_interval = "seconds between error log reads (default 300)";
+	const char *ana_interval = "seconds between ANA log reads (default 30)";
+	const char *scan_interval = "seconds between looks for new controllers (default 10)";
+	const char *shm = "also publish the controllers' health in this shared memory segment";
+	const char *group = "let this group query the daemon (default root only)";
+	struct sigaction sa = { .sa_handler = daemon_signal };
+	struct nvme_daemon d = { };
+	struct group *gr = NULL;
+	__u64 next;
+	int ret, i;
+
+	OPT_ARGS(opts) = {
+		OPT_FILE("socket",         's', &cfg.socket,         socket),
+		OPT_UINT("smart-interval", 'S', &cfg.smart_interval, smart_interval),
+		OPT_UINT("error-interval", 'E', &cfg.error_interval, error_interval),
+		OPT_UINT("ana-interval",   'A', &cfg.ana_interval,   ana_interval),
+		OPT_UINT("scan-interval",  'r', &cfg.scan_interval,  scan_interval),
+		OPT_STRING("shm",          'm', "NAME", &cfg.shm,    shm),
+		OPT_STRING("group",        'g', "GROUP", &cfg.group, group),
+		OPT_END()
+	};
+
+	ret = argconfig_parse(argc, argv, desc, opts);
+	if (ret)
+		return ret;
+	if (!cfg.smart_interval || !cfg.error_interval || !cfg.ana_interval ||
+	    !cfg.scan_interval) {
+		fprintf(stderr, "intervals must not be 0\n");
+		return -EINVAL;
+	}
+
+	if (cfg.group) {
+		gr = getgrnam(cfg.group);
+		if (!gr) {
+			fprintf(stderr, "Unknown group %s\n", cfg.group);
+			return -EINVAL;
+		}
+	}
+
+	d.sock = daemon_listen(cfg.socket, gr);
+	if (d.sock < 0) {
+		fprintf(stderr, "Failed to listen on %s: %s\n", cfg.socket,
+			strerror(-d.sock));
+		return d.sock;
+	}
+	if (cfg.shm) {
+		d.metrics = nvme_metrics_create(cfg.shm);
+		if (!d.metrics) {
+			ret = -errno;
+			fprintf(stderr, "Failed to create %s: %s\n", cfg.shm,
+				strerror(errno));
+			close(d.sock);
+			unlink(cfg.socket);
+			return ret;
+		}
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	next = daemon_poll(&d);
+	while (!daemon_stop) {
+		daemon_wait(&d, next);
+		if (daemon_now() >= next)
+			next = daemon_poll(&d);
+	}
+
+	while (d.nr_clients)
+		dclient_close(&d, 0);
+	close(d.sock);
+	unlink(cfg.socket);
+	if (d.metrics)
+		nvme_metrics_destroy(d.metrics);
+	for (i = 0; i < d.nr_ctrls; i++)
+		dctrl_free(&d.ctrls[i]);
+	free(d.ctrls);
+	return 0;
+}
+
+static bool daemon_ctrl_live(const char *subsys, const char *ctrl)
+{
+	char path[PATH_MAX], state[16];
+	ssize_t len;
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s/%s/state", subsys, ctrl) >=
+	    sizeof(path))
+		return false;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	len = read(fd, state, sizeof(state) - 1);
+	close(fd);
+	return len >= 4 && !strncmp(state, "live", 4);
+}
+
+/*
+ * The daemon keys its data by controller. A namespace is served by its
+ * controller, a multipath namespace by the first live controller of its
+ * subsystem.
+ */
+static int daemon_ctrl_name(int fd, char *name, size_t len)
+{
+	char path[PATH_MAX], target[PATH_MAX];
+	struct dirent **ents;
+	struct stat st;
+	char *base;
+	int i, n, ret = -ENODEV;
+
+	if (fstat(fd, &st))
+		return -errno;
+	if (S_ISCHR(st.st_mode))
+		snprintf(path, sizeof(path), "/sys/dev/char/%u:%u",
+			 major(st.st_rdev), minor(st.st_rdev));
+	else if (S_ISBLK(st.st_mode))
+		snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/device",
+			 major(st.st_rdev), minor(st.st_rdev));
+	else
+		return -ENODEV;
+
+	if (!realpath(path, target))
+		return -errno;
+	base = strrchr(target, '/');
+	base = base ? base + 1 : target;
+	if (strncmp(base, "nvme-subsys", 11))
+		return snprintf(name, len, "%s", base) < len ? 0 : -ENODEV;
+
+	n = scandir(target, &ents, scan_ctrls_filter, alphasort);
+	if (n < 0)
+		return -errno;
+	for (i = 0; i < n; i++) {
+		if (ret && daemon_ctrl_live(target, ents[i]->d_name) &&
+		    snprintf(name, len, "%s", ents[i]->d_name) < len)
+			ret = 0;
+		free(ents[i]);
+	}
+	free(ents);
+	return ret;
+}
+
+/*
+ * Asks the daemon for the output of request on the device open at fd and
+ * copies it to stdout. Returns -ECONNREFUSED if no daemon is running or it
+ * has nothing for the device yet, for the caller to send the command
+ * itself, otherwise the status of the data the daemon has, which has been
+ * reported like the command would have.
+ */
+int nvme_daemon_query(const char *request, int fd,
+		      enum nvme_print_flags flags, __u32 arg)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	const char *path = daemon_sock_path();
+	char name[64], buf[4096], *nl;
+	ssize_t len = 0, ret;
+	int sock, err;
+
+	err = daemon_ctrl_name(fd, name, sizeof(name));
+	if (err)
+		return -ECONNREFUSED;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ECONNREFUSED;
+	strcpy(addr.sun_path, path);
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -ECONNREFUSED;
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(sock);
+		return -ECONNREFUSED;
+	}
+
+	dprintf(sock, "%s %s %d %u\n", request, name, flags, arg);
+
+	/* the status line, then the output as is */
+	while (len < sizeof(buf) - 1) {
+		ret = read(sock, buf + len, sizeof(buf) - 1 - len);
+		if (ret <= 0)
+			break;
+		len += ret;
+		buf[len] = '\0';
+		if (strchr(buf, '\n'))
+			break;
+	}
+	buf[len] = '\0';
+	nl = strchr(buf, '\n');
+	if (!nl || sscanf(buf, "%d", &err) != 1) {
+		fprintf(stderr, "Bad answer from %s\n", path);
+		close(sock);
+		return -EPROTO;
+	}
+
+	/* not known to the daemon or not polled yet, ask the drive */
+	if (err == -ENODEV || err == -EAGAIN) {
+		close(sock);
+		return -ECONNREFUSED;
+	}
+
+	fwrite(nl + 1, 1, len - (nl + 1 - buf), stdout);
+	while ((ret = read(sock, buf, sizeof(buf))) > 0)
+		fwrite(buf, 1, ret, stdout);
+	close(sock);
+
+	if (err > 0)
+		nvme_show_status(err);
+	else if (err < 0)
+		fprintf(stderr, "%s from %s: %s\n", request, path,
+			strerror(-err));
+	return err;
+}
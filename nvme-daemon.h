@@ -0,0 +1,13 @@
+#ifndef _NVME_DAEMON_H
+#define _NVME_DAEMON_H
+
+#include "nvme.h"
+
+#define NVME_DAEMON_SOCK	"/run/nvme/daemon.sock"
+
+int nvme_daemon_query(const char *request, int fd,
+		      enum nvme_print_flags flags, __u32 arg);
+
+extern int run_daemon(const char *desc, int argc, char **argv);
+
+#endif
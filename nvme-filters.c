@@ -4,9 +4,6 @@
 
 #include "nvme.h"
 
-/* global, used for controller specific namespace filter */
-int current_index;
-
 int scan_namespace_filter(const struct dirent *d)
 {
 	int i, n;
@@ -70,19 +67,3 @@ int scan_subsys_filter(const struct dirent *d)
 
 	return 0;
 }
-
-int scan_dev_filter(const struct dirent *d)
-{
-	int ctrl, ns, part;
-
-	if (d->d_name[0] == '.')
-		return 0;
-
-	if (strstr(d->d_name, "nvme")) {
-		if (sscanf(d->d_name, "nvme%dn%dp%d", &ctrl, &ns, &part) == 3)
-			return 0;
-		if (sscanf(d->d_name, "nvme%dn%d", &ctrl, &ns) == 2)
-			return ctrl == current_index;
-	}
-	return 0;
-}
@@ -0,0 +1,874 @@
+/*
+ * nvme history: keeps the SMART / Health history of each drive in a
+ * fixed-size ring of fixed-size records, one file per drive, and queries
+ * it by time.
+ *
+ * The file is a header page followed by the ring. Writers reserve a slot
+ * by atomically incrementing the sequence number in the header, so that
+ * several of them may append without a lock, and publish the record seqlock
+ * style: its sequence number is written both before and after the payload
+ * and a reader only trusts a copy whose two numbers match the one it
+ * expected. Records are in sequence order, and timestamps are kept from
+ * going backwards, so a time can be found with a binary search: first over
+ * a sparse index of every chunk'th record kept in the header, then over the
+ * records of one chunk.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-print.h"
+#include "nvme-history.h"
+
+#define NVME_HISTORY_MAGIC	"NVMEHIST"
+#define NVME_HISTORY_VERSION	1
+#define NVME_HISTORY_HDR_SIZE	4096
+#define NVME_HISTORY_MAX_INDEX	240
+#define NVME_HISTORY_RECORDS	32768	/* ~10MiB, 113 days at 5 minutes */
+
+#define HIST_SEQ_INVALID	(~0ULL)
+
+/* the part of the SMART log that is not reserved */
+#define HIST_SMART_LEN		offsetof(struct nvme_smart_log, rsvd232)
+
+struct hist_index {
+	__u64 seq;
+	__u64 timestamp;
+};
+
+struct hist_hdr {
+	char	magic[8];
+	__u32	version;
+	__u32	record_size;
+	__u64	nr_records;
+	__u64	next_seq;		/* updated atomically */
+	__u32	chunk;			/* records per index entry */
+	__u32	nr_index;
+	__u64	created;
+	char	rsvd48[80];
+	struct hist_index index[NVME_HISTORY_MAX_INDEX];
+};
+
+struct hist_rec {
+	__u64	seq;
+	__u64	timestamp;		/* microseconds since the epoch */
+	__u8	smart[HIST_SMART_LEN];
+	__u16	vendor_len;
+	__u8	rsvd[6];
+	__u8	vendor[NVME_HISTORY_VENDOR_LEN];
+	__u64	seq_end;
+};
+
+struct nvme_history {
+	int fd;
+	size_t len;
+	struct hist_hdr *hdr;
+	struct hist_rec *ring;
+};
+
+static struct config {
+	char *dir;
+	char *file;
+	bool record;
+	__u32 interval;
+	__u32 count;
+	__u32 records;
+	char *since;
+	char *until;
+	__u32 step;
+	char *output_format;
+} cfg = {
+	.dir = NVME_HISTORY_DIR,
+	.records = NVME_HISTORY_RECORDS,
+	.output_format = "normal",
+};
+
+static int hist_init(int fd, __u64 nr_records)
+{
+	struct hist_hdr hdr = { };
+	__u32 chunk = 1;
+
+	while ((__u64)chunk * NVME_HISTORY_MAX_INDEX < nr_records)
+		chunk <<= 1;
+	nr_records = (nr_records + chunk - 1) & ~(__u64)(chunk - 1);
+
+	memcpy(hdr.magic, NVME_HISTORY_MAGIC, sizeof(hdr.magic));
+	hdr.version = NVME_HISTORY_VERSION;
+	hdr.record_size = sizeof(struct hist_rec);
+	hdr.nr_records = nr_records;
+	hdr.chunk = chunk;
+	hdr.nr_index = nr_records / chunk;
+	hdr.created = time(NULL);
+
+	if (ftruncate(fd, NVME_HISTORY_HDR_SIZE +
+		      nr_records * sizeof(struct hist_rec)) ||
+	    pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return -errno;
+	return 0;
+}
+
+/*
+ * A new file is set up under a temporary name and linked into place, so
+ * that nobody ever maps a half initialized one. If another writer created
+ * it first, theirs is used.
+ */
+static int hist_create(const char *path, __u64 nr_records)
+{
+	char tmp[PATH_MAX];
+	int fd, ret;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+
+	ret = hist_init(fd, nr_records);
+	if (!ret && fchmod(fd, 0644))
+		ret = -errno;
+	if (!ret && link(tmp, path) && errno != EEXIST)
+		ret = -errno;
+	unlink(tmp);
+	close(fd);
+	return ret;
+}
+
+struct nvme_history *nvme_history_open(const char *path, bool create,
+				       __u64 nr_records)
+{
+	struct nvme_history *h;
+	struct hist_hdr hdr;
+	struct stat st;
+	int ret;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+
+	h->fd = open(path, (create ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+	if (h->fd < 0 && errno == ENOENT && create) {
+		ret = hist_create(path, nr_records);
+		if (ret) {
+			errno = -ret;
+			goto free;
+		}
+		h->fd = open(path, O_RDWR | O_CLOEXEC);
+	}
+	if (h->fd < 0)
+		goto free;
+
+	errno = EINVAL;
+	if (pread(h->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, NVME_HISTORY_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != NVME_HISTORY_VERSION ||
+	    hdr.record_size != sizeof(struct hist_rec) || !hdr.chunk ||
+	    hdr.nr_index > NVME_HISTORY_MAX_INDEX ||
+	    (__u64)hdr.nr_index * hdr.chunk != hdr.nr_records ||
+	    fstat(h->fd, &st) ||
+	    st.st_size != NVME_HISTORY_HDR_SIZE +
+			  hdr.nr_records * sizeof(struct hist_rec))
+		goto close;
+
+	h->len = st.st_size;
+	h->hdr = mmap(NULL, h->len, PROT_READ | (create ? PROT_WRITE : 0),
+		      MAP_SHARED, h->fd, 0);
+	if (h->hdr == MAP_FAILED)
+		goto close;
+	h->ring = (void *)((char *)h->hdr + NVME_HISTORY_HDR_SIZE);
+	return h;
+close:
+	ret = errno;
+	close(h->fd);
+	errno = ret;
+free:
+	free(h);
+	return NULL;
+}
+
+void nvme_history_close(struct nvme_history *h)
+{
+	munmap(h->hdr, h->len);
+	close(h->fd);
+	free(h);
+}
+
+static __u64 hist_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static struct hist_rec *hist_slot(struct nvme_history *h, __u64 seq)
+{
+	return &h->ring[seq % h->hdr->nr_records];
+}
+
+/*
+ * Copies record seq out of the ring. Returns false if it was overwritten,
+ * is being written, or was never written.
+ */
+static bool hist_read(struct nvme_history *h, __u64 seq, struct hist_rec *rec)
+{
+	struct hist_rec *r = hist_slot(h, seq);
+
+	if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != seq)
+		return false;
+	memcpy(rec, r, sizeof(*rec));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return rec->seq == seq &&
+	       __atomic_load_n(&r->seq_end, __ATOMIC_RELAXED) == seq;
+}
+
+int nvme_history_append(struct nvme_history *h, struct nvme_smart_log *smart,
+			const void *vendor, __u16 vendor_len)
+{
+	struct hist_hdr *hdr = h->hdr;
+	struct hist_rec *r, prev;
+	__u64 seq, ts;
+
+	if (vendor_len > NVME_HISTORY_VENDOR_LEN)
+		return -EINVAL;
+
+	seq = __atomic_fetch_add(&hdr->next_seq, 1, __ATOMIC_ACQ_REL);
+	r = hist_slot(h, seq);
+
+	/* keep the ring sorted by time if the clock was stepped back */
+	ts = hist_now();
+	if (seq && hist_read(h, seq - 1, &prev) && prev.timestamp > ts)
+		ts = prev.timestamp;
+
+	__atomic_store_n(&r->seq_end, HIST_SEQ_INVALID, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->seq, HIST_SEQ_INVALID, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	r->timestamp = ts;
+	memcpy(r->smart, smart, sizeof(r->smart));
+	r->vendor_len = vendor_len;
+	memset(r->vendor, 0, sizeof(r->vendor));
+	if (vendor_len)
+		memcpy(r->vendor, vendor, vendor_len);
+
+	__atomic_store_n(&r->seq_end, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->seq, seq, __ATOMIC_RELEASE);
+
+	if (!(seq % hdr->chunk)) {
+		struct hist_index *idx;
+
+		idx = &hdr->index[(seq / hdr->chunk) % hdr->nr_index];
+		__atomic_store_n(&idx->seq, HIST_SEQ_INVALID, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		idx->timestamp = ts;
+		__atomic_store_n(&idx->seq, seq, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+/* Serial numbers may contain anything, keep file names tame */
+static void hist_name(char *dst, size_t len, const char *src, size_t src_len)
+{
+	size_t i;
+
+	while (src_len && (src[src_len - 1] == ' ' || !src[src_len - 1]))
+		src_len--;
+	for (i = 0; i < src_len && i < len - 1; i++) {
+		char c = src[i];
+
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		    (c >= '0' && c <= '9') || c == '.' || c == '-')
+			dst[i] = c;
+		else
+			dst[i] = '_';
+	}
+	dst[i] = '\0';
+}
+
+/* The history follows the drive, whatever name it is given next boot */
+int nvme_history_path(int fd, const char *dir, char *path, size_t len)
+{
+	struct nvme_id_ctrl ctrl;
+	char sn[sizeof(ctrl.sn) + 1];
+	int err;
+
+	err = nvme_identify_ctrl(fd, &ctrl);
+	if (err)
+		return err;
+
+	hist_name(sn, sizeof(sn), ctrl.sn, sizeof(ctrl.sn));
+	if (!sn[0])
+		return -ENODEV;
+	snprintf(path, len, "%s/%s.hist", dir, sn);
+	return 0;
+}
+
+static int hist_mkdir(const char *dir)
+{
+	char path[PATH_MAX], *p;
+
+	snprintf(path, sizeof(path), "%s", dir);
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(path, 0755) && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+static int hist_sample(int fd, struct nvme_history *h, const void *vendor,
+		       __u16 vendor_len)
+{
+	struct nvme_smart_log smart;
+	int err;
+
+	err = nvme_smart_log(fd, NVME_NSID_ALL, &smart);
+	if (err)
+		return err;
+	return nvme_history_append(h, &smart, vendor, vendor_len);
+}
+
+/*
+ * Appends a sample to the drive's history in the default directory, for
+ * plugins that collect their own. The SMART log is read if not given.
+ */
+int nvme_history_record(int fd, struct nvme_smart_log *smart,
+			const void *vendor, __u16 vendor_len)
+{
+	struct nvme_history *h;
+	char path[PATH_MAX];
+	int err;
+
+	err = nvme_history_path(fd, NVME_HISTORY_DIR, path, sizeof(path));
+	if (err)
+		return err;
+	err = hist_mkdir(NVME_HISTORY_DIR);
+	if (err)
+		return err;
+
+	h = nvme_history_open(path, true, NVME_HISTORY_RECORDS);
+	if (!h)
+		return -errno;
+	if (smart)
+		err = nvme_history_append(h, smart, vendor, vendor_len);
+	else
+		err = hist_sample(fd, h, vendor, vendor_len);
+	nvme_history_close(h);
+	return err;
+}
+
+static void hist_range(struct nvme_history *h, __u64 *oldest, __u64 *end)
+{
+	__u64 nr = h->hdr->nr_records;
+
+	*end = __atomic_load_n(&h->hdr->next_seq, __ATOMIC_ACQUIRE);
+	*oldest = *end > nr ? *end - nr : 0;
+}
+
+/* Timestamp of record seq, or of the next readable one after it */
+static bool hist_timestamp(struct nvme_history *h, __u64 *seq, __u64 end,
+			   __u64 *ts)
+{
+	struct hist_rec rec;
+
+	for (; *seq < end; (*seq)++) {
+		if (hist_read(h, *seq, &rec)) {
+			*ts = rec.timestamp;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* The first record at or after ts, or end if there is none */
+static __u64 hist_find(struct nvme_history *h, __u64 ts)
+{
+	struct hist_hdr *hdr = h->hdr;
+	__u64 oldest, end, lo, hi, mid, seq, t;
+
+	hist_range(h, &oldest, &end);
+	lo = oldest;
+	hi = end;
+
+	/* narrow down to one chunk with the index */
+	if (end - oldest > hdr->chunk) {
+		__u64 klo = (oldest + hdr->chunk - 1) / hdr->chunk;
+		__u64 khi = (end - 1) / hdr->chunk + 1;
+
+		while (klo < khi) {
+			__u64 k = klo + (khi - klo) / 2;
+			struct hist_index *idx =
+				&hdr->index[k % hdr->nr_index];
+
+			if (__atomic_load_n(&idx->seq, __ATOMIC_ACQUIRE) !=
+			    k * hdr->chunk)
+				break;	/* being rewritten, search the ring */
+			t = idx->timestamp;
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&idx->seq, __ATOMIC_RELAXED) !=
+			    k * hdr->chunk)
+				break;
+			if (t < ts) {
+				lo = k * hdr->chunk;
+				klo = k + 1;
+			} else {
+				hi = k * hdr->chunk;
+				khi = k;
+			}
+		}
+	}
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		seq = mid;
+		if (!hist_timestamp(h, &seq, hi, &t) || t >= ts)
+			hi = mid;
+		else
+			lo = seq + 1;
+	}
+	return lo;
+}
+
+/*
+ * Times are seconds since the epoch, or relative to now with a leading
+ * '-' and an optional s, m, h or d suffix: -30m, -7d.
+ */
+static int hist_parse_time(const char *s, __u64 *usec)
+{
+	const char *num;
+	unsigned long long v, unit;
+	__u64 now;
+	char *end;
+
+	if (!s)
+		return 0;
+	/* strtoull() would take a sign or blanks of its own */
+	num = s[0] == '-' ? s + 1 : s;
+	if (!isdigit((unsigned char)*num))
+		return -EINVAL;
+	errno = 0;
+	v = strtoull(num, &end, 10);
+	if (errno || (s[0] != '-' && *end))
+		return -EINVAL;
+	if (s[0] != '-') {
+		if (v > UINT64_MAX / 1000000ULL)
+			return -EINVAL;
+		*usec = v * 1000000ULL;
+		return 0;
+	}
+
+	switch (*end) {
+	case 'd':
+		unit = 24 * 60 * 60;
+		break;
+	case 'h':
+		unit = 60 * 60;
+		break;
+	case 'm':
+		unit = 60;
+		break;
+	case 's':
+	case '\0':
+		unit = 1;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (*end && end[1])
+		return -EINVAL;
+
+	/* nothing is older than the epoch */
+	now = hist_now();
+	if (v > now / 1000000ULL / unit)
+		return -EINVAL;
+	*usec = now - v * unit * 1000000ULL;
+	return 0;
+}
+
+enum hist_format {
+	HIST_NORMAL,
+	HIST_JSON,
+	HIST_CSV,
+};
+
+/* A downsampling bucket: the last record in it, and its temperature range */
+struct hist_bucket {
+	struct hist_rec last;
+	struct nvme_smart_log smart;
+	unsigned int samples;
+	int temp_min;
+	int temp_max;
+	long long temp_sum;
+};
+
+static const struct {
+	const char *name;
+	size_t offset;
+} hist_counters[] = {
+	{ "data_units_read", offsetof(struct nvme_smart_log, data_units_read) },
+	{ "data_units_written", offsetof(struct nvme_smart_log, data_units_written) },
+	{ "host_read_commands", offsetof(struct nvme_smart_log, host_reads) },
+	{ "host_write_commands", offsetof(struct nvme_smart_log, host_writes) },
+	{ "controller_busy_time", offsetof(struct nvme_smart_log, ctrl_busy_time) },
+	{ "power_cycles", offsetof(struct nvme_smart_log, power_cycles) },
+	{ "power_on_hours", offsetof(struct nvme_smart_log, power_on_hours) },
+	{ "unsafe_shutdowns", offsetof(struct nvme_smart_log, unsafe_shutdowns) },
+	{ "media_errors", offsetof(struct nvme_smart_log, media_errors) },
+	{ "num_err_log_entries", offsetof(struct nvme_smart_log, num_err_log_entries) },
+};
+
+static const struct {
+	const char *name;
+	size_t offset;
+} hist_counters32[] = {
+	{ "warning_temp_time", offsetof(struct nvme_smart_log, warning_temp_time) },
+	{ "critical_comp_time", offsetof(struct nvme_smart_log, critical_comp_time) },
+	{ "thm_temp1_trans_count", offsetof(struct nvme_smart_log, thm_temp1_trans_count) },
+	{ "thm_temp2_trans_count", offsetof(struct nvme_smart_log, thm_temp2_trans_count) },
+	{ "thm_temp1_total_time", offsetof(struct nvme_smart_log, thm_temp1_total_time) },
+	{ "thm_temp2_total_time", offsetof(struct nvme_smart_log, thm_temp2_total_time) },
+};
+
+static int hist_temp(struct nvme_smart_log *smart)
+{
+	return ((smart->temperature[1] << 8) | smart->temperature[0]) - 273;
+}
+
+static __u32 hist_u32(struct nvme_smart_log *smart, size_t offset)
+{
+	__le32 v;
+
+	memcpy(&v, (__u8 *)smart + offset, sizeof(v));
+	return le32_to_cpu(v);
+}
+
+static void hist_time_str(__u64 usec, char *buf, size_t len)
+{
+	time_t t = usec / 1000000;
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	strftime(buf, len, "%Y-%m-%dT%H:%M:%SZ", &tm);
+}
+
+static void hist_print_csv_header(void)
+{
+	int i;
+
+	printf("timestamp,samples,temperature,temperature_min,temperature_max,"
+	       "critical_warning,avail_spare,spare_thresh,percent_used");
+	for (i = 0; i < ARRAY_SIZE(hist_counters); i++)
+		printf(",%s", hist_counters[i].name);
+	for (i = 0; i < ARRAY_SIZE(hist_counters32); i++)
+		printf(",%s", hist_counters32[i].name);
+	for (i = 0; i < 8; i++)
+		printf(",temperature_sensor_%d", i + 1);
+	printf(",vendor\n");
+}
+
+static void hist_print_bucket(struct hist_bucket *b, enum hist_format fmt,
+			      struct json_array *array)
+{
+	struct nvme_smart_log *smart = &b->smart;
+	struct json_object *o = NULL;
+	char ts[32], num[40], vendor[2 * NVME_HISTORY_VENDOR_LEN + 1];
+	int i, temp = b->temp_sum / (long long)b->samples;
+
+	hist_time_str(b->last.timestamp, ts, sizeof(ts));
+	for (i = 0; i < b->last.vendor_len; i++)
+		sprintf(vendor + 2 * i, "%02x", b->last.vendor[i]);
+	vendor[2 * i] = '\0';
+
+	if (fmt == HIST_NORMAL) {
+		char written[40], errors[40];
+
+		printf("%-20s %4dC %4dC %4dC 0x%02x %3u%% %3u%% %22s %22s %8s\n",
+		       ts, temp, b->temp_min, b->temp_max,
+		       smart->critical_warning, smart->avail_spare,
+		       smart->percent_used,
+		       nvme_u128_to_string(nvme_u128_from_le(
+				smart->data_units_read), num, sizeof(num)),
+		       nvme_u128_to_string(nvme_u128_from_le(
+				smart->data_units_written), written,
+				sizeof(written)),
+		       nvme_u128_to_string(nvme_u128_from_le(
+				smart->media_errors), errors, sizeof(errors)));
+		return;
+	}
+
+	if (fmt == HIST_CSV) {
+		printf("%s,%u,%d,%d,%d,%u,%u,%u,%u", ts, b->samples, temp,
+		       b->temp_min, b->temp_max, smart->critical_warning,
+		       smart->avail_spare, smart->spare_thresh,
+		       smart->percent_used);
+	} else {
+		o = json_create_object();
+		json_object_add_value_string(o, "timestamp", ts);
+		json_object_add_value_uint(o, "timestamp_us",
+					   b->last.timestamp);
+		json_object_add_value_uint(o, "samples", b->samples);
+		json_object_add_value_int(o, "temperature", temp);
+		json_object_add_value_int(o, "temperature_min", b->temp_min);
+		json_object_add_value_int(o, "temperature_max", b->temp_max);
+		json_object_add_value_uint(o, "critical_warning",
+					   smart->critical_warning);
+		json_object_add_value_uint(o, "avail_spare",
+					   smart->avail_spare);
+		json_object_add_value_uint(o, "spare_thresh",
+					   smart->spare_thresh);
+		json_object_add_value_uint(o, "percent_used",
+					   smart->percent_used);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(hist_counters); i++) {
+		nvme_u128_to_string(nvme_u128_from_le((__u8 *)smart +
+				    hist_counters[i].offset), num, sizeof(num));
+		if (o)
+			json_object_add_value_string(o, hist_counters[i].name,
+						     num);
+		else
+			printf(",%s", num);
+	}
+	for (i = 0; i < ARRAY_SIZE(hist_counters32); i++) {
+		__u32 v = hist_u32(smart, hist_counters32[i].offset);
+
+		if (o)
+			json_object_add_value_uint(o, hist_counters32[i].name,
+						   v);
+		else
+			printf(",%u", v);
+	}
+	for (i = 0; i < 8; i++) {
+		int t = le16_to_cpu(smart->temp_sensor[i]);
+
+		if (o && t) {
+			char key[32];
+
+			sprintf(key, "temperature_sensor_%d", i + 1);
+			json_object_add_value_int(o, key, t - 273);
+		} else if (!o) {
+			if (t)
+				printf(",%d", t - 273);
+			else
+				printf(",");
+		}
+	}
+	if (o) {
+		if (vendor[0])
+			json_object_add_value_string(o, "vendor", vendor);
+		json_array_add_value_object(array, o);
+	} else
+		printf(",%s\n", vendor);
+}
+
+static int hist_query(struct nvme_history *h, __u64 since, __u64 until,
+		      enum hist_format fmt)
+{
+	struct json_object *root = NULL;
+	struct json_array *array = NULL;
+	struct nvme_smart_log smart = { };
+	struct hist_bucket b = { };
+	struct hist_rec rec;
+	__u64 seq, oldest, end, step = cfg.step * 1000000ULL, key = 0;
+	int temp;
+
+	hist_range(h, &oldest, &end);
+	seq = since ? hist_find(h, since) : oldest;
+
+	if (fmt == HIST_JSON) {
+		root = json_create_object();
+		array = json_create_array();
+		json_object_add_value_uint(root, "records", end - oldest);
+		json_object_add_value_uint(root, "capacity",
+					   h->hdr->nr_records);
+	} else if (fmt == HIST_CSV)
+		hist_print_csv_header();
+	else
+		printf("%-20s %5s %5s %5s %4s %4s %4s %22s %22s %8s\n",
+		       "Time", "Temp", "Min", "Max", "CW", "Spr", "Used",
+		       "Data Units Read", "Data Units Written", "Media Err");
+
+	for (; seq < end; seq++) {
+		if (!hist_read(h, seq, &rec))
+			continue;
+		if (until && rec.timestamp >= until)
+			break;
+
+		if (b.samples && (!step || rec.timestamp / step != key)) {
+			hist_print_bucket(&b, fmt, array);
+			b.samples = 0;
+		}
+
+		memcpy(&smart, rec.smart, sizeof(rec.smart));
+		temp = hist_temp(&smart);
+		if (!b.samples) {
+			key = step ? rec.timestamp / step : 0;
+			b.temp_min = b.temp_max = temp;
+			b.temp_sum = 0;
+		}
+		b.last = rec;
+		b.smart = smart;
+		b.samples++;
+		b.temp_sum += temp;
+		if (temp < b.temp_min)
+			b.temp_min = temp;
+		if (temp > b.temp_max)
+			b.temp_max = temp;
+	}
+	if (b.samples) {
+		hist_print_bucket(&b, fmt, array);
+	}
+
+	if (fmt == HIST_JSON) {
+		json_object_add_value_array(root, "samples", array);
+		json_print_object(root, NULL);
+		printf("\n");
+		json_free_object(root);
+	}
+	return 0;
+}
+
+static int hist_record(int fd, struct nvme_history *h)
+{
+	struct timespec start, next;
+	__u32 i;
+	int err;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; ; i++) {
+		err = hist_sample(fd, h, NULL, 0);
+		if (err > 0)
+			nvme_show_status(err);
+		else if (err < 0)
+			fprintf(stderr, "Failed to record sample: %s\n",
+				strerror(-err));
+		if (err || !cfg.interval || (cfg.count && i + 1 >= cfg.count))
+			return err;
+
+		next.tv_sec = start.tv_sec + (time_t)cfg.interval * (i + 1);
+		next.tv_nsec = start.tv_nsec;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+				       NULL) == EINTR)
+			;
+	}
+}
+
+int history(const char *desc, int argc, char **argv)
+{
+	const char *dir = "directory of the history files (default " NVME_HISTORY_DIR ")";
+	const char *file = "history file to use instead of the device's one";
+	const char *record = "read the SMART log and append it to the history";
+	const char *interval = "with --record, take a sample every interval seconds";
+	const char *count = "with --record --interval, number of samples to take";
+	const char *records = "number of records a new history file holds";
+	const char *since = "first time to show: seconds since the epoch, or -<n>[smhd] before now";
+	const char *until = "time to stop before, same format as --since";
+	const char *step = "downsample to one sample per step seconds";
+	const char *output_format = "Output format: normal|json|csv";
+	struct nvme_history *h;
+	enum hist_format fmt;
+	char path[PATH_MAX];
+	__u64 since_us = 0, until_us = 0;
+	int fd = -1, ret;
+
+	OPT_ARGS(opts) = {
+		OPT_FILE("dir",           'd', &cfg.dir,           dir),
+		OPT_FILE("file",          'f', &cfg.file,          file),
+		OPT_FLAG("record",        'r', &cfg.record,        record),
+		OPT_UINT("interval",      'i', &cfg.interval,      interval),
+		OPT_UINT("count",         'c', &cfg.count,         count),
+		OPT_UINT("records",       'N', &cfg.records,       records),
+		OPT_FMT("since",          's', &cfg.since,         since),
+		OPT_FMT("until",          'u', &cfg.until,         until),
+		OPT_UINT("step",          'S', &cfg.step,          step),
+		OPT_FMT("output-format",  'o', &cfg.output_format, output_format),
+		OPT_END()
+	};
+
+	ret = argconfig_parse(argc, argv, desc, opts);
+	if (ret)
+		return ret;
+
+	if (!strcmp(cfg.output_format, "normal"))
+		fmt = HIST_NORMAL;
+	else if (!strcmp(cfg.output_format, "json"))
+		fmt = HIST_JSON;
+	else if (!strcmp(cfg.output_format, "csv"))
+		fmt = HIST_CSV;
+	else {
+		fprintf(stderr, "invalid output format\n");
+		return -EINVAL;
+	}
+	if (hist_parse_time(cfg.since, &since_us) ||
+	    hist_parse_time(cfg.until, &until_us) || !cfg.records) {
+		fprintf(stderr, "invalid argument\n");
+		return -EINVAL;
+	}
+
+	if (optind < argc) {
+		fd = open(argv[optind], O_RDONLY);
+		if (fd < 0) {
+			perror(argv[optind]);
+			return -errno;
+		}
+		devicename = basename(argv[optind]);
+	}
+	if (fd < 0 && (cfg.record || !cfg.file)) {
+		fprintf(stderr, "%s needs a device\n",
+			cfg.record ? "--record" : "without --file, history");
+		argconfig_print_help(desc, opts);
+		return -EINVAL;
+	}
+
+	if (cfg.file)
+		snprintf(path, sizeof(path), "%s", cfg.file);
+	else {
+		ret = nvme_history_path(fd, cfg.dir, path, sizeof(path));
+		if (ret) {
+			fprintf(stderr, "Failed to identify %s\n", devicename);
+			goto close_fd;
+		}
+	}
+
+	if (cfg.record && !cfg.file) {
+		ret = hist_mkdir(cfg.dir);
+		if (ret) {
+			fprintf(stderr, "Failed to create %s: %s\n", cfg.dir,
+				strerror(-ret));
+			goto close_fd;
+		}
+	}
+
+	h = nvme_history_open(path, cfg.record, cfg.records);
+	if (!h) {
+		ret = -errno;
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+			strerror(errno));
+		goto close_fd;
+	}
+
+	if (cfg.record)
+		ret = hist_record(fd, h);
+	else
+		ret = hist_query(h, since_us, until_us, fmt);
+	nvme_history_close(h);
+close_fd:
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
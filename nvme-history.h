@@ -0,0 +1,24 @@
+#ifndef _NVME_HISTORY_H
+#define _NVME_HISTORY_H
+
+#include "nvme.h"
+
+#define NVME_HISTORY_DIR	"/var/lib/nvme/history"
+
+/* bytes of vendor specific counters a record can hold */
+#define NVME_HISTORY_VENDOR_LEN	56
+
+struct nvme_history;
+
+struct nvme_history *nvme_history_open(const char *path, bool create,
+				       __u64 nr_records);
+void nvme_history_close(struct nvme_history *h);
+int nvme_history_append(struct nvme_history *h, struct nvme_smart_log *smart,
+			const void *vendor, __u16 vendor_len);
+int nvme_history_path(int fd, const char *dir, char *path, size_t len);
+int nvme_history_record(int fd, struct nvme_smart_log *smart,
+			const void *vendor, __u16 vendor_len);
+
+extern int history(const char *desc, int argc, char **argv);
+
+#endif
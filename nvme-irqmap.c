@@ -0,0 +1,871 @@
+/*
+ * nvme irq-map: how the queues of each NVMe controller are tied to CPUs,
+ * from the blk-mq map of CPUs to hardware queues, the MSI-X vectors of the
+ * controller, their affinity and the interrupts they took, next to the
+ * NUMA node of the controller and of those CPUs, with warnings for the
+ * layouts known to hurt tail latency.
+ *
+ * The nvme driver names the interrupt handler of each queue nvme<N>q<qid>
+ * in /proc/interrupts, which ties vectors to queues, and hardware context
+ * n of a namespace is I/O queue n + 1 of its controller.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sched.h>
+
+#include "nvme.h"
+#include "nvme-print.h"
+#include "nvme-irqmap.h"
+#include "json.h"
+
+#define PROC_INTERRUPTS		"/proc/interrupts"
+#define PROC_IRQ		"/proc/irq"
+#define SYS_NODE		"/sys/devices/system/node"
+#define SYS_BLOCK		"/sys/block"
+
+/* below this many I/O interrupts, how they are spread means nothing */
+#define IRQ_MIN_INTERRUPTS	1000
+
+/* a line of /proc/interrupts for an nvme queue */
+struct irq_count {
+	int irq;
+	char *actions;
+	__u64 *per_cpu;
+};
+
+struct irq_vector {
+	int irq;
+	cpu_set_t affinity;
+	bool admin;
+	int nr_queues;			/* I/O queues */
+	const struct irq_count *count;	/* NULL if never requested */
+};
+
+struct irq_queue {
+	int qid;
+	bool mapped;			/* has a blk-mq hardware context */
+	cpu_set_t cpus;			/* submitting to it */
+	struct irq_vector *v;		/* NULL for polled queues */
+};
+
+struct irq_ctrl {
+	struct nvme_ctrl *c;
+	int instance;
+	int node;
+	int nr_vectors;
+	struct irq_vector *vectors;
+	int nr_queues;
+	struct irq_queue *queues;	/* by qid */
+	int nr_warnings;
+	char **warnings;
+};
+
+struct irq_map {
+	int nr_cpus;			/* the highest CPU + 1 */
+	int *cpu_node;
+	int nr_counts;
+	struct irq_count *counts;
+};
+
+static struct config {
+	__u32 interval;
+	char *output_format;
+} cfg = {
+	.output_format = "normal",
+};
+
+static int irq_read_attr(const char *path, char *buf, size_t len)
+{
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return -errno;
+	if (!fgets(buf, len, f))
+		buf[0] = '\0';
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+/* A list of CPUs as sysfs and procfs print them, "0-3,8,10-11" */
+static int irq_parse_cpulist(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+	int first, last, n;
+
+	CPU_ZERO(set);
+	while (*p) {
+		if (sscanf(p, "%d%n", &first, &n) != 1)
+			return -EINVAL;
+		p += n;
+		last = first;
+		if (*p == '-') {
+			if (sscanf(++p, "%d%n", &last, &n) != 1)
+				return -EINVAL;
+			p += n;
+		}
+		if (first < 0 || last < first || last >= CPU_SETSIZE)
+			return -EINVAL;
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return -EINVAL;
+	}
+	return 0;
+}
+
+static char *irq_cpulist(const cpu_set_t *set, char *buf, size_t len)
+{
+	size_t off = 0;
+	int cpu, last;
+
+	buf[0] = '\0';
+	for (cpu = 0; cpu < CPU_SETSIZE && off < len; cpu++) {
+		if (!CPU_ISSET(cpu, set))
+			continue;
+		for (last = cpu; last + 1 < CPU_SETSIZE &&
+		     CPU_ISSET(last + 1, set); last++)
+			;
+		if (last == cpu)
+			off += snprintf(buf + off, len - off, "%s%d",
+					off ? "," : "", cpu);
+		else
+			off += snprintf(buf + off, len - off, "%s%d-%d",
+					off ? "," : "", cpu, last);
+		cpu = last;
+	}
+	if (!buf[0])
+		snprintf(buf, len, "-");
+	return buf;
+}
+
+/* The NUMA nodes of a set of CPUs, "-" if none is known */
+static char *irq_nodelist(struct irq_map *m, const cpu_set_t *set, char *buf,
+			  size_t len)
+{
+	cpu_set_t nodes;
+	int cpu;
+
+	CPU_ZERO(&nodes);
+	for (cpu = 0; cpu < m->nr_cpus; cpu++)
+		if (CPU_ISSET(cpu, set) && m->cpu_node[cpu] >= 0)
+			CPU_SET(m->cpu_node[cpu], &nodes);
+	return irq_cpulist(&nodes, buf, len);
+}
+
+static bool irq_on_node(struct irq_map *m, const cpu_set_t *set, int node)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < m->nr_cpus; cpu++)
+		if (CPU_ISSET(cpu, set) && m->cpu_node[cpu] == node)
+			return true;
+	return false;
+}
+
+static void irq_grow_cpus(struct irq_map *m, int nr_cpus)
+{
+	int *cpu_node;
+	int i;
+
+	if (nr_cpus <= m->nr_cpus)
+		return;
+	cpu_node = realloc(m->cpu_node, nr_cpus * sizeof(*cpu_node));
+	if (!cpu_node)
+		return;
+	for (i = m->nr_cpus; i < nr_cpus; i++)
+		cpu_node[i] = -1;
+	m->cpu_node = cpu_node;
+	m->nr_cpus = nr_cpus;
+}
+
+static void irq_read_nodes(struct irq_map *m)
+{
+	char path[PATH_MAX], list[1024];
+	struct dirent *d;
+	cpu_set_t cpus;
+	int node, cpu;
+	DIR *dir;
+
+	dir = opendir(SYS_NODE);
+	if (!dir)
+		return;
+	while ((d = readdir(dir))) {
+		if (sscanf(d->d_name, "node%d", &node) != 1)
+			continue;
+		snprintf(path, sizeof(path), SYS_NODE "/%s/cpulist",
+			 d->d_name);
+		if (irq_read_attr(path, list, sizeof(list)) ||
+		    irq_parse_cpulist(list, &cpus))
+			continue;
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (!CPU_ISSET(cpu, &cpus))
+				continue;
+			irq_grow_cpus(m, cpu + 1);
+			if (cpu < m->nr_cpus)
+				m->cpu_node[cpu] = node;
+		}
+	}
+	closedir(dir);
+}
+
+static void irq_free_counts(struct irq_map *m)
+{
+	int i;
+
+	for (i = 0; i < m->nr_counts; i++) {
+		free(m->counts[i].actions);
+		free(m->counts[i].per_cpu);
+	}
+	free(m->counts);
+	m->counts = NULL;
+	m->nr_counts = 0;
+}
+
+/*
+ * The interrupts of the nvme queues, per CPU. The header line names the
+ * CPU of each column, which skips the CPUs that are offline.
+ */
+static int irq_read_counts(struct irq_map *m)
+{
+	char *line = NULL, *p, *end;
+	int *cols = NULL, nr_cols = 0, cpu, i, err = 0;
+	struct irq_count *counts, *c;
+	size_t len = 0;
+	FILE *f;
+
+	f = fopen(PROC_INTERRUPTS, "r");
+	if (!f)
+		return -errno;
+
+	if (getline(&line, &len, f) < 0) {
+		err = -EINVAL;
+		goto close;
+	}
+	for (p = line; (p = strstr(p, "CPU")); p += 3) {
+		if (sscanf(p, "CPU%d", &cpu) != 1)
+			continue;
+		cols = realloc(cols, (nr_cols + 1) * sizeof(*cols));
+		if (!cols) {
+			err = -ENOMEM;
+			goto close;
+		}
+		cols[nr_cols++] = cpu;
+		irq_grow_cpus(m, cpu + 1);
+	}
+
+	while (getline(&line, &len, f) >= 0) {
+		int irq;
+
+		if (!strstr(line, "nvme") || sscanf(line, " %d:", &irq) != 1)
+			continue;
+		counts = realloc(m->counts, (m->nr_counts + 1) *
+				 sizeof(*counts));
+		if (!counts) {
+			err = -ENOMEM;
+			break;
+		}
+		m->counts = counts;
+		c = &m->counts[m->nr_counts];
+		c->irq = irq;
+		c->per_cpu = calloc(m->nr_cpus, sizeof(*c->per_cpu));
+		if (!c->per_cpu) {
+			err = -ENOMEM;
+			break;
+		}
+		p = strchr(line, ':') + 1;
+		for (i = 0; i < nr_cols; i++) {
+			__u64 n = strtoull(p, &end, 10);
+
+			if (end == p)
+				break;
+			if (cols[i] < m->nr_cpus)
+				c->per_cpu[cols[i]] = n;
+			p = end;
+		}
+		c->actions = strdup(p);
+		if (!c->actions) {
+			free(c->per_cpu);
+			err = -ENOMEM;
+			break;
+		}
+		m->nr_counts++;
+	}
+close:
+	free(line);
+	free(cols);
+	fclose(f);
+	return err;
+}
+
+/* Leaves in cur the interrupts since prev, for vectors in both */
+static void irq_sub_counts(struct irq_map *cur, struct irq_map *prev)
+{
+	int i, j, cpu;
+
+	for (i = 0; i < cur->nr_counts; i++) {
+		struct irq_count *c = &cur->counts[i];
+
+		for (j = 0; j < prev->nr_counts; j++)
+			if (prev->counts[j].irq == c->irq)
+				break;
+		if (j == prev->nr_counts)
+			continue;
+		for (cpu = 0; cpu < cur->nr_cpus && cpu < prev->nr_cpus; cpu++)
+			if (c->per_cpu[cpu] >= prev->counts[j].per_cpu[cpu])
+				c->per_cpu[cpu] -= prev->counts[j].per_cpu[cpu];
+	}
+}
+
+static __u64 irq_total(struct irq_map *m, const struct irq_vector *v,
+		       int *busiest)
+{
+	__u64 total = 0, max = 0;
+	int cpu;
+
+	*busiest = -1;
+	if (!v->count)
+		return 0;
+	for (cpu = 0; cpu < m->nr_cpus; cpu++) {
+		total += v->count->per_cpu[cpu];
+		if (v->count->per_cpu[cpu] > max) {
+			max = v->count->per_cpu[cpu];
+			*busiest = cpu;
+		}
+	}
+	return total;
+}
+
+static void irq_warn(struct irq_ctrl *ic, const char *fmt, ...)
+{
+	char buf[256], **warnings;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	warnings = realloc(ic->warnings, (ic->nr_warnings + 1) *
+			   sizeof(*warnings));
+	if (!warnings)
+		return;
+	ic->warnings = warnings;
+	ic->warnings[ic->nr_warnings] = strdup(buf);
+	if (ic->warnings[ic->nr_warnings])
+		ic->nr_warnings++;
+}
+
+static struct irq_vector *irq_find_vector(struct irq_ctrl *ic, int irq)
+{
+	int i;
+
+	for (i = 0; i < ic->nr_vectors; i++)
+		if (ic->vectors[i].irq == irq)
+			return &ic->vectors[i];
+	return NULL;
+}
+
+static struct irq_vector *irq_add_vector(struct irq_ctrl *ic, int irq)
+{
+	struct irq_vector *vectors, *v;
+
+	v = irq_find_vector(ic, irq);
+	if (v)
+		return v;
+
+	vectors = realloc(ic->vectors, (ic->nr_vectors + 1) *
+			  sizeof(*vectors));
+	if (!vectors)
+		return NULL;
+	ic->vectors = vectors;
+	v = &ic->vectors[ic->nr_vectors++];
+	memset(v, 0, sizeof(*v));
+	v->irq = irq;
+	return v;
+}
+
+static int irq_vector_cmp(const void *a, const void *b)
+{
+	const struct irq_vector *va = a, *vb = b;
+
+	return va->irq - vb->irq;
+}
+
+static struct irq_queue *irq_add_queue(struct irq_ctrl *ic, int qid)
+{
+	struct irq_queue *queues;
+	int i;
+
+	if (qid < 0 || qid > 0xffff)
+		return NULL;
+	if (qid >= ic->nr_queues) {
+		queues = realloc(ic->queues, (qid + 1) * sizeof(*queues));
+		if (!queues)
+			return NULL;
+		memset(queues + ic->nr_queues, 0,
+		       (qid + 1 - ic->nr_queues) * sizeof(*queues));
+		for (i = ic->nr_queues; i <= qid; i++)
+			queues[i].qid = -1;
+		ic->queues = queues;
+		ic->nr_queues = qid + 1;
+	}
+	ic->queues[qid].qid = qid;
+	return &ic->queues[qid];
+}
+
+/*
+ * The vectors the controller was given, and those its queues requested,
+ * which include the legacy interrupt of a device without MSI-X.
+ */
+static void irq_scan_vectors(struct irq_map *m, struct irq_ctrl *ic)
+{
+	char path[PATH_MAX], list[1024];
+	struct irq_vector *v;
+	struct irq_queue *q;
+	struct dirent *d;
+	char *p;
+	int i, irq, id, qid;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), SYS_NVME "/%s/device/msi_irqs",
+		 ic->c->name);
+	dir = opendir(path);
+	if (dir) {
+		while ((d = readdir(dir)))
+			if (sscanf(d->d_name, "%d", &irq) == 1)
+				irq_add_vector(ic, irq);
+		closedir(dir);
+	}
+
+	for (i = 0; i < m->nr_counts; i++)
+		for (p = m->counts[i].actions; (p = strstr(p, "nvme")); p++)
+			if (sscanf(p, "nvme%dq%d", &id, &qid) == 2 &&
+			    id == ic->instance)
+				irq_add_vector(ic, m->counts[i].irq);
+	if (ic->nr_vectors)
+		qsort(ic->vectors, ic->nr_vectors, sizeof(*ic->vectors),
+		      irq_vector_cmp);
+
+	for (i = 0; i < m->nr_counts; i++) {
+		for (p = m->counts[i].actions; (p = strstr(p, "nvme")); p++) {
+			if (sscanf(p, "nvme%dq%d", &id, &qid) != 2 ||
+			    id != ic->instance)
+				continue;
+			v = irq_find_vector(ic, m->counts[i].irq);
+			q = irq_add_queue(ic, qid);
+			if (!v || !q)
+				continue;
+			v->count = &m->counts[i];
+			q->v = v;
+			if (qid)
+				v->nr_queues++;
+			else
+				v->admin = true;
+		}
+	}
+
+	for (i = 0; i < ic->nr_vectors; i++) {
+		v = &ic->vectors[i];
+		snprintf(path, sizeof(path),
+			 PROC_IRQ "/%d/effective_affinity_list", v->irq);
+		if (irq_read_attr(path, list, sizeof(list)) || !list[0]) {
+			snprintf(path, sizeof(path),
+				 PROC_IRQ "/%d/smp_affinity_list", v->irq);
+			if (irq_read_attr(path, list, sizeof(list)))
+				list[0] = '\0';
+		}
+		if (irq_parse_cpulist(list, &v->affinity))
+			CPU_ZERO(&v->affinity);
+	}
+}
+
+/*
+ * The hardware contexts of the first namespace of the controller, they all
+ * share them. With native multipath the namespaces of the controller are
+ * its hidden path devices, nvme0c0n1, the head has no hardware contexts.
+ */
+static void irq_scan_queues(struct irq_ctrl *ic)
+{
+	char path[PATH_MAX], list[1024];
+	struct irq_queue *q;
+	struct dirent **ns, *d;
+	int i, n, hctx;
+	DIR *dir = NULL;
+
+	snprintf(path, sizeof(path), SYS_NVME "/%s", ic->c->name);
+	n = scandir(path, &ns, scan_ctrl_paths_filter, alphasort);
+	for (i = 0; i < n; i++) {
+		if (!dir) {
+			snprintf(path, sizeof(path), SYS_BLOCK "/%s/mq",
+				 ns[i]->d_name);
+			dir = opendir(path);
+		}
+		free(ns[i]);
+	}
+	if (n > 0)
+		free(ns);
+	if (!dir)
+		return;
+
+	while ((d = readdir(dir))) {
+		if (sscanf(d->d_name, "%d", &hctx) != 1)
+			continue;
+		snprintf(path + strlen(path), sizeof(path) - strlen(path),
+			 "/%d/cpu_list", hctx);
+		if (!irq_read_attr(path, list, sizeof(list))) {
+			q = irq_add_queue(ic, hctx + 1);
+			if (q && !irq_parse_cpulist(list, &q->cpus))
+				q->mapped = true;
+		}
+		*strrchr(path, '/') = '\0';
+		*strrchr(path, '/') = '\0';
+	}
+	closedir(dir);
+}
+
+static void irq_analyze(struct irq_map *m, struct irq_ctrl *ic)
+{
+	char cpus[256], aff[256], nodes[64];
+	__u64 total = 0, *per_cpu;
+	int i, j, cpu, busiest, nr_busy = 0, fair;
+
+	for (i = 0; i < ic->nr_queues; i++) {
+		struct irq_queue *q = &ic->queues[i];
+
+		if (q->qid < 1 || !q->v)
+			continue;
+		irq_cpulist(&q->v->affinity, aff, sizeof(aff));
+		/*
+		 * The queues of the CPUs of other nodes are expected to
+		 * interrupt them, not those of the CPUs of this one.
+		 */
+		if (ic->node >= 0 && CPU_COUNT(&q->v->affinity) &&
+		    !irq_on_node(m, &q->v->affinity, ic->node) &&
+		    (!q->mapped || irq_on_node(m, &q->cpus, ic->node)))
+			irq_warn(ic, "queue %d interrupts CPUs %s on node %s, "
+				 "the controller is on node %d", q->qid, aff,
+				 irq_nodelist(m, &q->v->affinity, nodes,
+					      sizeof(nodes)), ic->node);
+		if (q->mapped && CPU_COUNT(&q->v->affinity)) {
+			cpu_set_t both;
+
+			CPU_AND(&both, &q->cpus, &q->v->affinity);
+			if (!CPU_COUNT(&both))
+				irq_warn(ic, "queue %d is submitted to from "
+					 "CPUs %s but interrupts CPUs %s",
+					 q->qid, irq_cpulist(&q->cpus, cpus,
+							     sizeof(cpus)),
+					 aff);
+		}
+	}
+
+	per_cpu = calloc(m->nr_cpus, sizeof(*per_cpu));
+	for (i = 0; i < ic->nr_vectors; i++) {
+		struct irq_vector *v = &ic->vectors[i];
+		size_t off = 0;
+
+		if (v->nr_queues > 1) {
+			cpus[0] = '\0';
+			for (j = 1; j < ic->nr_queues; j++)
+				if (ic->queues[j].v == v && off < sizeof(cpus))
+					off += snprintf(cpus + off,
+							sizeof(cpus) - off,
+							"%s%d", off ? ", " : "",
+							j);
+			irq_warn(ic, "vector %d serves %d queues: %s", v->irq,
+				 v->nr_queues, cpus);
+		}
+		if (!v->nr_queues || !irq_total(m, v, &busiest))
+			continue;
+		nr_busy++;
+		for (cpu = 0; per_cpu && cpu < m->nr_cpus; cpu++) {
+			per_cpu[cpu] += v->count->per_cpu[cpu];
+			total += v->count->per_cpu[cpu];
+		}
+	}
+
+	/* more than twice its share of the I/O interrupts on one CPU */
+	fair = nr_busy < m->nr_cpus ? nr_busy : m->nr_cpus;
+	if (per_cpu && nr_busy > 1 && total >= IRQ_MIN_INTERRUPTS) {
+		for (cpu = 0; cpu < m->nr_cpus; cpu++) {
+			int from = 0;
+
+			if (per_cpu[cpu] * fair < 2 * total)
+				continue;
+			for (i = 0; i < ic->nr_vectors; i++)
+				if (ic->vectors[i].nr_queues &&
+				    ic->vectors[i].count &&
+				    ic->vectors[i].count->per_cpu[cpu])
+					from++;
+			irq_warn(ic, "CPU %d takes %.0f%% of the I/O "
+				 "interrupts, from %d vector%s", cpu,
+				 100.0 * per_cpu[cpu] / total, from,
+				 from == 1 ? "" : "s");
+		}
+	}
+	free(per_cpu);
+}
+
+static int irq_scan_ctrl(struct irq_map *m, struct irq_ctrl *ic,
+			 struct nvme_ctrl *c)
+{
+	char path[PATH_MAX], buf[16];
+
+	memset(ic, 0, sizeof(*ic));
+	ic->c = c;
+	ic->node = -1;
+	if (sscanf(c->name, "nvme%d", &ic->instance) != 1)
+		return -EINVAL;
+
+	snprintf(path, sizeof(path), SYS_NVME "/%s/device/numa_node",
+		 c->name);
+	if (!irq_read_attr(path, buf, sizeof(buf)))
+		ic->node = atoi(buf);
+
+	irq_scan_vectors(m, ic);
+	irq_scan_queues(ic);
+	irq_analyze(m, ic);
+	return 0;
+}
+
+static void irq_free_ctrl(struct irq_ctrl *ic)
+{
+	int i;
+
+	for (i = 0; i < ic->nr_warnings; i++)
+		free(ic->warnings[i]);
+	free(ic->warnings);
+	free(ic->vectors);
+	free(ic->queues);
+}
+
+static void irq_show_ctrl(struct irq_map *m, struct irq_ctrl *ic)
+{
+	char cpus[256], aff[256], nodes[64], busy[32], vec[16];
+	int i, busiest;
+	__u64 total;
+
+	printf("%s", ic->c->name);
+	if (ic->c->address && ic->c->address[0])
+		printf(" at %s", ic->c->address);
+	if (ic->node >= 0)
+		printf(", NUMA node %d", ic->node);
+	printf(", %d vectors\n", ic->nr_vectors);
+
+	printf("  %5s  %-16s %6s  %-16s %-6s %14s  %s\n", "queue", "cpus",
+	       "vector", "affinity", "nodes", "interrupts", "busiest cpu");
+	for (i = 0; i < ic->nr_queues; i++) {
+		struct irq_queue *q = &ic->queues[i];
+
+		if (q->qid < 0)
+			continue;
+		if (q->mapped)
+			irq_cpulist(&q->cpus, cpus, sizeof(cpus));
+		else
+			snprintf(cpus, sizeof(cpus), "-");
+		if (!q->v) {
+			printf("  %5d  %-16s %6s\n", q->qid, cpus, "polled");
+			continue;
+		}
+		total = irq_total(m, q->v, &busiest);
+		snprintf(vec, sizeof(vec), "%d", q->v->irq);
+		busy[0] = '\0';
+		if (busiest >= 0)
+			snprintf(busy, sizeof(busy), "%d (%.0f%%)", busiest,
+				 100.0 * q->v->count->per_cpu[busiest] / total);
+		printf("  %5d  %-16s %6s  %-16s %-6s %14"PRIu64"  %s\n", q->qid,
+		       cpus, vec, irq_cpulist(&q->v->affinity, aff, sizeof(aff)),
+		       irq_nodelist(m, &q->v->affinity, nodes, sizeof(nodes)),
+		       (uint64_t)total, busy);
+	}
+
+	for (i = 0; i < ic->nr_vectors; i++)
+		if (!ic->vectors[i].count)
+			printf("  vector %d is not used by any queue\n",
+			       ic->vectors[i].irq);
+	for (i = 0; i < ic->nr_warnings; i++)
+		printf("  warning: %s\n", ic->warnings[i]);
+}
+
+static struct json_object *irq_json_ctrl(struct irq_map *m,
+					 struct irq_ctrl *ic)
+{
+	struct json_array *queues, *vectors, *warnings, *qids;
+	struct json_object *ctrl, *obj;
+	char buf[256];
+	int i, j, busiest;
+	__u64 total;
+
+	ctrl = json_create_object();
+	json_object_add_value_string(ctrl, "controller", ic->c->name);
+	if (ic->c->address)
+		json_object_add_value_string(ctrl, "address", ic->c->address);
+	json_object_add_value_int(ctrl, "numa_node", ic->node);
+
+	queues = json_create_array();
+	for (i = 0; i < ic->nr_queues; i++) {
+		struct irq_queue *q = &ic->queues[i];
+
+		if (q->qid < 0)
+			continue;
+		obj = json_create_object();
+		json_object_add_value_uint(obj, "qid", q->qid);
+		if (q->mapped)
+			json_object_add_value_string(obj, "cpus",
+				irq_cpulist(&q->cpus, buf, sizeof(buf)));
+		if (q->v)
+			json_object_add_value_uint(obj, "vector", q->v->irq);
+		json_array_add_value_object(queues, obj);
+	}
+	json_object_add_value_array(ctrl, "queues", queues);
+
+	vectors = json_create_array();
+	for (i = 0; i < ic->nr_vectors; i++) {
+		struct irq_vector *v = &ic->vectors[i];
+
+		obj = json_create_object();
+		json_object_add_value_uint(obj, "vector", v->irq);
+		qids = json_create_array();
+		for (j = 0; j < ic->nr_queues; j++)
+			if (ic->queues[j].qid >= 0 && ic->queues[j].v == v)
+				json_array_add_value_uint(qids,
+					(unsigned long long)j);
+		json_object_add_value_array(obj, "queues", qids);
+		json_object_add_value_string(obj, "affinity",
+			irq_cpulist(&v->affinity, buf, sizeof(buf)));
+		json_object_add_value_string(obj, "nodes",
+			irq_nodelist(m, &v->affinity, buf, sizeof(buf)));
+		total = irq_total(m, v, &busiest);
+		json_object_add_value_uint(obj, "interrupts", total);
+		if (busiest >= 0) {
+			json_object_add_value_uint(obj, "busiest_cpu", busiest);
+			json_object_add_value_uint(obj,
+				"busiest_cpu_interrupts",
+				v->count->per_cpu[busiest]);
+		}
+		json_array_add_value_object(vectors, obj);
+	}
+	json_object_add_value_array(ctrl, "vectors", vectors);
+
+	warnings = json_create_array();
+	for (i = 0; i < ic->nr_warnings; i++)
+		json_array_add_value_string(warnings, ic->warnings[i]);
+	json_object_add_value_array(ctrl, "warnings", warnings);
+	return ctrl;
+}
+
+int irq_map(const char *desc, int argc, char **argv)
+{
+	const char *interval = "count the interrupts over this many seconds "\
+		"instead of since boot";
+	const char *output_format = "Output format: normal|json";
+	struct nvme_topology t = { };
+	struct irq_map m = { }, prev = { };
+	struct json_object *root = NULL;
+	struct json_array *ctrls = NULL;
+	enum nvme_print_flags flags;
+	const char *dev = NULL;
+	struct irq_ctrl ic;
+	int err, i, j, shown = 0;
+
+	OPT_ARGS(opts) = {
+		OPT_UINT("interval",     'i', &cfg.interval,      interval),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_END()
+	};
+
+	err = argconfig_parse(argc, argv, desc, opts);
+	if (err)
+		return err;
+
+	err = flags = validate_output_format(cfg.output_format);
+	if (flags < 0)
+		return err;
+	if (flags != JSON && flags != NORMAL) {
+		fprintf(stderr, "Invalid output format\n");
+		return -EINVAL;
+	}
+	if (optind < argc) {
+		dev = strrchr(argv[optind], '/');
+		dev = dev ? dev + 1 : argv[optind];
+	}
+
+	irq_read_nodes(&m);
+	err = irq_read_counts(&m);
+	if (!err && cfg.interval) {
+		prev = m;
+		m.counts = NULL;
+		m.nr_counts = 0;
+		m.cpu_node = NULL;
+		m.nr_cpus = 0;
+		irq_read_nodes(&m);
+		sleep(cfg.interval);
+		err = irq_read_counts(&m);
+		if (!err)
+			irq_sub_counts(&m, &prev);
+		irq_free_counts(&prev);
+		free(prev.cpu_node);
+	}
+	if (err) {
+		fprintf(stderr, "Failed to read " PROC_INTERRUPTS ": %s\n",
+			strerror(-err));
+		goto free;
+	}
+
+	err = scan_subsystems(&t, NULL, 0);
+	if (err) {
+		fprintf(stderr, "Failed to scan subsystems\n");
+		goto free;
+	}
+
+	if (flags == JSON) {
+		root = json_create_object();
+		ctrls = json_create_array();
+	}
+	for (i = 0; i < t.nr_subsystems; i++) {
+		struct nvme_subsystem *s = &t.subsystems[i];
+
+		for (j = 0; j < s->nr_ctrls; j++) {
+			struct nvme_ctrl *c = &s->ctrls[j];
+
+			if (dev && strcmp(dev, c->name))
+				continue;
+			if (irq_scan_ctrl(&m, &ic, c))
+				continue;
+			if (flags == JSON) {
+				json_array_add_value_object(ctrls,
+						irq_json_ctrl(&m, &ic));
+			} else {
+				if (shown)
+					printf("\n");
+				irq_show_ctrl(&m, &ic);
+			}
+			irq_free_ctrl(&ic);
+			shown++;
+		}
+	}
+	if (flags == JSON) {
+		json_object_add_value_array(root, "controllers", ctrls);
+		json_print_object(root, NULL);
+		printf("\n");
+		json_free_object(root);
+	}
+	if (dev && !shown) {
+		fprintf(stderr, "%s: no such NVMe controller\n", dev);
+		err = -ENODEV;
+	}
+	free_topology(&t);
+free:
+	irq_free_counts(&m);
+	free(m.cpu_node);
+	return err;
+}
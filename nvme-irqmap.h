@@ -0,0 +1,6 @@
+#ifndef _NVME_IRQMAP_H
+#define _NVME_IRQMAP_H
+
+extern int irq_map(const char *desc, int argc, char **argv);
+
+#endif
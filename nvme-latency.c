@@ -0,0 +1,577 @@
+/*
+ * nvme latency-stats: command latency percentiles from the latency
+ * histograms drives keep in vendor specific log pages, over the life of
+ * the drive or, with --interval, over each interval between two reads.
+ *
+ * Each layout has a converter to struct nvme_lat_hist; everything past
+ * that, the percentiles, the difference of two reads and the output, is
+ * shared, so that the command reads the same on any drive it knows.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-print.h"
+#include "nvme-latency.h"
+#include "json.h"
+
+int nvme_lat_hist_init(struct nvme_lat_hist *h, int nr_buckets)
+{
+	h->buckets = calloc(nr_buckets, sizeof(*h->buckets));
+	if (!h->buckets)
+		return -ENOMEM;
+	h->nr_buckets = nr_buckets;
+	h->total = 0;
+	return 0;
+}
+
+/*
+ * Buckets of 1us up to 2 << sub_bits us and then, for each power of two,
+ * 1 << sub_bits buckets splitting it evenly, nr_buckets in all, the last
+ * one open ended. Each bucket is within 1 / (1 << sub_bits) of its lower
+ * bound, the precision of the percentiles.
+ */
+static __u64 lat_log2_lower(int i, int sub_bits)
+{
+	int bits;
+
+	if (i < 2 << sub_bits)
+		return i;
+	bits = (i >> sub_bits) - 1;
+	return (1ULL << (bits + sub_bits)) +
+		((__u64)(i & ((1 << sub_bits) - 1)) << bits);
+}
+
+int nvme_lat_hist_init_log2(struct nvme_lat_hist *h, int sub_bits,
+			    int nr_buckets)
+{
+	int i, err;
+
+	err = nvme_lat_hist_init(h, nr_buckets);
+	if (err)
+		return err;
+	for (i = 0; i < nr_buckets; i++) {
+		h->buckets[i].lower_us = lat_log2_lower(i, sub_bits);
+		h->buckets[i].upper_us = i < nr_buckets - 1 ?
+			lat_log2_lower(i + 1, sub_bits) : NVME_LAT_INF;
+	}
+	return 0;
+}
+
+void nvme_lat_hist_free(struct nvme_lat_hist *h)
+{
+	free(h->buckets);
+	h->buckets = NULL;
+	h->nr_buckets = 0;
+}
+
+/* Counts a command of us microseconds in the bucket it falls in */
+void nvme_lat_hist_add(struct nvme_lat_hist *h, __u64 us)
+{
+	int lo = 0, hi = h->nr_buckets - 1, mid;
+
+	if (!h->nr_buckets || us < h->buckets[0].lower_us)
+		return;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (h->buckets[mid].lower_us <= us)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	h->buckets[lo].count++;
+	h->total++;
+}
+
+/*
+ * Sets delta, which must have been initialized with as many buckets, to
+ * what cur counted since prev. Returns -EINVAL if the two have different
+ * buckets and -ERANGE if a count went down, as when the drive was reset
+ * or the statistics cleared, leaving delta undefined.
+ */
+int nvme_lat_hist_sub(struct nvme_lat_hist *delta,
+		      const struct nvme_lat_hist *cur,
+		      const struct nvme_lat_hist *prev)
+{
+	int i;
+
+	if (cur->nr_buckets != prev->nr_buckets ||
+	    delta->nr_buckets != cur->nr_buckets)
+		return -EINVAL;
+
+	delta->total = 0;
+	for (i = 0; i < cur->nr_buckets; i++) {
+		const struct nvme_lat_bucket *c = &cur->buckets[i];
+		const struct nvme_lat_bucket *p = &prev->buckets[i];
+
+		if (c->lower_us != p->lower_us || c->upper_us != p->upper_us)
+			return -EINVAL;
+		if (c->count < p->count)
+			return -ERANGE;
+		delta->buckets[i] = *c;
+		delta->buckets[i].count = c->count - p->count;
+		delta->total += delta->buckets[i].count;
+	}
+	return 0;
+}
+
+/*
+ * The latency below which pct percent of the commands completed, assuming
+ * the commands of a bucket are spread evenly over it. In the open ended
+ * last bucket, that is its lower bound.
+ */
+double nvme_lat_hist_percentile(const struct nvme_lat_hist *h, double pct)
+{
+	const struct nvme_lat_bucket *b;
+	double rank, seen = 0;
+	int i;
+
+	if (!h->total)
+		return 0;
+	rank = h->total * pct / 100;
+	for (i = 0; i < h->nr_buckets; i++) {
+		b = &h->buckets[i];
+		if (!b->count || seen + b->count < rank) {
+			seen += b->count;
+			continue;
+		}
+		if (b->upper_us == NVME_LAT_INF)
+			break;
+		return b->lower_us + (b->upper_us - b->lower_us) *
+			(rank - seen) / b->count;
+	}
+	return h->buckets[h->nr_buckets - 1].lower_us;
+}
+
+/* The upper bound of the slowest bucket that counted any command */
+double nvme_lat_hist_max(const struct nvme_lat_hist *h)
+{
+	int i;
+
+	for (i = h->nr_buckets - 1; i >= 0; i--) {
+		if (!h->buckets[i].count)
+			continue;
+		if (h->buckets[i].upper_us == NVME_LAT_INF)
+			return h->buckets[i].lower_us;
+		return h->buckets[i].upper_us;
+	}
+	return 0;
+}
+
+static bool lat_in_overflow(const struct nvme_lat_hist *h, double us)
+{
+	const struct nvme_lat_bucket *last = &h->buckets[h->nr_buckets - 1];
+
+	return h->total && last->upper_us == NVME_LAT_INF &&
+		us >= last->lower_us;
+}
+
+/*
+ * Revision 3: 32 buckets of 32us, 31 of 1ms from 1ms and 31 of 32ms from
+ * 32ms. The three last entries hold the commands that took a second or
+ * more and are counted in one open ended bucket.
+ */
+static int lat_from_intel_3(struct nvme_lat_hist *h,
+			    const struct intel_lat_stats *stats)
+{
+	int i, err;
+
+	err = nvme_lat_hist_init(h, 95);
+	if (err)
+		return err;
+	for (i = 0; i < 94; i++) {
+		struct nvme_lat_bucket *b = &h->buckets[i];
+
+		if (i < 32)
+			b->lower_us = 32 * i;
+		else if (i < 63)
+			b->lower_us = 1024 * (i - 31);
+		else
+			b->lower_us = 32768 * (i - 62);
+		b->count = le32_to_cpu(stats->data[i]);
+	}
+	for (i = 0; i < 93; i++)
+		h->buckets[i].upper_us = h->buckets[i + 1].lower_us;
+	h->buckets[93].upper_us = 1048576;
+	h->buckets[94].lower_us = 1048576;
+	h->buckets[94].upper_us = NVME_LAT_INF;
+	h->buckets[94].count = le32_to_cpu(stats->data[94]) +
+		le32_to_cpu(stats->data[95]) + le32_to_cpu(stats->data[96]);
+	return 0;
+}
+
+/*
+ * Revisions 4.0 to 4.5: 1216 buckets, of 1us up to 128us and then, for
+ * each power of two, 64 buckets splitting it evenly. The last one is open
+ * ended.
+ */
+static int lat_from_intel_4(struct nvme_lat_hist *h,
+			    const struct intel_lat_stats *stats)
+{
+	int n = ARRAY_SIZE(stats->data), i, err;
+
+	err = nvme_lat_hist_init_log2(h, 6, n);
+	if (err)
+		return err;
+	for (i = 0; i < n; i++)
+		h->buckets[i].count = le32_to_cpu(stats->data[i]);
+	return 0;
+}
+
+/* Returns -ENOTSUP for a revision it does not know the layout of */
+int nvme_lat_hist_from_intel(struct nvme_lat_hist *h,
+			     const struct intel_lat_stats *stats)
+{
+	__u16 maj = le16_to_cpu(stats->maj), min = le16_to_cpu(stats->min);
+	int i, err;
+
+	if (maj == 3)
+		err = lat_from_intel_3(h, stats);
+	else if (maj == 4 && min <= 5)
+		err = lat_from_intel_4(h, stats);
+	else
+		return -ENOTSUP;
+	if (err)
+		return err;
+
+	for (i = 0; i < h->nr_buckets; i++)
+		h->total += h->buckets[i].count;
+	return 0;
+}
+
+/*
+ * The drives with a latency histogram, by PCI vendor id. The log is read
+ * into a buffer of log_len bytes and handed to convert.
+ */
+struct lat_source {
+	const char *vendor;
+	__u16 vid;
+	__u8 read_lid;
+	__u8 write_lid;
+	__u32 log_len;
+	int (*convert)(struct nvme_lat_hist *h, const void *log,
+		       char *revision, size_t len);
+};
+
+static int lat_convert_intel(struct nvme_lat_hist *h, const void *log,
+			     char *revision, size_t len)
+{
+	const struct intel_lat_stats *stats = log;
+
+	snprintf(revision, len, "%u.%u", le16_to_cpu(stats->maj),
+		 le16_to_cpu(stats->min));
+	return nvme_lat_hist_from_intel(h, stats);
+}
+
+static const struct lat_source lat_sources[] = {
+	{ "intel", 0x8086, 0xc1, 0xc2, sizeof(struct intel_lat_stats),
+	  lat_convert_intel },
+	/* drives that moved to Solidigm kept the log */
+	{ "solidigm", 0x025e, 0xc1, 0xc2, sizeof(struct intel_lat_stats),
+	  lat_convert_intel },
+};
+
+static struct config {
+	int write;
+	__u32 interval;
+	__u32 count;
+	int buckets;
+	char *output_format;
+} cfg = {
+	.output_format = "normal",
+};
+
+struct lat_state {
+	const struct lat_source *src;
+	void *log;
+	char revision[16];
+	__u8 lid;
+};
+
+static int lat_read(int fd, struct lat_state *s, struct nvme_lat_hist *h)
+{
+	int err;
+
+	err = nvme_get_log(fd, NVME_NSID_ALL, s->lid, false, s->src->log_len,
+			   s->log);
+	if (err)
+		return err;
+	err = s->src->convert(h, s->log, s->revision, sizeof(s->revision));
+	if (err == -ENOTSUP)
+		fprintf(stderr, "Unsupported %s latency statistics revision %s\n",
+			s->src->vendor, s->revision);
+	return err;
+}
+
+static const double lat_pcts[] = { 50, 90, 99, 99.9 };
+static const char *lat_pct_names[] = { "p50", "p90", "p99", "p99.9" };
+
+char *nvme_lat_us_to_string(double us, char *buf, size_t len)
+{
+	if (us < 1000)
+		snprintf(buf, len, "%.0fus", us);
+	else if (us < 1000000)
+		snprintf(buf, len, "%.2fms", us / 1000);
+	else
+		snprintf(buf, len, "%.2fs", us / 1000000);
+	return buf;
+}
+
+static void lat_show_value(const struct nvme_lat_hist *h, double us)
+{
+	char buf[24], val[32];
+
+	snprintf(val, sizeof(val), "%s%s", lat_in_overflow(h, us) ? ">" : "",
+		 nvme_lat_us_to_string(us, buf, sizeof(buf)));
+	printf(" %10s", val);
+}
+
+static void lat_show_buckets(const struct nvme_lat_hist *h)
+{
+	char lower[24], upper[24];
+	int i;
+
+	for (i = 0; i < h->nr_buckets; i++) {
+		const struct nvme_lat_bucket *b = &h->buckets[i];
+
+		if (!b->count)
+			continue;
+		nvme_lat_us_to_string(b->lower_us, lower, sizeof(lower));
+		if (b->upper_us == NVME_LAT_INF)
+			snprintf(upper, sizeof(upper), "+INF");
+		else
+			nvme_lat_us_to_string(b->upper_us, upper,
+					      sizeof(upper));
+		printf("  %10s - %-10s %20"PRIu64"\n", lower, upper,
+		       (uint64_t)b->count);
+	}
+}
+
+static void lat_show(struct lat_state *s, const struct nvme_lat_hist *h,
+		     double seconds, bool header)
+{
+	char when[16];
+	int i;
+
+	if (header) {
+		printf("%s latency of %s (%s log %#x, revision %s)\n",
+		       cfg.write ? "Write" : "Read", devicename, s->src->vendor,
+		       s->lid, s->revision);
+		printf("%-10s %12s", "interval", "commands");
+		for (i = 0; i < ARRAY_SIZE(lat_pct_names); i++)
+			printf(" %10s", lat_pct_names[i]);
+		printf(" %10s\n", "max");
+	}
+
+	if (seconds)
+		snprintf(when, sizeof(when), "%.1fs", seconds);
+	else
+		snprintf(when, sizeof(when), "lifetime");
+	printf("%-10s %12"PRIu64, when, (uint64_t)h->total);
+	for (i = 0; i < ARRAY_SIZE(lat_pcts); i++)
+		lat_show_value(h, nvme_lat_hist_percentile(h, lat_pcts[i]));
+	lat_show_value(h, nvme_lat_hist_max(h));
+	printf("\n");
+	if (cfg.buckets)
+		lat_show_buckets(h);
+}
+
+static void lat_json(struct lat_state *s, const struct nvme_lat_hist *h,
+		     double seconds)
+{
+	const struct nvme_lat_bucket *last = &h->buckets[h->nr_buckets - 1];
+	struct json_object *root, *bucket;
+	struct json_array *buckets;
+	char name[24];
+	int i;
+
+	root = json_create_object();
+	json_object_add_value_string(root, "device", devicename);
+	json_object_add_value_string(root, "vendor", s->src->vendor);
+	json_object_add_value_uint(root, "log_id", s->lid);
+	json_object_add_value_string(root, "revision", s->revision);
+	json_object_add_value_string(root, "direction",
+				     cfg.write ? "write" : "read");
+	if (seconds)
+		json_object_add_value_float(root, "seconds", seconds);
+	json_object_add_value_uint(root, "commands", h->total);
+	for (i = 0; i < ARRAY_SIZE(lat_pcts); i++) {
+		snprintf(name, sizeof(name), "%s_us", lat_pct_names[i]);
+		json_object_add_value_uint(root, name,
+			nvme_lat_hist_percentile(h, lat_pcts[i]));
+	}
+	json_object_add_value_uint(root, "max_us", nvme_lat_hist_max(h));
+	/* percentiles at or past this are a lower bound */
+	if (last->upper_us == NVME_LAT_INF) {
+		json_object_add_value_uint(root, "overflow_us", last->lower_us);
+		json_object_add_value_uint(root, "overflow_commands",
+					   last->count);
+	}
+
+	if (cfg.buckets) {
+		buckets = json_create_array();
+		for (i = 0; i < h->nr_buckets; i++) {
+			if (!h->buckets[i].count)
+				continue;
+			bucket = json_create_object();
+			json_object_add_value_uint(bucket, "lower_us",
+						   h->buckets[i].lower_us);
+			if (h->buckets[i].upper_us != NVME_LAT_INF)
+				json_object_add_value_uint(bucket, "upper_us",
+						h->buckets[i].upper_us);
+			json_object_add_value_uint(bucket, "count",
+						   h->buckets[i].count);
+			json_array_add_value_object(buckets, bucket);
+		}
+		json_object_add_value_array(root, "buckets", buckets);
+	}
+
+	json_print_object(root, NULL);
+	printf("\n");
+	json_free_object(root);
+}
+
+static __u64 lat_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int lat_interval(int fd, struct lat_state *s, struct nvme_lat_hist *prev,
+			enum nvme_print_flags flags)
+{
+	struct nvme_lat_hist cur = { }, delta = { };
+	struct timespec start, next;
+	__u64 last, now;
+	__u32 i;
+	int err;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	last = lat_usecs();
+	for (i = 1; !cfg.count || i <= cfg.count; i++) {
+		next.tv_sec = start.tv_sec + (time_t)cfg.interval * i;
+		next.tv_nsec = start.tv_nsec;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+				       NULL) == EINTR)
+			;
+
+		err = lat_read(fd, s, &cur);
+		if (err)
+			break;
+		now = lat_usecs();
+
+		err = nvme_lat_hist_init(&delta, cur.nr_buckets);
+		if (err)
+			break;
+		err = nvme_lat_hist_sub(&delta, &cur, prev);
+		if (err == -ERANGE || err == -EINVAL) {
+			fprintf(stderr, "%s: latency statistics were reset, "
+				"starting over\n", devicename);
+			err = 0;
+		} else if (!err) {
+			if (flags == JSON)
+				lat_json(s, &delta, (now - last) / 1e6);
+			else
+				lat_show(s, &delta, (now - last) / 1e6, false);
+			fflush(stdout);
+		}
+		nvme_lat_hist_free(&delta);
+		nvme_lat_hist_free(prev);
+		*prev = cur;
+		cur.buckets = NULL;
+		last = now;
+		if (err)
+			break;
+	}
+	nvme_lat_hist_free(&cur);
+	return err;
+}
+
+int latency_stats(const char *desc, int argc, char **argv)
+{
+	const char *write = "show the latency of writes instead of reads";
+	const char *interval = "read the histogram again every interval "\
+		"seconds and show the latency of the commands in between";
+	const char *count = "number of intervals to show, 0 to run until "\
+		"interrupted";
+	const char *buckets = "also show the non-empty buckets";
+	const char *output_format = "Output format: normal|json";
+	struct lat_state s = { };
+	struct nvme_lat_hist h = { };
+	struct nvme_id_ctrl id;
+	enum nvme_print_flags flags;
+	int fd, err, i;
+
+	OPT_ARGS(opts) = {
+		OPT_FLAG("write",        'w', &cfg.write,         write),
+		OPT_UINT("interval",     'i', &cfg.interval,      interval),
+		OPT_UINT("count",        'c', &cfg.count,         count),
+		OPT_FLAG("buckets",      'B', &cfg.buckets,       buckets),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_END()
+	};
+
+	err = fd = parse_and_open(argc, argv, desc, opts);
+	if (fd < 0)
+		return err;
+
+	err = flags = validate_output_format(cfg.output_format);
+	if (flags < 0)
+		goto close_fd;
+	if (flags != JSON && flags != NORMAL) {
+		fprintf(stderr, "Invalid output format\n");
+		err = -EINVAL;
+		goto close_fd;
+	}
+
+	err = nvme_identify_ctrl(fd, &id);
+	if (err)
+		goto show_err;
+	for (i = 0; i < ARRAY_SIZE(lat_sources); i++)
+		if (lat_sources[i].vid == le16_to_cpu(id.vid))
+			s.src = &lat_sources[i];
+	if (!s.src) {
+		fprintf(stderr, "%s: no known latency histogram for PCI vendor "
+			"%#06x\n", devicename, le16_to_cpu(id.vid));
+		err = -ENOTSUP;
+		goto close_fd;
+	}
+	s.lid = cfg.write ? s.src->write_lid : s.src->read_lid;
+	s.log = calloc(1, s.src->log_len);
+	if (!s.log) {
+		err = -ENOMEM;
+		goto close_fd;
+	}
+
+	err = lat_read(fd, &s, &h);
+	if (err)
+		goto free;
+	if (flags == JSON)
+		lat_json(&s, &h, 0);
+	else
+		lat_show(&s, &h, 0, true);
+	if (cfg.interval) {
+		fflush(stdout);
+		err = lat_interval(fd, &s, &h, flags);
+	}
+free:
+	nvme_lat_hist_free(&h);
+	free(s.log);
+show_err:
+	if (err > 0)
+		nvme_show_status(err);
+	else if (err < 0 && err != -ENOTSUP)
+		perror("latency-stats");
+close_fd:
+	close(fd);
+	return err;
+}
@@ -0,0 +1,53 @@
+#ifndef _NVME_LATENCY_H
+#define _NVME_LATENCY_H
+
+/*
+ * A command latency histogram independent of the log it was read from:
+ * buckets of [lower_us, upper_us) microseconds, in increasing order and
+ * without gaps, the last one possibly open ended. Vendor logs are turned
+ * into it by their converter, so that percentiles and the change between
+ * two reads are computed the same way for every drive.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/types.h>
+
+#define NVME_LAT_INF		UINT64_MAX
+
+struct nvme_lat_bucket {
+	__u64	lower_us;
+	__u64	upper_us;		/* NVME_LAT_INF for the last bucket */
+	__u64	count;
+};
+
+struct nvme_lat_hist {
+	int	nr_buckets;
+	struct nvme_lat_bucket *buckets;
+	__u64	total;
+};
+
+int nvme_lat_hist_init(struct nvme_lat_hist *h, int nr_buckets);
+int nvme_lat_hist_init_log2(struct nvme_lat_hist *h, int sub_bits,
+			    int nr_buckets);
+void nvme_lat_hist_free(struct nvme_lat_hist *h);
+void nvme_lat_hist_add(struct nvme_lat_hist *h, __u64 us);
+int nvme_lat_hist_sub(struct nvme_lat_hist *delta,
+		      const struct nvme_lat_hist *cur,
+		      const struct nvme_lat_hist *prev);
+double nvme_lat_hist_percentile(const struct nvme_lat_hist *h, double pct);
+double nvme_lat_hist_max(const struct nvme_lat_hist *h);
+char *nvme_lat_us_to_string(double us, char *buf, size_t len);
+
+/* Intel latency statistics, log pages 0xc1 (reads) and 0xc2 (writes) */
+struct intel_lat_stats {
+	__u16 maj;
+	__u16 min;
+	__u32 data[1216];
+};
+
+int nvme_lat_hist_from_intel(struct nvme_lat_hist *h,
+			     const struct intel_lat_stats *stats);
+
+extern int latency_stats(const char *desc, int argc, char **argv);
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * The shared memory page nvme daemon --shm keeps the latest health of each
+ * controller in, and what it takes to read it. Only libc is needed here.
+ *
+ * There is a single writer, the daemon. It makes a slot's sequence count
+ * odd, updates the slot and makes the count even again; a reader copies
+ * the slot between two reads of the count and retries when the count was
+ * odd or changed. Readers never write to the segment, so any number of
+ * them can map it read only, and a reader holding a copy never delays the
+ * writer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nvme-metrics-shm.h"
+
+/* a slot is rewritten in well under a microsecond */
+#define METRICS_READ_RETRIES	1000
+
+#define METRICS_ALIGN(x)	(((x) + 63) & ~63UL)
+
+struct nvme_metrics {
+	char name[NAME_MAX];
+	size_t len;
+	struct nvme_metrics_hdr *hdr;
+	char *slots;
+};
+
+static void *metrics_slot(struct nvme_metrics *m, int slot)
+{
+	return m->slots + (size_t)slot * m->hdr->slot_size;
+}
+
+struct nvme_metrics *nvme_metrics_open(const char *name)
+{
+	struct nvme_metrics *m;
+	struct nvme_metrics_hdr hdr;
+	struct stat st;
+	int fd, ret;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		goto free;
+	if (fstat(fd, &st))
+		goto close;
+
+	/* the writer sets the magic last */
+	errno = EAGAIN;
+	if (st.st_size < sizeof(hdr) ||
+	    pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, NVME_METRICS_MAGIC, sizeof(hdr.magic)))
+		goto close;
+
+	errno = EINVAL;
+	if (hdr.version != NVME_METRICS_VERSION ||
+	    hdr.hdr_size < sizeof(hdr) ||
+	    hdr.slot_size < sizeof(struct nvme_metrics_ctrl) ||
+	    hdr.nr_lat_buckets != NVME_METRICS_LAT_BUCKETS ||
+	    st.st_size < hdr.hdr_size + (off_t)hdr.nr_slots * hdr.slot_size)
+		goto close;
+
+	m->len = st.st_size;
+	m->hdr = mmap(NULL, m->len, PROT_READ, MAP_SHARED, fd, 0);
+	if (m->hdr == MAP_FAILED)
+		goto close;
+	m->slots = (char *)m->hdr + hdr.hdr_size;
+	close(fd);
+	return m;
+close:
+	ret = errno;
+	close(fd);
+	errno = ret;
+free:
+	free(m);
+	return NULL;
+}
+
+void nvme_metrics_close(struct nvme_metrics *m)
+{
+	munmap(m->hdr, m->len);
+	free(m);
+}
+
+int nvme_metrics_nr_slots(struct nvme_metrics *m)
+{
+	return m->hdr->nr_slots;
+}
+
+const struct nvme_metrics_hdr *nvme_metrics_hdr(struct nvme_metrics *m)
+{
+	return m->hdr;
+}
+
+/*
+ * Copies a consistent snapshot of slot. Returns -ENOENT if no controller
+ * is in it, -EAGAIN if the writer kept changing it, which only happens if
+ * the writer died while changing it.
+ */
+int nvme_metrics_read(struct nvme_metrics *m, int slot,
+		      struct nvme_metrics_ctrl *ctrl)
+{
+	struct nvme_metrics_ctrl *s;
+	__u32 seq;
+	int i;
+
+	if (slot < 0 || slot >= m->hdr->nr_slots)
+		return -EINVAL;
+	s = metrics_slot(m, slot);
+
+	for (i = 0; i < METRICS_READ_RETRIES; i++) {
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(ctrl, s, sizeof(*ctrl));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		ctrl->seq = seq;
+		return ctrl->flags & NVME_METRICS_VALID ? 0 : -ENOENT;
+	}
+	return -EAGAIN;
+}
+
+/* Upper bound of the latency below which pct percent of the samples are */
+__u64 nvme_metrics_lat_percentile(const struct nvme_metrics_lat *lat,
+				  double pct)
+{
+	double rank = lat->count * pct / 100;
+	__u64 sum = 0, want = rank, bound;
+	int i;
+
+	if (!lat->count)
+		return 0;
+	if (want < rank || !want)
+		want++;
+	for (i = 0; i < NVME_METRICS_LAT_BUCKETS - 1; i++) {
+		sum += lat->bucket[i];
+		if (sum >= want)
+			break;
+	}
+	bound = i < NVME_METRICS_LAT_BUCKETS - 1 ? (2ULL << i) - 1 : lat->max_us;
+	return bound < lat->max_us ? bound : lat->max_us;
+}
+
+void nvme_metrics_lat_add(struct nvme_metrics_lat *lat, __u64 us)
+{
+	int i;
+
+	for (i = 0; i < NVME_METRICS_LAT_BUCKETS - 1 && us >= (2ULL << i); i++)
+		;
+	lat->bucket[i]++;
+	lat->count++;
+	lat->sum_us += us;
+	if (us > lat->max_us)
+		lat->max_us = us;
+}
+
+/*
+ * A previous writer's segment is unlinked rather than reused: its readers
+ * keep their mapping of it, with every slot invalid if the writer exited
+ * cleanly, and only new readers see the new one once its magic is set.
+ */
+struct nvme_metrics *nvme_metrics_create(const char *name)
+{
+	struct nvme_metrics *m;
+	struct nvme_metrics_hdr *hdr;
+	struct timespec ts;
+	size_t hdr_size = METRICS_ALIGN(sizeof(*hdr));
+	size_t slot_size = METRICS_ALIGN(sizeof(struct nvme_metrics_ctrl));
+	int fd, ret;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	if (strlen(name) >= sizeof(m->name)) {
+		errno = ENAMETOOLONG;
+		goto free;
+	}
+	strcpy(m->name, name);
+
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		goto free;
+	/* not to depend on the umask to be readable by all */
+	m->len = hdr_size + NVME_METRICS_SLOTS * slot_size;
+	if (fchmod(fd, 0644) || ftruncate(fd, m->len))
+		goto unlink;
+
+	m->hdr = mmap(NULL, m->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (m->hdr == MAP_FAILED)
+		goto unlink;
+	close(fd);
+
+	hdr = m->hdr;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	hdr->version = NVME_METRICS_VERSION;
+	hdr->hdr_size = hdr_size;
+	hdr->slot_size = slot_size;
+	hdr->nr_slots = NVME_METRICS_SLOTS;
+	hdr->nr_lat_buckets = NVME_METRICS_LAT_BUCKETS;
+	hdr->pid = getpid();
+	hdr->started = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(hdr->magic, NVME_METRICS_MAGIC, sizeof(hdr->magic));
+	m->slots = (char *)hdr + hdr_size;
+	return m;
+unlink:
+	ret = errno;
+	close(fd);
+	shm_unlink(name);
+	errno = ret;
+free:
+	free(m);
+	return NULL;
+}
+
+/* Empties every slot, so that readers still mapping it notice */
+void nvme_metrics_destroy(struct nvme_metrics *m)
+{
+	struct nvme_metrics_ctrl empty = { };
+	int i;
+
+	for (i = 0; i < m->hdr->nr_slots; i++)
+		nvme_metrics_publish(m, i, &empty);
+	shm_unlink(m->name);
+	nvme_metrics_close(m);
+}
+
+void nvme_metrics_publish(struct nvme_metrics *m, int slot,
+			  const struct nvme_metrics_ctrl *ctrl)
+{
+	struct nvme_metrics_ctrl *s = metrics_slot(m, slot);
+	size_t off = offsetof(struct nvme_metrics_ctrl, flags);
+	__u32 seq = s->seq;
+
+	__atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy((char *)s + off, (const char *)ctrl + off, sizeof(*s) - off);
+	__atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
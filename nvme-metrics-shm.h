@@ -0,0 +1,94 @@
+#ifndef _NVME_METRICS_SHM_H
+#define _NVME_METRICS_SHM_H
+
+/*
+ * Layout of the shared memory page nvme daemon --shm publishes, and the
+ * functions to read it. A reader maps the segment once and from then on
+ * gets a consistent copy of a controller's slot without any system call.
+ * This header and nvme-metrics-shm.c only need libc, so that another
+ * program can build them in to read the segment.
+ *
+ * The segment is a header followed by nr_slots slots of slot_size bytes,
+ * each guarded by a sequence count that is odd while the slot is written.
+ * Fields are only ever appended to the slot, in a new minor revision; a
+ * reader copies the part it knows. A new NVME_METRICS_VERSION means the
+ * layout changed incompatibly.
+ */
+#include <stdbool.h>
+#include <linux/types.h>
+
+#define NVME_METRICS_SHM		"/nvme-metrics"
+#define NVME_METRICS_MAGIC		"NVMEMETR"
+#define NVME_METRICS_VERSION		1
+#define NVME_METRICS_SLOTS		1024
+
+/*
+ * Bucket i counts latencies below 2 << i microseconds and, but for the
+ * first, not below 1 << i. The last bucket counts everything longer.
+ */
+#define NVME_METRICS_LAT_BUCKETS	32
+
+/* slot flags */
+#define NVME_METRICS_VALID		(1 << 0)	/* slot is in use */
+#define NVME_METRICS_ID			(1 << 1)	/* sn, mn and fr are set */
+#define NVME_METRICS_SMART		(1 << 2)	/* smart holds a log */
+
+struct nvme_metrics_hdr {
+	char	magic[8];
+	__u16	version;
+	__u16	minor;
+	__u32	hdr_size;		/* offset of the first slot */
+	__u32	slot_size;
+	__u32	nr_slots;
+	__u32	nr_lat_buckets;
+	__u32	pid;			/* of the writer */
+	__u64	started;		/* microseconds since the epoch */
+	__u8	rsvd40[24];
+};
+
+struct nvme_metrics_lat {
+	__u64	count;
+	__u64	sum_us;
+	__u64	max_us;
+	__u64	bucket[NVME_METRICS_LAT_BUCKETS];
+};
+
+struct nvme_metrics_ctrl {
+	__u32	seq;
+	__u32	flags;
+	/* strings are NUL terminated */
+	char	name[32];		/* controller, "nvme0" */
+	char	sn[24];
+	char	mn[48];
+	char	fr[12];
+	__u8	rsvd124[4];
+	__u64	updated;		/* microseconds since the epoch */
+	__u64	smart_at;		/* when smart was read, same unit */
+	__s32	smart_err;		/* of the last read: errno < 0, status > 0 */
+	__u16	temperature;		/* composite, Kelvin */
+	__u8	critical_warning;
+	__u8	rsvd151;
+	__u8	smart[512];		/* struct nvme_smart_log */
+	struct nvme_metrics_lat admin_lat;	/* of the commands the writer sent */
+};
+
+struct nvme_metrics;
+
+/* reading */
+struct nvme_metrics *nvme_metrics_open(const char *name);
+void nvme_metrics_close(struct nvme_metrics *m);
+int nvme_metrics_nr_slots(struct nvme_metrics *m);
+const struct nvme_metrics_hdr *nvme_metrics_hdr(struct nvme_metrics *m);
+int nvme_metrics_read(struct nvme_metrics *m, int slot,
+		      struct nvme_metrics_ctrl *ctrl);
+__u64 nvme_metrics_lat_percentile(const struct nvme_metrics_lat *lat,
+				  double pct);
+
+/* writing, for a single writer */
+struct nvme_metrics *nvme_metrics_create(const char *name);
+void nvme_metrics_destroy(struct nvme_metrics *m);
+void nvme_metrics_publish(struct nvme_metrics *m, int slot,
+			  const struct nvme_metrics_ctrl *ctrl);
+void nvme_metrics_lat_add(struct nvme_metrics_lat *lat, __u64 us);
+
+#endif
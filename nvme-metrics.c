@@ -0,0 +1,165 @@
+/*
+ * nvme metrics: shows what nvme daemon --shm publishes, through the reader
+ * of nvme-metrics-shm.c, without sending anything to the drives.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "nvme.h"
+#include "nvme-print.h"
+#include "nvme-metrics-shm.h"
+#include "nvme-metrics.h"
+
+static struct config {
+	char *shm;
+	char *output_format;
+} cfg = {
+	.shm = NVME_METRICS_SHM,
+	.output_format = "normal",
+};
+
+static void metrics_print(struct nvme_metrics_ctrl *c, __u64 now)
+{
+	struct nvme_smart_log *smart = (struct nvme_smart_log *)c->smart;
+	struct nvme_metrics_lat *lat = &c->admin_lat;
+	char age[16] = "-", temp[8] = "-", used[8] = "-", spare[8] = "-";
+
+	if (c->flags & NVME_METRICS_SMART) {
+		snprintf(age, sizeof(age), "%llus",
+			 now > c->smart_at ? (now - c->smart_at) / 1000000 : 0);
+		snprintf(temp, sizeof(temp), "%dC", c->temperature - 273);
+		snprintf(used, sizeof(used), "%u%%", smart->percent_used);
+		snprintf(spare, sizeof(spare), "%u%%", smart->avail_spare);
+	}
+	printf("%-10s %-20.20s %7s %5s 0x%02x %5s %5s %9llu %7llu %7llu %7llu %8llu\n",
+	       c->name, c->flags & NVME_METRICS_ID ? c->sn : "-", age, temp,
+	       c->critical_warning, used, spare, lat->count,
+	       lat->count ? lat->sum_us / lat->count : 0,
+	       nvme_metrics_lat_percentile(lat, 50),
+	       nvme_metrics_lat_percentile(lat, 99), lat->max_us);
+}
+
+static void metrics_json(struct nvme_metrics_ctrl *c, struct json_array *array)
+{
+	struct nvme_smart_log *smart = (struct nvme_smart_log *)c->smart;
+	struct nvme_metrics_lat *lat = &c->admin_lat;
+	struct json_object *o = json_create_object();
+	struct json_object *l = json_create_object();
+	struct json_array *buckets = json_create_array();
+	int i;
+
+	json_object_add_value_string(o, "name", c->name);
+	if (c->flags & NVME_METRICS_ID) {
+		json_object_add_value_string(o, "serial", c->sn);
+		json_object_add_value_string(o, "model", c->mn);
+		json_object_add_value_string(o, "firmware", c->fr);
+	}
+	json_object_add_value_uint(o, "updated", c->updated);
+	json_object_add_value_int(o, "smart_status", c->smart_err);
+	if (c->flags & NVME_METRICS_SMART) {
+		json_object_add_value_uint(o, "smart_at", c->smart_at);
+		json_object_add_value_int(o, "critical_warning",
+					  c->critical_warning);
+		json_object_add_value_int(o, "temperature", c->temperature);
+		json_object_add_value_int(o, "percent_used",
+					  smart->percent_used);
+		json_object_add_value_int(o, "avail_spare", smart->avail_spare);
+	}
+
+	json_object_add_value_uint(l, "count", lat->count);
+	json_object_add_value_uint(l, "sum_us", lat->sum_us);
+	json_object_add_value_uint(l, "max_us", lat->max_us);
+	json_object_add_value_uint(l, "p50_us",
+				   nvme_metrics_lat_percentile(lat, 50));
+	json_object_add_value_uint(l, "p99_us",
+				   nvme_metrics_lat_percentile(lat, 99));
+	for (i = 0; i < NVME_METRICS_LAT_BUCKETS; i++) {
+		struct json_object *b;
+
+		if (!lat->bucket[i])
+			continue;
+		b = json_create_object();
+		json_object_add_value_uint(b, "below_us",
+				i < NVME_METRICS_LAT_BUCKETS - 1 ? 2ULL << i : 0);
+		json_object_add_value_uint(b, "count", lat->bucket[i]);
+		json_array_add_value_object(buckets, b);
+	}
+	json_object_add_value_array(l, "histogram", buckets);
+	json_object_add_value_object(o, "admin_latency", l);
+	json_array_add_value_object(array, o);
+}
+
+int metrics(const char *desc, int argc, char **argv)
+{
+	const char *shm = "shared memory segment to read (default " NVME_METRICS_SHM ")";
+	const char *output_format = "Output format: normal|json";
+	struct nvme_metrics_ctrl c;
+	struct json_object *root = NULL;
+	struct json_array *array = NULL;
+	struct nvme_metrics *m;
+	struct timespec ts;
+	int ret, i, nr = 0;
+	__u64 now;
+
+	OPT_ARGS(opts) = {
+		OPT_STRING("shm",        'm', "NAME", &cfg.shm,   shm),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_END()
+	};
+
+	ret = argconfig_parse(argc, argv, desc, opts);
+	if (ret)
+		return ret;
+	if (strcmp(cfg.output_format, "normal") &&
+	    strcmp(cfg.output_format, "json")) {
+		fprintf(stderr, "invalid output format\n");
+		return -EINVAL;
+	}
+
+	m = nvme_metrics_open(cfg.shm);
+	if (!m) {
+		ret = -errno;
+		fprintf(stderr, "Failed to open %s: %s\n", cfg.shm,
+			errno == ENOENT ? "is nvme daemon running with --shm?" :
+			strerror(errno));
+		return ret;
+	}
+	if (!strcmp(cfg.output_format, "json")) {
+		root = json_create_object();
+		array = json_create_array();
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	now = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	for (i = 0; i < nvme_metrics_nr_slots(m); i++) {
+		if (nvme_metrics_read(m, i, &c))
+			continue;
+		/* not to trust the writer blindly */
+		c.sn[sizeof(c.sn) - 1] = c.mn[sizeof(c.mn) - 1] = '\0';
+		c.fr[sizeof(c.fr) - 1] = c.name[sizeof(c.name) - 1] = '\0';
+		if (array) {
+			metrics_json(&c, array);
+			continue;
+		}
+		if (!nr++)
+			printf("%-10s %-20s %7s %5s %4s %5s %5s %9s %7s %7s %7s %8s\n",
+			       "Controller", "Serial", "Age", "Temp", "CW",
+			       "Used", "Spare", "Admin", "avg_us", "p50_us",
+			       "p99_us", "max_us");
+		metrics_print(&c, now);
+	}
+
+	if (root) {
+		json_object_add_value_uint(root, "writer_pid",
+					  nvme_metrics_hdr(m)->pid);
+		json_object_add_value_array(root, "controllers", array);
+		json_print_object(root, NULL);
+		printf("\n");
+		json_free_object(root);
+	}
+	nvme_metrics_close(m);
+	return 0;
+}
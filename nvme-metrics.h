@@ -0,0 +1,6 @@
+#ifndef _NVME_METRICS_H
+#define _NVME_METRICS_H
+
+extern int metrics(const char *desc, int argc, char **argv);
+
+#endif
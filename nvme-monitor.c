@@ -0,0 +1,1024 @@
+/*
+ * nvme monitor: follows NVMe topology changes through kernel uevents and
+ * reports them as a stream of JSON objects, one per line.
+ *
+ * The topology is scanned once at startup and then updated from the events
+ * alone. Events can also be replayed from a recording, in which case sysfs
+ * is never consulted, so that the tracking logic can be exercised without
+ * the hardware that produced them, unless --live says that the events are
+ * those of this machine as they happen, as from a udevadm monitor pipe.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "nvme.h"
+#include "nvme-monitor.h"
+
+#define UEVENT_BUF_SIZE		8192
+#define UEVENT_MAX_ENV		64
+#define UEVENT_RCVBUF		(4 * 1024 * 1024)
+
+/* Updates between nvme_topology_compact() calls */
+#define MONITOR_COMPACT		256
+
+struct uevent {
+	__u64 usec;		/* CLOCK_MONOTONIC, or as recorded */
+	char *action;
+	char *devpath;
+	char *subsystem;
+	char *name;		/* last component of devpath */
+	int nr_env;
+	char *env[UEVENT_MAX_ENV];
+	char buf[UEVENT_BUF_SIZE];
+};
+
+/*
+ * Where events come from. read() returns 1 for an event, 0 when none is
+ * pending, -ENOBUFS when events were lost and a negative errno or EOF
+ * (-1) otherwise. Events that could not be parsed have a NULL action.
+ */
+struct uevent_source {
+	int fd;			/* pollable, or -1 if read() never blocks */
+	FILE *file;
+	bool live;		/* sysfs reflects the events */
+	int (*read)(struct uevent_source *src, struct uevent *ev);
+};
+
+struct outage {
+	char *key;
+	char *subsysnqn;	/* NULL if not known when it began */
+	__u64 usec;
+};
+
+struct monitor {
+	struct nvme_topology t;
+	struct uevent_source *src;
+	FILE *record;
+
+	int nr_outages;
+	struct outage *outages;
+
+	unsigned int updates;
+};
+
+static struct config {
+	char *replay;
+	char *record;
+	int interval;
+	bool live;
+} cfg = {
+	.interval = 1000,
+};
+
+static volatile sig_atomic_t monitor_stop;
+
+static void monitor_signal(int sig)
+{
+	monitor_stop = 1;
+}
+
+static __u64 monotonic_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static const char *uevent_get(struct uevent *ev, const char *key)
+{
+	size_t len = strlen(key);
+	int i;
+
+	for (i = 0; i < ev->nr_env; i++)
+		if (!strncmp(ev->env[i], key, len) && ev->env[i][len] == '=')
+			return ev->env[i] + len + 1;
+	return NULL;
+}
+
+/* Picks out the fields every handler needs once the environment is parsed */
+static void uevent_finish(struct uevent *ev)
+{
+	char *p;
+
+	ev->action = (char *)uevent_get(ev, "ACTION");
+	ev->devpath = (char *)uevent_get(ev, "DEVPATH");
+	ev->subsystem = (char *)uevent_get(ev, "SUBSYSTEM");
+	p = ev->devpath ? strrchr(ev->devpath, '/') : NULL;
+	if (!ev->subsystem || !p || !p[1]) {
+		/* not something we can make sense of, skip it */
+		ev->action = NULL;
+		return;
+	}
+	ev->name = p + 1;
+}
+
+static int netlink_read(struct uevent_source *src, struct uevent *ev)
+{
+	struct sockaddr_nl addr;
+	struct iovec iov = {
+		.iov_base = ev->buf,
+		.iov_len = sizeof(ev->buf) - 1,
+	};
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	ssize_t len;
+	char *p;
+
+	len = recvmsg(src->fd, &msg, MSG_DONTWAIT);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -errno;
+
+	/* only the kernel itself may tell us about devices */
+	if (addr.nl_pid)
+		return 0;
+
+	ev->buf[len] = '\0';
+	ev->usec = monotonic_usec();
+	ev->nr_env = 0;
+
+	/* "action@devpath", followed by the KEY=value environment */
+	for (p = ev->buf + strlen(ev->buf) + 1; p < ev->buf + len;
+	     p += strlen(p) + 1) {
+		if (strchr(p, '=') && ev->nr_env < UEVENT_MAX_ENV)
+			ev->env[ev->nr_env++] = p;
+	}
+	uevent_finish(ev);
+	return 1;
+}
+
+static int netlink_open(struct uevent_source *src)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,		/* kernel events, not udev's */
+	};
+	int size = UEVENT_RCVBUF;
+
+	src->fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+			 NETLINK_KOBJECT_UEVENT);
+	if (src->fd < 0)
+		return -errno;
+
+	/* connect-all can produce bursts of events, try not to drop any */
+	if (setsockopt(src->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+		       sizeof(size)))
+		setsockopt(src->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	if (bind(src->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(src->fd);
+		return -errno;
+	}
+	src->live = true;
+	src->read = netlink_read;
+	return 0;
+}
+
+/*
+ * Recordings use the format of 'udevadm monitor --kernel --property': a
+ * "KERNEL[seconds] action devpath (subsystem)" line followed by the
+ * environment, one KEY=value per line, and an empty line. UDEV events and
+ * other lines are skipped, so plain udevadm output can be replayed too.
+ */
+static int replay_read(struct uevent_source *src, struct uevent *ev)
+{
+	char line[1024], *p = ev->buf;
+	bool in_event = false, skip = false;
+	unsigned long long sec, usec;
+
+	ev->nr_env = 0;
+	ev->usec = 0;
+	while (fgets(line, sizeof(line), src->file)) {
+		size_t len = strcspn(line, "\n");
+
+		line[len] = '\0';
+		if (!len) {
+			if (in_event)
+				break;
+			skip = false;
+			continue;
+		}
+		if (!strncmp(line, "UDEV", 4)) {
+			skip = true;
+			continue;
+		}
+		if (sscanf(line, "KERNEL[%llu.%llu]", &sec, &usec) == 2) {
+			ev->usec = sec * 1000000ULL + usec;
+			skip = false;
+			in_event = true;
+			continue;
+		}
+		if (skip || !strchr(line, '=') || ev->nr_env == UEVENT_MAX_ENV ||
+		    p + len + 1 > ev->buf + sizeof(ev->buf))
+			continue;
+
+		in_event = true;
+		memcpy(p, line, len + 1);
+		ev->env[ev->nr_env++] = p;
+		p += len + 1;
+	}
+
+	if (!in_event)
+		return -1;
+	uevent_finish(ev);
+	return 1;
+}
+
+static int replay_open(struct uevent_source *src, const char *path)
+{
+	src->file = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!src->file)
+		return -errno;
+	src->fd = -1;
+	src->live = false;
+	src->read = replay_read;
+	return 0;
+}
+
+static void record_event(struct monitor *m, struct uevent *ev)
+{
+	int i;
+
+	if (!m->record)
+		return;
+
+	fprintf(m->record, "KERNEL[%llu.%06llu] %s %s (%s)\n",
+		ev->usec / 1000000, ev->usec % 1000000, ev->action,
+		ev->devpath, ev->subsystem);
+	for (i = 0; i < ev->nr_env; i++)
+		fprintf(m->record, "%s\n", ev->env[i]);
+	fprintf(m->record, "\n");
+	fflush(m->record);
+}
+
+static void json_add_str(struct json_object *root, const char *name,
+			 const char *value)
+{
+	if (value)
+		json_object_add_value_string(root, name, value);
+}
+
+/*
+ * Live events carry the wall clock time they were seen at, replayed events
+ * the time recorded for them, which is relative to the recording system's
+ * boot.
+ */
+static struct json_object *monitor_event(struct monitor *m, __u64 usec,
+					 const char *event, const char *device)
+{
+	struct json_object *root = json_create_object();
+	char ts[64];
+
+	if (m->src->live) {
+		struct timespec now;
+		struct tm tm;
+		size_t len;
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		gmtime_r(&now.tv_sec, &tm);
+		len = strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+		snprintf(ts + len, sizeof(ts) - len, ".%06ldZ",
+			 now.tv_nsec / 1000);
+	} else {
+		snprintf(ts, sizeof(ts), "%llu.%06llu", usec / 1000000,
+			 usec % 1000000);
+	}
+
+	json_object_add_value_string(root, "timestamp", ts);
+	json_object_add_value_string(root, "event", event);
+	json_add_str(root, "device", device);
+	return root;
+}
+
+static void monitor_emit(struct json_object *root)
+{
+	json_print_object_compact(root);
+	printf("\n");
+	fflush(stdout);
+	json_free_object(root);
+}
+
+/*
+ * Counts changes to the topology. Compacting moves every record, so it is
+ * left to the main loop, where no pointers into the topology are held.
+ */
+static void monitor_updated(struct monitor *m)
+{
+	m->updates++;
+}
+
+/*
+ * Controllers are matched across a reconnect by where they connect to, as
+ * the kernel may hand out a different instance when one is recreated, and
+ * by subsystem NQN once it is known. A controller added before the link
+ * to its subsystem exists has none yet, so the NQN is compared apart.
+ */
+static void ctrl_key(struct nvme_ctrl *c, char *key, size_t len)
+{
+	snprintf(key, len, "%s %s", c->transport ? c->transport : "",
+		 c->address ? c->address : c->name);
+}
+
+static const char *ctrl_subsysnqn(struct nvme_ctrl *c)
+{
+	const char *nqn = c->subsys->subsysnqn;
+
+	return nqn && nqn[0] ? nqn : NULL;
+}
+
+static struct outage *find_outage(struct monitor *m, const char *key,
+				  const char *subsysnqn)
+{
+	struct outage *o;
+	int i;
+
+	for (i = 0; i < m->nr_outages; i++) {
+		o = &m->outages[i];
+		if (strcmp(o->key, key))
+			continue;
+		if (!o->subsysnqn || !subsysnqn ||
+		    !strcmp(o->subsysnqn, subsysnqn))
+			return o;
+	}
+	return NULL;
+}
+
+static void outage_begin(struct monitor *m, struct nvme_ctrl *c, __u64 usec)
+{
+	const char *nqn = ctrl_subsysnqn(c);
+	struct outage *o;
+	char key[512];
+
+	ctrl_key(c, key, sizeof(key));
+	if (find_outage(m, key, nqn))
+		return;
+
+	o = realloc(m->outages, (m->nr_outages + 1) * sizeof(*o));
+	if (!o)
+		return;
+	m->outages = o;
+	o = &m->outages[m->nr_outages];
+	o->key = strdup(key);
+	o->subsysnqn = nqn ? strdup(nqn) : NULL;
+	o->usec = usec;
+	if (!o->key || (nqn && !o->subsysnqn)) {
+		free(o->key);
+		free(o->subsysnqn);
+		return;
+	}
+	m->nr_outages++;
+}
+
+/* Returns how long the controller was unavailable, in usec, or 0 */
+static __u64 outage_end(struct monitor *m, struct nvme_ctrl *c, __u64 usec)
+{
+	struct outage *o;
+	char key[512];
+	__u64 start;
+
+	ctrl_key(c, key, sizeof(key));
+	o = find_outage(m, key, ctrl_subsysnqn(c));
+	if (!o)
+		return 0;
+
+	start = o->usec;
+	free(o->key);
+	free(o->subsysnqn);
+	*o = m->outages[--m->nr_outages];
+	return usec > start ? usec - start : 1;
+}
+
+static bool state_is_live(const char *state)
+{
+	return state && !strcmp(state, "live");
+}
+
+static void ctrl_set_state(struct monitor *m, struct nvme_ctrl *c,
+			   const char *state, __u64 usec)
+{
+	struct json_object *root;
+	const char *old = c->state;
+	__u64 down;
+
+	if (old && !strcmp(old, state))
+		return;
+
+	root = monitor_event(m, usec, "ctrl-state", c->name);
+	json_add_str(root, "subsystem", c->subsys->name);
+	json_add_str(root, "previous", old);
+	json_object_add_value_string(root, "state", state);
+
+	if (state_is_live(state)) {
+		down = outage_end(m, c, usec);
+		if (down)
+			json_object_add_value_uint(root, "reconnect_ms",
+						   down / 1000);
+	} else if (state_is_live(old)) {
+		outage_begin(m, c, usec);
+	}
+	monitor_emit(root);
+
+	c->state = nvme_topology_strdup(&m->t, state);
+	monitor_updated(m);
+}
+
+static int ctrl_read_state(struct nvme_ctrl *c, char *state, size_t len)
+{
+	char path[NAME_MAX + 32];
+	ssize_t ret;
+	int fd;
+
+	snprintf(path, sizeof(path), SYS_NVME "/%s/state", c->name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	ret = read(fd, state, len - 1);
+	close(fd);
+	if (ret <= 0)
+		return -ENODEV;
+	state[ret] = '\0';
+	state[strcspn(state, "\n")] = '\0';
+	return 0;
+}
+
+static const char *aen_type(unsigned int aen)
+{
+	switch (aen & 0x7) {
+	case 0:
+		return "error";
+	case 1:
+		return "smart";
+	case 2:
+		return "notice";
+	case 6:
+		return "io-command-set";
+	case 7:
+		return "vendor";
+	default:
+		return "reserved";
+	}
+}
+
+/* Without sysfs, the controller record is filled from the event itself */
+static void ctrl_from_uevent(struct monitor *m, struct nvme_ctrl *c,
+			     struct uevent *ev)
+{
+	const char *traddr = uevent_get(ev, "NVME_TRADDR");
+	const char *trsvcid = uevent_get(ev, "NVME_TRSVCID");
+	const char *host_traddr = uevent_get(ev, "NVME_HOST_TRADDR");
+	struct nvme_topology *t = &m->t;
+	char address[512], *p;
+	int len = 0;
+
+	c->transport = nvme_topology_strdup(t, uevent_get(ev, "NVME_TRTYPE"));
+	if (traddr && strcmp(traddr, "none")) {
+		c->traddr = nvme_topology_strdup(t, traddr);
+		len += snprintf(address + len, sizeof(address) - len,
+				"traddr=%s", traddr);
+	}
+	if (trsvcid && strcmp(trsvcid, "none")) {
+		c->trsvcid = nvme_topology_strdup(t, trsvcid);
+		len += snprintf(address + len, sizeof(address) - len,
+				"%strsvcid=%s", len ? " " : "", trsvcid);
+	}
+	if (host_traddr && strcmp(host_traddr, "none")) {
+		c->host_traddr = nvme_topology_strdup(t, host_traddr);
+		snprintf(address + len, sizeof(address) - len,
+			 "%shost_traddr=%s", len ? " " : "", host_traddr);
+	}
+
+	if (!c->transport) {
+		/* .../0000:01:00.0/nvme/nvme0 for PCIe */
+		snprintf(address, sizeof(address), "%s", ev->devpath);
+		p = strstr(address, "/nvme/");
+		if (!p)
+			return;
+		*p = '\0';
+		p = strrchr(address, '/');
+		c->transport = nvme_topology_strdup(t, "pcie");
+		c->address = nvme_topology_strdup(t, p ? p + 1 : address);
+		return;
+	}
+	c->address = nvme_topology_strdup(t, address);
+}
+
+static struct nvme_ctrl *ctrl_add(struct monitor *m, const char *name,
+				  struct uevent *ev)
+{
+	struct nvme_subsystem *s = NULL;
+	struct nvme_ctrl *c;
+	char subsys[NAME_MAX + 1];
+
+	if (m->src->live && !nvme_ctrl_subsys_name(name, subsys,
+						   sizeof(subsys))) {
+		s = nvme_topology_add_subsys(&m->t, subsys, NULL);
+		if (s)
+			nvme_topology_refresh_subsys(&m->t, s);
+	} else {
+		/*
+		 * Uevents do not say which subsystem a controller is part of,
+		 * so without sysfs every controller is its own subsystem, as
+		 * in legacy_list(), with the NQN left unknown.
+		 */
+		s = nvme_topology_add_subsys(&m->t, name, NULL);
+	}
+	if (!s)
+		return NULL;
+
+	c = nvme_topology_add_ctrl(&m->t, s, name);
+	if (!c)
+		return NULL;
+	if (!m->src->live || nvme_topology_refresh_ctrl(&m->t, c))
+		ctrl_from_uevent(m, c, ev);
+	monitor_updated(m);
+	return nvme_topology_find_ctrl(&m->t, name);
+}
+
+/*
+ * The link from a subsystem to a new controller may not exist yet when
+ * the controller's add event is seen, which files it below a subsystem
+ * of its own name. Moves it to the subsystem it is part of once sysfs
+ * tells which, and returns where it is now.
+ */
+static struct nvme_ctrl *ctrl_resolve_subsys(struct monitor *m,
+					     struct nvme_ctrl *c)
+{
+	char subsys[NAME_MAX + 1], name[NAME_MAX + 1];
+	struct nvme_subsystem *s, *old;
+	struct json_object *root;
+
+	if (!m->src->live || strcmp(c->subsys->name, c->name) ||
+	    nvme_ctrl_subsys_name(c->name, subsys, sizeof(subsys)))
+		return c;
+
+	snprintf(name, sizeof(name), "%s", c->name);
+	s = nvme_topology_add_subsys(&m->t, subsys, NULL);
+	if (!s)
+		return c;
+	if (!s->subsysnqn[0])
+		nvme_topology_refresh_subsys(&m->t, s);
+
+	/* adding the subsystem moved the controller record */
+	c = nvme_topology_find_ctrl(&m->t, name);
+	if (!nvme_topology_move_ctrl(&m->t, c, s))
+		return nvme_topology_find_ctrl(&m->t, name);
+	old = nvme_topology_find_subsys(&m->t, name);
+	if (old && !old->nr_ctrls && !old->nr_namespaces)
+		nvme_topology_remove_subsys(&m->t, old);
+	monitor_updated(m);
+
+	c = nvme_topology_find_ctrl(&m->t, name);
+	root = monitor_event(m, monotonic_usec(), "ctrl-subsystem", c->name);
+	json_add_str(root, "subsystem", c->subsys->name);
+	json_add_str(root, "subsysnqn", ctrl_subsysnqn(c));
+	monitor_emit(root);
+	return c;
+}
+
+/* Resolves every controller still below a placeholder subsystem */
+static void monitor_resolve_subsys(struct monitor *m)
+{
+	int i, j;
+
+	if (!m->src->live)
+		return;
+again:
+	for (i = 0; i < m->t.nr_subsystems; i++) {
+		struct nvme_subsystem *s = &m->t.subsystems[i];
+
+		for (j = 0; j < s->nr_ctrls; j++) {
+			struct nvme_ctrl *c = &s->ctrls[j];
+
+			if (strcmp(s->name, c->name) ||
+			    ctrl_resolve_subsys(m, c)->subsys == s)
+				continue;
+			/* the arrays changed below us */
+			goto again;
+		}
+	}
+}
+
+static void handle_ctrl(struct monitor *m, struct uevent *ev)
+{
+	struct nvme_ctrl *c = nvme_topology_find_ctrl(&m->t, ev->name);
+	struct json_object *root;
+	const char *value;
+	char state[32];
+	__u64 down;
+
+	if (!strcmp(ev->action, "add")) {
+		if (c)
+			return;
+		c = ctrl_add(m, ev->name, ev);
+		if (!c)
+			return;
+
+		root = monitor_event(m, ev->usec, "ctrl-add", c->name);
+		json_add_str(root, "subsystem", c->subsys->name);
+		json_add_str(root, "subsysnqn", ctrl_subsysnqn(c));
+		json_add_str(root, "transport", c->transport);
+		json_add_str(root, "address", c->address);
+		json_add_str(root, "state", c->state);
+		/* the controller may already be live by the time this is seen */
+		if (state_is_live(c->state)) {
+			down = outage_end(m, c, ev->usec);
+			if (down)
+				json_object_add_value_uint(root, "reconnect_ms",
+							   down / 1000);
+		}
+		monitor_emit(root);
+		return;
+	}
+
+	if (!c)
+		return;
+	c = ctrl_resolve_subsys(m, c);
+
+	if (!strcmp(ev->action, "remove")) {
+		root = monitor_event(m, ev->usec, "ctrl-remove", c->name);
+		json_add_str(root, "subsystem", c->subsys->name);
+		json_add_str(root, "transport", c->transport);
+		json_add_str(root, "address", c->address);
+		monitor_emit(root);
+
+		outage_begin(m, c, ev->usec);
+		nvme_topology_remove_ctrl(&m->t, c);
+		monitor_updated(m);
+		return;
+	}
+
+	value = uevent_get(ev, "NVME_AEN");
+	if (value) {
+		unsigned int aen = strtoul(value, NULL, 0);
+
+		root = monitor_event(m, ev->usec, "aen", c->name);
+		json_add_str(root, "subsystem", c->subsys->name);
+		json_object_add_value_string(root, "aen", value);
+		json_object_add_value_string(root, "type", aen_type(aen));
+		json_object_add_value_uint(root, "info", (aen >> 8) & 0xff);
+		json_object_add_value_uint(root, "log_page",
+					   (aen >> 16) & 0xff);
+		monitor_emit(root);
+	}
+
+	value = uevent_get(ev, "NVME_EVENT");
+	if (value) {
+		root = monitor_event(m, ev->usec, "ctrl-event", c->name);
+		json_add_str(root, "subsystem", c->subsys->name);
+		json_object_add_value_string(root, "value", value);
+		monitor_emit(root);
+
+		if (!strcmp(value, "connected"))
+			ctrl_set_state(m, c, "live", ev->usec);
+	}
+
+	if (m->src->live && !ctrl_read_state(c, state, sizeof(state)))
+		ctrl_set_state(m, c, state, ev->usec);
+}
+
+static void handle_subsys(struct monitor *m, struct uevent *ev)
+{
+	struct nvme_subsystem *s = nvme_topology_find_subsys(&m->t, ev->name);
+	struct json_object *root;
+
+	if (!strcmp(ev->action, "add") && !s) {
+		s = nvme_topology_add_subsys(&m->t, ev->name, NULL);
+		if (!s)
+			return;
+		if (m->src->live)
+			nvme_topology_refresh_subsys(&m->t, s);
+		monitor_updated(m);
+
+		root = monitor_event(m, ev->usec, "subsystem-add", s->name);
+		json_add_str(root, "subsysnqn", s->subsysnqn);
+		monitor_emit(root);
+
+		/* controllers seen before it can now be filed below it */
+		monitor_resolve_subsys(m);
+	} else if (!strcmp(ev->action, "remove") && s) {
+		root = monitor_event(m, ev->usec, "subsystem-remove", s->name);
+		json_add_str(root, "subsysnqn", s->subsysnqn);
+		monitor_emit(root);
+
+		nvme_topology_remove_subsys(&m->t, s);
+		monitor_updated(m);
+	}
+}
+
+/*
+ * The subsystem namespace n belongs to, and its controller unless it is a
+ * multipath head.
+ */
+static struct nvme_subsystem *ns_owner(struct monitor *m,
+				       struct nvme_namespace *n,
+				       struct nvme_ctrl **ctrl)
+{
+	int i, j;
+
+	*ctrl = NULL;
+	for (i = 0; i < m->t.nr_subsystems; i++) {
+		struct nvme_subsystem *s = &m->t.subsystems[i];
+
+		if (n >= s->namespaces && n < s->namespaces + s->nr_namespaces)
+			return s;
+		for (j = 0; j < s->nr_ctrls; j++) {
+			struct nvme_ctrl *c = &s->ctrls[j];
+
+			if (n >= c->namespaces &&
+			    n < c->namespaces + c->nr_namespaces) {
+				*ctrl = c;
+				return s;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void ns_event(struct monitor *m, struct uevent *ev, const char *event,
+		     struct nvme_namespace *n)
+{
+	struct nvme_subsystem *s;
+	struct json_object *root;
+	struct nvme_ctrl *c;
+
+	s = ns_owner(m, n, &c);
+	root = monitor_event(m, ev->usec, event, n->name);
+	if (c)
+		json_add_str(root, "ctrl", c->name);
+	if (s)
+		json_add_str(root, "subsystem", s->name);
+	json_object_add_value_uint(root, "nsid", n->nsid);
+	if (n->nsze) {
+		json_object_add_value_uint(root, "nsze", n->nsze);
+		json_object_add_value_uint(root, "lba_size",
+					   1ULL << n->lba_shift);
+	}
+	monitor_emit(root);
+}
+
+/*
+ * Block devices are either multipath heads, below the subsystem, or the
+ * namespaces of a controller that is not part of a multipath setup. The
+ * hidden per path devices of multipath namespaces are not tracked.
+ */
+static void handle_block(struct monitor *m, struct uevent *ev)
+{
+	struct nvme_namespace *n = nvme_topology_find_ns(&m->t, ev->name);
+	struct nvme_subsystem *s = NULL;
+	struct nvme_ctrl *c = NULL;
+	char parent[NAME_MAX + 1], *p;
+	int id, nsid, part;
+
+	if (sscanf(ev->name, "nvme%dn%d", &id, &nsid) != 2 ||
+	    sscanf(ev->name, "nvme%dn%dp%d", &id, &nsid, &part) == 3)
+		return;
+
+	if (!strcmp(ev->action, "add")) {
+		if (n)
+			return;
+
+		snprintf(parent, sizeof(parent), "%.*s",
+			 (int)(ev->name - ev->devpath - 1), ev->devpath);
+		p = strrchr(parent, '/');
+		p = p ? p + 1 : parent;
+
+		if (!strncmp(p, "nvme-subsys", 11)) {
+			s = nvme_topology_add_subsys(&m->t, p, NULL);
+		} else {
+			c = nvme_topology_find_ctrl(&m->t, p);
+			if (!c)
+				c = ctrl_add(m, p, ev);
+			if (c)
+				s = c->subsys;
+		}
+		if (!s)
+			return;
+
+		n = nvme_topology_add_ns(&m->t, s, c, ev->name);
+		if (!n)
+			return;
+		if (m->src->live)
+			nvme_topology_refresh_ns(n);
+		monitor_updated(m);
+		ns_event(m, ev, "ns-add", n);
+		return;
+	}
+
+	if (!n)
+		return;
+
+	if (!strcmp(ev->action, "remove")) {
+		ns_event(m, ev, "ns-remove", n);
+		nvme_topology_remove_ns(&m->t, n);
+		monitor_updated(m);
+	} else if (!strcmp(ev->action, "change")) {
+		if (m->src->live)
+			nvme_topology_refresh_ns(n);
+		ns_event(m, ev, "ns-change", n);
+	}
+}
+
+/* Events for other devices, such as FC rediscovery requests */
+static void handle_other(struct monitor *m, struct uevent *ev)
+{
+	const char *value = uevent_get(ev, "NVME_EVENT");
+	struct json_object *root;
+	int i;
+
+	if (!value)
+		return;
+
+	root = monitor_event(m, ev->usec, "nvme-event", ev->name);
+	json_object_add_value_string(root, "value", value);
+	for (i = 0; i < ev->nr_env; i++) {
+		char key[64], *eq = strchr(ev->env[i], '=');
+
+		if (strncmp(ev->env[i], "NVME", 4) ||
+		    !strncmp(ev->env[i], "NVME_EVENT=", 11) ||
+		    eq - ev->env[i] >= (int)sizeof(key))
+			continue;
+		snprintf(key, sizeof(key), "%.*s", (int)(eq - ev->env[i]),
+			 ev->env[i]);
+		json_object_add_value_string(root, key, eq + 1);
+	}
+	monitor_emit(root);
+}
+
+static bool monitor_wants(struct uevent *ev)
+{
+	if (!strcmp(ev->subsystem, "nvme") ||
+	    !strcmp(ev->subsystem, "nvme-subsystem"))
+		return true;
+	if (!strcmp(ev->subsystem, "block"))
+		return !strncmp(ev->name, "nvme", 4);
+	return uevent_get(ev, "NVME_EVENT") != NULL;
+}
+
+static void monitor_handle(struct monitor *m, struct uevent *ev)
+{
+	if (!ev->action || !monitor_wants(ev))
+		return;
+
+	record_event(m, ev);
+	if (!strcmp(ev->subsystem, "nvme"))
+		handle_ctrl(m, ev);
+	else if (!strcmp(ev->subsystem, "nvme-subsystem"))
+		handle_subsys(m, ev);
+	else if (!strcmp(ev->subsystem, "block"))
+		handle_block(m, ev);
+	else
+		handle_other(m, ev);
+}
+
+/*
+ * The kernel does not send an event when a controller starts resetting or
+ * loses its connection, only once it is back, so the state of each
+ * controller is sampled to see when an outage began.
+ */
+static void monitor_poll_states(struct monitor *m, __u64 now)
+{
+	char state[32];
+	int i, j;
+
+	monitor_resolve_subsys(m);
+	for (i = 0; i < m->t.nr_subsystems; i++) {
+		struct nvme_subsystem *s = &m->t.subsystems[i];
+
+		for (j = 0; j < s->nr_ctrls; j++)
+			if (!ctrl_read_state(&s->ctrls[j], state,
+					     sizeof(state)))
+				ctrl_set_state(m, &s->ctrls[j], state, now);
+	}
+}
+
+/* Events were dropped, so the only way to catch up is a full scan */
+static void monitor_resync(struct monitor *m)
+{
+	free_topology(&m->t);
+	scan_subsystems(&m->t, NULL, 0);
+	m->updates = 0;
+	monitor_emit(monitor_event(m, monotonic_usec(), "resync", NULL));
+}
+
+int monitor(const char *desc, int argc, char **argv)
+{
+	struct uevent_source src = { .fd = -1 };
+	struct monitor m = { .src = &src };
+	struct sigaction sa = { .sa_handler = monitor_signal };
+	__u64 now, sampled = 0;
+	struct uevent *ev;
+	int ret, i;
+
+	OPT_ARGS(opts) = {
+		OPT_FILE("replay",   'r', &cfg.replay,   "replay recorded events from file instead of the kernel"),
+		OPT_FILE("record",   'R', &cfg.record,   "record the events seen to file, for later replay"),
+		OPT_INT("interval",  'i', &cfg.interval, "controller state sampling interval in milliseconds, 0 to disable"),
+		OPT_FLAG("live",     'L', &cfg.live,     "replayed events are those of this machine as they happen, read sysfs for them"),
+		OPT_END()
+	};
+
+	ret = argconfig_parse(argc, argv, desc, opts);
+	if (ret)
+		return ret;
+	if (cfg.live && !cfg.replay) {
+		fprintf(stderr, "--live only applies to --replay\n");
+		return -EINVAL;
+	}
+
+	ev = malloc(sizeof(*ev));
+	if (!ev)
+		return -ENOMEM;
+
+	if (cfg.replay) {
+		ret = replay_open(&src, cfg.replay);
+		src.live = cfg.live;
+	} else
+		ret = netlink_open(&src);
+	if (ret) {
+		fprintf(stderr, "Failed to open %s: %s\n",
+			cfg.replay ? cfg.replay : "uevent socket",
+			strerror(-ret));
+		goto free;
+	}
+
+	if (cfg.record) {
+		m.record = fopen(cfg.record, "w");
+		if (!m.record) {
+			ret = -errno;
+			fprintf(stderr, "Failed to open %s: %s\n", cfg.record,
+				strerror(errno));
+			goto close;
+		}
+	}
+
+	/* replays start from nothing, the recording describes all there is */
+	if (src.live)
+		scan_subsystems(&m.t, NULL, 0);
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (!monitor_stop) {
+		if (src.fd >= 0) {
+			struct pollfd pfd = { .fd = src.fd, .events = POLLIN };
+
+			ret = poll(&pfd, 1, cfg.interval > 0 ? cfg.interval : -1);
+			if (ret < 0 && errno != EINTR) {
+				ret = -errno;
+				break;
+			}
+			now = monotonic_usec();
+			if (cfg.interval > 0 &&
+			    now - sampled >= cfg.interval * 1000ULL) {
+				monitor_poll_states(&m, now);
+				sampled = now;
+			}
+			if (ret <= 0)
+				goto compact;
+		}
+
+		while ((ret = src.read(&src, ev)) > 0 && !monitor_stop)
+			monitor_handle(&m, ev);
+		if (ret == -ENOBUFS)
+			monitor_resync(&m);
+		else if (ret < 0)
+			break;
+compact:
+		if (m.updates >= MONITOR_COMPACT &&
+		    !nvme_topology_compact(&m.t))
+			m.updates = 0;
+	}
+	ret = ret == -1 || monitor_stop ? 0 : ret;
+	if (ret)
+		fprintf(stderr, "Failed to read events: %s\n", strerror(-ret));
+
+	if (m.record)
+		fclose(m.record);
+close:
+	if (src.fd >= 0)
+		close(src.fd);
+	if (src.file && src.file != stdin)
+		fclose(src.file);
+	for (i = 0; i < m.nr_outages; i++) {
+		free(m.outages[i].key);
+		free(m.outages[i].subsysnqn);
+	}
+	free(m.outages);
+	free_topology(&m.t);
+free:
+	free(ev);
+	return ret;
+}
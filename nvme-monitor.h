@@ -0,0 +1,6 @@
+#ifndef _NVME_MONITOR_H
+#define _NVME_MONITOR_H
+
+extern int monitor(const char *desc, int argc, char **argv);
+
+#endif
@@ -0,0 +1,679 @@
+/*
+ * nvme pcie-health: the PCIe link of each NVMe controller, as trained
+ * against what the device and the port above it support, the bandwidth
+ * that leaves, the NUMA node of the device and the errors AER counted on
+ * the link, with the vendor counts of the same errors where known.
+ *
+ * Everything but the vendor log pages comes from sysfs, which can be read
+ * from a copy, as the one in a sosreport, to check a machine offline.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <inttypes.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-print.h"
+#include "nvme-pcie.h"
+#include "json.h"
+#include "plugins/seagate/seagate-diag.h"
+
+#define PCI_VENDOR_SEAGATE	0x1bb1
+
+#define PCI_EXT_CAP_START	0x100
+#define PCI_EXT_CAP_ID_AER	0x0001
+#define PCI_ERR_UNCOR_STATUS	0x04
+#define PCI_ERR_COR_STATUS	0x10
+
+/* log page 0xcb of Seagate drives, as nvme seagate vs-pcie-stats reads it */
+#define SEAGATE_LOG_PCIE	0xcb
+
+enum {
+	AER_CORRECTABLE,
+	AER_NONFATAL,
+	AER_FATAL,
+	AER_KINDS,
+};
+
+static const char * const aer_files[AER_KINDS] = {
+	"aer_dev_correctable", "aer_dev_nonfatal", "aer_dev_fatal",
+};
+
+static const char * const aer_names[AER_KINDS] = {
+	"correctable", "nonfatal", "fatal",
+};
+
+/* The bits of the AER status registers, named as the kernel counts them */
+static const char * const aer_cor_bits[32] = {
+	[0] = "RxErr", [6] = "BadTLP", [7] = "BadDLLP", [8] = "Rollover",
+	[12] = "Timeout", [13] = "NonFatalErr", [14] = "CorrIntErr",
+	[15] = "HeaderOF",
+};
+
+static const char * const aer_uncor_bits[32] = {
+	[4] = "DLP", [5] = "SDES", [12] = "TLP", [13] = "FCP",
+	[14] = "CmpltTO", [15] = "CmpltAbrt", [16] = "UnxCmplt",
+	[17] = "RxOF", [18] = "MalfTLP", [19] = "ECRC", [20] = "UnsupReq",
+	[21] = "ACSViol", [22] = "UncorrIntErr", [23] = "BlockedTLP",
+	[24] = "AtomicOpBlocked", [25] = "TLPBlockedErr",
+};
+
+struct pcie_link {
+	char speed_str[32];
+	double speed;		/* GT/s, 0 if unknown */
+	int width;
+};
+
+struct pcie_ctrl {
+	char name[NAME_MAX + 1];
+	char address[32];
+	char model[64];
+	char serial[32];
+	unsigned int vendor;
+
+	struct pcie_link cur, max, port;
+	bool have_port;
+	double expected_speed;
+	int expected_width;
+
+	int node;
+	char cpulist[256];
+
+	bool have_aer;
+	__u64 aer[AER_KINDS];
+	char aer_detail[AER_KINDS][256];
+
+	bool have_status;
+	__u32 cor_status, uncor_status;
+
+	bool have_seagate;
+	__u64 seagate_cor, seagate_uncor;
+
+	int nr_warnings;
+	char **warnings;
+};
+
+static struct config {
+	char *sysfs;
+	char *output_format;
+} cfg = {
+	.sysfs = "/sys",
+	.output_format = "normal",
+};
+
+static int pcie_read_attr(char *buf, size_t len, const char *fmt, ...)
+{
+	char path[PATH_MAX];
+	va_list ap;
+	FILE *f;
+
+	va_start(ap, fmt);
+	vsnprintf(path, sizeof(path), fmt, ap);
+	va_end(ap);
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	if (!fgets(buf, len, f))
+		buf[0] = '\0';
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+static void pcie_warn(struct pcie_ctrl *pc, const char *fmt, ...)
+{
+	char buf[256], **warnings;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	warnings = realloc(pc->warnings, (pc->nr_warnings + 1) *
+			   sizeof(*warnings));
+	if (!warnings)
+		return;
+	pc->warnings = warnings;
+	pc->warnings[pc->nr_warnings] = strdup(buf);
+	if (pc->warnings[pc->nr_warnings])
+		pc->nr_warnings++;
+}
+
+static int pcie_gen(double speed)
+{
+	if (speed >= 64)
+		return 6;
+	if (speed >= 32)
+		return 5;
+	if (speed >= 16)
+		return 4;
+	if (speed >= 8)
+		return 3;
+	if (speed >= 5)
+		return 2;
+	return speed > 0 ? 1 : 0;
+}
+
+/*
+ * The payload bandwidth of a link, in MB/s each way, after the line
+ * encoding: 8b/10b up to 5 GT/s, 128b/130b up to 32 GT/s and the 242B
+ * of each 256B FLIT at 64 GT/s. TLP and DLLP overhead take another 10 to
+ * 20% depending on the payload size, which is left to the reader.
+ */
+static __u64 pcie_bandwidth(double speed, int width)
+{
+	double eff;
+
+	if (speed >= 64)
+		eff = 242.0 / 256;
+	else if (speed >= 8)
+		eff = 128.0 / 130;
+	else
+		eff = 8.0 / 10;
+	return speed * 1000 / 8 * eff * width;
+}
+
+/* "16.0 GT/s PCIe", or "8 GT/s" and "Unknown speed" from older kernels */
+static bool pcie_read_link(struct pcie_link *l, const char *dev,
+			   const char *which)
+{
+	char buf[32];
+
+	memset(l, 0, sizeof(*l));
+	if (pcie_read_attr(l->speed_str, sizeof(l->speed_str),
+			   "%s/%s_link_speed", dev, which))
+		return false;
+	l->speed = strtod(l->speed_str, NULL);
+	if (!pcie_read_attr(buf, sizeof(buf), "%s/%s_link_width", dev, which))
+		l->width = strtol(buf, NULL, 0);
+	return true;
+}
+
+/*
+ * The counters of the kernel since boot, a name and a count per line and
+ * a TOTAL_ERR_* line with their sum. The detail keeps those not zero.
+ */
+static int pcie_read_aer(struct pcie_ctrl *pc, const char *dev, int kind)
+{
+	char path[PATH_MAX + 32], name[64], *detail = pc->aer_detail[kind];
+	unsigned long long count;
+	size_t off = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dev, aer_files[kind]);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	while (fscanf(f, "%63s %llu", name, &count) == 2) {
+		if (!strncmp(name, "TOTAL_ERR_", 10)) {
+			pc->aer[kind] = count;
+			continue;
+		}
+		if (count && off < sizeof(pc->aer_detail[kind]))
+			off += snprintf(detail + off,
+					sizeof(pc->aer_detail[kind]) - off,
+					"%s%s %llu", off ? ", " : "", name,
+					count);
+	}
+	fclose(f);
+	return 0;
+}
+
+/*
+ * The AER status registers of the device, the errors it latched since
+ * they were last cleared, as nvme micron vs-pcie-stats reads them with
+ * setpci. Only root reads past the first 64 bytes of config space.
+ */
+static void pcie_read_status(struct pcie_ctrl *pc, const char *dev)
+{
+	unsigned char cfg_space[4096];
+	char path[PATH_MAX + 8];
+	int fd, pos, loops;
+	ssize_t len;
+	__le32 raw;
+	__u32 hdr;
+
+	snprintf(path, sizeof(path), "%s/config", dev);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	len = read(fd, cfg_space, sizeof(cfg_space));
+	close(fd);
+
+	for (pos = PCI_EXT_CAP_START, loops = 0; pos && loops < 480; loops++) {
+		if (pos + PCI_ERR_COR_STATUS + 4 > len)
+			return;
+		memcpy(&raw, cfg_space + pos, sizeof(raw));
+		hdr = le32_to_cpu(raw);
+		if (!hdr || hdr == 0xffffffff)
+			return;
+		if ((hdr & 0xffff) == PCI_EXT_CAP_ID_AER) {
+			memcpy(&raw, cfg_space + pos + PCI_ERR_UNCOR_STATUS,
+			       sizeof(raw));
+			pc->uncor_status = le32_to_cpu(raw);
+			memcpy(&raw, cfg_space + pos + PCI_ERR_COR_STATUS,
+			       sizeof(raw));
+			pc->cor_status = le32_to_cpu(raw);
+			pc->have_status = true;
+			return;
+		}
+		pos = (hdr >> 20) & 0xffc;
+	}
+}
+
+static char *pcie_status_bits(__u32 status, const char * const *names,
+			      char *buf, size_t len)
+{
+	size_t off = 0;
+	int bit;
+
+	buf[0] = '\0';
+	for (bit = 0; bit < 32 && off < len; bit++) {
+		if (!(status & (1U << bit)))
+			continue;
+		if (names[bit])
+			off += snprintf(buf + off, len - off, "%s%s",
+					off ? " " : "", names[bit]);
+		else
+			off += snprintf(buf + off, len - off, "%sbit%d",
+					off ? " " : "", bit);
+	}
+	if (!buf[0])
+		snprintf(buf, len, "none");
+	return buf;
+}
+
+/* the errors split as nvme seagate vs-pcie-stats counts them */
+static void pcie_read_seagate(struct pcie_ctrl *pc)
+{
+	pcie_error_log_page log;
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "/dev/%s", pc->name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (!nvme_get_log(fd, 1, SEAGATE_LOG_PCIE, false, sizeof(log),
+			  &log)) {
+		pc->seagate_cor = (__u64)le32_to_cpu(log.BadDllpErrCnt) +
+			le32_to_cpu(log.BadTlpErrCnt) +
+			le32_to_cpu(log.RcvrErrCnt) +
+			le32_to_cpu(log.ReplayTOErrCnt) +
+			le32_to_cpu(log.ReplayNumRolloverErrCnt);
+		pc->seagate_uncor = (__u64)le32_to_cpu(log.FCProtocolErrCnt) +
+			le32_to_cpu(log.DllpProtocolErrCnt) +
+			le32_to_cpu(log.CmpltnTOErrCnt) +
+			le32_to_cpu(log.RcvrQOverflowErrCnt) +
+			le32_to_cpu(log.UnexpectedCplTlpErrCnt) +
+			le32_to_cpu(log.CplTlpURErrCnt) +
+			le32_to_cpu(log.CplTlpCAErrCnt) +
+			le32_to_cpu(log.ReqCAErrCnt) +
+			le32_to_cpu(log.ReqURErrCnt) +
+			le32_to_cpu(log.EcrcErrCnt) +
+			le32_to_cpu(log.MalformedTlpErrCnt) +
+			le32_to_cpu(log.CplTlpPoisonedErrCnt) +
+			le32_to_cpu(log.MemRdTlpPoisonedErrCnt);
+		pc->have_seagate = true;
+	}
+	close(fd);
+}
+
+static void pcie_check(struct pcie_ctrl *pc, int nr_nodes)
+{
+	int kind;
+
+	if (pc->cur.speed && pc->expected_speed &&
+	    pc->cur.speed < pc->expected_speed)
+		pcie_warn(pc, "link trained at %s (Gen%d), below the %.1f GT/s "
+			  "(Gen%d) both ends support", pc->cur.speed_str,
+			  pcie_gen(pc->cur.speed), pc->expected_speed,
+			  pcie_gen(pc->expected_speed));
+	if (pc->cur.width && pc->expected_width &&
+	    pc->cur.width < pc->expected_width)
+		pcie_warn(pc, "link trained at x%d, below the x%d both ends "
+			  "support", pc->cur.width, pc->expected_width);
+	if (pc->have_port && pc->port.speed && pc->port.speed < pc->max.speed)
+		pcie_warn(pc, "the port supports only %s, the device %s",
+			  pc->port.speed_str, pc->max.speed_str);
+	if (pc->have_port && pc->port.width && pc->port.width < pc->max.width)
+		pcie_warn(pc, "the port supports only x%d, the device x%d",
+			  pc->port.width, pc->max.width);
+
+	if (pc->node < 0 && nr_nodes > 1)
+		pcie_warn(pc, "the NUMA node of the device is unknown on a "
+			  "system of %d nodes, the firmware does not report "
+			  "its proximity", nr_nodes);
+
+	for (kind = 0; kind < AER_KINDS; kind++)
+		if (pc->aer[kind])
+			pcie_warn(pc, "%"PRIu64" %s AER errors since boot%s%s%s",
+				  (uint64_t)pc->aer[kind], aer_names[kind],
+				  pc->aer_detail[kind][0] ? " (" : "",
+				  pc->aer_detail[kind],
+				  pc->aer_detail[kind][0] ? ")" : "");
+	if (pc->have_status && pc->uncor_status) {
+		char bits[256];
+
+		pcie_warn(pc, "uncorrectable errors latched in AER status: %s",
+			  pcie_status_bits(pc->uncor_status, aer_uncor_bits,
+					   bits, sizeof(bits)));
+	}
+	if (pc->have_seagate && pc->seagate_uncor)
+		pcie_warn(pc, "the drive counted %"PRIu64" uncorrectable PCIe "
+			  "errors", (uint64_t)pc->seagate_uncor);
+}
+
+static int pcie_scan_ctrl(struct pcie_ctrl *pc, const char *name,
+			  int nr_nodes)
+{
+	char dev[PATH_MAX], port[PATH_MAX + 4], buf[32];
+	int kind;
+
+	memset(pc, 0, sizeof(*pc));
+	snprintf(pc->name, sizeof(pc->name), "%s", name);
+	pc->node = -1;
+
+	if (pcie_read_attr(buf, sizeof(buf), "%s/class/nvme/%s/transport",
+			   cfg.sysfs, name) || strcmp(buf, "pcie"))
+		return -ENODEV;
+	pcie_read_attr(pc->address, sizeof(pc->address),
+		       "%s/class/nvme/%s/address", cfg.sysfs, name);
+	pcie_read_attr(pc->model, sizeof(pc->model),
+		       "%s/class/nvme/%s/model", cfg.sysfs, name);
+	pcie_read_attr(pc->serial, sizeof(pc->serial),
+		       "%s/class/nvme/%s/serial", cfg.sysfs, name);
+
+	snprintf(dev, sizeof(dev), "%s/class/nvme/%s/device", cfg.sysfs, name);
+	if (!pcie_read_attr(buf, sizeof(buf), "%s/vendor", dev))
+		pc->vendor = strtoul(buf, NULL, 0);
+	if (!pcie_read_attr(buf, sizeof(buf), "%s/numa_node", dev))
+		pc->node = atoi(buf);
+	pcie_read_attr(pc->cpulist, sizeof(pc->cpulist), "%s/local_cpulist",
+		       dev);
+
+	pcie_read_link(&pc->cur, dev, "current");
+	pcie_read_link(&pc->max, dev, "max");
+
+	/* the port above, unless the device hangs off the root complex */
+	snprintf(port, sizeof(port), "%s/..", dev);
+	pc->have_port = pcie_read_link(&pc->port, port, "max");
+
+	pc->expected_speed = pc->max.speed;
+	pc->expected_width = pc->max.width;
+	if (pc->have_port) {
+		if (pc->port.speed && pc->port.speed < pc->expected_speed)
+			pc->expected_speed = pc->port.speed;
+		if (pc->port.width && pc->port.width < pc->expected_width)
+			pc->expected_width = pc->port.width;
+	}
+
+	for (kind = 0; kind < AER_KINDS; kind++)
+		if (!pcie_read_aer(pc, dev, kind))
+			pc->have_aer = true;
+	pcie_read_status(pc, dev);
+
+	/* the drives of the sysfs copy are not those of this machine */
+	if (pc->vendor == PCI_VENDOR_SEAGATE && !strcmp(cfg.sysfs, "/sys"))
+		pcie_read_seagate(pc);
+
+	pcie_check(pc, nr_nodes);
+	return 0;
+}
+
+static void pcie_free_ctrl(struct pcie_ctrl *pc)
+{
+	int i;
+
+	for (i = 0; i < pc->nr_warnings; i++)
+		free(pc->warnings[i]);
+	free(pc->warnings);
+}
+
+static int pcie_nr_nodes(void)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	int nr = 0, node;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "%s/devices/system/node", cfg.sysfs);
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+	while ((d = readdir(dir)))
+		if (sscanf(d->d_name, "node%d", &node) == 1)
+			nr++;
+	closedir(dir);
+	return nr;
+}
+
+static void pcie_show_link(const char *what, const struct pcie_link *l)
+{
+	printf("  %-12s ", what);
+	if (l->speed)
+		printf("%s (Gen%d)", l->speed_str, pcie_gen(l->speed));
+	else
+		printf("%s", l->speed_str[0] ? l->speed_str : "unknown");
+	if (l->width)
+		printf(" x%d", l->width);
+	printf("\n");
+}
+
+static void pcie_show_ctrl(struct pcie_ctrl *pc)
+{
+	char bits[256];
+	int kind, i;
+
+	printf("%s at %s, %s (%s)\n", pc->name, pc->address, pc->model,
+	       pc->serial);
+	pcie_show_link("link", &pc->cur);
+	pcie_show_link("device max", &pc->max);
+	if (pc->have_port)
+		pcie_show_link("port max", &pc->port);
+	if (pc->cur.speed && pc->cur.width) {
+		__u64 bw = pcie_bandwidth(pc->cur.speed, pc->cur.width);
+		__u64 max = pcie_bandwidth(pc->expected_speed,
+					   pc->expected_width);
+
+		printf("  %-12s %"PRIu64" MB/s", "bandwidth", (uint64_t)bw);
+		if (max > bw)
+			printf(" of %"PRIu64" MB/s", (uint64_t)max);
+		printf(" each way\n");
+	}
+	printf("  %-12s ", "numa node");
+	if (pc->node >= 0)
+		printf("%d", pc->node);
+	else
+		printf("unknown");
+	if (pc->cpulist[0])
+		printf(", local cpus %s", pc->cpulist);
+	printf("\n");
+
+	if (pc->have_aer) {
+		printf("  %-12s", "aer");
+		for (kind = 0; kind < AER_KINDS; kind++)
+			printf("%s %s %"PRIu64, kind ? "," : "",
+			       aer_names[kind], (uint64_t)pc->aer[kind]);
+		printf("\n");
+	}
+	if (pc->have_status) {
+		printf("  %-12s correctable: %s", "aer status",
+		       pcie_status_bits(pc->cor_status, aer_cor_bits, bits,
+					sizeof(bits)));
+		printf(", uncorrectable: %s\n",
+		       pcie_status_bits(pc->uncor_status, aer_uncor_bits, bits,
+					sizeof(bits)));
+	}
+	if (pc->have_seagate)
+		printf("  %-12s correctable %"PRIu64", uncorrectable %"PRIu64
+		       " (Seagate log 0x%x)\n", "drive count",
+		       (uint64_t)pc->seagate_cor, (uint64_t)pc->seagate_uncor,
+		       SEAGATE_LOG_PCIE);
+	for (i = 0; i < pc->nr_warnings; i++)
+		printf("  warning: %s\n", pc->warnings[i]);
+}
+
+static void pcie_json_link(struct json_object *obj, const char *what,
+			   const struct pcie_link *l)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "%s_link_speed", what);
+	json_object_add_value_string(obj, name, l->speed_str);
+	snprintf(name, sizeof(name), "%s_link_width", what);
+	json_object_add_value_uint(obj, name, l->width);
+}
+
+static struct json_object *pcie_json_ctrl(struct pcie_ctrl *pc)
+{
+	struct json_object *ctrl, *aer;
+	struct json_array *warnings;
+	char bits[256];
+	int kind, i;
+
+	ctrl = json_create_object();
+	json_object_add_value_string(ctrl, "controller", pc->name);
+	json_object_add_value_string(ctrl, "address", pc->address);
+	json_object_add_value_string(ctrl, "model", pc->model);
+	json_object_add_value_string(ctrl, "serial", pc->serial);
+
+	pcie_json_link(ctrl, "current", &pc->cur);
+	pcie_json_link(ctrl, "max", &pc->max);
+	if (pc->have_port)
+		pcie_json_link(ctrl, "port_max", &pc->port);
+	json_object_add_value_uint(ctrl, "bandwidth_mbps",
+		pcie_bandwidth(pc->cur.speed, pc->cur.width));
+	json_object_add_value_uint(ctrl, "max_bandwidth_mbps",
+		pcie_bandwidth(pc->expected_speed, pc->expected_width));
+	json_object_add_value_int(ctrl, "numa_node", pc->node);
+	json_object_add_value_string(ctrl, "local_cpulist", pc->cpulist);
+
+	if (pc->have_aer) {
+		aer = json_create_object();
+		for (kind = 0; kind < AER_KINDS; kind++)
+			json_object_add_value_uint(aer, aer_names[kind],
+						   pc->aer[kind]);
+		json_object_add_value_object(ctrl, "aer", aer);
+	}
+	if (pc->have_status) {
+		aer = json_create_object();
+		json_object_add_value_string(aer, "correctable",
+			pcie_status_bits(pc->cor_status, aer_cor_bits, bits,
+					 sizeof(bits)));
+		json_object_add_value_string(aer, "uncorrectable",
+			pcie_status_bits(pc->uncor_status, aer_uncor_bits, bits,
+					 sizeof(bits)));
+		json_object_add_value_object(ctrl, "aer_status", aer);
+	}
+	if (pc->have_seagate) {
+		aer = json_create_object();
+		json_object_add_value_uint(aer, "correctable",
+					   pc->seagate_cor);
+		json_object_add_value_uint(aer, "uncorrectable",
+					   pc->seagate_uncor);
+		json_object_add_value_object(ctrl, "drive_pcie_errors", aer);
+	}
+
+	warnings = json_create_array();
+	for (i = 0; i < pc->nr_warnings; i++)
+		json_array_add_value_string(warnings, pc->warnings[i]);
+	json_object_add_value_array(ctrl, "warnings", warnings);
+	return ctrl;
+}
+
+int pcie_health(const char *desc, int argc, char **argv)
+{
+	const char *sysfs = "read sysfs from this directory, as a copy of "\
+		"it taken on another machine";
+	const char *output_format = "Output format: normal|json";
+	struct json_object *root = NULL;
+	struct json_array *ctrls = NULL;
+	enum nvme_print_flags flags;
+	struct dirent **ents;
+	struct pcie_ctrl pc;
+	char path[PATH_MAX];
+	const char *dev = NULL;
+	int err, i, n, nr_nodes, shown = 0;
+
+	OPT_ARGS(opts) = {
+		OPT_STRING("sysfs",      'r', "DIR", &cfg.sysfs,         sysfs),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_END()
+	};
+
+	err = argconfig_parse(argc, argv, desc, opts);
+	if (err)
+		return err;
+
+	err = flags = validate_output_format(cfg.output_format);
+	if (flags < 0)
+		return err;
+	if (flags != JSON && flags != NORMAL) {
+		fprintf(stderr, "Invalid output format\n");
+		return -EINVAL;
+	}
+	if (optind < argc) {
+		dev = strrchr(argv[optind], '/');
+		dev = dev ? dev + 1 : argv[optind];
+	}
+
+	snprintf(path, sizeof(path), "%s/class/nvme", cfg.sysfs);
+	n = scandir(path, &ents, scan_ctrls_filter, alphasort);
+	if (n < 0) {
+		/* no NVMe controller, unless the root itself is missing */
+		if (errno == ENOENT && !dev && !access(cfg.sysfs, F_OK)) {
+			n = 0;
+		} else {
+			err = -errno;
+			fprintf(stderr, "Failed to read %s: %s\n", path,
+				strerror(-err));
+			return err;
+		}
+	}
+	nr_nodes = pcie_nr_nodes();
+
+	if (flags == JSON) {
+		root = json_create_object();
+		ctrls = json_create_array();
+	}
+	for (i = 0; i < n; i++) {
+		if ((dev && strcmp(dev, ents[i]->d_name)) ||
+		    pcie_scan_ctrl(&pc, ents[i]->d_name, nr_nodes)) {
+			free(ents[i]);
+			continue;
+		}
+		if (flags == JSON) {
+			json_array_add_value_object(ctrls, pcie_json_ctrl(&pc));
+		} else {
+			if (shown)
+				printf("\n");
+			pcie_show_ctrl(&pc);
+		}
+		pcie_free_ctrl(&pc);
+		free(ents[i]);
+		shown++;
+	}
+	if (n > 0)
+		free(ents);
+
+	if (flags == JSON) {
+		json_object_add_value_array(root, "controllers", ctrls);
+		json_print_object(root, NULL);
+		printf("\n");
+		json_free_object(root);
+	}
+	if (dev && !shown) {
+		fprintf(stderr, "%s: no such PCIe NVMe controller\n", dev);
+		return -ENODEV;
+	}
+	return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef _NVME_PCIE_H
+#define _NVME_PCIE_H
+
+extern int pcie_health(const char *desc, int argc, char **argv);
+
+#endif
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -26,6 +27,64 @@ static long double int128_to_double(__u8 *data)
 	return result;
 }
 
+struct nvme_u128 nvme_u128_from_le(const __u8 *data)
+{
+	struct nvme_u128 v = { };
+	int i;
+
+	for (i = 7; i >= 0; i--) {
+		v.hi = v.hi << 8 | data[8 + i];
+		v.lo = v.lo << 8 | data[i];
+	}
+	return v;
+}
+
+int nvme_u128_cmp(struct nvme_u128 a, struct nvme_u128 b)
+{
+	if (a.hi != b.hi)
+		return a.hi < b.hi ? -1 : 1;
+	return a.lo < b.lo ? -1 : a.lo > b.lo;
+}
+
+struct nvme_u128 nvme_u128_sub(struct nvme_u128 a, struct nvme_u128 b)
+{
+	struct nvme_u128 v;
+
+	v.lo = a.lo - b.lo;
+	v.hi = a.hi - b.hi - (a.lo < b.lo);
+	return v;
+}
+
+long double nvme_u128_to_double(struct nvme_u128 v)
+{
+	return (long double)v.hi * 18446744073709551616.0L + v.lo;
+}
+
+/* Exact decimal representation, by long division on 32 bit limbs */
+char *nvme_u128_to_string(struct nvme_u128 v, char *buf, size_t len)
+{
+	__u32 limb[4] = { v.hi >> 32, v.hi, v.lo >> 32, v.lo };
+	char digits[40];
+	int i, n = 0;
+
+	do {
+		__u64 rem = 0;
+
+		for (i = 0; i < 4; i++) {
+			__u64 cur = rem << 32 | limb[i];
+
+			limb[i] = cur / 10;
+			rem = cur % 10;
+		}
+		digits[n++] = '0' + rem;
+	} while (limb[0] || limb[1] || limb[2] || limb[3]);
+
+	for (i = 0; i < n && i < len - 1; i++)
+		buf[i] = digits[n - 1 - i];
+	buf[i] = '\0';
+	return buf;
+}
+
 static const char *nvme_ana_state_to_string(enum nvme_ana_state state)
 {
 	switch (state) {
@@ -1659,46 +1718,94 @@ void nvme_show_relatives(const char *name)
 	free(path);
 }
 
+#define HEXDUMP_BUF_SIZE	65536
+#define HEXDUMP_LINE_MAX	256
+
+static const char hexdump_digits[] = "0123456789abcdef";
+
+static void hexdump_flush(char *buf, char **p)
+{
+	fwrite(buf, 1, *p - buf, stdout);
+	*p = buf;
+}
+
+/* Equivalent of printf("\n%04x:", offset) */
+static char *hexdump_offset(char *p, unsigned int offset)
+{
+	int shift = 12;
+
+	*p++ = '\n';
+	while (shift < 28 && (offset >> (shift + 4)))
+		shift += 4;
+	for (; shift >= 0; shift -= 4)
+		*p++ = hexdump_digits[(offset >> shift) & 0xf];
+	*p++ = ':';
+	return p;
+}
+
+/* Blank space standing in for the hex of the missing bytes of a short line */
+static char *hexdump_pad(char *p, int b, int group)
+{
+	int pad = 2 * b + b / group + (b % group ? 1 : 0);
+
+	*p++ = ' ';
+	memset(p, ' ', pad);
+	return p + pad;
+}
+
+/*
+ * Formats whole lines into a local buffer using a nibble lookup table and
+ * hands them to stdio in large chunks, rather than issuing one printf per
+ * byte. The output layout is the same as the historical per-byte version.
+ */
 void d(unsigned char *buf, int len, int width, int group)
 {
-	int i, offset = 0, line_done = 0;
-	char ascii[32 + 1];
-
-	assert(width < sizeof(ascii));
-	printf("     ");
-	for (i = 0; i <= 15; i++)
-		printf("%3x", i);
-	for (i = 0; i < len; i++) {
-		line_done = 0;
-		if (i % width == 0)
-			printf( "\n%04x:", offset);
-		if (i % group == 0)
-			printf( " %02x", buf[i]);
-		else
-			printf( "%02x", buf[i]);
-		ascii[i % width] = (buf[i] >= '!' && buf[i] <= '~') ? buf[i] : '.';
-		if (((i + 1) % width) == 0) {
-			ascii[i % width + 1] = '\0';
-			printf( " \"%.*s\"", width, ascii);
-			offset += width;
-			line_done = 1;
+	static char out[HEXDUMP_BUF_SIZE];
+	char *p = out, *end = out + sizeof(out) - HEXDUMP_LINE_MAX;
+	int i, j, n, offset = 0;
+
+	assert(width <= 32);
+	memset(p, ' ', 5);
+	p += 5;
+	for (i = 0; i <= 15; i++) {
+		*p++ = ' ';
+		*p++ = ' ';
+		*p++ = hexdump_digits[i];
+	}
+
+	for (i = 0; i < len; i += width) {
+		n = len - i < width ? len - i : width;
+		p = hexdump_offset(p, offset);
+		for (j = 0; j < n; j++) {
+			if ((i + j) % group == 0)
+				*p++ = ' ';
+			*p++ = hexdump_digits[buf[i + j] >> 4];
+			*p++ = hexdump_digits[buf[i + j] & 0xf];
 		}
+		if (n < width)
+			p = hexdump_pad(p, width - n, group);
+		*p++ = ' ';
+		*p++ = '"';
+		for (j = 0; j < n; j++)
+			*p++ = (buf[i + j] >= '!' && buf[i + j] <= '~') ?
+					buf[i + j] : '.';
+		*p++ = '"';
+		offset += width;
+		if (p > end)
+			hexdump_flush(out, &p);
 	}
-	if (!line_done) {
-		unsigned b = width - (i % width);
-		ascii[i % width + 1] = '\0';
-		printf( " %*s \"%.*s\"",
-				2 * b + b / group + (b % group ? 1 : 0), "",
-				width, ascii);
+	if (len <= 0) {
+		p = hexdump_pad(p, width, group);
+		memcpy(p, " \"\"", 3);
+		p += 3;
 	}
-	printf( "\n");
+	*p++ = '\n';
+	hexdump_flush(out, &p);
 }
 
 void d_raw(unsigned char *buf, unsigned len)
 {
-	unsigned i;
-	for (i = 0; i < len; i++)
-		putchar(*(buf+i));
+	fwrite(buf, 1, len, stdout);
 }
 
 void nvme_show_status(__u16 status)
@@ -1707,21 +1814,6 @@ void nvme_show_status(__u16 status)
 		status);
 }
 
-static void format(char *formatter, size_t fmt_sz, char *tofmt, size_t tofmtsz)
-{
-
-	fmt_sz = snprintf(formatter,fmt_sz, "%-*.*s",
-		 (int)tofmtsz, (int)tofmtsz, tofmt);
-	/* trim() the obnoxious trailing white lines */
-	while (fmt_sz) {
-		if (formatter[fmt_sz - 1] != ' ' && formatter[fmt_sz - 1] != '\0') {
-			formatter[fmt_sz] = '\0';
-			break;
-		}
-		fmt_sz--;
-	}
-}
-
 static const char *nvme_uuid_to_string(uuid_t uuid)
 {
 	/* large enough to hold uuid str (37) + null-termination byte */
@@ -3163,6 +3255,13 @@ void nvme_show_error_log(struct nvme_error_log_page *err_log, int entries,
 			     entries * sizeof(*err_log));
 	else if (flags & JSON)
 		return json_error_log(err_log, entries);
+	else if (flags & PROMETHEUS) {
+		struct nvme_prom *p = nvme_prom_begin(devname);
+
+		nvme_prom_error_log(p, err_log, entries);
+		nvme_prom_end(p);
+		return;
+	}
 
 	printf("Error Log Entries for device:%s entries:%d\n", devname,
 								entries);
@@ -3266,6 +3365,13 @@ void nvme_show_fw_log(struct nvme_firmware_log_page *fw_log,
 		return d_raw((unsigned char *)fw_log, sizeof(*fw_log));
 	if (flags & JSON)
 		return json_fw_log(fw_log, devname);
+	if (flags & PROMETHEUS) {
+		struct nvme_prom *p = nvme_prom_begin(devname);
+
+		nvme_prom_fw_log(p, fw_log);
+		nvme_prom_end(p);
+		return;
+	}
 
 	printf("Firmware Log for device:%s\n", devname);
 	printf("afi  : %#x\n", fw_log->afi);
@@ -3421,6 +3527,13 @@ void nvme_show_smart_log(struct nvme_smart_log *smart, unsigned int nsid,
 		return d_raw((unsigned char *)smart, sizeof(*smart));
 	else if (flags & JSON)
 		return json_smart_log(smart, nsid, flags);
+	else if (flags & PROMETHEUS) {
+		struct nvme_prom *p = nvme_prom_begin(devname);
+
+		nvme_prom_smart_log(p, smart, nsid);
+		nvme_prom_end(p);
+		return;
+	}
 
 	printf("Smart Log for NVME device:%s namespace-id:%x\n", devname, nsid);
 	printf("critical_warning			: %#x\n",
@@ -3487,6 +3600,130 @@ void nvme_show_smart_log(struct nvme_smart_log *smart, unsigned int nsid,
 		le32_to_cpu(smart->thm_temp2_total_time));
 }
 
+/*
+ * Counters of the SMART / Health log that grow with the workload, reported
+ * by the interval mode of smart-log as the change since the previous
+ * sample. The 32 bit thermal counters may wrap, which modular arithmetic
+ * handles; a 128 bit counter that goes backwards was reset, so its change
+ * is taken to be its new value.
+ */
+static const struct smart_counter {
+	const char *name;
+	size_t offset;
+	bool wide;		/* 128 bit, else __le32 */
+	const char *unit;
+	bool rate;		/* worth a per second rate */
+} smart_counters[] = {
+	{ "data_units_read", offsetof(struct nvme_smart_log, data_units_read), true, "units", true },
+	{ "data_units_written", offsetof(struct nvme_smart_log, data_units_written), true, "units", true },
+	{ "host_read_commands", offsetof(struct nvme_smart_log, host_reads), true, "commands", true },
+	{ "host_write_commands", offsetof(struct nvme_smart_log, host_writes), true, "commands", true },
+	{ "controller_busy_time", offsetof(struct nvme_smart_log, ctrl_busy_time), true, "minutes", false },
+	{ "media_errors", offsetof(struct nvme_smart_log, media_errors), true, "errors", true },
+	{ "num_err_log_entries", offsetof(struct nvme_smart_log, num_err_log_entries), true, "entries", true },
+	{ "warning_temp_time", offsetof(struct nvme_smart_log, warning_temp_time), false, "minutes", false },
+	{ "critical_comp_time", offsetof(struct nvme_smart_log, critical_comp_time), false, "minutes", false },
+	{ "thm_temp1_trans_count", offsetof(struct nvme_smart_log, thm_temp1_trans_count), false, "transitions", true },
+	{ "thm_temp2_trans_count", offsetof(struct nvme_smart_log, thm_temp2_trans_count), false, "transitions", true },
+	{ "thm_temp1_total_time", offsetof(struct nvme_smart_log, thm_temp1_total_time), false, "seconds", false },
+	{ "thm_temp2_total_time", offsetof(struct nvme_smart_log, thm_temp2_total_time), false, "seconds", false },
+};
+
+static struct nvme_u128 smart_counter_delta(const struct smart_counter *sc,
+					    struct nvme_smart_log *prev,
+					    struct nvme_smart_log *cur)
+{
+	struct nvme_u128 p, c, v = { };
+	__le32 p32, c32;
+
+	if (!sc->wide) {
+		memcpy(&p32, (__u8 *)prev + sc->offset, sizeof(p32));
+		memcpy(&c32, (__u8 *)cur + sc->offset, sizeof(c32));
+		v.lo = (__u32)(le32_to_cpu(c32) - le32_to_cpu(p32));
+		return v;
+	}
+
+	p = nvme_u128_from_le((__u8 *)prev + sc->offset);
+	c = nvme_u128_from_le((__u8 *)cur + sc->offset);
+	return nvme_u128_cmp(c, p) < 0 ? c : nvme_u128_sub(c, p);
+}
+
+static void json_smart_log_delta(struct nvme_smart_log *prev,
+				 struct nvme_smart_log *cur, __u64 usecs,
+				 unsigned int nsid, const char *devname)
+{
+	struct json_object *root = json_create_object();
+	long double secs = usecs / 1e6L;
+	char key[64], num[40];
+	int i;
+
+	json_object_add_value_string(root, "device", devname);
+	json_object_add_value_uint(root, "nsid", nsid);
+	json_object_add_value_uint(root, "interval_us", usecs);
+	json_object_add_value_int(root, "temperature",
+		((cur->temperature[1] << 8) | cur->temperature[0]) - 273);
+	json_object_add_value_int(root, "critical_warning",
+		cur->critical_warning);
+
+	for (i = 0; i < ARRAY_SIZE(smart_counters); i++) {
+		const struct smart_counter *sc = &smart_counters[i];
+		struct nvme_u128 delta = smart_counter_delta(sc, prev, cur);
+
+		/* the JSON writer has no 128 bit numbers */
+		if (delta.hi)
+			json_object_add_value_string(root, sc->name,
+				nvme_u128_to_string(delta, num, sizeof(num)));
+		else
+			json_object_add_value_uint(root, sc->name, delta.lo);
+		if (sc->rate && usecs) {
+			snprintf(key, sizeof(key), "%s_per_sec", sc->name);
+			json_object_add_value_float(root, key,
+				nvme_u128_to_double(delta) / secs);
+		}
+	}
+
+	json_print_object(root, NULL);
+	printf("\n");
+	json_free_object(root);
+}
+
+void nvme_show_smart_log_delta(struct nvme_smart_log *prev,
+			       struct nvme_smart_log *cur, __u64 usecs,
+			       unsigned int nsid, const char *devname,
+			       enum nvme_print_flags flags)
+{
+	long double secs = usecs / 1e6L, rate;
+	char num[40];
+	int i;
+
+	if (flags & JSON)
+		return json_smart_log_delta(prev, cur, usecs, nsid, devname);
+
+	printf("Smart Log changes for NVME device:%s namespace-id:%x over %.3Lfs\n",
+		devname, nsid, secs);
+	printf("%-40s: %d C\n", "temperature",
+		((cur->temperature[1] << 8) | cur->temperature[0]) - 273);
+	printf("%-40s: %#x\n", "critical_warning", cur->critical_warning);
+
+	for (i = 0; i < ARRAY_SIZE(smart_counters); i++) {
+		const struct smart_counter *sc = &smart_counters[i];
+		struct nvme_u128 delta = smart_counter_delta(sc, prev, cur);
+
+		printf("%-40s: +%s %s", sc->name,
+			nvme_u128_to_string(delta, num, sizeof(num)), sc->unit);
+		rate = secs ? nvme_u128_to_double(delta) / secs : 0;
+		/* a data unit is a thousand 512 byte blocks */
+		if (sc->rate && sc->wide && !strcmp(sc->unit, "units")) {
+			double bytes = rate * 512000;
+			const char *suffix = suffix_si_get(&bytes);
+
+			printf(" (%.1Lf/s, %.1f %sB/s)", rate, bytes, suffix);
+		} else if (sc->rate)
+			printf(" (%.1Lf/s)", rate);
+		printf("\n");
+	}
+}
+
 void nvme_show_ana_log(struct nvme_ana_rsp_hdr *ana_log, const char *devname,
 			enum nvme_print_flags flags, size_t len)
 {
@@ -3502,6 +3739,13 @@ void nvme_show_ana_log(struct nvme_ana_rsp_hdr *ana_log, const char *devname,
 		return d_raw((unsigned char *)ana_log, len);
 	else if (flags & JSON)
 		return json_ana_log(ana_log, devname);
+	else if (flags & PROMETHEUS) {
+		struct nvme_prom *p = nvme_prom_begin(devname);
+
+		nvme_prom_ana_log(p, ana_log, len);
+		nvme_prom_end(p);
+		return;
+	}
 
 	printf("Asynchronous Namespace Access Log for NVMe device: %s\n",
 			devname);
@@ -4294,9 +4538,10 @@ void nvme_show_lba_status(struct nvme_lba_status *list, unsigned long len,
 
 static void nvme_show_list_item(struct nvme_namespace *n)
 {
-	long long lba	= 1 << n->ns.lbaf[(n->ns.flbas & 0x0f)].ds;
-	double nsze	= le64_to_cpu(n->ns.nsze) * lba;
-	double nuse	= le64_to_cpu(n->ns.nuse) * lba;
+	struct nvme_ctrl *c = n->ctrl;
+	long long lba	= 1 << n->lba_shift;
+	double nsze	= n->nsze * lba;
+	double nuse	= n->nuse * lba;
 
 	const char *s_suffix = suffix_si_get(&nsze);
 	const char *u_suffix = suffix_si_get(&nuse);
@@ -4307,12 +4552,10 @@ static void nvme_show_list_item(struct nvme_namespace *n)
 
 	sprintf(usage,"%6.2f %2sB / %6.2f %2sB", nuse, u_suffix,
 		nsze, s_suffix);
-	sprintf(format,"%3.0f %2sB + %2d B", (double)lba, l_suffix,
-		le16_to_cpu(n->ns.lbaf[(n->ns.flbas & 0x0f)].ms));
-	printf("/dev/%-11s %-*.*s %-*.*s %-9d %-26s %-16s %-.*s\n", n->name,
-		(int)sizeof(n->ctrl->id.sn), (int)sizeof(n->ctrl->id.sn), n->ctrl->id.sn,
-		(int)sizeof(n->ctrl->id.mn), (int)sizeof(n->ctrl->id.mn), n->ctrl->id.mn,
-		n->nsid, usage, format, (int)sizeof(n->ctrl->id.fr), n->ctrl->id.fr);
+	sprintf(format,"%3.0f %2sB + %2d B", (double)lba, l_suffix, n->ms);
+	printf("/dev/%-11s %-20s %-40s %-9d %-26s %-16s %-8s\n", n->name,
+		c ? c->sn : "", c ? c->mn : "", n->nsid, usage, format,
+		c ? c->fr : "");
 }
 
 static void nvme_show_simple_list(struct nvme_topology *t)
@@ -4345,9 +4588,9 @@ static void nvme_show_simple_list(struct nvme_topology *t)
 
 static void nvme_show_details_ns(struct nvme_namespace *n, bool ctrl)
 {
-	long long lba	= 1 << n->ns.lbaf[(n->ns.flbas & 0x0f)].ds;
-	double nsze	= le64_to_cpu(n->ns.nsze) * lba;
-	double nuse	= le64_to_cpu(n->ns.nuse) * lba;
+	long long lba	= 1 << n->lba_shift;
+	double nsze	= n->nsze * lba;
+	double nuse	= n->nuse * lba;
 
 	const char *s_suffix = suffix_si_get(&nsze);
 	const char *u_suffix = suffix_si_get(&nuse);
@@ -4358,14 +4601,13 @@ static void nvme_show_details_ns(struct nvme_namespace *n, bool ctrl)
 
 	sprintf(usage,"%6.2f %2sB / %6.2f %2sB", nuse, u_suffix,
 		nsze, s_suffix);
-	sprintf(format,"%3.0f %2sB + %2d B", (double)lba, l_suffix,
-		le16_to_cpu(n->ns.lbaf[(n->ns.flbas & 0x0f)].ms));
+	sprintf(format,"%3.0f %2sB + %2d B", (double)lba, l_suffix, n->ms);
 
 	printf("%-12s %-8x %-26s %-16s ", n->name, n->nsid, usage, format);
 
 	if (ctrl)
 		printf("%s", n->ctrl->name);
-	else {
+	else if (n->ctrl) {
 		struct nvme_subsystem *s = n->ctrl->subsys;
 		int i;
 
@@ -4406,8 +4648,8 @@ static void nvme_show_detailed_list(struct nvme_topology *t)
 			bool comma = false;
 			struct nvme_ctrl *c = &s->ctrls[j];
 
-			printf("%-8s %-.20s %-.40s %-.8s %-6s %-14s %-12s ",
-				c->name, c->id.sn, c->id.mn, c->id.fr,
+			printf("%-8s %-20s %-40s %-8s %-6s %-14s %-12s ",
+				c->name, c->sn, c->mn, c->fr,
 				c->transport, c->address, s->name);
 
 			for (k = 0; k < c->nr_namespaces; k++) {
@@ -4451,16 +4693,15 @@ static void json_detail_ns(struct nvme_namespace *n, struct json_object *ns_attr
 	long long lba;
 	double nsze, nuse;
 
-	lba = 1 << n->ns.lbaf[(n->ns.flbas & 0x0f)].ds;
-	nsze = le64_to_cpu(n->ns.nsze) * lba;
-	nuse = le64_to_cpu(n->ns.nuse) * lba;
+	lba = 1 << n->lba_shift;
+	nsze = n->nsze * lba;
+	nuse = n->nuse * lba;
 
 	json_object_add_value_string(ns_attrs, "NameSpace", n->name);
 	json_object_add_value_uint(ns_attrs, "NSID", n->nsid);
 
 	json_object_add_value_uint(ns_attrs, "UsedBytes", nuse);
-	json_object_add_value_uint(ns_attrs, "MaximumLBA",
-		le64_to_cpu(n->ns.nsze));
+	json_object_add_value_uint(ns_attrs, "MaximumLBA", n->nsze);
 	json_object_add_value_uint(ns_attrs, "PhysicalSize", nsze);
 	json_object_add_value_uint(ns_attrs, "SectorSize", lba);
 }
@@ -4470,7 +4711,6 @@ static void json_detail_list(struct nvme_topology *t)
 	int i, j, k;
 	struct json_object *root;
 	struct json_array *devices;
-	char formatter[41] = { 0 };
 
 	root = json_create_object();
 	devices = json_create_array();
@@ -4496,14 +4736,9 @@ static void json_detail_list(struct nvme_topology *t)
 			json_object_add_value_string(ctrl_attrs, "Address", c->address);
 			json_object_add_value_string(ctrl_attrs, "State", c->state);
 
-			format(formatter, sizeof(formatter), c->id.fr, sizeof(c->id.fr));
-			json_object_add_value_string(ctrl_attrs, "Firmware", formatter);
-
-			format(formatter, sizeof(formatter), c->id.mn, sizeof(c->id.mn));
-			json_object_add_value_string(ctrl_attrs, "ModelNumber", formatter);
-
-			format(formatter, sizeof(formatter), c->id.sn, sizeof(c->id.sn));
-			json_object_add_value_string(ctrl_attrs, "SerialNumber", formatter);
+			json_object_add_value_string(ctrl_attrs, "Firmware", c->fr);
+			json_object_add_value_string(ctrl_attrs, "ModelNumber", c->mn);
+			json_object_add_value_string(ctrl_attrs, "SerialNumber", c->sn);
 
 			namespaces = json_create_array();
 
@@ -4547,7 +4782,6 @@ static void json_detail_list(struct nvme_topology *t)
 static void json_simple_ns(struct nvme_namespace *n, struct json_array *devices)
 {
 	struct json_object *device_attrs;
-	char formatter[41] = { 0 };
 	double nsze, nuse;
 	int index = -1;
 	long long lba;
@@ -4562,41 +4796,35 @@ static void json_simple_ns(struct nvme_namespace *n, struct json_array *devices)
 	json_object_add_value_string(device_attrs, "DevicePath", devnode);
 	free(devnode);
 
-	format(formatter, sizeof(formatter),
-			   n->ctrl->id.fr,
-			   sizeof(n->ctrl->id.fr));
-
-	json_object_add_value_string(device_attrs, "Firmware", formatter);
+	/* a multipath namespace with no controller left has no identity */
+	if (n->ctrl) {
+		json_object_add_value_string(device_attrs, "Firmware",
+					     n->ctrl->fr);
 
-	if (sscanf(n->ctrl->name, "nvme%d", &index) == 1)
-		json_object_add_value_int(device_attrs, "Index", index);
+		if (sscanf(n->ctrl->name, "nvme%d", &index) == 1)
+			json_object_add_value_int(device_attrs, "Index", index);
 
-	format(formatter, sizeof(formatter),
-		       n->ctrl->id.mn,
-		       sizeof(n->ctrl->id.mn));
+		json_object_add_value_string(device_attrs, "ModelNumber",
+					     n->ctrl->mn);
 
-	json_object_add_value_string(device_attrs, "ModelNumber", formatter);
+		if (index >= 0) {
+			char *product = nvme_product_name(index);
 
-	if (index >= 0) {
-		char *product = nvme_product_name(index);
+			json_object_add_value_string(device_attrs,
+						     "ProductName", product);
+			free((void*)product);
+		}
 
-		json_object_add_value_string(device_attrs, "ProductName", product);
-		free((void*)product);
+		json_object_add_value_string(device_attrs, "SerialNumber",
+					     n->ctrl->sn);
 	}
 
-	format(formatter, sizeof(formatter),
-	       n->ctrl->id.sn,
-	       sizeof(n->ctrl->id.sn));
-
-	json_object_add_value_string(device_attrs, "SerialNumber", formatter);
-
-	lba = 1 << n->ns.lbaf[(n->ns.flbas & 0x0f)].ds;
-	nsze = le64_to_cpu(n->ns.nsze) * lba;
-	nuse = le64_to_cpu(n->ns.nuse) * lba;
+	lba = 1 << n->lba_shift;
+	nsze = n->nsze * lba;
+	nuse = n->nuse * lba;
 
 	json_object_add_value_uint(device_attrs, "UsedBytes", nuse);
-	json_object_add_value_uint(device_attrs, "MaximumLBA",
-				  le64_to_cpu(n->ns.nsze));
+	json_object_add_value_uint(device_attrs, "MaximumLBA", n->nsze);
 	json_object_add_value_uint(device_attrs, "PhysicalSize", nsze);
 	json_object_add_value_uint(device_attrs, "SectorSize", lba);
 
@@ -4641,9 +4869,279 @@ static void json_print_list_items(struct nvme_topology *t,
 		json_simple_list(t);
 }
 
+static const struct {
+	const char *name;
+	size_t offset;
+	bool wide;		/* 128 bit, else __le32 */
+	const char *help;
+} prom_smart_counters[] = {
+	{ "nvme_data_units_read_total", offsetof(struct nvme_smart_log, data_units_read), true,
+	  "Data read by the host, in thousands of 512 byte units" },
+	{ "nvme_data_units_written_total", offsetof(struct nvme_smart_log, data_units_written), true,
+	  "Data written by the host, in thousands of 512 byte units" },
+	{ "nvme_host_read_commands_total", offsetof(struct nvme_smart_log, host_reads), true,
+	  "Read commands completed by the controller" },
+	{ "nvme_host_write_commands_total", offsetof(struct nvme_smart_log, host_writes), true,
+	  "Write commands completed by the controller" },
+	{ "nvme_controller_busy_time_minutes_total", offsetof(struct nvme_smart_log, ctrl_busy_time), true,
+	  "Minutes the controller was busy with I/O commands" },
+	{ "nvme_power_cycles_total", offsetof(struct nvme_smart_log, power_cycles), true,
+	  "Power cycles" },
+	{ "nvme_power_on_hours_total", offsetof(struct nvme_smart_log, power_on_hours), true,
+	  "Power on hours" },
+	{ "nvme_unsafe_shutdowns_total", offsetof(struct nvme_smart_log, unsafe_shutdowns), true,
+	  "Shutdowns without a shutdown notification" },
+	{ "nvme_media_errors_total", offsetof(struct nvme_smart_log, media_errors), true,
+	  "Unrecovered data integrity errors" },
+	{ "nvme_error_log_entries_total", offsetof(struct nvme_smart_log, num_err_log_entries), true,
+	  "Error Information log entries over the life of the controller" },
+	{ "nvme_warning_temperature_time_minutes_total", offsetof(struct nvme_smart_log, warning_temp_time), false,
+	  "Minutes above the warning composite temperature threshold" },
+	{ "nvme_critical_temperature_time_minutes_total", offsetof(struct nvme_smart_log, critical_comp_time), false,
+	  "Minutes above the critical composite temperature threshold" },
+};
+
+void nvme_prom_smart_log(struct nvme_prom *p, struct nvme_smart_log *smart,
+			 unsigned int nsid)
+{
+	int temperature = ((smart->temperature[1] << 8) |
+			    smart->temperature[0]) - 273;
+	char ns[32] = "", labels[64], num[40];
+	__le32 v32;
+	int i;
+
+	if (nsid != NVME_NSID_ALL)
+		snprintf(ns, sizeof(ns), "nsid=\"%u\"", nsid);
+
+	nvme_prom_add(p, "nvme_critical_warning", NVME_PROM_GAUGE,
+		      "Critical warning bits of the SMART / Health log", ns,
+		      "%u", smart->critical_warning);
+	nvme_prom_add(p, "nvme_temperature_celsius", NVME_PROM_GAUGE,
+		      "Composite temperature", ns, "%d", temperature);
+	nvme_prom_add(p, "nvme_available_spare_percent", NVME_PROM_GAUGE,
+		      "Remaining spare capacity", ns, "%u",
+		      smart->avail_spare);
+	nvme_prom_add(p, "nvme_available_spare_threshold_percent",
+		      NVME_PROM_GAUGE,
+		      "Available spare below which a critical warning is raised",
+		      ns, "%u", smart->spare_thresh);
+	nvme_prom_add(p, "nvme_percentage_used", NVME_PROM_GAUGE,
+		      "Estimate of the endurance used, may exceed 100", ns,
+		      "%u", smart->percent_used);
+	nvme_prom_add(p, "nvme_endurance_group_critical_warning",
+		      NVME_PROM_GAUGE,
+		      "Critical warning bits summarized over endurance groups",
+		      ns, "%u", smart->endu_grp_crit_warn_sumry);
+
+	for (i = 0; i < ARRAY_SIZE(prom_smart_counters); i++) {
+		const __u8 *f = (__u8 *)smart + prom_smart_counters[i].offset;
+
+		if (prom_smart_counters[i].wide)
+			nvme_u128_to_string(nvme_u128_from_le(f), num,
+					    sizeof(num));
+		else {
+			memcpy(&v32, f, sizeof(v32));
+			snprintf(num, sizeof(num), "%u", le32_to_cpu(v32));
+		}
+		nvme_prom_add(p, prom_smart_counters[i].name,
+			      NVME_PROM_COUNTER, prom_smart_counters[i].help,
+			      ns, "%s", num);
+	}
+
+	for (i = 0; i < 8; i++) {
+		__s32 temp = le16_to_cpu(smart->temp_sensor[i]);
+
+		if (!temp)
+			continue;
+		snprintf(labels, sizeof(labels), "%s%ssensor=\"%d\"", ns,
+			 ns[0] ? "," : "", i + 1);
+		nvme_prom_add(p, "nvme_temperature_sensor_celsius",
+			      NVME_PROM_GAUGE, "Temperature sensor reading",
+			      labels, "%d", temp - 273);
+	}
+
+	for (i = 0; i < 2; i++) {
+		snprintf(labels, sizeof(labels), "%s%slevel=\"%d\"", ns,
+			 ns[0] ? "," : "", i + 1);
+		nvme_prom_add(p, "nvme_thermal_management_transitions_total",
+			      NVME_PROM_COUNTER,
+			      "Transitions to the thermal management temperature",
+			      labels, "%u", le32_to_cpu(i ?
+				smart->thm_temp2_trans_count :
+				smart->thm_temp1_trans_count));
+		nvme_prom_add(p, "nvme_thermal_management_time_seconds_total",
+			      NVME_PROM_COUNTER,
+			      "Seconds spent at the thermal management temperature",
+			      labels, "%u", le32_to_cpu(i ?
+				smart->thm_temp2_total_time :
+				smart->thm_temp1_total_time));
+	}
+}
+
+/* A summary: the recent entries by status rather than each of them */
+void nvme_prom_error_log(struct nvme_prom *p,
+			 struct nvme_error_log_page *err_log, int entries)
+{
+	struct {
+		__u16 status;
+		int count;
+	} status[64];
+	int i, j, nr_status = 0, valid = 0;
+	char labels[32];
+	__u64 count = 0;
+
+	for (i = 0; i < entries; i++) {
+		__u16 sc = le16_to_cpu(err_log[i].status_field) >> 1;
+
+		if (!err_log[i].error_count)
+			continue;
+		valid++;
+		if (le64_to_cpu(err_log[i].error_count) > count)
+			count = le64_to_cpu(err_log[i].error_count);
+		for (j = 0; j < nr_status && status[j].status != sc; j++)
+			;
+		if (j == nr_status) {
+			if (nr_status == ARRAY_SIZE(status))
+				continue;
+			status[nr_status].status = sc;
+			status[nr_status++].count = 0;
+		}
+		status[j].count++;
+	}
+
+	nvme_prom_add(p, "nvme_error_count_total", NVME_PROM_COUNTER,
+		      "Error count of the most recent Error Information entry",
+		      NULL, "%"PRIu64, (uint64_t)count);
+	nvme_prom_add(p, "nvme_error_log_valid_entries", NVME_PROM_GAUGE,
+		      "Error Information entries read that are in use", NULL,
+		      "%d", valid);
+	for (i = 0; i < nr_status; i++) {
+		snprintf(labels, sizeof(labels), "status=\"%#x\"",
+			 status[i].status);
+		nvme_prom_add(p, "nvme_error_log_status_entries",
+			      NVME_PROM_GAUGE,
+			      "Error Information entries read with this status",
+			      labels, "%d", status[i].count);
+	}
+}
+
+void nvme_prom_fw_log(struct nvme_prom *p,
+		      struct nvme_firmware_log_page *fw_log)
+{
+	char labels[64], fr[9], efr[24];
+	int i, len;
+
+	nvme_prom_add(p, "nvme_firmware_active_slot", NVME_PROM_GAUGE,
+		      "Firmware slot the controller runs", NULL, "%u",
+		      fw_log->afi & 0x7);
+	nvme_prom_add(p, "nvme_firmware_next_slot", NVME_PROM_GAUGE,
+		      "Firmware slot activated at the next reset, 0 if none",
+		      NULL, "%u", (fw_log->afi >> 4) & 0x7);
+	for (i = 0; i < 7; i++) {
+		if (!fw_log->frs[i])
+			continue;
+		memcpy(fr, &fw_log->frs[i], 8);
+		for (len = 8; len && (fr[len - 1] == ' ' || !fr[len - 1]); len--)
+			;
+		fr[len] = '\0';
+		snprintf(labels, sizeof(labels), "slot=\"%d\",revision=\"%s\"",
+			 i + 1, nvme_prom_escape(fr, efr, sizeof(efr)));
+		nvme_prom_add(p, "nvme_firmware_slot_info", NVME_PROM_GAUGE,
+			      "Firmware revision in a slot", labels, "1");
+	}
+}
+
+void nvme_prom_ana_log(struct nvme_prom *p, struct nvme_ana_rsp_hdr *ana_log,
+		       size_t len)
+{
+	static const enum nvme_ana_state states[] = {
+		NVME_ANA_OPTIMIZED, NVME_ANA_NONOPTIMIZED,
+		NVME_ANA_INACCESSIBLE, NVME_ANA_PERSISTENT_LOSS,
+		NVME_ANA_CHANGE,
+	};
+	size_t offset = sizeof(*ana_log);
+	struct nvme_ana_group_desc *desc;
+	char labels[64];
+	int i, j;
+
+	nvme_prom_add(p, "nvme_ana_change_count_total", NVME_PROM_COUNTER,
+		      "Changes of the ANA log", NULL, "%"PRIu64,
+		      (uint64_t)le64_to_cpu(ana_log->chgcnt));
+
+	for (i = 0; i < le16_to_cpu(ana_log->ngrps); i++) {
+		if (offset + sizeof(*desc) > len)
+			break;
+		desc = (void *)ana_log + offset;
+		offset += sizeof(*desc) +
+			  le32_to_cpu(desc->nnsids) * sizeof(__le32);
+
+		snprintf(labels, sizeof(labels), "group=\"%u\"",
+			 le32_to_cpu(desc->grpid));
+		nvme_prom_add(p, "nvme_ana_group_namespaces", NVME_PROM_GAUGE,
+			      "Namespaces in the ANA group", labels, "%u",
+			      le32_to_cpu(desc->nnsids));
+		for (j = 0; j < ARRAY_SIZE(states); j++) {
+			snprintf(labels, sizeof(labels),
+				 "group=\"%u\",state=\"%s\"",
+				 le32_to_cpu(desc->grpid),
+				 nvme_ana_state_to_string(states[j]));
+			nvme_prom_add(p, "nvme_ana_group_state",
+				      NVME_PROM_GAUGE,
+				      "ANA state of the group through this controller",
+				      labels, "%d", desc->state == states[j]);
+		}
+	}
+}
+
+static void prom_list_ns(struct nvme_prom *p, struct nvme_namespace *n)
+{
+	struct nvme_ctrl *c = n->ctrl;
+	long long lba = 1LL << n->lba_shift;
+	char labels[64], fr[24];
+
+	nvme_prom_labels(p, n->name, c ? c->sn : "", c ? c->mn : "");
+	snprintf(labels, sizeof(labels), "nsid=\"%u\",firmware=\"%s\"",
+		 n->nsid, nvme_prom_escape(c ? c->fr : "", fr, sizeof(fr)));
+	nvme_prom_add(p, "nvme_namespace_info", NVME_PROM_GAUGE,
+		      "Namespace and the firmware of its controller", labels,
+		      "1");
+	snprintf(labels, sizeof(labels), "nsid=\"%u\"", n->nsid);
+	nvme_prom_add(p, "nvme_namespace_size_bytes", NVME_PROM_GAUGE,
+		      "Size of the namespace", labels, "%llu", n->nsze * lba);
+	nvme_prom_add(p, "nvme_namespace_used_bytes", NVME_PROM_GAUGE,
+		      "Space allocated in the namespace", labels, "%llu",
+		      n->nuse * lba);
+	nvme_prom_add(p, "nvme_namespace_sector_size_bytes", NVME_PROM_GAUGE,
+		      "Logical block size of the namespace", labels, "%lld",
+		      lba);
+}
+
+void nvme_prom_list(struct nvme_prom *p, struct nvme_topology *t)
+{
+	int i, j, k;
+
+	for (i = 0; i < t->nr_subsystems; i++) {
+		struct nvme_subsystem *s = &t->subsystems[i];
+
+		for (j = 0; j < s->nr_ctrls; j++) {
+			struct nvme_ctrl *c = &s->ctrls[j];
+
+			for (k = 0; k < c->nr_namespaces; k++)
+				prom_list_ns(p, &c->namespaces[k]);
+		}
+		for (j = 0; j < s->nr_namespaces; j++)
+			prom_list_ns(p, &s->namespaces[j]);
+	}
+}
+
 void nvme_show_list_items(struct nvme_topology *t, enum nvme_print_flags flags)
 {
-	if (flags & JSON)
+	if (flags & PROMETHEUS) {
+		struct nvme_prom *p = nvme_prom_create();
+
+		nvme_prom_list(p, t);
+		nvme_prom_end(p);
+	} else if (flags & JSON)
 		json_print_list_items(t, flags);
 	else if (flags & VERBOSE)
 		nvme_show_detailed_list(t);
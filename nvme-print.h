@@ -2,6 +2,7 @@
 #define NVME_PRINT_H
 
 #include "nvme.h"
+#include "nvme-prometheus.h"
 #include "util/json.h"
 #include <inttypes.h>
 
@@ -9,6 +10,18 @@ void d(unsigned char *buf, int len, int width, int group);
 void d_raw(unsigned char *buf, unsigned len);
 uint64_t int48_to_long(__u8 *data);
 
+/* 128 bit little endian counters, as found in log pages */
+struct nvme_u128 {
+	__u64 hi;
+	__u64 lo;
+};
+
+struct nvme_u128 nvme_u128_from_le(const __u8 *data);
+int nvme_u128_cmp(struct nvme_u128 a, struct nvme_u128 b);
+struct nvme_u128 nvme_u128_sub(struct nvme_u128 a, struct nvme_u128 b);
+long double nvme_u128_to_double(struct nvme_u128 v);
+char *nvme_u128_to_string(struct nvme_u128 v, char *buf, size_t len);
+
 void nvme_show_status(__u16 status);
 void nvme_show_relatives(const char *name);
 
@@ -24,6 +37,9 @@ void nvme_show_error_log(struct nvme_error_log_page *err_log, int entries,
 	const char *devname, enum nvme_print_flags flags);
 void nvme_show_smart_log(struct nvme_smart_log *smart, unsigned int nsid,
 	const char *devname, enum nvme_print_flags flags);
+void nvme_show_smart_log_delta(struct nvme_smart_log *prev,
+	struct nvme_smart_log *cur, __u64 usecs, unsigned int nsid,
+	const char *devname, enum nvme_print_flags flags);
 void nvme_show_ana_log(struct nvme_ana_rsp_hdr *ana_log, const char *devname,
 	enum nvme_print_flags flags, size_t len);
 void nvme_show_self_test_log(struct nvme_self_test_log *self_test, const char *devname,
@@ -54,6 +70,16 @@ void nvme_show_id_ns_granularity_list(const struct nvme_id_ns_granularity_list *
 void nvme_show_id_uuid_list(const struct nvme_id_uuid_list *uuid_list,
 	enum nvme_print_flags flags);
 
+void nvme_prom_smart_log(struct nvme_prom *p, struct nvme_smart_log *smart,
+	unsigned int nsid);
+void nvme_prom_error_log(struct nvme_prom *p,
+	struct nvme_error_log_page *err_log, int entries);
+void nvme_prom_fw_log(struct nvme_prom *p,
+	struct nvme_firmware_log_page *fw_log);
+void nvme_prom_ana_log(struct nvme_prom *p, struct nvme_ana_rsp_hdr *ana_log,
+	size_t len);
+void nvme_prom_list(struct nvme_prom *p, struct nvme_topology *t);
+
 void nvme_feature_show_fields(__u32 fid, unsigned int result, unsigned char *buf);
 void nvme_directive_show(__u8 type, __u8 oper, __u16 spec, __u32 nsid, __u32 result,
 	void *buf, __u32 len, enum nvme_print_flags flags);
@@ -0,0 +1,420 @@
+/*
+ * nvme prometheus: writes metrics in the Prometheus text exposition
+ * format, for -o prometheus and for export-metrics, which collects the
+ * health of every controller in one pass and replaces a node exporter
+ * textfile atomically.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-print.h"
+#include "nvme-prometheus.h"
+
+#define PROM_MAX_ERRORS		64
+
+struct prom_family {
+	const char *name;
+	const char *type;
+	const char *help;
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+struct nvme_prom {
+	int nr_families;
+	struct prom_family *families;
+	char labels[256];
+	bool failed;
+};
+
+static struct config {
+	char *textfile;
+} cfg;
+
+struct nvme_prom *nvme_prom_create(void)
+{
+	return calloc(1, sizeof(struct nvme_prom));
+}
+
+void nvme_prom_free(struct nvme_prom *p)
+{
+	int i;
+
+	if (!p)
+		return;
+	for (i = 0; i < p->nr_families; i++)
+		free(p->families[i].buf);
+	free(p->families);
+	free(p);
+}
+
+/* Escapes a label value: backslash, double quote and line feed */
+char *nvme_prom_escape(const char *s, char *buf, size_t len)
+{
+	size_t i = 0;
+
+	for (; *s && i + 2 < len; s++) {
+		if (*s == '\\' || *s == '"' || *s == '\n')
+			buf[i++] = '\\';
+		buf[i++] = *s == '\n' ? 'n' : *s;
+	}
+	buf[i] = '\0';
+	return buf;
+}
+
+static void prom_trim(char *s)
+{
+	size_t len = strlen(s);
+
+	while (len && (s[len - 1] == ' ' || s[len - 1] == '\n'))
+		s[--len] = '\0';
+}
+
+/* Sets the labels every following sample of p carries */
+void nvme_prom_labels(struct nvme_prom *p, const char *device,
+		      const char *serial, const char *model)
+{
+	char dev[64], sn[64], mn[96], esn[64], emn[96];
+
+	if (!p)
+		return;
+	snprintf(sn, sizeof(sn), "%s", serial ? serial : "");
+	snprintf(mn, sizeof(mn), "%s", model ? model : "");
+	prom_trim(sn);
+	prom_trim(mn);
+	nvme_prom_escape(device, dev, sizeof(dev));
+	nvme_prom_escape(sn, esn, sizeof(esn));
+	nvme_prom_escape(mn, emn, sizeof(emn));
+	snprintf(p->labels, sizeof(p->labels),
+		 "device=\"%s\",serial=\"%s\",model=\"%s\"", dev, esn, emn);
+}
+
+static void prom_read_attr(const char *devname, const char *attr, char *buf,
+			   size_t len)
+{
+	char path[PATH_MAX];
+	ssize_t ret;
+	int fd;
+
+	/* a controller, or a namespace of it or of its subsystem */
+	snprintf(path, sizeof(path), SYS_NVME "/%s/%s", devname, attr);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		snprintf(path, sizeof(path), "/sys/block/%s/device/%s",
+			 devname, attr);
+		fd = open(path, O_RDONLY);
+	}
+	buf[0] = '\0';
+	if (fd < 0)
+		return;
+	ret = read(fd, buf, len - 1);
+	close(fd);
+	buf[ret > 0 ? ret : 0] = '\0';
+}
+
+/* Labels the samples with the device and the serial and model sysfs has */
+void nvme_prom_device(struct nvme_prom *p, const char *devname)
+{
+	char sn[64], mn[96];
+
+	prom_read_attr(devname, "serial", sn, sizeof(sn));
+	prom_read_attr(devname, "model", mn, sizeof(mn));
+	nvme_prom_labels(p, devname, sn, mn);
+}
+
+static struct prom_family *prom_family(struct nvme_prom *p, const char *name,
+				       const char *type, const char *help)
+{
+	struct prom_family *f;
+	int i;
+
+	for (i = 0; i < p->nr_families; i++)
+		if (!strcmp(p->families[i].name, name))
+			return &p->families[i];
+
+	f = realloc(p->families, (p->nr_families + 1) * sizeof(*f));
+	if (!f)
+		return NULL;
+	p->families = f;
+	f = &p->families[p->nr_families++];
+	memset(f, 0, sizeof(*f));
+	f->name = name;
+	f->type = type;
+	f->help = help;
+	return f;
+}
+
+/*
+ * Adds a sample of the family name, which type and help describe when it
+ * is new. labels are the ones particular to the sample, if any, in the
+ * name="value" form and already escaped.
+ */
+void nvme_prom_add(struct nvme_prom *p, const char *name, const char *type,
+		   const char *help, const char *labels, const char *fmt, ...)
+{
+	struct prom_family *f;
+	char value[64], line[512];
+	va_list ap;
+	int len;
+	char *buf;
+
+	if (!p)
+		return;
+	f = prom_family(p, name, type, help);
+	if (!f) {
+		p->failed = true;
+		return;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(value, sizeof(value), fmt, ap);
+	va_end(ap);
+
+	if (!labels)
+		labels = "";
+	if (!p->labels[0] && !labels[0])
+		len = snprintf(line, sizeof(line), "%s %s\n", name, value);
+	else
+		len = snprintf(line, sizeof(line), "%s{%s%s%s} %s\n", name,
+			       p->labels, p->labels[0] && labels[0] ? "," : "",
+			       labels, value);
+	if (len >= sizeof(line)) {
+		p->failed = true;
+		return;
+	}
+
+	if (f->len + len + 1 > f->size) {
+		size_t size = f->size ? f->size * 2 : 1024;
+
+		while (size < f->len + len + 1)
+			size *= 2;
+		buf = realloc(f->buf, size);
+		if (!buf) {
+			p->failed = true;
+			return;
+		}
+		f->buf = buf;
+		f->size = size;
+	}
+	memcpy(f->buf + f->len, line, len + 1);
+	f->len += len;
+}
+
+/*
+ * Vendor logs have no common meaning for their attributes, nor always a
+ * type, so they share one untyped family, told apart by labels.
+ */
+void nvme_prom_vendor_smart(struct nvme_prom *p, const char *vendor,
+			    const char *log, const char *attribute,
+			    const char *fmt, ...)
+{
+	char value[64], attr[128], labels[192];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(value, sizeof(value), fmt, ap);
+	va_end(ap);
+
+	snprintf(labels, sizeof(labels),
+		 "vendor=\"%s\",log=\"%s\",attribute=\"%s\"", vendor, log,
+		 nvme_prom_escape(attribute, attr, sizeof(attr)));
+	nvme_prom_add(p, "nvme_vendor_smart", NVME_PROM_UNTYPED,
+		      "Attribute of a vendor specific SMART log", labels, "%s",
+		      value);
+}
+
+int nvme_prom_write(struct nvme_prom *p, FILE *f)
+{
+	struct prom_family *fam;
+	int i;
+
+	if (!p || p->failed)
+		return -ENOMEM;
+	for (i = 0; i < p->nr_families; i++) {
+		fam = &p->families[i];
+		fprintf(f, "# HELP %s %s\n", fam->name, fam->help);
+		fprintf(f, "# TYPE %s %s\n", fam->name, fam->type);
+		fputs(fam->buf, f);
+	}
+	return ferror(f) ? -EIO : 0;
+}
+
+struct nvme_prom *nvme_prom_begin(const char *devname)
+{
+	struct nvme_prom *p = nvme_prom_create();
+
+	nvme_prom_device(p, devname);
+	return p;
+}
+
+void nvme_prom_end(struct nvme_prom *p)
+{
+	if (nvme_prom_write(p, stdout))
+		fprintf(stderr, "Failed to format the metrics\n");
+	nvme_prom_free(p);
+}
+
+static void prom_read_result(struct nvme_prom *p, const char *log, int err)
+{
+	char labels[32];
+
+	snprintf(labels, sizeof(labels), "log=\"%s\"", log);
+	nvme_prom_add(p, "nvme_log_read_success", NVME_PROM_GAUGE,
+		      "Whether the log page could be read for this export",
+		      labels, "%d", !err);
+}
+
+static void prom_collect_ctrl(struct nvme_prom *p, struct nvme_ctrl *c)
+{
+	struct nvme_error_log_page errors[PROM_MAX_ERRORS];
+	struct nvme_firmware_log_page fw_log;
+	struct nvme_smart_log smart;
+	struct nvme_id_ctrl id;
+	char path[PATH_MAX];
+	size_t ana_len;
+	void *ana;
+	int fd, err, entries;
+
+	nvme_prom_labels(p, c->name, c->sn, c->mn);
+	snprintf(path, sizeof(path), "/dev/%s", c->name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		prom_read_result(p, "identify", -errno);
+		return;
+	}
+
+	err = nvme_identify_ctrl(fd, &id);
+	prom_read_result(p, "identify", err);
+	if (err)
+		goto close_fd;
+
+	err = nvme_smart_log(fd, NVME_NSID_ALL, &smart);
+	prom_read_result(p, "smart", err);
+	if (!err)
+		nvme_prom_smart_log(p, &smart, NVME_NSID_ALL);
+
+	entries = min(id.elpe + 1, PROM_MAX_ERRORS);
+	err = nvme_error_log(fd, entries, errors);
+	prom_read_result(p, "error", err);
+	if (!err)
+		nvme_prom_error_log(p, errors, entries);
+
+	err = nvme_fw_log(fd, &fw_log);
+	prom_read_result(p, "firmware", err);
+	if (!err)
+		nvme_prom_fw_log(p, &fw_log);
+
+	if (!(id.cmic & (1 << 3)))
+		goto close_fd;
+	ana_len = sizeof(struct nvme_ana_rsp_hdr) +
+		le32_to_cpu(id.nanagrpid) * sizeof(struct nvme_ana_group_desc);
+	if (!(id.anacap & (1 << 6)))
+		ana_len += le32_to_cpu(id.mnan) * sizeof(__le32);
+	ana = malloc(ana_len);
+	if (!ana)
+		goto close_fd;
+	err = nvme_ana_log(fd, ana, ana_len, 0);
+	prom_read_result(p, "ana", err);
+	if (!err)
+		nvme_prom_ana_log(p, ana, ana_len);
+	free(ana);
+close_fd:
+	close(fd);
+}
+
+/*
+ * The file is written under a temporary name in the same directory and
+ * renamed over the old one, so that a scrape never reads half of it. The
+ * node exporter only reads files ending in .prom.
+ */
+static int prom_write_file(struct nvme_prom *p, const char *path)
+{
+	char tmp[PATH_MAX];
+	FILE *f;
+	int fd, err;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))
+		return -ENAMETOOLONG;
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+	f = fdopen(fd, "w");
+	if (!f) {
+		err = -errno;
+		close(fd);
+		goto unlink;
+	}
+
+	err = nvme_prom_write(p, f);
+	if (!err && (fflush(f) || fchmod(fd, 0644) || fsync(fd)))
+		err = -errno;
+	if (fclose(f) && !err)
+		err = -errno;
+	if (!err && rename(tmp, path))
+		err = -errno;
+unlink:
+	if (err)
+		unlink(tmp);
+	return err;
+}
+
+int export_metrics(const char *desc, int argc, char **argv)
+{
+	const char *textfile = "file to replace atomically, instead of printing";
+	struct nvme_topology t = { };
+	struct nvme_prom *p;
+	int err, i, j;
+
+	OPT_ARGS(opts) = {
+		OPT_FILE("textfile", 'f', &cfg.textfile, textfile),
+		OPT_END()
+	};
+
+	err = argconfig_parse(argc, argv, desc, opts);
+	if (err)
+		return err;
+
+	err = scan_subsystems(&t, NULL, 0);
+	if (err) {
+		fprintf(stderr, "Failed to scan namespaces\n");
+		return err;
+	}
+	nvme_topology_identify(&t);
+
+	p = nvme_prom_create();
+	if (!p) {
+		free_topology(&t);
+		return -ENOMEM;
+	}
+	for (i = 0; i < t.nr_subsystems; i++) {
+		struct nvme_subsystem *s = &t.subsystems[i];
+
+		for (j = 0; j < s->nr_ctrls; j++)
+			prom_collect_ctrl(p, &s->ctrls[j]);
+	}
+	nvme_prom_list(p, &t);
+
+	if (cfg.textfile)
+		err = prom_write_file(p, cfg.textfile);
+	else
+		err = nvme_prom_write(p, stdout);
+	if (err)
+		fprintf(stderr, "Failed to write %s: %s\n",
+			cfg.textfile ? cfg.textfile : "the metrics",
+			strerror(-err));
+
+	nvme_prom_free(p);
+	free_topology(&t);
+	return err;
+}
@@ -0,0 +1,42 @@
+#ifndef _NVME_PROMETHEUS_H
+#define _NVME_PROMETHEUS_H
+
+#include <stdio.h>
+
+/*
+ * Metrics in the Prometheus text exposition format. Samples are kept per
+ * metric family, so that the metrics of many devices can be added in any
+ * order and still come out with each family in one block, as the format
+ * requires. Every sample carries the labels of the current device.
+ */
+struct nvme_prom;
+
+#define NVME_PROM_GAUGE		"gauge"
+#define NVME_PROM_COUNTER	"counter"
+#define NVME_PROM_UNTYPED	"untyped"
+
+struct nvme_prom *nvme_prom_create(void);
+void nvme_prom_free(struct nvme_prom *p);
+void nvme_prom_labels(struct nvme_prom *p, const char *device,
+		      const char *serial, const char *model);
+void nvme_prom_device(struct nvme_prom *p, const char *devname);
+void nvme_prom_add(struct nvme_prom *p, const char *name, const char *type,
+		   const char *help, const char *labels, const char *fmt, ...)
+	__attribute__((format(printf, 6, 7)));
+int nvme_prom_write(struct nvme_prom *p, FILE *f);
+
+/* an attribute of a vendor specific SMART log, as nvme_vendor_smart */
+void nvme_prom_vendor_smart(struct nvme_prom *p, const char *vendor,
+			    const char *log, const char *attribute,
+			    const char *fmt, ...)
+	__attribute__((format(printf, 5, 6)));
+
+/* for a command showing the metrics of one device */
+struct nvme_prom *nvme_prom_begin(const char *devname);
+void nvme_prom_end(struct nvme_prom *p);
+
+char *nvme_prom_escape(const char *s, char *buf, size_t len);
+
+extern int export_metrics(const char *desc, int argc, char **argv);
+
+#endif
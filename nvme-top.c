@@ -0,0 +1,536 @@
+/*
+ * nvme top: a live view of the I/O load of every NVMe controller and
+ * namespace, along the lines of iostat, with the temperature and critical
+ * warnings of the controllers next to it.
+ *
+ * The topology is scanned once and the block layer statistics of every
+ * namespace are then sampled through file descriptors kept open for the
+ * whole run. The load of a controller is the sum of that of its namespaces,
+ * or of its paths to them for multipath namespaces, so the heads of those
+ * are shown on their own under their subsystem.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <limits.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-print.h"
+#include "nvme-top.h"
+
+/* fields of /sys/block/<disk>/stat, see Documentation/block/stat.rst */
+enum {
+	STAT_READ_IOS,
+	STAT_READ_MERGES,
+	STAT_READ_SECTORS,
+	STAT_READ_TICKS,
+	STAT_WRITE_IOS,
+	STAT_WRITE_MERGES,
+	STAT_WRITE_SECTORS,
+	STAT_WRITE_TICKS,
+	STAT_IN_FLIGHT,
+	STAT_IO_TICKS,
+	STAT_TIME_IN_QUEUE,
+	STAT_NR,
+};
+
+enum top_kind {
+	TOP_CTRL,
+	TOP_NS,		/* namespace or path of a controller */
+	TOP_HEAD,	/* multipath namespace */
+};
+
+struct top_row {
+	enum top_kind kind;
+	const char *name;
+	struct top_row *ctrl;		/* owning controller of a TOP_NS */
+	struct dirent *dent;		/* sysfs entry a TOP_NS is named by */
+
+	int stat_fd;
+	int inflight_fd;
+	__u64 prev[STAT_NR];
+	__u64 cur[STAT_NR];
+	__u64 delta[STAT_NR];
+	unsigned int inflight;
+	bool gone;
+
+	/* TOP_CTRL only */
+	struct nvme_ctrl *c;
+	int dev_fd;
+	__u64 smart_at;
+	bool smart_valid;
+	int temp;			/* degrees Celsius */
+	__u8 critical_warning;
+};
+
+struct top {
+	struct nvme_topology t;
+	int nr_rows;
+	struct top_row *rows;
+	bool tty;
+};
+
+static struct config {
+	int interval;
+	int count;
+	int smart_interval;
+	char *output_format;
+} cfg = {
+	.interval = 1000,
+	.smart_interval = 10,
+	.output_format = "normal",
+};
+
+static volatile sig_atomic_t top_stop;
+
+static void top_signal(int sig)
+{
+	top_stop = 1;
+}
+
+static __u64 top_now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int top_open_attr(const char *disk, const char *attr)
+{
+	char path[NAME_MAX + 32];
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", disk, attr);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static struct top_row *top_add(struct top *top, enum top_kind kind,
+			       const char *name, struct top_row *ctrl)
+{
+	struct top_row *r = &top->rows[top->nr_rows++];
+
+	memset(r, 0, sizeof(*r));
+	r->kind = kind;
+	r->name = name;
+	r->ctrl = ctrl;
+	r->stat_fd = r->inflight_fd = r->dev_fd = -1;
+	if (kind != TOP_CTRL) {
+		r->stat_fd = top_open_attr(name, "stat");
+		r->inflight_fd = top_open_attr(name, "inflight");
+		r->gone = r->stat_fd < 0;
+	}
+	return r;
+}
+
+/*
+ * The namespaces nvme<subsys>n<ns> and path devices nvme<subsys>c<ctrl>n<ns>
+ * of controller c, which are its children in sysfs. The topology only keeps
+ * the former, while the I/O of a multipath namespace shows in the latter.
+ */
+static int top_ctrl_paths(struct nvme_ctrl *c, struct dirent ***paths)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), SYS_NVME "/%s", c->name);
+	return scandir(path, paths, scan_ctrl_paths_filter, alphasort);
+}
+
+static int top_init(struct top *top)
+{
+	struct top_paths {
+		struct dirent **ents;
+		int nr;
+	} *paths;
+	int i, j, k, n, nr = 0, nr_ctrls = 0;
+
+	for (i = 0; i < top->t.nr_subsystems; i++)
+		nr_ctrls += top->t.subsystems[i].nr_ctrls;
+	paths = calloc(nr_ctrls, sizeof(*paths));
+	if (nr_ctrls && !paths)
+		return -ENOMEM;
+
+	for (i = 0, n = 0; i < top->t.nr_subsystems; i++) {
+		struct nvme_subsystem *s = &top->t.subsystems[i];
+
+		nr += s->nr_namespaces;
+		for (j = 0; j < s->nr_ctrls; j++, n++) {
+			paths[n].nr = top_ctrl_paths(&s->ctrls[j],
+						     &paths[n].ents);
+			if (paths[n].nr < 0)
+				paths[n].nr = 0;
+			nr += 1 + paths[n].nr;
+		}
+	}
+
+	top->rows = calloc(nr, sizeof(*top->rows));
+	if (nr && !top->rows) {
+		for (n = 0; n < nr_ctrls; n++) {
+			for (k = 0; k < paths[n].nr; k++)
+				free(paths[n].ents[k]);
+			free(paths[n].ents);
+		}
+		free(paths);
+		return -ENOMEM;
+	}
+
+	for (i = 0, n = 0; i < top->t.nr_subsystems; i++) {
+		struct nvme_subsystem *s = &top->t.subsystems[i];
+
+		for (j = 0; j < s->nr_ctrls; j++, n++) {
+			struct nvme_ctrl *c = &s->ctrls[j];
+			struct top_row *cr, *r;
+
+			cr = top_add(top, TOP_CTRL, c->name, NULL);
+			cr->c = c;
+			for (k = 0; k < paths[n].nr; k++) {
+				r = top_add(top, TOP_NS,
+					    paths[n].ents[k]->d_name, cr);
+				r->dent = paths[n].ents[k];
+			}
+			free(paths[n].ents);
+		}
+		for (j = 0; j < s->nr_namespaces; j++)
+			top_add(top, TOP_HEAD, s->namespaces[j].name, NULL);
+	}
+	free(paths);
+	return 0;
+}
+
+static void top_free(struct top *top)
+{
+	int i;
+
+	for (i = 0; i < top->nr_rows; i++) {
+		struct top_row *r = &top->rows[i];
+
+		if (r->stat_fd >= 0)
+			close(r->stat_fd);
+		if (r->inflight_fd >= 0)
+			close(r->inflight_fd);
+		if (r->dev_fd >= 0)
+			close(r->dev_fd);
+		free(r->dent);
+	}
+	free(top->rows);
+	free_topology(&top->t);
+}
+
+static int top_read_fd(int fd, char *buf, size_t len)
+{
+	ssize_t ret;
+
+	ret = pread(fd, buf, len - 1, 0);
+	if (ret < 0)
+		return -errno;
+	buf[ret] = '\0';
+	return ret;
+}
+
+static void top_sample_row(struct top_row *r)
+{
+	char buf[256], *p, *end;
+	unsigned int reads, writes;
+	int i;
+
+	if (r->gone)
+		return;
+	if (top_read_fd(r->stat_fd, buf, sizeof(buf)) <= 0) {
+		/* the namespace went away, its row stays empty */
+		r->gone = true;
+		memset(r->delta, 0, sizeof(r->delta));
+		return;
+	}
+
+	memcpy(r->prev, r->cur, sizeof(r->prev));
+	for (p = buf, i = 0; i < STAT_NR; i++, p = end)
+		r->cur[i] = strtoull(p, &end, 10);
+	for (i = 0; i < STAT_NR; i++)
+		r->delta[i] = r->cur[i] - r->prev[i];
+
+	r->inflight = r->cur[STAT_IN_FLIGHT];
+	if (r->inflight_fd >= 0 &&
+	    top_read_fd(r->inflight_fd, buf, sizeof(buf)) > 0 &&
+	    sscanf(buf, "%u %u", &reads, &writes) == 2)
+		r->inflight = reads + writes;
+}
+
+/*
+ * The SMART log is only read every smart_interval seconds: a Get Log Page
+ * is cheap, but it is not free for every controller, and temperatures do
+ * not change from one second to the next.
+ */
+static void top_sample_smart(struct top_row *r, __u64 now)
+{
+	struct nvme_smart_log log;
+	char path[NAME_MAX + 8];
+
+	if (cfg.smart_interval <= 0 ||
+	    (r->smart_at && now - r->smart_at < cfg.smart_interval * 1000000ULL))
+		return;
+	r->smart_at = now;
+
+	if (r->dev_fd < 0) {
+		snprintf(path, sizeof(path), "/dev/%s", r->name);
+		r->dev_fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (r->dev_fd < 0)
+			return;
+	}
+
+	if (nvme_smart_log(r->dev_fd, NVME_NSID_ALL, &log)) {
+		r->smart_valid = false;
+		return;
+	}
+	r->smart_valid = true;
+	r->temp = ((log.temperature[1] << 8) | log.temperature[0]) - 273;
+	r->critical_warning = log.critical_warning;
+}
+
+static void top_sample(struct top *top, __u64 now)
+{
+	struct top_row *cr = NULL;
+	int i, j;
+
+	for (i = 0; i < top->nr_rows; i++) {
+		struct top_row *r = &top->rows[i];
+
+		if (r->kind == TOP_CTRL) {
+			cr = r;
+			memset(cr->delta, 0, sizeof(cr->delta));
+			cr->inflight = 0;
+			top_sample_smart(cr, now);
+			continue;
+		}
+
+		top_sample_row(r);
+		if (r->kind != TOP_NS)
+			continue;
+		for (j = 0; j < STAT_NR; j++)
+			cr->delta[j] += r->delta[j];
+		cr->inflight += r->inflight;
+	}
+}
+
+struct top_rates {
+	double rps, wps;
+	double rmbps, wmbps;
+	double r_await, w_await;	/* milliseconds */
+	double aqu;
+	double util;			/* percent */
+};
+
+static void top_rates(struct top_row *r, double secs, struct top_rates *rt)
+{
+	__u64 *d = r->delta;
+
+	rt->rps = d[STAT_READ_IOS] / secs;
+	rt->wps = d[STAT_WRITE_IOS] / secs;
+	rt->rmbps = d[STAT_READ_SECTORS] * 512 / secs / 1e6;
+	rt->wmbps = d[STAT_WRITE_SECTORS] * 512 / secs / 1e6;
+	rt->r_await = d[STAT_READ_IOS] ?
+		(double)d[STAT_READ_TICKS] / d[STAT_READ_IOS] : 0;
+	rt->w_await = d[STAT_WRITE_IOS] ?
+		(double)d[STAT_WRITE_TICKS] / d[STAT_WRITE_IOS] : 0;
+	rt->aqu = d[STAT_TIME_IN_QUEUE] / (secs * 1000);
+	rt->util = d[STAT_IO_TICKS] / (secs * 10);
+	/* summed over namespaces that are busy at the same time */
+	if (rt->util > 100)
+		rt->util = 100;
+}
+
+static const char *top_kind_str(enum top_kind kind)
+{
+	switch (kind) {
+	case TOP_CTRL:	return "controller";
+	case TOP_NS:	return "namespace";
+	case TOP_HEAD:	return "multipath";
+	}
+	return "unknown";
+}
+
+static void top_print_json(struct top *top, double secs)
+{
+	struct json_object *root = json_create_object();
+	struct json_array *devices = json_create_array();
+	struct timespec now;
+	struct tm tm;
+	char ts[64];
+	size_t len;
+	int i;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	gmtime_r(&now.tv_sec, &tm);
+	len = strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(ts + len, sizeof(ts) - len, ".%06ldZ", now.tv_nsec / 1000);
+	json_object_add_value_string(root, "timestamp", ts);
+	json_object_add_value_uint(root, "interval_ms", secs * 1000 + 0.5);
+
+	for (i = 0; i < top->nr_rows; i++) {
+		struct top_row *r = &top->rows[i];
+		struct json_object *o;
+		struct top_rates rt;
+
+		if (r->gone)
+			continue;
+		top_rates(r, secs, &rt);
+		o = json_create_object();
+		json_object_add_value_string(o, "device", r->name);
+		json_object_add_value_string(o, "type", top_kind_str(r->kind));
+		if (r->ctrl)
+			json_object_add_value_string(o, "controller",
+						     r->ctrl->name);
+		/* the JSON writer prints numbers as integers, pick units */
+		json_object_add_value_uint(o, "read_iops", rt.rps + 0.5);
+		json_object_add_value_uint(o, "write_iops", rt.wps + 0.5);
+		json_object_add_value_uint(o, "read_bytes_per_sec",
+					   rt.rmbps * 1e6 + 0.5);
+		json_object_add_value_uint(o, "write_bytes_per_sec",
+					   rt.wmbps * 1e6 + 0.5);
+		json_object_add_value_uint(o, "read_await_us",
+					   rt.r_await * 1000 + 0.5);
+		json_object_add_value_uint(o, "write_await_us",
+					   rt.w_await * 1000 + 0.5);
+		json_object_add_value_uint(o, "queue_depth_x100",
+					   rt.aqu * 100 + 0.5);
+		json_object_add_value_uint(o, "inflight", r->inflight);
+		json_object_add_value_uint(o, "util_percent", rt.util + 0.5);
+		if (r->kind == TOP_CTRL) {
+			json_object_add_value_string(o, "state",
+						     r->c->state ?: "");
+			if (r->smart_valid) {
+				json_object_add_value_int(o, "temperature",
+							  r->temp);
+				json_object_add_value_uint(o,
+					"critical_warning",
+					r->critical_warning);
+			}
+		}
+		json_array_add_value_object(devices, o);
+	}
+	json_object_add_value_array(root, "devices", devices);
+	json_print_object_compact(root);
+	printf("\n");
+	fflush(stdout);
+	json_free_object(root);
+}
+
+static void top_print(struct top *top, double secs)
+{
+	struct timespec now;
+	struct tm tm;
+	char ts[32];
+	int i;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	localtime_r(&now.tv_sec, &tm);
+	strftime(ts, sizeof(ts), "%H:%M:%S", &tm);
+
+	/* redraw in place on a terminal, append otherwise */
+	if (top->tty)
+		printf("\033[H\033[J");
+	printf("nvme top - %s, interval %.1fs\n\n", ts, secs);
+	printf("%-16s %9s %9s %8s %8s %8s %8s %7s %5s %5s %5s %4s\n",
+	       "Device", "r/s", "w/s", "rMB/s", "wMB/s", "r_await",
+	       "w_await", "aqu-sz", "inflt", "%util", "temp", "cw");
+
+	for (i = 0; i < top->nr_rows; i++) {
+		struct top_row *r = &top->rows[i];
+		struct top_rates rt;
+		char name[32];
+
+		snprintf(name, sizeof(name), "%s%s",
+			 r->kind == TOP_NS ? "  " : "", r->name);
+		if (r->gone) {
+			printf("%-16s (gone)\n", name);
+			continue;
+		}
+		top_rates(r, secs, &rt);
+		printf("%-16s %9.1f %9.1f %8.2f %8.2f %8.2f %8.2f %7.2f %5u %5.1f",
+		       name, rt.rps, rt.wps, rt.rmbps, rt.wmbps, rt.r_await,
+		       rt.w_await, rt.aqu, r->inflight, rt.util);
+		if (r->kind == TOP_CTRL && r->smart_valid)
+			printf(" %4dC %#04x%s\n", r->temp, r->critical_warning,
+			       r->critical_warning ? " !" : "");
+		else if (r->kind == TOP_CTRL && strcmp(r->c->state ?: "", "live"))
+			printf(" %s\n", r->c->state ?: "-");
+		else
+			printf("\n");
+	}
+	fflush(stdout);
+}
+
+int top(const char *desc, int argc, char **argv)
+{
+	const char *interval = "sampling interval in milliseconds (default 1000)";
+	const char *count = "number of samples to show, 0 to run until interrupted";
+	const char *smart_interval = "seconds between SMART log reads, 0 to disable (default 10)";
+	const char *output_format = "Output format: normal|json";
+	struct sigaction sa = { .sa_handler = top_signal };
+	struct top top = { };
+	enum nvme_print_flags flags;
+	__u64 last, now;
+	int ret, n = 0;
+
+	OPT_ARGS(opts) = {
+		OPT_INT("interval",       'i', &cfg.interval,       interval),
+		OPT_INT("count",          'c', &cfg.count,          count),
+		OPT_INT("smart-interval", 'S', &cfg.smart_interval, smart_interval),
+		OPT_FMT("output-format",  'o', &cfg.output_format,  output_format),
+		OPT_END()
+	};
+
+	ret = argconfig_parse(argc, argv, desc, opts);
+	if (ret)
+		return ret;
+
+	ret = flags = validate_output_format(cfg.output_format);
+	if (ret < 0)
+		return ret;
+	if ((flags != JSON && flags != NORMAL) || cfg.interval <= 0 ||
+	    cfg.count < 0) {
+		fprintf(stderr, "invalid argument\n");
+		return -EINVAL;
+	}
+
+	ret = scan_subsystems(&top.t, NULL, 0);
+	if (ret) {
+		fprintf(stderr, "Failed to scan subsystems\n");
+		return ret;
+	}
+	ret = top_init(&top);
+	if (ret)
+		goto free;
+	top.tty = flags != JSON && isatty(STDOUT_FILENO);
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	last = top_now_usec();
+	top_sample(&top, last);
+	while (!top_stop && (!cfg.count || n < cfg.count)) {
+		now = top_now_usec();
+		if (now - last < cfg.interval * 1000ULL) {
+			poll(NULL, 0, (cfg.interval * 1000ULL - (now - last) +
+				       999) / 1000);
+			continue;
+		}
+
+		top_sample(&top, now);
+		if (flags == JSON)
+			top_print_json(&top, (now - last) / 1e6);
+		else
+			top_print(&top, (now - last) / 1e6);
+		last = now;
+		n++;
+	}
+free:
+	top_free(&top);
+	return ret;
+}
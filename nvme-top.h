@@ -0,0 +1,6 @@
+#ifndef _NVME_TOP_H
+#define _NVME_TOP_H
+
+extern int top(const char *desc, int argc, char **argv);
+
+#endif
@@ -1,5 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -11,302 +14,540 @@
 
 static const char *dev = "/dev/";
 static const char *subsys_dir = "/sys/class/nvme-subsystem/";
+static const char *block_dir = "/sys/block/";
 
-char *get_nvme_subsnqn(char *path)
+#define NVME_ARENA_CHUNK	(64 * 1024)
+
+/*
+ * Everything a scan allocates comes from a per-topology arena, so that
+ * free_topology() can release it in one go regardless of how far the scan
+ * got.
+ */
+struct nvme_arena {
+	struct nvme_arena *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+static void *arena_alloc(struct nvme_topology *t, size_t len)
 {
-	char sspath[320], *subsysnqn;
-	int fd, ret;
+	struct nvme_arena *a = t->arena;
+	void *p;
+
+	len = (len + 7) & ~7;
+	if (!a || a->size - a->used < len) {
+		size_t size = len > NVME_ARENA_CHUNK ? len : NVME_ARENA_CHUNK;
+
+		a = malloc(sizeof(*a) + size);
+		if (!a)
+			return NULL;
+		a->size = size;
+		a->used = 0;
+		if (t->arena && size > NVME_ARENA_CHUNK) {
+			/* keep filling the current chunk after a large one */
+			a->next = t->arena->next;
+			t->arena->next = a;
+		} else {
+			a->next = t->arena;
+			t->arena = a;
+		}
+	}
 
-	snprintf(sspath, sizeof(sspath), "%s/subsysnqn", path);
+	p = a->data + a->used;
+	a->used += len;
+	memset(p, 0, len);
+	return p;
+}
 
-	fd = open(sspath, O_RDONLY);
-	if (fd < 0) {
-		fprintf(stderr, "Failed to open %s: %s\n",
-				sspath, strerror(errno));
-		return NULL;
-	}
+static char *arena_strdup(struct nvme_topology *t, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p = arena_alloc(t, len);
 
-	subsysnqn = calloc(1, 256);
-	if (!subsysnqn)
-		goto close_fd;
+	if (p)
+		memcpy(p, s, len);
+	return p;
+}
 
-	ret = read(fd, subsysnqn, 256);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to read %s: %s\n", sspath,
-				strerror(errno));
-		free(subsysnqn);
-		subsysnqn = NULL;
-	} else if (subsysnqn[strlen(subsysnqn) - 1] == '\n') {
-		subsysnqn[strlen(subsysnqn) - 1] = '\0';
-	}
+static void arena_release(struct nvme_topology *t)
+{
+	struct nvme_arena *a, *next;
 
-close_fd:
-	close(fd);
-	return subsysnqn;
+	for (a = t->arena; a; a = next) {
+		next = a->next;
+		free(a);
+	}
+	t->arena = NULL;
 }
 
-char *nvme_get_ctrl_attr(char *path, const char *attr)
+/*
+ * Reads the attribute at path, relative to dfd, into buf with the trailing
+ * newline removed. Failures are not reported, as callers use this for
+ * attributes older kernels may not provide.
+ */
+static int read_attr_at(int dfd, const char *path, char *buf, size_t len)
 {
-	char *attrpath, *value;
 	ssize_t ret;
-	int fd, i;
+	int fd;
+
+	fd = openat(dfd, path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
 
-	ret = asprintf(&attrpath, "%s/%s", path, attr);
+	ret = read(fd, buf, len - 1);
+	close(fd);
 	if (ret < 0)
-		return NULL;
+		return -errno;
 
-	value = calloc(1, 1024);
-	if (!value)
-		goto err_free_path;
+	while (ret && buf[ret - 1] == '\n')
+		ret--;
+	buf[ret] = '\0';
+	return ret;
+}
 
-	fd = open(attrpath, O_RDONLY);
-	if (fd < 0) {
-		fprintf(stderr, "Failed to open %s: %s\n",
-				attrpath, strerror(errno));
-		goto err_free_value;
-	}
+static void commas_to_spaces(char *s)
+{
+	while ((s = strchr(s, ',')))
+		*s++ = ' ';
+}
 
-	ret = read(fd, value, 1024);
+char *get_nvme_subsnqn(char *path)
+{
+	char sspath[320], subsysnqn[256];
+	int ret;
+
+	snprintf(sspath, sizeof(sspath), "%s/subsysnqn", path);
+
+	ret = read_attr_at(AT_FDCWD, sspath, subsysnqn, sizeof(subsysnqn));
 	if (ret < 0) {
-		fprintf(stderr, "read :%s :%s\n", attrpath, strerror(errno));
-		goto err_close_fd;
+		fprintf(stderr, "Failed to read %s: %s\n", sspath,
+				strerror(-ret));
+		return NULL;
 	}
+	return strdup(subsysnqn);
+}
 
-	if (value[strlen(value) - 1] == '\n')
-		value[strlen(value) - 1] = '\0';
+char *nvme_get_ctrl_attr(char *path, const char *attr)
+{
+	char attrpath[PATH_MAX], value[1024];
+	int ret;
 
-	for (i = 0; i < strlen(value); i++) {
-		if (value[i] == ',' )
-			value[i] = ' ';
-	}
+	snprintf(attrpath, sizeof(attrpath), "%s/%s", path, attr);
 
-	close(fd);
-	free(attrpath);
-	return value;
-err_close_fd:
-	close(fd);
-err_free_value:
-	free(value);
-err_free_path:
-	free(attrpath);
-	return NULL;
+	ret = read_attr_at(AT_FDCWD, attrpath, value, sizeof(value));
+	if (ret < 0) {
+		fprintf(stderr, "Failed to read %s: %s\n", attrpath,
+				strerror(-ret));
+		return NULL;
+	}
+	commas_to_spaces(value);
+	return strdup(value);
 }
 
-static int scan_namespace(struct nvme_namespace *n)
+/* Arena backed variant of nvme_get_ctrl_attr() for the open directory dfd */
+static char *scan_attr(struct nvme_topology *t, int dfd, const char *attr)
 {
-	int ret, fd;
-	char *path;
+	char value[1024];
 
-	ret = asprintf(&path, "%s%s", dev, n->name);
-	if (ret < 0)
-		return ret;
+	if (read_attr_at(dfd, attr, value, sizeof(value)) < 0)
+		return NULL;
+	commas_to_spaces(value);
+	return arena_strdup(t, value);
+}
 
-	fd = open(path, O_RDONLY);
-	if (fd < 0)
-		goto free;
+enum {
+	ENTRY_CTRL,
+	ENTRY_NS,
+	ENTRY_PATH,
+};
 
-	n->nsid = nvme_get_nsid(fd);
-	if (n->nsid < 0)
-		goto close_fd;
+struct scan_entry {
+	char *name;
+	int kind;
+};
 
-	ret = nvme_identify_ns(fd, n->nsid, 0, &n->ns);
-	if (ret < 0)
-		goto close_fd;
-close_fd:
-	close(fd);
-free:
-	free(path);
-	return 0;
+static int scan_entry_cmp(const void *a, const void *b)
+{
+	const struct scan_entry *ea = a, *eb = b;
+
+	return strcoll(ea->name, eb->name);
 }
 
-static char *get_nvme_ctrl_path_ana_state(char *path, int nsid)
+/*
+ * Indexes the NVMe entries of the directory open at dfd in one pass,
+ * sorted by name as scandir() with alphasort would. The entry array is
+ * malloc'ed and must be freed by the caller, the names live in the arena.
+ * dfd is not consumed.
+ */
+static int scan_dir(struct nvme_topology *t, int dfd, struct scan_entry **list)
 {
-	struct dirent **paths;
-	char *ana_state;
-	int i, n;
-
-	ana_state = calloc(1, 16);
-	if (!ana_state)
-		return NULL;
+	struct scan_entry *e = NULL, *tmp;
+	int n = 0, alloc = 0, fd;
+	struct dirent *d;
+	DIR *dir;
 
-	n = scandir(path, &paths, scan_ctrl_paths_filter, alphasort);
-	if (n <= 0) {
-		free(ana_state);
-		return NULL;
+	fd = dup(dfd);
+	if (fd < 0)
+		return -errno;
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return -errno;
 	}
-	for (i = 0; i < n; i++) {
-		int id, cntlid, ns, fd;
-		char *ctrl_path;
-		ssize_t ret;
+	rewinddir(dir);
 
-		if (sscanf(paths[i]->d_name, "nvme%dc%dn%d",
-			   &id, &cntlid, &ns) != 3) {
-			if (sscanf(paths[i]->d_name, "nvme%dn%d",
-				   &id, &ns) != 2) {
-				continue;
-			}
-		}
-		if (ns != nsid)
+	while ((d = readdir(dir))) {
+		int kind, ctrl, ns, part;
+
+		if (sscanf(d->d_name, "nvme%dn%dp%d", &ctrl, &ns, &part) == 3)
+			continue;
+		if (scan_namespace_filter(d))
+			kind = ENTRY_NS;
+		else if (scan_ctrl_paths_filter(d))
+			kind = ENTRY_PATH;
+		else if (scan_ctrls_filter(d))
+			kind = ENTRY_CTRL;
+		else
 			continue;
 
-		ret = asprintf(&ctrl_path, "%s/%s/ana_state",
-			       path, paths[i]->d_name);
-		if (ret < 0) {
-			free(ana_state);
-			ana_state = NULL;
-			break;
-		}
-		fd = open(ctrl_path, O_RDONLY);
-		if (fd < 0) {
-			free(ctrl_path);
-			free(ana_state);
-			ana_state = NULL;
-			break;
+		if (n == alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			tmp = realloc(e, alloc * sizeof(*e));
+			if (!tmp)
+				goto err;
+			e = tmp;
 		}
-		ret = read(fd, ana_state, 16);
-		if (ret < 0) {
-			fprintf(stderr, "Failed to read ANA state from %s\n",
-				ctrl_path);
-			free(ana_state);
-			ana_state = NULL;
-		} else if (ana_state[strlen(ana_state) - 1] == '\n')
-			ana_state[strlen(ana_state) - 1] = '\0';
-		close(fd);
-		free(ctrl_path);
-		break;
+		e[n].name = arena_strdup(t, d->d_name);
+		if (!e[n].name)
+			goto err;
+		e[n++].kind = kind;
 	}
+	closedir(dir);
+
+	qsort(e, n, sizeof(*e), scan_entry_cmp);
+	*list = e;
+	return n;
+err:
+	closedir(dir);
+	free(e);
+	return -ENOMEM;
+}
+
+static int count_entries(struct scan_entry *e, int n, int kind)
+{
+	int i, nr = 0;
+
 	for (i = 0; i < n; i++)
-		free(paths[i]);
-	free(paths);
-	return ana_state;
+		if (e[i].kind == kind)
+			nr++;
+	return nr;
 }
 
-static int scan_ctrl(struct nvme_ctrl *c, char *p, __u32 ns_instance)
+/*
+ * Identify strings are space padded and not NUL terminated. Keeps them as
+ * C strings with the padding removed, the form the kernel exports them in.
+ */
+static void copy_id_string(char *dst, size_t size, const char *src, size_t len)
 {
-	struct nvme_namespace *n;
-	struct dirent **ns;
-	char *path;
-	int i, fd, ret;
+	while (len && (src[len - 1] == ' ' || src[len - 1] == '\0'))
+		len--;
+	if (len >= size)
+		len = size - 1;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
 
-	ret = asprintf(&path, "%s/%s", p, c->name);
-	if (ret < 0)
-		return ret;
+/*
+ * Fills in the namespace record from the attributes of its block device,
+ * which is the entry n->name in the directory open at dfd. The kernel does
+ * not export namespace utilization or the metadata size; until the identify
+ * data is fetched nuse is reported as nsze and ms as zero.
+ */
+static int scan_namespace(int dfd, struct nvme_namespace *n)
+{
+	unsigned long long sectors;
+	char path[NAME_MAX + 32], buf[32];
+	unsigned int lbs;
+	int id;
+
+	snprintf(path, sizeof(path), "%s/nsid", n->name);
+	if (read_attr_at(dfd, path, buf, sizeof(buf)) > 0)
+		n->nsid = strtoul(buf, NULL, 0);
+	else if (sscanf(n->name, "nvme%dn%u", &id, &n->nsid) != 2)
+		return -ENODEV;
 
-	c->address = nvme_get_ctrl_attr(path, "address");
-	c->transport = nvme_get_ctrl_attr(path, "transport");
-	c->state = nvme_get_ctrl_attr(path, "state");
+	snprintf(path, sizeof(path), "%s/queue/logical_block_size", n->name);
+	if (read_attr_at(dfd, path, buf, sizeof(buf)) <= 0)
+		return -ENODEV;
+	lbs = strtoul(buf, NULL, 0);
+	if (!lbs || (lbs & (lbs - 1)))
+		return -EINVAL;
 
-	if (ns_instance)
-		c->ana_state = get_nvme_ctrl_path_ana_state(path, ns_instance);
+	snprintf(path, sizeof(path), "%s/size", n->name);
+	if (read_attr_at(dfd, path, buf, sizeof(buf)) <= 0)
+		return -ENODEV;
+	sectors = strtoull(buf, NULL, 0);
 
-	ret = scandir(path, &ns, scan_namespace_filter, alphasort);
-	if (ret == -1) {
-		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
-		return errno;
-	}
+	n->lba_shift = ffs(lbs) - 1;
+	n->nsze = (sectors << 9) >> n->lba_shift;
+	n->nuse = n->nsze;
+	n->ms = 0;
+	return 0;
+}
+
+static int scan_namespaces(struct nvme_topology *t, int dfd,
+			   struct scan_entry *e, int nr_entries,
+			   struct nvme_ctrl *c, struct nvme_namespace **list)
+{
+	struct nvme_namespace *n;
+	int i, nr;
 
-	c->nr_namespaces = ret;
-	c->namespaces = calloc(c->nr_namespaces, sizeof(*n));
-	for (i = 0; i < c->nr_namespaces; i++) {
-		n = &c->namespaces[i];
-		n->name = strdup(ns[i]->d_name);
+	nr = count_entries(e, nr_entries, ENTRY_NS);
+	*list = arena_alloc(t, nr * sizeof(*n));
+	if (nr && !*list)
+		return -ENOMEM;
+
+	for (n = *list, i = 0; i < nr_entries; i++) {
+		if (e[i].kind != ENTRY_NS)
+			continue;
+		n->name = e[i].name;
 		n->ctrl = c;
-		scan_namespace(n);
+		scan_namespace(dfd, n++);
 	}
+	return nr;
+}
 
-	while (i--)
-		free(ns[i]);
-	free(ns);
-	free(path);
+struct nvme_id_ns *nvme_ns_get_id(struct nvme_namespace *n)
+{
+	struct nvme_topology *t;
+	struct nvme_id_ns *ns;
+	char path[NAME_MAX + 8];
+	int fd, ret;
 
-	ret = asprintf(&path, "%s%s", dev, c->name);
-	if (ret < 0)
-		return ret;
+	if (n->id)
+		return n->id;
+	/* a multipath namespace with no controller has no path to ask */
+	if (!n->ctrl)
+		return NULL;
+	t = n->ctrl->subsys->topology;
 
+	snprintf(path, sizeof(path), "%s%s", dev, n->name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (!n->nsid) {
+		ret = nvme_get_nsid(fd);
+		if (ret <= 0)
+			goto close_fd;
+		n->nsid = ret;
+	}
+
+	ns = arena_alloc(t, sizeof(*ns));
+	if (!ns)
+		goto close_fd;
+	ret = nvme_identify_ns(fd, n->nsid, 0, ns);
+	if (ret)
+		goto close_fd;
+
+	n->id = ns;
+	n->lba_shift = ns->lbaf[ns->flbas & 0x0f].ds;
+	n->ms = le16_to_cpu(ns->lbaf[ns->flbas & 0x0f].ms);
+	n->nsze = le64_to_cpu(ns->nsze);
+	n->nuse = le64_to_cpu(ns->nuse);
+close_fd:
+	close(fd);
+	return n->id;
+}
+
+struct nvme_id_ctrl *nvme_ctrl_get_id(struct nvme_ctrl *c)
+{
+	struct nvme_topology *t = c->subsys->topology;
+	struct nvme_id_ctrl *id;
+	char path[NAME_MAX + 8];
+	int fd, ret;
+
+	if (c->id)
+		return c->id;
+
+	snprintf(path, sizeof(path), "%s%s", dev, c->name);
 	fd = open(path, O_RDONLY);
 	if (fd < 0) {
 		fprintf(stderr, "Failed to open %s\n", path);
-		goto free;
+		return NULL;
 	}
 
-	ret = nvme_identify_ctrl(fd, &c->id);
-	if (ret < 0)
+	id = arena_alloc(t, sizeof(*id));
+	if (!id)
 		goto close_fd;
+	ret = nvme_identify_ctrl(fd, id);
+	if (ret)
+		goto close_fd;
+
+	c->id = id;
+	copy_id_string(c->sn, sizeof(c->sn), id->sn, sizeof(id->sn));
+	copy_id_string(c->mn, sizeof(c->mn), id->mn, sizeof(id->mn));
+	copy_id_string(c->fr, sizeof(c->fr), id->fr, sizeof(id->fr));
 close_fd:
 	close(fd);
-free:
-	free(path);
-	return 0;
+	return c->id;
 }
 
-static int scan_subsystem(struct nvme_subsystem *s, __u32 ns_instance)
+void nvme_topology_identify(struct nvme_topology *t)
 {
-	struct dirent **ctrls, **ns;
-	struct nvme_namespace *n;
-	struct nvme_ctrl *c;
-	int i, ret;
-	char *path;
+	int i, j, k;
 
-	ret = asprintf(&path, "%s%s", subsys_dir, s->name);
-	if (ret < 0)
-		return ret;
+	for (i = 0; i < t->nr_subsystems; i++) {
+		struct nvme_subsystem *s = &t->subsystems[i];
 
-	s->subsysnqn = get_nvme_subsnqn(path);
-	ret = scandir(path, &ctrls, scan_ctrls_filter, alphasort);
-	if (ret == -1) {
-		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
-		return errno;
-	}
-	s->nr_ctrls = ret;
-	s->ctrls = calloc(s->nr_ctrls, sizeof(*c));
-	for (i = 0; i < s->nr_ctrls; i++) {
-		c = &s->ctrls[i];
-		c->name = strdup(ctrls[i]->d_name);
-		c->subsys = s;
-		scan_ctrl(c, path, ns_instance);
+		for (j = 0; j < s->nr_ctrls; j++) {
+			struct nvme_ctrl *c = &s->ctrls[j];
+
+			if (!c->sn[0] || !c->mn[0])
+				nvme_ctrl_get_id(c);
+			for (k = 0; k < c->nr_namespaces; k++)
+				nvme_ns_get_id(&c->namespaces[k]);
+		}
+		for (j = 0; j < s->nr_namespaces; j++)
+			nvme_ns_get_id(&s->namespaces[j]);
 	}
+}
 
-	while (i--)
-		free(ctrls[i]);
-	free(ctrls);
+/*
+ * The ANA state of the first path to the namespace with instance nsid,
+ * looked up in the already indexed controller directory.
+ */
+static char *get_nvme_ctrl_path_ana_state(struct nvme_topology *t, int dfd,
+					  struct scan_entry *e, int nr_entries,
+					  int nsid)
+{
+	char path[NAME_MAX + 16], ana_state[16];
+	int i;
 
-	ret = scandir(path, &ns, scan_namespace_filter, alphasort);
-	if (ret == -1) {
-		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
-		return errno;
+	for (i = 0; i < nr_entries; i++) {
+		int id, cntlid, ns;
+
+		if (e[i].kind == ENTRY_CTRL)
+			continue;
+		if (sscanf(e[i].name, "nvme%dc%dn%d", &id, &cntlid, &ns) != 3 &&
+		    sscanf(e[i].name, "nvme%dn%d", &id, &ns) != 2)
+			continue;
+		if (ns != nsid)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/ana_state", e[i].name);
+		if (read_attr_at(dfd, path, ana_state, sizeof(ana_state)) < 0) {
+			fprintf(stderr, "Failed to read ANA state from %s\n",
+				path);
+			return NULL;
+		}
+		return arena_strdup(t, ana_state);
 	}
+	return NULL;
+}
 
-	s->nr_namespaces = ret;
-	s->namespaces = calloc(s->nr_namespaces, sizeof(*n));
-	for (i = 0; i < s->nr_namespaces; i++) {
-		n = &s->namespaces[i];
-		n->name = strdup(ns[i]->d_name);
-		n->ctrl = &s->ctrls[0];
-		scan_namespace(n);
+static void scan_ctrl_attrs(struct nvme_topology *t, int dfd,
+			    struct nvme_ctrl *c)
+{
+	char buf[64];
+
+	c->address = scan_attr(t, dfd, "address");
+	c->transport = scan_attr(t, dfd, "transport");
+	c->state = scan_attr(t, dfd, "state");
+	if (read_attr_at(dfd, "serial", buf, sizeof(buf)) >= 0)
+		copy_id_string(c->sn, sizeof(c->sn), buf, strlen(buf));
+	if (read_attr_at(dfd, "model", buf, sizeof(buf)) >= 0)
+		copy_id_string(c->mn, sizeof(c->mn), buf, strlen(buf));
+	if (read_attr_at(dfd, "firmware_rev", buf, sizeof(buf)) >= 0)
+		copy_id_string(c->fr, sizeof(c->fr), buf, strlen(buf));
+}
+
+static int scan_ctrl(struct nvme_topology *t, int sdfd, struct nvme_ctrl *c,
+		     __u32 ns_instance)
+{
+	struct scan_entry *e;
+	int dfd, n, ret;
+
+	dfd = openat(sdfd, c->name, O_RDONLY | O_DIRECTORY);
+	if (dfd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", c->name,
+			strerror(errno));
+		return -errno;
 	}
 
-	while (i--)
-		free(ns[i]);
-	free(ns);
+	scan_ctrl_attrs(t, dfd, c);
+	n = scan_dir(t, dfd, &e);
+	if (n < 0) {
+		ret = n;
+		goto close_fd;
+	}
 
-	free(path);
-	return 0;
+	if (ns_instance)
+		c->ana_state = get_nvme_ctrl_path_ana_state(t, dfd, e, n,
+							    ns_instance);
+
+	ret = scan_namespaces(t, dfd, e, n, c, &c->namespaces);
+	if (ret >= 0) {
+		c->nr_namespaces = ret;
+		ret = 0;
+	}
+	free(e);
+close_fd:
+	close(dfd);
+	return ret;
+}
+
+static int scan_subsystem(struct nvme_topology *t, int dfd,
+			  struct nvme_subsystem *s, __u32 ns_instance)
+{
+	struct scan_entry *e;
+	struct nvme_ctrl *c;
+	int i, n, ret;
+
+	n = scan_dir(t, dfd, &e);
+	if (n < 0) {
+		fprintf(stderr, "Failed to read %s: %s\n", s->name,
+			strerror(-n));
+		return n;
+	}
+
+	s->nr_ctrls = count_entries(e, n, ENTRY_CTRL);
+	s->ctrls = NULL;
+	if (s->nr_ctrls) {
+		s->ctrls = arena_alloc(t, s->nr_ctrls * sizeof(*c));
+		if (!s->ctrls) {
+			ret = -ENOMEM;
+			goto free;
+		}
+	}
+	for (c = s->ctrls, i = 0; i < n; i++) {
+		if (e[i].kind != ENTRY_CTRL)
+			continue;
+		c->name = e[i].name;
+		c->subsys = s;
+		scan_ctrl(t, dfd, c++, ns_instance);
+	}
+
+	ret = scan_namespaces(t, dfd, e, n, s->ctrls, &s->namespaces);
+	if (ret >= 0) {
+		s->nr_namespaces = ret;
+		ret = 0;
+	}
+free:
+	free(e);
+	return ret;
 }
 
 static int verify_legacy_ns(struct nvme_namespace *n)
 {
 	struct nvme_ctrl *c = n->ctrl;
 	struct nvme_id_ctrl id;
-	char *path;
+	char path[NAME_MAX + 8];
 	int ret, fd;
 
-	ret = asprintf(&path, "%s%s", dev, n->name);
-	if (ret < 0)
-		return ret;
-
+	snprintf(path, sizeof(path), "%s%s", dev, n->name);
 	fd = open(path, O_RDONLY);
-	free (path);
-
 	if (fd < 0)
 		return fd;
 
@@ -316,8 +557,9 @@ static int verify_legacy_ns(struct nvme_namespace *n)
 	if (ret)
 		return ret;
 
-	if (memcmp(id.mn, c->id.mn, sizeof(id.mn)) ||
-	    memcmp(id.sn, c->id.sn, sizeof(id.sn)))
+	if (!c->id ||
+	    memcmp(id.mn, c->id->mn, sizeof(id.mn)) ||
+	    memcmp(id.sn, c->id->sn, sizeof(id.sn)))
 		return -ENODEV;
 	return 0;
 }
@@ -333,137 +575,567 @@ static int legacy_list(struct nvme_topology *t)
 	struct nvme_ctrl *c;
 	struct nvme_subsystem *s;
 	struct nvme_namespace *n;
-	struct dirent **devices, **namespaces;
-	int ret = 0, fd, i;
-	char *path;
+	struct scan_entry *e = NULL;
+	int ret, i, j, nr, dfd, bdfd = -1;
 
-	t->nr_subsystems = scandir(dev, &devices, scan_ctrls_filter, alphasort);
-	if (t->nr_subsystems < 0) {
+	dfd = open(dev, O_RDONLY | O_DIRECTORY);
+	if (dfd < 0) {
 		fprintf(stderr, "no NVMe device(s) detected.\n");
-		return t->nr_subsystems;
+		return -errno;
 	}
 
-	t->subsystems = calloc(t->nr_subsystems, sizeof(*s));
-	for (i = 0; i < t->nr_subsystems; i++) {
-		int j;
+	/* One pass over /dev finds both the controllers and namespaces */
+	nr = scan_dir(t, dfd, &e);
+	close(dfd);
+	if (nr < 0) {
+		fprintf(stderr, "no NVMe device(s) detected.\n");
+		return nr;
+	}
 
-		s = &t->subsystems[i];
-		s->nr_ctrls = 1;
-		s->ctrls = calloc(s->nr_ctrls, sizeof(*c));
-		s->name = strdup(devices[i]->d_name);
-		s->subsysnqn = strdup(s->name);
-		s->nr_namespaces = 0;
-
-		c = s->ctrls;
-		c->name = strdup(s->name);
-		sscanf(c->name, "nvme%d", &current_index);
-		c->nr_namespaces = scandir(dev, &namespaces, scan_dev_filter,
-					   alphasort);
-		c->namespaces = calloc(c->nr_namespaces, sizeof(*n));
-
-		ret = asprintf(&path, "%s%s", dev, c->name);
-		if (ret < 0)
+	bdfd = open(block_dir, O_RDONLY | O_DIRECTORY);
+	t->subsystems = arena_alloc(t, count_entries(e, nr, ENTRY_CTRL) *
+					sizeof(*s));
+	if (!t->subsystems) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	for (ret = 0, i = 0; i < nr; i++) {
+		int index, nr_ns = 0;
+
+		if (e[i].kind != ENTRY_CTRL)
 			continue;
-		ret = 0;
 
-		fd = open(path, O_RDONLY);
-		if (fd > 0) {
-			nvme_identify_ctrl(fd, &c->id);
-			close(fd);
+		s = &t->subsystems[t->nr_subsystems++];
+		s->topology = t;
+		s->name = e[i].name;
+		s->subsysnqn = e[i].name;
+		s->nr_ctrls = 1;
+		s->ctrls = c = arena_alloc(t, sizeof(*c));
+		if (!c) {
+			ret = -ENOMEM;
+			goto free;
 		}
-		free(path);
+		c->name = e[i].name;
+		c->subsys = s;
+		sscanf(c->name, "nvme%d", &index);
+		nvme_ctrl_get_id(c);
+
+		for (j = 0; j < nr; j++) {
+			int id, nsid;
+
+			if (e[j].kind == ENTRY_NS &&
+			    sscanf(e[j].name, "nvme%dn%d", &id, &nsid) == 2 &&
+			    id == index)
+				nr_ns++;
+		}
+		c->namespaces = arena_alloc(t, nr_ns * sizeof(*n));
+		if (nr_ns && !c->namespaces) {
+			ret = -ENOMEM;
+			goto free;
+		}
+
+		for (j = 0; j < nr && c->nr_namespaces < nr_ns; j++) {
+			int id, nsid;
+
+			if (e[j].kind != ENTRY_NS ||
+			    sscanf(e[j].name, "nvme%dn%d", &id, &nsid) != 2 ||
+			    id != index)
+				continue;
 
-		for (j = 0; j < c->nr_namespaces; j++) {
-			n = &c->namespaces[j];
-			n->name = strdup(namespaces[j]->d_name);
+			n = &c->namespaces[c->nr_namespaces++];
+			n->name = e[j].name;
 			n->ctrl = c;
-			scan_namespace(n);
+			scan_namespace(bdfd, n);
 			ret = verify_legacy_ns(n);
 			if (ret)
 				goto free;
 		}
-		while (j--)
-			free(namespaces[j]);
-		free(namespaces);
 	}
-
 free:
-	while (i--)
-		free(devices[i]);
-	free(devices);
+	if (bdfd >= 0)
+		close(bdfd);
+	free(e);
 	return ret;
 }
 
-static void free_ctrl(struct nvme_ctrl *c)
+int scan_subsystems(struct nvme_topology *t, const char *subsysnqn,
+		    __u32 ns_instance)
 {
-	int i;
+	struct nvme_subsystem *s;
+	struct dirent **subsys;
+	char nqn[256];
+	int i, nr, dfd, sdfd;
 
-	for (i = 0; i < c->nr_namespaces; i++) {
-		struct nvme_namespace *n = &c->namespaces[i];
-		free(n->name);
+	nr = scandir(subsys_dir, &subsys, scan_subsys_filter, alphasort);
+	if (nr < 0)
+		return legacy_list(t);
+
+	dfd = open(subsys_dir, O_RDONLY | O_DIRECTORY);
+	t->subsystems = arena_alloc(t, nr * sizeof(*s));
+	if (dfd < 0 || (nr && !t->subsystems))
+		goto free;
+
+	for (i = 0; i < nr; i++) {
+		sdfd = openat(dfd, subsys[i]->d_name, O_RDONLY | O_DIRECTORY);
+		if (sdfd < 0)
+			continue;
+
+		if (read_attr_at(sdfd, "subsysnqn", nqn, sizeof(nqn)) < 0) {
+			fprintf(stderr, "Failed to read %s/subsysnqn\n",
+				subsys[i]->d_name);
+			nqn[0] = '\0';
+		}
+		if (subsysnqn && strcmp(nqn, subsysnqn)) {
+			close(sdfd);
+			continue;
+		}
+
+		s = &t->subsystems[t->nr_subsystems++];
+		s->topology = t;
+		s->name = arena_strdup(t, subsys[i]->d_name);
+		s->subsysnqn = arena_strdup(t, nqn);
+		scan_subsystem(t, sdfd, s, ns_instance);
+		close(sdfd);
 	}
-	free(c->name);
-	free(c->transport);
-	free(c->address);
-	free(c->state);
-	free(c->ana_state);
-	free(c->namespaces);
+
+free:
+	if (dfd >= 0)
+		close(dfd);
+	for (i = 0; i < nr; i++)
+		free(subsys[i]);
+	free(subsys);
+	return 0;
 }
 
-static void free_subsystem(struct nvme_subsystem *s)
+void free_topology(struct nvme_topology *t)
+{
+	arena_release(t);
+	t->subsystems = NULL;
+	t->nr_subsystems = 0;
+}
+
+/*
+ * Incremental updates, for long running users that follow hotplug events
+ * instead of rescanning. Arrays are never resized in place: adding a record
+ * copies the array it belongs to into a new arena allocation, so pointers
+ * into the topology are only valid until the next update. The copies left
+ * behind are reclaimed by nvme_topology_compact().
+ */
+static void topology_relink(struct nvme_topology *t)
+{
+	int i, j, k;
+
+	for (i = 0; i < t->nr_subsystems; i++) {
+		struct nvme_subsystem *s = &t->subsystems[i];
+
+		s->topology = t;
+		for (j = 0; j < s->nr_ctrls; j++) {
+			struct nvme_ctrl *c = &s->ctrls[j];
+
+			c->subsys = s;
+			for (k = 0; k < c->nr_namespaces; k++)
+				c->namespaces[k].ctrl = c;
+		}
+		for (j = 0; j < s->nr_namespaces; j++)
+			s->namespaces[j].ctrl = s->nr_ctrls ? s->ctrls : NULL;
+	}
+}
+
+/* Copy of array with room for one more, zeroed, element at the end */
+static void *array_grow(struct nvme_topology *t, const void *array, int nr,
+			size_t size)
+{
+	void *p = arena_alloc(t, (nr + 1) * size);
+
+	if (p && nr)
+		memcpy(p, array, nr * size);
+	return p;
+}
+
+static void array_remove(void *array, int *nr, int idx, size_t size)
+{
+	char *p = array;
+
+	memmove(p + idx * size, p + (idx + 1) * size, (*nr - idx - 1) * size);
+	(*nr)--;
+}
+
+struct nvme_subsystem *nvme_topology_find_subsys(struct nvme_topology *t,
+						 const char *name)
 {
 	int i;
 
-	for (i = 0; i < s->nr_ctrls; i++)
-		free_ctrl(&s->ctrls[i]);
-	for (i = 0; i < s->nr_namespaces; i++) {
-		struct nvme_namespace *n = &s->namespaces[i];
-		free(n->name);
+	for (i = 0; i < t->nr_subsystems; i++)
+		if (!strcmp(t->subsystems[i].name, name))
+			return &t->subsystems[i];
+	return NULL;
+}
+
+struct nvme_ctrl *nvme_topology_find_ctrl(struct nvme_topology *t,
+					  const char *name)
+{
+	int i, j;
+
+	for (i = 0; i < t->nr_subsystems; i++) {
+		struct nvme_subsystem *s = &t->subsystems[i];
+
+		for (j = 0; j < s->nr_ctrls; j++)
+			if (!strcmp(s->ctrls[j].name, name))
+				return &s->ctrls[j];
 	}
-	free(s->name);
-	free(s->subsysnqn);
-	free(s->ctrls);
-	free(s->namespaces);
+	return NULL;
 }
 
-int scan_subsystems(struct nvme_topology *t, const char *subsysnqn,
-		    __u32 ns_instance)
+struct nvme_namespace *nvme_topology_find_ns(struct nvme_topology *t,
+					     const char *name)
+{
+	int i, j, k;
+
+	for (i = 0; i < t->nr_subsystems; i++) {
+		struct nvme_subsystem *s = &t->subsystems[i];
+
+		for (j = 0; j < s->nr_namespaces; j++)
+			if (!strcmp(s->namespaces[j].name, name))
+				return &s->namespaces[j];
+		for (j = 0; j < s->nr_ctrls; j++) {
+			struct nvme_ctrl *c = &s->ctrls[j];
+
+			for (k = 0; k < c->nr_namespaces; k++)
+				if (!strcmp(c->namespaces[k].name, name))
+					return &c->namespaces[k];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Adds subsystem name, or returns the existing record. A NULL subsysnqn
+ * leaves it empty, nvme_topology_refresh_subsys() fills it from sysfs.
+ */
+struct nvme_subsystem *nvme_topology_add_subsys(struct nvme_topology *t,
+						const char *name,
+						const char *subsysnqn)
 {
 	struct nvme_subsystem *s;
-	struct dirent **subsys;
-	int i, j = 0;
+	char *sname, *nqn;
 
-	t->nr_subsystems = scandir(subsys_dir, &subsys, scan_subsys_filter,
-				   alphasort);
-	if (t->nr_subsystems < 0)
-		return legacy_list(t);
+	s = nvme_topology_find_subsys(t, name);
+	if (s)
+		return s;
+
+	sname = arena_strdup(t, name);
+	nqn = arena_strdup(t, subsysnqn ? subsysnqn : "");
+	s = array_grow(t, t->subsystems, t->nr_subsystems, sizeof(*s));
+	if (!sname || !nqn || !s)
+		return NULL;
+
+	t->subsystems = s;
+	s = &t->subsystems[t->nr_subsystems++];
+	s->name = sname;
+	s->subsysnqn = nqn;
+	topology_relink(t);
+	return s;
+}
+
+struct nvme_ctrl *nvme_topology_add_ctrl(struct nvme_topology *t,
+					 struct nvme_subsystem *s,
+					 const char *name)
+{
+	struct nvme_ctrl *c;
+	char *cname;
+	int i;
+
+	for (i = 0; i < s->nr_ctrls; i++)
+		if (!strcmp(s->ctrls[i].name, name))
+			return &s->ctrls[i];
+
+	cname = arena_strdup(t, name);
+	c = array_grow(t, s->ctrls, s->nr_ctrls, sizeof(*c));
+	if (!cname || !c)
+		return NULL;
+
+	s->ctrls = c;
+	c = &s->ctrls[s->nr_ctrls++];
+	c->name = cname;
+	topology_relink(t);
+	return c;
+}
+
+/*
+ * Adds namespace name below controller c, or as a multipath head of s
+ * when c is NULL.
+ */
+struct nvme_namespace *nvme_topology_add_ns(struct nvme_topology *t,
+					    struct nvme_subsystem *s,
+					    struct nvme_ctrl *c,
+					    const char *name)
+{
+	struct nvme_namespace **list = c ? &c->namespaces : &s->namespaces;
+	int *nr = c ? &c->nr_namespaces : &s->nr_namespaces;
+	struct nvme_namespace *n;
+	int i, id, nsid;
+	char *nname;
+
+	for (i = 0; i < *nr; i++)
+		if (!strcmp((*list)[i].name, name))
+			return &(*list)[i];
+
+	nname = arena_strdup(t, name);
+	n = array_grow(t, *list, *nr, sizeof(*n));
+	if (!nname || !n)
+		return NULL;
+
+	*list = n;
+	n = &n[(*nr)++];
+	n->name = nname;
+	if (sscanf(name, "nvme%dn%d", &id, &nsid) == 2)
+		n->nsid = nsid;
+	topology_relink(t);
+	return n;
+}
+
+void nvme_topology_remove_subsys(struct nvme_topology *t,
+				 struct nvme_subsystem *s)
+{
+	array_remove(t->subsystems, &t->nr_subsystems, s - t->subsystems,
+		     sizeof(*s));
+	topology_relink(t);
+}
+
+void nvme_topology_remove_ctrl(struct nvme_topology *t, struct nvme_ctrl *c)
+{
+	struct nvme_subsystem *s = c->subsys;
+
+	array_remove(s->ctrls, &s->nr_ctrls, c - s->ctrls, sizeof(*c));
+	topology_relink(t);
+}
+
+/*
+ * Moves controller c, with its namespaces, below subsystem s, for one that
+ * was filed elsewhere before it was known which subsystem it is part of.
+ */
+struct nvme_ctrl *nvme_topology_move_ctrl(struct nvme_topology *t,
+					  struct nvme_ctrl *c,
+					  struct nvme_subsystem *s)
+{
+	struct nvme_subsystem *old = c->subsys;
+	struct nvme_ctrl *ctrls;
+
+	if (old == s)
+		return c;
+
+	ctrls = array_grow(t, s->ctrls, s->nr_ctrls, sizeof(*ctrls));
+	if (!ctrls)
+		return NULL;
+	ctrls[s->nr_ctrls] = *c;
+	s->ctrls = ctrls;
+	s->nr_ctrls++;
+	array_remove(old->ctrls, &old->nr_ctrls, c - old->ctrls, sizeof(*c));
+	topology_relink(t);
+	return &s->ctrls[s->nr_ctrls - 1];
+}
+
+void nvme_topology_remove_ns(struct nvme_topology *t, struct nvme_namespace *n)
+{
+	int i, j;
 
-	t->subsystems = calloc(t->nr_subsystems, sizeof(*s));
 	for (i = 0; i < t->nr_subsystems; i++) {
-		s = &t->subsystems[j];
-		s->name = strdup(subsys[i]->d_name);
-		scan_subsystem(s, ns_instance);
+		struct nvme_subsystem *s = &t->subsystems[i];
 
-		if (!subsysnqn || !strcmp(s->subsysnqn, subsysnqn))
-			j++;
-		else
-			free_subsystem(s);
+		if (n >= s->namespaces && n < s->namespaces + s->nr_namespaces) {
+			array_remove(s->namespaces, &s->nr_namespaces,
+				     n - s->namespaces, sizeof(*n));
+			goto relink;
+		}
+		for (j = 0; j < s->nr_ctrls; j++) {
+			struct nvme_ctrl *c = &s->ctrls[j];
+
+			if (n >= c->namespaces &&
+			    n < c->namespaces + c->nr_namespaces) {
+				array_remove(c->namespaces, &c->nr_namespaces,
+					     n - c->namespaces, sizeof(*n));
+				goto relink;
+			}
+		}
 	}
-	t->nr_subsystems = j;
+	return;
+relink:
+	topology_relink(t);
+}
 
-	while (i--)
-		free(subsys[i]);
-	free(subsys);
+int nvme_topology_refresh_subsys(struct nvme_topology *t,
+				 struct nvme_subsystem *s)
+{
+	char path[NAME_MAX + 32], nqn[256];
+	int ret;
+
+	snprintf(path, sizeof(path), "%s%s/subsysnqn", subsys_dir, s->name);
+	ret = read_attr_at(AT_FDCWD, path, nqn, sizeof(nqn));
+	if (ret < 0)
+		return ret;
+	s->subsysnqn = arena_strdup(t, nqn);
+	return s->subsysnqn ? 0 : -ENOMEM;
+}
+
+int nvme_topology_refresh_ctrl(struct nvme_topology *t, struct nvme_ctrl *c)
+{
+	char path[NAME_MAX + 32];
+	int dfd;
+
+	snprintf(path, sizeof(path), SYS_NVME "/%s", c->name);
+	dfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dfd < 0)
+		return -errno;
+	scan_ctrl_attrs(t, dfd, c);
+	close(dfd);
 	return 0;
 }
 
-void free_topology(struct nvme_topology *t)
+int nvme_topology_refresh_ns(struct nvme_namespace *n)
 {
-	int i;
+	int dfd, ret;
 
-	for (i = 0; i < t->nr_subsystems; i++)
-		free_subsystem(&t->subsystems[i]);
-	free(t->subsystems);
+	dfd = open(block_dir, O_RDONLY | O_DIRECTORY);
+	if (dfd < 0)
+		return -errno;
+	ret = scan_namespace(dfd, n);
+	close(dfd);
+	return ret;
+}
+
+/* Copies s into the topology's arena, so that it is freed along with it */
+char *nvme_topology_strdup(struct nvme_topology *t, const char *s)
+{
+	return s ? arena_strdup(t, s) : NULL;
+}
+
+/*
+ * Looks up the subsystem a controller belongs to from the links in the
+ * subsystem directories, for controllers that were not found by a scan.
+ */
+int nvme_ctrl_subsys_name(const char *ctrl, char *buf, size_t len)
+{
+	char path[NAME_MAX * 2 + 2];
+	struct dirent *d;
+	int ret = -ENODEV;
+	DIR *dir;
+
+	dir = opendir(subsys_dir);
+	if (!dir)
+		return -errno;
+	while ((d = readdir(dir))) {
+		if (!scan_subsys_filter(d))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", d->d_name, ctrl);
+		if (faccessat(dirfd(dir), path, F_OK, AT_SYMLINK_NOFOLLOW))
+			continue;
+		snprintf(buf, len, "%s", d->d_name);
+		ret = 0;
+		break;
+	}
+	closedir(dir);
+	return ret;
+}
+
+static int copy_str(struct nvme_topology *t, char **dst, const char *src)
+{
+	if (!src)
+		return 0;
+	*dst = arena_strdup(t, src);
+	return *dst ? 0 : -ENOMEM;
+}
+
+static int copy_namespaces(struct nvme_topology *t, struct nvme_namespace **dst,
+			   const struct nvme_namespace *src, int nr)
+{
+	int i, ret = 0;
+
+	*dst = arena_alloc(t, nr * sizeof(**dst));
+	if (nr && !*dst)
+		return -ENOMEM;
+	for (i = 0; i < nr; i++) {
+		struct nvme_namespace *n = &(*dst)[i];
+
+		*n = src[i];
+		ret |= copy_str(t, &n->name, src[i].name);
+		if (src[i].id) {
+			n->id = arena_alloc(t, sizeof(*n->id));
+			if (!n->id)
+				return -ENOMEM;
+			*n->id = *src[i].id;
+		}
+	}
+	return ret;
+}
+
+static int copy_ctrl(struct nvme_topology *t, struct nvme_ctrl *c,
+		     const struct nvme_ctrl *src)
+{
+	int ret = 0;
+
+	*c = *src;
+	ret |= copy_str(t, &c->name, src->name);
+	ret |= copy_str(t, &c->address, src->address);
+	ret |= copy_str(t, &c->transport, src->transport);
+	ret |= copy_str(t, &c->state, src->state);
+	ret |= copy_str(t, &c->ana_state, src->ana_state);
+	ret |= copy_str(t, &c->traddr, src->traddr);
+	ret |= copy_str(t, &c->trsvcid, src->trsvcid);
+	ret |= copy_str(t, &c->host_traddr, src->host_traddr);
+	if (src->id) {
+		c->id = arena_alloc(t, sizeof(*c->id));
+		if (!c->id)
+			return -ENOMEM;
+		*c->id = *src->id;
+	}
+	return ret | copy_namespaces(t, &c->namespaces, src->namespaces,
+				     src->nr_namespaces);
+}
+
+/*
+ * Moves the topology into a fresh arena, dropping what earlier updates left
+ * behind. On failure the topology is left as it was.
+ */
+int nvme_topology_compact(struct nvme_topology *t)
+{
+	struct nvme_topology nt = { 0 };
+	int i, j, ret = -ENOMEM;
+
+	nt.nr_subsystems = t->nr_subsystems;
+	nt.subsystems = arena_alloc(&nt, t->nr_subsystems *
+				    sizeof(*nt.subsystems));
+	if (t->nr_subsystems && !nt.subsystems)
+		goto err;
+
+	for (i = 0; i < t->nr_subsystems; i++) {
+		struct nvme_subsystem *s = &nt.subsystems[i];
+		struct nvme_subsystem *src = &t->subsystems[i];
+
+		*s = *src;
+		if (copy_str(&nt, &s->name, src->name) ||
+		    copy_str(&nt, &s->subsysnqn, src->subsysnqn))
+			goto err;
+
+		s->ctrls = arena_alloc(&nt, src->nr_ctrls * sizeof(*s->ctrls));
+		if (src->nr_ctrls && !s->ctrls)
+			goto err;
+		for (j = 0; j < src->nr_ctrls; j++)
+			if (copy_ctrl(&nt, &s->ctrls[j], &src->ctrls[j]))
+				goto err;
+
+		if (copy_namespaces(&nt, &s->namespaces, src->namespaces,
+				    src->nr_namespaces))
+			goto err;
+	}
+
+	arena_release(t);
+	*t = nt;
+	topology_relink(t);
+	return 0;
+err:
+	arena_release(&nt);
+	return ret;
 }
 
 char *nvme_char_from_block(char *dev)
@@ -0,0 +1,1466 @@
+/*
+ * nvme trace: the latency of every command as the host sees it, from the
+ * nvme_setup_cmd and nvme_complete_rq tracepoints of the kernel driver.
+ *
+ * The events are read in the binary format of the ftrace ring buffer from
+ * the per CPU trace_pipe_raw files of a tracefs instance of our own, so
+ * that other tracers and the top level buffers are left alone, a page at
+ * a time, and the
+ * CPUs are merged in timestamp order, so that the completion of a command
+ * always comes after its setup, which it is matched to by controller,
+ * queue and command id. The layout of the pages and of the two events is
+ * taken from their format files rather than assumed.
+ *
+ * --save keeps the raw pages and the format files in a directory laid out
+ * like tracefs, and --input reads such a directory instead of tracing,
+ * through the same code.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <endian.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "nvme.h"
+#include "nvme-print.h"
+#include "nvme-latency.h"
+#include "nvme-trace.h"
+#include "json.h"
+
+#define TRACEFS			"/sys/kernel/tracing"
+#define TRACEFS_DEBUGFS		"/sys/kernel/debug/tracing"
+
+#define TRACE_SETUP		"events/nvme/nvme_setup_cmd"
+#define TRACE_COMPLETE		"events/nvme/nvme_complete_rq"
+
+/* ring buffer event types, see include/linux/ring_buffer.h */
+#define RB_TYPE_PADDING		29
+#define RB_TYPE_TIME_EXTEND	30
+#define RB_TYPE_TIME_STAMP	31
+#define RB_TS_SHIFT		27
+#define RB_TS_MSB		(0xf8ULL << 56)
+
+/* flags in the commit field of a page read from trace_pipe_raw */
+#define RB_MISSED_EVENTS	(1ULL << 31)
+#define RB_MISSED_STORED	(1ULL << 30)
+#define RB_COMMIT_MASK		((1ULL << 27) - 1)
+
+/* 1/16 of a power of two each, the last one open ended from 64s */
+#define TRACE_HIST_SUB_BITS	4
+#define TRACE_HIST_BUCKETS	369
+
+#define TRACE_PENDING_BUCKETS	4096
+
+struct trace_field {
+	int offset;
+	int size;		/* 0 if the event does not have it */
+};
+
+struct trace_event_format {
+	int id;
+	struct trace_field ctrl_id;
+	struct trace_field qid;
+	struct trace_field cid;
+	struct trace_field disk;
+	struct trace_field opcode;	/* setup */
+	struct trace_field nsid;	/* setup */
+	struct trace_field status;	/* completion */
+};
+
+/* the field every event starts with */
+static const struct trace_field trace_common_type = { .offset = 0, .size = 2 };
+
+struct trace_page_format {
+	struct trace_field timestamp;
+	struct trace_field commit;
+	struct trace_field data;
+};
+
+struct trace_cpu {
+	int cpu;
+	int fd;
+	int save_fd;
+	unsigned char *page;
+	unsigned int len;		/* of the data in the page */
+	unsigned int pos;		/* of the next event in the data */
+	__u64 ts;			/* of the current event */
+	const unsigned char *event;	/* NULL if none read yet */
+	unsigned int event_len;
+	bool dry;			/* nothing more to read for now */
+	bool eof;
+};
+
+/* a command set up and not completed yet */
+struct trace_pending {
+	struct trace_pending *next;
+	__u64 key;
+	__u64 ts;
+	__u32 nsid;
+	__u8 opcode;
+	char disk[32];
+};
+
+struct trace_stat {
+	struct nvme_lat_hist h;
+	__u64 sum_ns;
+	__u64 max_ns;
+	__u64 errors;
+};
+
+struct trace_outlier {
+	__u64 ts;			/* since the first event */
+	__u64 lat_ns;
+	int qid;
+	__u16 cid;
+	__u16 status;
+	__u8 opcode;
+	__u32 nsid;
+	char disk[32];
+};
+
+struct trace_ctrl {
+	int id;
+	struct trace_stat all;
+	struct trace_stat *ops[2][256];	/* by I/O or admin, and opcode */
+	struct trace_stat **queues;
+	int nr_queues;
+	__u64 unmatched;	/* completions of commands set up before */
+	__u64 incomplete;	/* commands whose completion was not seen */
+	__u64 in_flight;
+	struct trace_outlier *outliers;	/* a min heap of the slowest */
+	int nr_outliers;
+};
+
+struct trace {
+	const char *root;
+	const char *buffers;	/* root, or the instance when live */
+	char instance[PATH_MAX];
+	bool live;
+	bool mono;		/* trace clock is CLOCK_MONOTONIC */
+	int only_ctrl;		/* -1 for all */
+	int page_size;
+	struct trace_page_format page;
+	struct trace_event_format setup;
+	struct trace_event_format complete;
+
+	int nr_cpus;
+	struct trace_cpu *cpus;
+
+	struct trace_pending *pending[TRACE_PENDING_BUCKETS];
+	struct trace_pending *free_pending;
+
+	int nr_ctrls;
+	struct trace_ctrl **ctrls;
+
+	__u64 first_ts;
+	__u64 last_ts;
+	__u64 events;
+	__u64 lost;		/* events the ring buffer overwrote */
+	bool lost_uncounted;	/* ... and pages that did not say how many */
+	__u64 bad_pages;
+};
+
+static struct config {
+	__u32 duration;
+	char *input;
+	char *save;
+	__u32 outliers;
+	char *output_format;
+} cfg = {
+	.duration = 10,
+	.outliers = 10,
+	.output_format = "normal",
+};
+
+static volatile sig_atomic_t trace_stop;
+
+static void trace_signal(int sig)
+{
+	trace_stop = 1;
+}
+
+static __u64 trace_now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int trace_write_file(const char *root, const char *file,
+			    const char *val)
+{
+	char path[PATH_MAX];
+	ssize_t ret;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", root, file);
+	fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	ret = write(fd, val, strlen(val));
+	close(fd);
+	return ret < 0 ? -errno : 0;
+}
+
+/*
+ * A line of a format file that describes a field, such as
+ * "\tfield:u16 cid;\toffset:52;\tsize:2;\tsigned:0;". Returns 0 and the
+ * name of the field, without its array size, if it is one.
+ */
+static int trace_parse_field(const char *line, char *name, size_t len,
+			     struct trace_field *f)
+{
+	const char *decl, *end, *start, *p;
+
+	decl = strstr(line, "field:");
+	if (!decl)
+		return -EINVAL;
+	decl += strlen("field:");
+	end = strchr(decl, ';');
+	if (!end)
+		return -EINVAL;
+
+	p = strstr(end, "offset:");
+	if (!p || sscanf(p, "offset:%d", &f->offset) != 1)
+		return -EINVAL;
+	p = strstr(end, "size:");
+	if (!p || sscanf(p, "size:%d", &f->size) != 1)
+		return -EINVAL;
+	if (f->offset < 0 || f->size < 0)
+		return -EINVAL;
+
+	/* the name is the last word of the declaration */
+	p = memchr(decl, '[', end - decl);
+	if (p)
+		end = p;
+	while (end > decl && isspace((unsigned char)end[-1]))
+		end--;
+	start = end;
+	while (start > decl &&
+	       (isalnum((unsigned char)start[-1]) || start[-1] == '_'))
+		start--;
+	snprintf(name, len, "%.*s", (int)(end - start), start);
+	return 0;
+}
+
+static int trace_parse_event(const char *root, const char *event,
+			     struct trace_event_format *e)
+{
+	char path[PATH_MAX], line[512], name[64];
+	struct trace_field f;
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s/%s/format", root, event);
+	file = fopen(path, "r");
+	if (!file)
+		return -errno;
+
+	memset(e, 0, sizeof(*e));
+	e->id = -1;
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "ID: %d", &e->id) == 1)
+			continue;
+		if (trace_parse_field(line, name, sizeof(name), &f))
+			continue;
+		if (!strcmp(name, "ctrl_id"))
+			e->ctrl_id = f;
+		else if (!strcmp(name, "qid"))
+			e->qid = f;
+		else if (!strcmp(name, "cid"))
+			e->cid = f;
+		else if (!strcmp(name, "disk"))
+			e->disk = f;
+		else if (!strcmp(name, "opcode"))
+			e->opcode = f;
+		else if (!strcmp(name, "nsid"))
+			e->nsid = f;
+		else if (!strcmp(name, "status"))
+			e->status = f;
+	}
+	fclose(file);
+
+	if (e->id < 0 || !e->qid.size || !e->cid.size)
+		return -EINVAL;
+	return 0;
+}
+
+static int trace_parse_header_page(struct trace *t)
+{
+	char path[PATH_MAX], line[512], name[64];
+	struct trace_field f;
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s/events/header_page", t->root);
+	file = fopen(path, "r");
+	if (!file)
+		return -errno;
+
+	memset(&t->page, 0, sizeof(t->page));
+	while (fgets(line, sizeof(line), file)) {
+		if (trace_parse_field(line, name, sizeof(name), &f))
+			continue;
+		if (!strcmp(name, "timestamp"))
+			t->page.timestamp = f;
+		else if (!strcmp(name, "commit"))
+			t->page.commit = f;
+		else if (!strcmp(name, "data"))
+			t->page.data = f;
+	}
+	fclose(file);
+
+	if (t->page.timestamp.size != 8 || !t->page.commit.size ||
+	    !t->page.data.size)
+		return -EINVAL;
+	t->page_size = t->page.data.offset + t->page.data.size;
+	return 0;
+}
+
+/* A field of an event or page, of any size, 0 if it does not fit */
+static __u64 trace_get(const unsigned char *data, unsigned int len,
+		       const struct trace_field *f)
+{
+	__u8 v8;
+	__u16 v16;
+	__u32 v32;
+	__u64 v64;
+
+	if (!f->size || f->offset + f->size > len)
+		return 0;
+	switch (f->size) {
+	case 1:
+		memcpy(&v8, data + f->offset, 1);
+		return v8;
+	case 2:
+		memcpy(&v16, data + f->offset, 2);
+		return v16;
+	case 4:
+		memcpy(&v32, data + f->offset, 4);
+		return v32;
+	case 8:
+		memcpy(&v64, data + f->offset, 8);
+		return v64;
+	}
+	return 0;
+}
+
+static void trace_get_string(const unsigned char *data, unsigned int len,
+			     const struct trace_field *f, char *buf,
+			     size_t buf_len)
+{
+	int n = f->size < buf_len ? f->size : buf_len - 1;
+
+	buf[0] = '\0';
+	if (f->size && f->offset + f->size <= len)
+		snprintf(buf, buf_len, "%.*s", n,
+			 (const char *)data + f->offset);
+}
+
+/*
+ * Reads the next page of a CPU. Returns 1 if it did, 0 at the end of a
+ * saved trace or when the kernel has nothing more for now, and -errno on
+ * errors.
+ */
+static int trace_read_page(struct trace *t, struct trace_cpu *c)
+{
+	unsigned int data = t->page.data.offset;
+	__u64 commit;
+	ssize_t n;
+
+	n = read(c->fd, c->page, t->page_size);
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			return -errno;
+		c->dry = true;
+		return 0;
+	}
+	if (n <= data) {
+		if (t->live)
+			c->dry = true;
+		else
+			c->eof = true;
+		return 0;
+	}
+	if (c->save_fd >= 0 && write(c->save_fd, c->page, n) != n)
+		return -errno;
+	memset(c->page + n, 0, t->page_size - n);
+
+	c->ts = trace_get(c->page, n, &t->page.timestamp);
+	commit = trace_get(c->page, n, &t->page.commit);
+	c->len = commit & RB_COMMIT_MASK;
+	c->pos = 0;
+	if (c->len > t->page.data.size) {
+		t->bad_pages++;
+		c->len = 0;
+	}
+
+	if (commit & RB_MISSED_EVENTS) {
+		struct trace_field missed = {
+			.offset = data + c->len,
+			.size = t->page.commit.size,
+		};
+
+		if (commit & RB_MISSED_STORED &&
+		    missed.offset + missed.size <= t->page_size)
+			t->lost += trace_get(c->page, t->page_size, &missed);
+		else
+			t->lost_uncounted = true;
+	}
+	return 1;
+}
+
+/*
+ * Moves a CPU to its next nvme event, reading pages as needed. Returns 1
+ * if there is one, 0 if there is none for now and -errno on errors.
+ */
+static int trace_next_event(struct trace *t, struct trace_cpu *c)
+{
+	const unsigned char *ev;
+	__u32 hdr, type, delta, array;
+	unsigned int len, size;
+	__u64 ts;
+	int err, id;
+
+	c->event = NULL;
+	for (;;) {
+		if (c->pos + 4 > c->len) {
+			err = trace_read_page(t, c);
+			if (err <= 0)
+				return err;
+			continue;
+		}
+
+		ev = c->page + t->page.data.offset + c->pos;
+		memcpy(&hdr, ev, 4);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		type = hdr & 0x1f;
+		delta = hdr >> 5;
+#else
+		type = hdr >> RB_TS_SHIFT;
+		delta = hdr & ((1U << RB_TS_SHIFT) - 1);
+#endif
+		array = 0;
+		if (c->pos + 8 <= c->len)
+			memcpy(&array, ev + 4, 4);
+
+		switch (type) {
+		case RB_TYPE_PADDING:
+			/* a discarded event, or the end of the page */
+			if (!delta || c->pos + 8 > c->len) {
+				c->pos = c->len;
+				continue;
+			}
+			c->pos += 4 + array;
+			continue;
+		case RB_TYPE_TIME_EXTEND:
+			c->ts += ((__u64)array << RB_TS_SHIFT) + delta;
+			c->pos += 8;
+			continue;
+		case RB_TYPE_TIME_STAMP:
+			/* absolute, without the top bits */
+			ts = ((__u64)array << RB_TS_SHIFT) + delta;
+			if (c->ts & RB_TS_MSB) {
+				ts |= c->ts & RB_TS_MSB;
+				if (ts < c->ts)
+					ts += 1ULL << 59;
+			}
+			c->ts = ts;
+			c->pos += 8;
+			continue;
+		case 0:
+			if (array < 4) {
+				t->bad_pages++;
+				c->pos = c->len;
+				continue;
+			}
+			len = (array - 4 + 3) & ~3U;
+			size = 8 + len;
+			ev += 8;
+			break;
+		default:
+			len = type * 4;
+			size = 4 + len;
+			ev += 4;
+			break;
+		}
+
+		if (c->pos + size > c->len) {
+			t->bad_pages++;
+			c->pos = c->len;
+			continue;
+		}
+		c->pos += size;
+		c->ts += delta;
+
+		id = trace_get(ev, len, &trace_common_type);
+		if (id != t->setup.id && id != t->complete.id)
+			continue;
+		c->event = ev;
+		c->event_len = len;
+		return 1;
+	}
+}
+
+static __u64 trace_key(int ctrl, int qid, int cid)
+{
+	return (__u64)(__u32)ctrl << 32 | (__u64)(qid & 0xffff) << 16 |
+		(cid & 0xffff);
+}
+
+static struct trace_pending **trace_pending_find(struct trace *t, __u64 key)
+{
+	struct trace_pending **p;
+
+	p = &t->pending[(key ^ key >> 29) % TRACE_PENDING_BUCKETS];
+	while (*p && (*p)->key != key)
+		p = &(*p)->next;
+	return p;
+}
+
+static struct trace_ctrl *trace_ctrl(struct trace *t, int id)
+{
+	struct trace_ctrl **ctrls, *c;
+	int i;
+
+	for (i = 0; i < t->nr_ctrls; i++)
+		if (t->ctrls[i]->id == id)
+			return t->ctrls[i];
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	if (nvme_lat_hist_init_log2(&c->all.h, TRACE_HIST_SUB_BITS,
+				    TRACE_HIST_BUCKETS))
+		goto free;
+	if (cfg.outliers) {
+		c->outliers = calloc(cfg.outliers, sizeof(*c->outliers));
+		if (!c->outliers)
+			goto free_hist;
+	}
+	ctrls = realloc(t->ctrls, (t->nr_ctrls + 1) * sizeof(*ctrls));
+	if (!ctrls)
+		goto free_outliers;
+	c->id = id;
+	t->ctrls = ctrls;
+	t->ctrls[t->nr_ctrls++] = c;
+	return c;
+
+free_outliers:
+	free(c->outliers);
+free_hist:
+	nvme_lat_hist_free(&c->all.h);
+free:
+	free(c);
+	return NULL;
+}
+
+static struct trace_stat *trace_stat(struct trace_stat **s)
+{
+	if (*s)
+		return *s;
+	*s = calloc(1, sizeof(**s));
+	if (!*s)
+		return NULL;
+	if (nvme_lat_hist_init_log2(&(*s)->h, TRACE_HIST_SUB_BITS,
+				    TRACE_HIST_BUCKETS)) {
+		free(*s);
+		*s = NULL;
+	}
+	return *s;
+}
+
+static struct trace_stat *trace_queue(struct trace_ctrl *c, int qid)
+{
+	struct trace_stat **queues;
+
+	if (qid < 0 || qid > 0xffff)
+		return NULL;
+	if (qid >= c->nr_queues) {
+		queues = realloc(c->queues, (qid + 1) * sizeof(*queues));
+		if (!queues)
+			return NULL;
+		memset(queues + c->nr_queues, 0,
+		       (qid + 1 - c->nr_queues) * sizeof(*queues));
+		c->queues = queues;
+		c->nr_queues = qid + 1;
+	}
+	return trace_stat(&c->queues[qid]);
+}
+
+static void trace_stat_add(struct trace_stat *s, __u64 lat_ns, __u16 status)
+{
+	if (!s)
+		return;
+	nvme_lat_hist_add(&s->h, lat_ns / 1000);
+	s->sum_ns += lat_ns;
+	if (lat_ns > s->max_ns)
+		s->max_ns = lat_ns;
+	if (status)
+		s->errors++;
+}
+
+static void trace_outlier_sift_down(struct trace_ctrl *c, int i)
+{
+	struct trace_outlier tmp;
+	int min, l, r;
+
+	for (;;) {
+		min = i;
+		l = 2 * i + 1;
+		r = l + 1;
+		if (l < c->nr_outliers &&
+		    c->outliers[l].lat_ns < c->outliers[min].lat_ns)
+			min = l;
+		if (r < c->nr_outliers &&
+		    c->outliers[r].lat_ns < c->outliers[min].lat_ns)
+			min = r;
+		if (min == i)
+			return;
+		tmp = c->outliers[i];
+		c->outliers[i] = c->outliers[min];
+		c->outliers[min] = tmp;
+		i = min;
+	}
+}
+
+static void trace_outlier_add(struct trace_ctrl *c,
+			      const struct trace_outlier *o)
+{
+	struct trace_outlier tmp;
+	int i, parent;
+
+	if (!cfg.outliers)
+		return;
+	if (c->nr_outliers == cfg.outliers) {
+		if (o->lat_ns <= c->outliers[0].lat_ns)
+			return;
+		c->outliers[0] = *o;
+		trace_outlier_sift_down(c, 0);
+		return;
+	}
+
+	i = c->nr_outliers++;
+	c->outliers[i] = *o;
+	while (i) {
+		parent = (i - 1) / 2;
+		if (c->outliers[parent].lat_ns <= c->outliers[i].lat_ns)
+			break;
+		tmp = c->outliers[i];
+		c->outliers[i] = c->outliers[parent];
+		c->outliers[parent] = tmp;
+		i = parent;
+	}
+}
+
+static void trace_setup(struct trace *t, const unsigned char *ev,
+			unsigned int len, __u64 ts)
+{
+	const struct trace_event_format *f = &t->setup;
+	int ctrl = (int)trace_get(ev, len, &f->ctrl_id);
+	int qid = (int)trace_get(ev, len, &f->qid);
+	int cid = (int)trace_get(ev, len, &f->cid);
+	struct trace_pending **pp, *p;
+	struct trace_ctrl *c;
+	__u64 key;
+
+	if (t->only_ctrl >= 0 && ctrl != t->only_ctrl)
+		return;
+
+	key = trace_key(ctrl, qid, cid);
+	pp = trace_pending_find(t, key);
+	p = *pp;
+	if (p) {
+		/* the id was reused, the completion of the last one lost */
+		c = trace_ctrl(t, ctrl);
+		if (c)
+			c->incomplete++;
+	} else {
+		p = t->free_pending;
+		if (p)
+			t->free_pending = p->next;
+		else
+			p = malloc(sizeof(*p));
+		if (!p)
+			return;
+		p->key = key;
+		p->next = NULL;
+		*pp = p;
+	}
+	p->ts = ts;
+	p->opcode = trace_get(ev, len, &f->opcode);
+	p->nsid = trace_get(ev, len, &f->nsid);
+	trace_get_string(ev, len, &f->disk, p->disk, sizeof(p->disk));
+}
+
+static void trace_complete(struct trace *t, const unsigned char *ev,
+			   unsigned int len, __u64 ts)
+{
+	const struct trace_event_format *f = &t->complete;
+	int ctrl = (int)trace_get(ev, len, &f->ctrl_id);
+	int qid = (int)trace_get(ev, len, &f->qid);
+	int cid = (int)trace_get(ev, len, &f->cid);
+	__u16 status = trace_get(ev, len, &f->status);
+	struct trace_pending **pp, *p;
+	struct trace_outlier o;
+	struct trace_ctrl *c;
+	bool admin = !qid;
+
+	if (t->only_ctrl >= 0 && ctrl != t->only_ctrl)
+		return;
+
+	c = trace_ctrl(t, ctrl);
+	if (!c)
+		return;
+	pp = trace_pending_find(t, trace_key(ctrl, qid, cid));
+	p = *pp;
+	if (!p) {
+		c->unmatched++;
+		return;
+	}
+	*pp = p->next;
+
+	o.ts = p->ts - t->first_ts;
+	o.lat_ns = ts > p->ts ? ts - p->ts : 0;
+	o.qid = qid;
+	o.cid = cid;
+	o.status = status;
+	o.opcode = p->opcode;
+	o.nsid = p->nsid;
+	memcpy(o.disk, p->disk, sizeof(o.disk));
+
+	trace_stat_add(&c->all, o.lat_ns, status);
+	trace_stat_add(trace_stat(&c->ops[admin][o.opcode]), o.lat_ns, status);
+	trace_stat_add(trace_queue(c, qid), o.lat_ns, status);
+	trace_outlier_add(c, &o);
+
+	p->next = t->free_pending;
+	t->free_pending = p;
+}
+
+static void trace_handle(struct trace *t, struct trace_cpu *c)
+{
+	int id = trace_get(c->event, c->event_len, &trace_common_type);
+
+	if (!t->events++)
+		t->first_ts = c->ts;
+	t->last_ts = c->ts;
+	if (id == t->setup.id)
+		trace_setup(t, c->event, c->event_len, c->ts);
+	else
+		trace_complete(t, c->event, c->event_len, c->ts);
+}
+
+/*
+ * Handles the events of every CPU, in timestamp order, up to until or to
+ * the last one if until is 0. A live trace is merged up to the time the
+ * pages were read at, so that no CPU can still add an earlier event.
+ */
+static int trace_merge(struct trace *t, __u64 until)
+{
+	struct trace_cpu *c, *next;
+	int i, err;
+
+	for (i = 0; i < t->nr_cpus; i++)
+		t->cpus[i].dry = false;
+
+	for (;;) {
+		next = NULL;
+		for (i = 0; i < t->nr_cpus; i++) {
+			c = &t->cpus[i];
+			if (!c->event && !c->dry && !c->eof) {
+				err = trace_next_event(t, c);
+				if (err < 0)
+					return err;
+			}
+			if (c->event && (!next || c->ts < next->ts))
+				next = c;
+		}
+		if (!next || (until && next->ts >= until))
+			return 0;
+		trace_handle(t, next);
+		next->event = NULL;
+	}
+}
+
+static int trace_open_cpus(struct trace *t)
+{
+	char path[PATH_MAX];
+	struct trace_cpu *cpus;
+	struct dirent *d;
+	int cpu, err = 0;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "%s/per_cpu", t->buffers);
+	dir = opendir(path);
+	if (!dir)
+		return -errno;
+
+	while ((d = readdir(dir))) {
+		struct trace_cpu *c;
+
+		if (sscanf(d->d_name, "cpu%d", &cpu) != 1)
+			continue;
+		cpus = realloc(t->cpus, (t->nr_cpus + 1) * sizeof(*cpus));
+		if (!cpus) {
+			err = -ENOMEM;
+			break;
+		}
+		t->cpus = cpus;
+		c = &t->cpus[t->nr_cpus];
+		memset(c, 0, sizeof(*c));
+		c->cpu = cpu;
+		c->save_fd = -1;
+		c->page = malloc(t->page_size);
+		if (!c->page) {
+			err = -ENOMEM;
+			break;
+		}
+		snprintf(path, sizeof(path), "%s/per_cpu/%s/trace_pipe_raw",
+			 t->buffers, d->d_name);
+		c->fd = open(path, O_RDONLY | O_CLOEXEC |
+			     (t->live ? O_NONBLOCK : 0));
+		if (c->fd < 0) {
+			err = -errno;
+			free(c->page);
+			break;
+		}
+		t->nr_cpus++;
+	}
+	closedir(dir);
+
+	if (!err && !t->nr_cpus)
+		err = -ENOENT;
+	return err;
+}
+
+static int trace_mkdirs(const char *dir, const char *path)
+{
+	char buf[PATH_MAX], *p;
+
+	snprintf(buf, sizeof(buf), "%s/%s", dir, path);
+	for (p = strchr(buf + strlen(dir) + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(buf, 0755) && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+	if (mkdir(buf, 0755) && errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+static int trace_copy(const char *root, const char *dir, const char *file)
+{
+	char path[PATH_MAX], buf[4096];
+	int in, out, err = 0;
+	ssize_t n;
+
+	snprintf(path, sizeof(path), "%s/%s", root, file);
+	in = open(path, O_RDONLY | O_CLOEXEC);
+	if (in < 0)
+		return -errno;
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	out = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out < 0) {
+		err = -errno;
+		goto close_in;
+	}
+	/* tracefs files have no size, read them to the end */
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, n) != n) {
+			n = -1;
+			break;
+		}
+	}
+	if (n < 0)
+		err = -errno;
+	close(out);
+close_in:
+	close(in);
+	return err;
+}
+
+/* Lays dir out like tracefs, with the files --input reads */
+static int trace_save_init(struct trace *t, const char *dir)
+{
+	const char *formats[] = {
+		"events/header_page", TRACE_SETUP "/format",
+		TRACE_COMPLETE "/format",
+	};
+	char path[PATH_MAX];
+	int i, err;
+
+	if (mkdir(dir, 0755) && errno != EEXIST)
+		return -errno;
+	err = trace_mkdirs(dir, TRACE_SETUP);
+	if (!err)
+		err = trace_mkdirs(dir, TRACE_COMPLETE);
+	for (i = 0; !err && i < ARRAY_SIZE(formats); i++)
+		err = trace_copy(t->root, dir, formats[i]);
+	if (err)
+		return err;
+
+	for (i = 0; i < t->nr_cpus; i++) {
+		struct trace_cpu *c = &t->cpus[i];
+
+		snprintf(path, sizeof(path), "per_cpu/cpu%d", c->cpu);
+		err = trace_mkdirs(dir, path);
+		if (err)
+			return err;
+		snprintf(path, sizeof(path), "%s/per_cpu/cpu%d/trace_pipe_raw",
+			 dir, c->cpu);
+		c->save_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC |
+				  O_CLOEXEC, 0644);
+		if (c->save_fd < 0)
+			return -errno;
+	}
+	return 0;
+}
+
+/*
+ * A new instance has buffers of its own, empty, with all events disabled
+ * and tracing on; the events enabled in it are only recorded there.
+ */
+static int trace_instance_create(struct trace *t)
+{
+	snprintf(t->instance, sizeof(t->instance),
+		 "%s/instances/nvme-cli-%d", t->root, (int)getpid());
+	if (mkdir(t->instance, 0700)) {
+		t->instance[0] = '\0';
+		return -errno;
+	}
+	t->buffers = t->instance;
+	return 0;
+}
+
+/* Its buffers must be closed first, or the instance is busy */
+static void trace_instance_remove(struct trace *t)
+{
+	if (t->instance[0] && rmdir(t->instance))
+		fprintf(stderr, "Failed to remove %s: %s\n", t->instance,
+			strerror(errno));
+}
+
+static int trace_start(struct trace *t)
+{
+	int err;
+
+	/* Timestamps of CLOCK_MONOTONIC tell how far the pages are complete */
+	t->mono = !trace_write_file(t->buffers, "trace_clock", "mono");
+
+	err = trace_write_file(t->buffers, TRACE_SETUP "/enable", "1");
+	if (!err)
+		err = trace_write_file(t->buffers, TRACE_COMPLETE "/enable",
+				       "1");
+	return err;
+}
+
+static int trace_live(struct trace *t)
+{
+	struct sigaction sa = { .sa_handler = trace_signal };
+	__u64 start, now;
+	int err;
+
+	err = trace_start(t);
+	if (err) {
+		fprintf(stderr, "Failed to enable the nvme tracepoints: %s\n",
+			strerror(-err));
+		return err;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	start = trace_now_nsec();
+	while (!trace_stop) {
+		now = trace_now_nsec();
+		if (cfg.duration && now - start >= cfg.duration * 1000000000ULL)
+			break;
+		err = trace_merge(t, t->mono ? now : 0);
+		if (err)
+			break;
+		poll(NULL, 0, 100);
+	}
+
+	trace_write_file(t->buffers, "tracing_on", "0");
+	/* what the buffers still hold */
+	if (!err)
+		err = trace_merge(t, 0);
+	return err;
+}
+
+static const char *trace_opcode_name(bool admin, __u8 opcode)
+{
+	if (opcode == nvme_fabrics_command)
+		return "fabrics";
+	if (admin) {
+		switch (opcode) {
+		case nvme_admin_delete_sq:	return "delete-sq";
+		case nvme_admin_create_sq:	return "create-sq";
+		case nvme_admin_get_log_page:	return "get-log";
+		case nvme_admin_delete_cq:	return "delete-cq";
+		case nvme_admin_create_cq:	return "create-cq";
+		case nvme_admin_identify:	return "identify";
+		case nvme_admin_abort_cmd:	return "abort";
+		case nvme_admin_set_features:	return "set-feature";
+		case nvme_admin_get_features:	return "get-feature";
+		case nvme_admin_async_event:	return "async-event";
+		case nvme_admin_ns_mgmt:	return "ns-mgmt";
+		case nvme_admin_activate_fw:	return "fw-commit";
+		case nvme_admin_download_fw:	return "fw-download";
+		case nvme_admin_dev_self_test:	return "device-self-test";
+		case nvme_admin_ns_attach:	return "ns-attach";
+		case nvme_admin_keep_alive:	return "keep-alive";
+		case nvme_admin_directive_send:	return "directive-send";
+		case nvme_admin_directive_recv:	return "directive-recv";
+		case nvme_admin_virtual_mgmt:	return "virt-mgmt";
+		case nvme_admin_nvme_mi_send:	return "mi-send";
+		case nvme_admin_nvme_mi_recv:	return "mi-recv";
+		case nvme_admin_dbbuf:		return "dbbuf";
+		case nvme_admin_format_nvm:	return "format";
+		case nvme_admin_security_send:	return "security-send";
+		case nvme_admin_security_recv:	return "security-recv";
+		case nvme_admin_sanitize_nvm:	return "sanitize";
+		case nvme_admin_get_lba_status:	return "get-lba-status";
+		}
+		return NULL;
+	}
+	switch (opcode) {
+	case nvme_cmd_flush:		return "flush";
+	case nvme_cmd_write:		return "write";
+	case nvme_cmd_read:		return "read";
+	case nvme_cmd_write_uncor:	return "write-uncor";
+	case nvme_cmd_compare:		return "compare";
+	case nvme_cmd_write_zeroes:	return "write-zeroes";
+	case nvme_cmd_dsm:		return "dsm";
+	case nvme_cmd_verify:		return "verify";
+	case nvme_cmd_resv_register:	return "resv-register";
+	case nvme_cmd_resv_report:	return "resv-report";
+	case nvme_cmd_resv_acquire:	return "resv-acquire";
+	case nvme_cmd_resv_release:	return "resv-release";
+	}
+	return NULL;
+}
+
+static char *trace_command(bool admin, __u8 opcode, char *buf, size_t len)
+{
+	const char *name = trace_opcode_name(admin, opcode);
+
+	if (name)
+		snprintf(buf, len, "%s%s", admin ? "admin " : "", name);
+	else
+		snprintf(buf, len, "%s%#04x", admin ? "admin " : "", opcode);
+	return buf;
+}
+
+static const double trace_pcts[] = { 50, 99, 99.9 };
+static const char *trace_pct_names[] = { "p50", "p99", "p99.9" };
+
+/* spread evenly over its bucket, a percentile can pass the exact max */
+static double trace_percentile(const struct trace_stat *s, double pct)
+{
+	double us = nvme_lat_hist_percentile(&s->h, pct);
+
+	return us < s->max_ns / 1000.0 ? us : s->max_ns / 1000.0;
+}
+
+static void trace_show_stat(const char *name, const struct trace_stat *s)
+{
+	char buf[24];
+	int i;
+
+	double mean = s->sum_ns / 1000.0 / s->h.total, pct;
+
+	printf("  %-22s %12"PRIu64" %8"PRIu64, name, (uint64_t)s->h.total,
+	       (uint64_t)s->errors);
+	printf(" %10s", nvme_lat_us_to_string(mean, buf, sizeof(buf)));
+	for (i = 0; i < ARRAY_SIZE(trace_pcts); i++) {
+		pct = trace_percentile(s, trace_pcts[i]);
+		printf(" %10s", nvme_lat_us_to_string(pct, buf, sizeof(buf)));
+	}
+	printf(" %10s\n", nvme_lat_us_to_string(s->max_ns / 1000.0, buf,
+						sizeof(buf)));
+}
+
+static int trace_outlier_cmp(const void *a, const void *b)
+{
+	const struct trace_outlier *x = a, *y = b;
+
+	return x->lat_ns < y->lat_ns ? 1 : x->lat_ns > y->lat_ns ? -1 : 0;
+}
+
+static void trace_show_ctrl(struct trace_ctrl *c)
+{
+	char name[32], buf[24];
+	int admin, op, i;
+
+	printf("\nnvme%d: %"PRIu64" commands, %"PRIu64" errors", c->id,
+	       (uint64_t)c->all.h.total, (uint64_t)c->all.errors);
+	if (c->unmatched)
+		printf(", %"PRIu64" completed without their setup",
+		       (uint64_t)c->unmatched);
+	if (c->incomplete)
+		printf(", %"PRIu64" not seen completing",
+		       (uint64_t)c->incomplete);
+	if (c->in_flight)
+		printf(", %"PRIu64" in flight at the end",
+		       (uint64_t)c->in_flight);
+	printf("\n");
+	if (!c->all.h.total)
+		return;
+
+	printf("  %-22s %12s %8s %10s", "", "commands", "errors", "mean");
+	for (i = 0; i < ARRAY_SIZE(trace_pct_names); i++)
+		printf(" %10s", trace_pct_names[i]);
+	printf(" %10s\n", "max");
+	trace_show_stat("all", &c->all);
+	for (admin = 0; admin < 2; admin++)
+		for (op = 0; op < 256; op++)
+			if (c->ops[admin][op])
+				trace_show_stat(trace_command(admin, op, name,
+						sizeof(name)), c->ops[admin][op]);
+	for (i = 0; i < c->nr_queues; i++) {
+		if (!c->queues[i])
+			continue;
+		snprintf(name, sizeof(name), "queue %d", i);
+		trace_show_stat(name, c->queues[i]);
+	}
+
+	if (!c->nr_outliers)
+		return;
+	qsort(c->outliers, c->nr_outliers, sizeof(*c->outliers),
+	      trace_outlier_cmp);
+	printf("  slowest commands:\n");
+	printf("  %12s %10s %5s %6s %-20s %10s %s\n", "time", "latency",
+	       "qid", "cid", "command", "nsid", "status");
+	for (i = 0; i < c->nr_outliers; i++) {
+		struct trace_outlier *o = &c->outliers[i];
+
+		printf("  %11.6fs %10s %5d %6u %-20s %10u %s\n", o->ts / 1e9,
+		       nvme_lat_us_to_string(o->lat_ns / 1000.0, buf,
+					     sizeof(buf)),
+		       o->qid, o->cid,
+		       trace_command(!o->qid, o->opcode, name, sizeof(name)),
+		       o->nsid, o->status ? nvme_status_to_string(o->status) :
+		       "success");
+	}
+}
+
+static void trace_json_stat(struct json_object *obj,
+			    const struct trace_stat *s)
+{
+	char name[24];
+	int i;
+
+	json_object_add_value_uint(obj, "commands", s->h.total);
+	json_object_add_value_uint(obj, "errors", s->errors);
+	json_object_add_value_uint(obj, "mean_us", s->h.total ?
+				   s->sum_ns / s->h.total / 1000 : 0);
+	for (i = 0; i < ARRAY_SIZE(trace_pcts); i++) {
+		snprintf(name, sizeof(name), "%s_us", trace_pct_names[i]);
+		json_object_add_value_uint(obj, name,
+					   trace_percentile(s, trace_pcts[i]));
+	}
+	json_object_add_value_uint(obj, "max_us", s->max_ns / 1000);
+}
+
+static struct json_object *trace_json_ctrl(struct trace_ctrl *c)
+{
+	struct json_array *ops, *queues, *outliers;
+	struct json_object *ctrl, *obj;
+	char name[32];
+	int admin, op, i;
+
+	ctrl = json_create_object();
+	snprintf(name, sizeof(name), "nvme%d", c->id);
+	json_object_add_value_string(ctrl, "controller", name);
+	trace_json_stat(ctrl, &c->all);
+	json_object_add_value_uint(ctrl, "unmatched_completions",
+				   c->unmatched);
+	json_object_add_value_uint(ctrl, "incomplete", c->incomplete);
+	json_object_add_value_uint(ctrl, "in_flight", c->in_flight);
+
+	ops = json_create_array();
+	for (admin = 0; admin < 2; admin++)
+		for (op = 0; op < 256; op++) {
+			if (!c->ops[admin][op])
+				continue;
+			obj = json_create_object();
+			json_object_add_value_string(obj, "command",
+				trace_command(admin, op, name, sizeof(name)));
+			json_object_add_value_uint(obj, "opcode", op);
+			json_object_add_value_uint(obj, "admin", admin);
+			trace_json_stat(obj, c->ops[admin][op]);
+			json_array_add_value_object(ops, obj);
+		}
+	json_object_add_value_array(ctrl, "opcodes", ops);
+
+	queues = json_create_array();
+	for (i = 0; i < c->nr_queues; i++) {
+		if (!c->queues[i])
+			continue;
+		obj = json_create_object();
+		json_object_add_value_uint(obj, "qid", i);
+		trace_json_stat(obj, c->queues[i]);
+		json_array_add_value_object(queues, obj);
+	}
+	json_object_add_value_array(ctrl, "queues", queues);
+
+	if (c->nr_outliers)
+		qsort(c->outliers, c->nr_outliers, sizeof(*c->outliers),
+		      trace_outlier_cmp);
+	outliers = json_create_array();
+	for (i = 0; i < c->nr_outliers; i++) {
+		struct trace_outlier *o = &c->outliers[i];
+
+		obj = json_create_object();
+		json_object_add_value_uint(obj, "time_us", o->ts / 1000);
+		json_object_add_value_uint(obj, "latency_us", o->lat_ns / 1000);
+		json_object_add_value_uint(obj, "qid", o->qid);
+		json_object_add_value_uint(obj, "cid", o->cid);
+		json_object_add_value_string(obj, "command",
+			trace_command(!o->qid, o->opcode, name, sizeof(name)));
+		json_object_add_value_uint(obj, "nsid", o->nsid);
+		if (o->disk[0])
+			json_object_add_value_string(obj, "disk", o->disk);
+		json_object_add_value_uint(obj, "status", o->status);
+		json_array_add_value_object(outliers, obj);
+	}
+	json_object_add_value_array(ctrl, "outliers", outliers);
+	return ctrl;
+}
+
+static int trace_ctrl_cmp(const void *a, const void *b)
+{
+	const struct trace_ctrl *x = *(struct trace_ctrl **)a;
+	const struct trace_ctrl *y = *(struct trace_ctrl **)b;
+
+	return x->id - y->id;
+}
+
+static void trace_show(struct trace *t, double seconds,
+		       enum nvme_print_flags flags)
+{
+	struct json_object *root;
+	struct json_array *ctrls;
+	struct trace_pending *p;
+	struct trace_ctrl *c;
+	int i;
+
+	/* the commands still pending were in flight when tracing stopped */
+	for (i = 0; i < TRACE_PENDING_BUCKETS; i++)
+		for (p = t->pending[i]; p; p = p->next) {
+			c = trace_ctrl(t, (int)(p->key >> 32));
+			if (c)
+				c->in_flight++;
+		}
+	if (t->nr_ctrls)
+		qsort(t->ctrls, t->nr_ctrls, sizeof(*t->ctrls), trace_ctrl_cmp);
+
+	if (flags == JSON) {
+		root = json_create_object();
+		json_object_add_value_uint(root, "duration_us", seconds * 1e6);
+		json_object_add_value_uint(root, "events", t->events);
+		json_object_add_value_uint(root, "lost_events", t->lost);
+		ctrls = json_create_array();
+		for (i = 0; i < t->nr_ctrls; i++)
+			json_array_add_value_object(ctrls,
+						    trace_json_ctrl(t->ctrls[i]));
+		json_object_add_value_array(root, "controllers", ctrls);
+		json_print_object(root, NULL);
+		printf("\n");
+		json_free_object(root);
+		return;
+	}
+
+	printf("%"PRIu64" events in %.1fs\n", (uint64_t)t->events, seconds);
+	for (i = 0; i < t->nr_ctrls; i++)
+		trace_show_ctrl(t->ctrls[i]);
+}
+
+static void trace_free(struct trace *t)
+{
+	struct trace_pending *p, *next;
+	struct trace_ctrl *c;
+	int i, j;
+
+	for (i = 0; i < t->nr_cpus; i++) {
+		close(t->cpus[i].fd);
+		if (t->cpus[i].save_fd >= 0)
+			close(t->cpus[i].save_fd);
+		free(t->cpus[i].page);
+	}
+	free(t->cpus);
+
+	for (i = 0; i < TRACE_PENDING_BUCKETS; i++) {
+		for (p = t->pending[i]; p; p = next) {
+			next = p->next;
+			free(p);
+		}
+	}
+	for (p = t->free_pending; p; p = next) {
+		next = p->next;
+		free(p);
+	}
+
+	for (i = 0; i < t->nr_ctrls; i++) {
+		c = t->ctrls[i];
+		nvme_lat_hist_free(&c->all.h);
+		for (j = 0; j < 512; j++) {
+			struct trace_stat *s = c->ops[j / 256][j % 256];
+
+			if (s)
+				nvme_lat_hist_free(&s->h);
+			free(s);
+		}
+		for (j = 0; j < c->nr_queues; j++) {
+			if (c->queues[j])
+				nvme_lat_hist_free(&c->queues[j]->h);
+			free(c->queues[j]);
+		}
+		free(c->queues);
+		free(c->outliers);
+		free(c);
+	}
+	free(t->ctrls);
+}
+
+static const char *trace_find_tracefs(void)
+{
+	if (!access(TRACEFS "/events", F_OK))
+		return TRACEFS;
+	if (!access(TRACEFS_DEBUGFS "/events", F_OK))
+		return TRACEFS_DEBUGFS;
+	return NULL;
+}
+
+int trace(const char *desc, int argc, char **argv)
+{
+	const char *duration = "seconds to trace, 0 to trace until "\
+		"interrupted (default 10)";
+	const char *input = "read a trace saved with --save instead of tracing";
+	const char *save = "also save the raw trace into this directory";
+	const char *outliers = "number of slowest commands to list per "\
+		"controller (default 10)";
+	const char *output_format = "Output format: normal|json";
+	struct trace t = { .only_ctrl = -1 };
+	enum nvme_print_flags flags;
+	const char *dev;
+	double seconds;
+	__u64 start;
+	int err;
+
+	OPT_ARGS(opts) = {
+		OPT_UINT("duration",     'd', &cfg.duration,      duration),
+		OPT_FILE("input",        'i', &cfg.input,         input),
+		OPT_FILE("save",         's', &cfg.save,          save),
+		OPT_UINT("outliers",     'n', &cfg.outliers,      outliers),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_END()
+	};
+
+	err = argconfig_parse(argc, argv, desc, opts);
+	if (err)
+		return err;
+
+	err = flags = validate_output_format(cfg.output_format);
+	if (flags < 0)
+		return err;
+	if (flags != JSON && flags != NORMAL) {
+		fprintf(stderr, "Invalid output format\n");
+		return -EINVAL;
+	}
+	if (cfg.input && cfg.save) {
+		fprintf(stderr, "--save only applies to a live trace\n");
+		return -EINVAL;
+	}
+	if (optind < argc) {
+		dev = strrchr(argv[optind], '/');
+		dev = dev ? dev + 1 : argv[optind];
+		if (sscanf(dev, "nvme%d", &t.only_ctrl) != 1) {
+			fprintf(stderr, "%s is not an NVMe controller\n",
+				argv[optind]);
+			return -EINVAL;
+		}
+	}
+
+	t.live = !cfg.input;
+	t.root = cfg.input ? cfg.input : trace_find_tracefs();
+	if (!t.root) {
+		fprintf(stderr, "tracefs is not mounted\n");
+		return -ENOENT;
+	}
+
+	err = trace_parse_header_page(&t);
+	if (!err)
+		err = trace_parse_event(t.root, TRACE_SETUP, &t.setup);
+	if (!err)
+		err = trace_parse_event(t.root, TRACE_COMPLETE, &t.complete);
+	if (err) {
+		fprintf(stderr, "No nvme tracepoints in %s: %s\n", t.root,
+			strerror(-err));
+		return err;
+	}
+
+	t.buffers = t.root;
+	if (t.live) {
+		err = trace_instance_create(&t);
+		if (err) {
+			fprintf(stderr,
+				"Failed to create a trace instance in %s: %s\n",
+				t.root, strerror(-err));
+			return err;
+		}
+	}
+
+	err = trace_open_cpus(&t);
+	if (err) {
+		fprintf(stderr, "Failed to open the trace buffers in %s: %s\n",
+			t.buffers, strerror(-err));
+		goto free;
+	}
+	if (cfg.save) {
+		err = trace_save_init(&t, cfg.save);
+		if (err) {
+			fprintf(stderr, "Failed to save the trace to %s: %s\n",
+				cfg.save, strerror(-err));
+			goto free;
+		}
+	}
+
+	start = trace_now_nsec();
+	err = t.live ? trace_live(&t) : trace_merge(&t, 0);
+	if (err) {
+		fprintf(stderr, "Failed to read the trace: %s\n",
+			strerror(-err));
+		goto free;
+	}
+	if (t.live)
+		seconds = (trace_now_nsec() - start) / 1e9;
+	else
+		seconds = (t.last_ts - t.first_ts) / 1e9;
+
+	if (t.lost || t.lost_uncounted)
+		fprintf(stderr, "warning: the trace buffers overflowed, "
+			"%s%"PRIu64" events lost\n",
+			t.lost_uncounted ? "at least " : "", (uint64_t)t.lost);
+	if (t.bad_pages)
+		fprintf(stderr, "warning: %"PRIu64" corrupted trace pages\n",
+			(uint64_t)t.bad_pages);
+	trace_show(&t, seconds, flags);
+free:
+	trace_free(&t);
+	trace_instance_remove(&t);
+	return err;
+}
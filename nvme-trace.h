@@ -0,0 +1,6 @@
+#ifndef _NVME_TRACE_H
+#define _NVME_TRACE_H
+
+extern int trace(const char *desc, int argc, char **argv);
+
+#endif
@@ -36,6 +36,7 @@
 #include <math.h>
 #include <dirent.h>
 #include <libgen.h>
+#include <time.h>
 
 #ifdef LIBHUGETLBFS
 #include <hugetlbfs.h>
@@ -58,6 +59,16 @@
 
 #include "argconfig.h"
 #include "fabrics.h"
+#include "nvme-monitor.h"
+#include "nvme-ana.h"
+#include "nvme-top.h"
+#include "nvme-history.h"
+#include "nvme-daemon.h"
+#include "nvme-metrics.h"
+#include "nvme-latency.h"
+#include "nvme-trace.h"
+#include "nvme-irqmap.h"
+#include "nvme-pcie.h"
 
 #define CREATE_CMD
 #include "nvme-builtin.h"
@@ -87,6 +98,8 @@ static struct program nvme = {
 
 static const char *output_format = "Output format: normal|json|binary";
 static const char *output_format_no_binary = "Output format: normal|json";
+static const char *output_format_prom = "Output format: normal|json|binary|prometheus";
+static const char *via_daemon = "Get the data cached by nvme daemon, if it runs";
 
 static void *__nvme_alloc(size_t len, bool *huge)
 {
@@ -210,6 +223,53 @@ enum nvme_print_flags validate_output_format(char *format)
 	return -EINVAL;
 }
 
+/* For the commands that can also print Prometheus metrics */
+enum nvme_print_flags validate_metrics_output_format(char *format)
+{
+	if (format && !strcmp(format, "prometheus"))
+		return PROMETHEUS;
+	return validate_output_format(format);
+}
+
+/*
+ * Reads the log every interval seconds and shows how its counters moved
+ * since the previous read. Sleeping to absolute deadlines keeps the samples
+ * from drifting, and the rates use the time actually elapsed between reads.
+ */
+static int smart_log_interval(int fd, __u32 nsid, struct nvme_smart_log *prev,
+			      __u32 interval, __u32 count,
+			      enum nvme_print_flags flags)
+{
+	struct nvme_smart_log cur;
+	struct timespec start, next, now;
+	__u64 last, usec;
+	__u32 i;
+	int err = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	last = start.tv_sec * 1000000ULL + start.tv_nsec / 1000;
+	for (i = 1; !count || i <= count; i++) {
+		next.tv_sec = start.tv_sec + (time_t)interval * i;
+		next.tv_nsec = start.tv_nsec;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+				       NULL) == EINTR)
+			;
+
+		err = nvme_smart_log(fd, nsid, &cur);
+		if (err)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		usec = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+
+		nvme_show_smart_log_delta(prev, &cur, usec - last, nsid,
+					  devicename, flags);
+		fflush(stdout);
+		*prev = cur;
+		last = usec;
+	}
+	return err;
+}
+
 static int get_smart_log(int argc, char **argv, struct command *cmd, struct plugin *plugin)
 {
 	struct nvme_smart_log smart_log;
@@ -219,6 +279,10 @@ static int get_smart_log(int argc, char **argv, struct command *cmd, struct plug
 	const char *namespace = "(optional) desired namespace";
 	const char *raw = "output in binary format";
 	const char *human_readable = "show info in readable format";
+	const char *interval = "read the log again every interval seconds and "\
+		"show the change of its counters";
+	const char *count = "number of changes to show with --interval, "\
+		"0 to run until interrupted";
 	enum nvme_print_flags flags;
 	int err, fd;
 
@@ -227,6 +291,9 @@ static int get_smart_log(int argc, char **argv, struct command *cmd, struct plug
 		int   raw_binary;
 		char *output_format;
 		int   human_readable;
+		__u32 interval;
+		__u32 count;
+		int   via_daemon;
 	};
 
 	struct config cfg = {
@@ -237,9 +304,12 @@ static int get_smart_log(int argc, char **argv, struct command *cmd, struct plug
 
 	OPT_ARGS(opts) = {
 		OPT_UINT("namespace-id",   'n', &cfg.namespace_id,   namespace),
-		OPT_FMT("output-format",   'o', &cfg.output_format,  output_format),
+		OPT_FMT("output-format",   'o', &cfg.output_format,  output_format_prom),
 		OPT_FLAG("raw-binary",     'b', &cfg.raw_binary,     raw),
 		OPT_FLAG("human-readable", 'H', &cfg.human_readable, human_readable),
+		OPT_UINT("interval",       'i', &cfg.interval,       interval),
+		OPT_UINT("count",          'c', &cfg.count,          count),
+		OPT_FLAG("via-daemon",       0, &cfg.via_daemon,     via_daemon),
 		OPT_END()
 	};
 
@@ -247,21 +317,41 @@ static int get_smart_log(int argc, char **argv, struct command *cmd, struct plug
 	if (fd < 0)
 		goto ret;
 
-	err = flags = validate_output_format(cfg.output_format);
+	err = flags = validate_metrics_output_format(cfg.output_format);
 	if (flags < 0)
 		goto close_fd;
 	if (cfg.raw_binary)
 		flags = BINARY;
 	if (cfg.human_readable)
 		flags |= VERBOSE;
+	if (cfg.interval && flags & (BINARY | PROMETHEUS)) {
+		fprintf(stderr, "--interval does not support %s output\n",
+			flags & BINARY ? "binary" : "prometheus");
+		err = -EINVAL;
+		goto close_fd;
+	}
+
+	if (cfg.via_daemon && !cfg.interval &&
+	    cfg.namespace_id == NVME_NSID_ALL) {
+		err = nvme_daemon_query("smart-log", fd, flags, 0);
+		if (err != -ECONNREFUSED)
+			goto close_fd;
+	}
 
 	err = nvme_smart_log(fd, cfg.namespace_id, &smart_log);
-	if (!err)
+	if (!err) {
 		nvme_show_smart_log(&smart_log, cfg.namespace_id, devicename,
 				    flags);
-	else if (err > 0)
+		if (cfg.interval) {
+			fflush(stdout);
+			err = smart_log_interval(fd, cfg.namespace_id,
+						 &smart_log, cfg.interval,
+						 cfg.count, flags);
+		}
+	}
+	if (err > 0)
 		nvme_show_status(err);
-	else
+	else if (err < 0)
 		perror("smart log");
 close_fd:
 	close(fd);
@@ -283,6 +373,7 @@ static int get_ana_log(int argc, char **argv, struct command *cmd,
 
 	struct config {
 		char *output_format;
+		int   via_daemon;
 	};
 
 	struct config cfg = {
@@ -290,7 +381,8 @@ static int get_ana_log(int argc, char **argv, struct command *cmd,
 	};
 
 	OPT_ARGS(opts) = {
-		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format_prom),
+		OPT_FLAG("via-daemon",     0, &cfg.via_daemon,    via_daemon),
 		OPT_END()
 	};
 
@@ -298,10 +390,16 @@ static int get_ana_log(int argc, char **argv, struct command *cmd,
 	if (fd < 0)
 		goto ret;
 
-	err = flags = validate_output_format(cfg.output_format);
+	err = flags = validate_metrics_output_format(cfg.output_format);
 	if (flags < 0)
 		goto close_fd;
 
+	if (cfg.via_daemon) {
+		err = nvme_daemon_query("ana-log", fd, flags, 0);
+		if (err != -ECONNREFUSED)
+			goto close_fd;
+	}
+
 	err = nvme_identify_ctrl(fd, &ctrl);
 	if (err) {
 		fprintf(stderr, "ERROR : nvme_identify_ctrl() failed 0x%x\n",
@@ -577,6 +675,7 @@ static int get_error_log(int argc, char **argv, struct command *cmd, struct plug
 		__u32 log_entries;
 		int   raw_binary;
 		char *output_format;
+		int   via_daemon;
 	};
 
 	struct config cfg = {
@@ -586,8 +685,9 @@ static int get_error_log(int argc, char **argv, struct command *cmd, struct plug
 
 	OPT_ARGS(opts) = {
 		OPT_UINT("log-entries",  'e', &cfg.log_entries,   log_entries),
-		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format_prom),
 		OPT_FLAG("raw-binary",   'b', &cfg.raw_binary,    raw),
+		OPT_FLAG("via-daemon",     0, &cfg.via_daemon,    via_daemon),
 		OPT_END()
 	};
 
@@ -595,7 +695,7 @@ static int get_error_log(int argc, char **argv, struct command *cmd, struct plug
 	if (fd < 0)
 		goto ret;
 
-	err = flags = validate_output_format(cfg.output_format);
+	err = flags = validate_metrics_output_format(cfg.output_format);
 	if (flags < 0)
 		goto close_fd;
 	if (cfg.raw_binary)
@@ -607,6 +707,12 @@ static int get_error_log(int argc, char **argv, struct command *cmd, struct plug
 		goto close_fd;
 	}
 
+	if (cfg.via_daemon) {
+		err = nvme_daemon_query("error-log", fd, flags, cfg.log_entries);
+		if (err != -ECONNREFUSED)
+			goto close_fd;
+	}
+
 	err = nvme_identify_ctrl(fd, &ctrl);
 	if (err < 0) {
 		perror("identify controller");
@@ -658,7 +764,7 @@ static int get_fw_log(int argc, char **argv, struct command *cmd, struct plugin
 	};
 
 	OPT_ARGS(opts) = {
-		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format_prom),
 		OPT_FLAG("raw-binary",   'b', &cfg.raw_binary,    raw),
 		OPT_END()
 	};
@@ -667,7 +773,7 @@ static int get_fw_log(int argc, char **argv, struct command *cmd, struct plugin
 	if (fd < 0)
 		goto ret;
 
-	err = flags = validate_output_format(cfg.output_format);
+	err = flags = validate_metrics_output_format(cfg.output_format);
 	if (flags < 0)
 		goto close_fd;
 	if (cfg.raw_binary)
@@ -1333,6 +1439,9 @@ static int list(int argc, char **argv, struct command *cmd, struct plugin *plugi
 {
 	const char *desc = "Retrieve basic information for all NVMe namespaces";
 	const char *verbose = "Increase output verbosity";
+	const char *sysfs_only = "Only use sysfs attributes, don't send "\
+		"identify commands to the devices";
+	const char *output_format_list = "Output format: normal|json|prometheus";
 	struct nvme_topology t = { };
 	enum nvme_print_flags flags;
 	int err = 0;
@@ -1340,16 +1449,19 @@ static int list(int argc, char **argv, struct command *cmd, struct plugin *plugi
 	struct config {
 		char *output_format;
 		int verbose;
+		int sysfs_only;
 	};
 
 	struct config cfg = {
 		.output_format = "normal",
 		.verbose = 0,
+		.sysfs_only = 0,
 	};
 
 	OPT_ARGS(opts) = {
-		OPT_FMT("output-format", 'o', &cfg.output_format, output_format_no_binary),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format_list),
 		OPT_FLAG("verbose",      'v', &cfg.verbose,       verbose),
+		OPT_FLAG("sysfs-only",   's', &cfg.sysfs_only,    sysfs_only),
 		OPT_END()
 	};
 
@@ -1357,10 +1469,10 @@ static int list(int argc, char **argv, struct command *cmd, struct plugin *plugi
 	if (err < 0)
 		return err;
 
-	err = flags = validate_output_format(cfg.output_format);
+	err = flags = validate_metrics_output_format(cfg.output_format);
 	if (flags < 0)
 		return err;
-	if (flags != JSON && flags != NORMAL) {
+	if (flags != JSON && flags != NORMAL && flags != PROMETHEUS) {
 		fprintf(stderr, "Invalid output format\n");
 		return -EINVAL;
 	}
@@ -1372,6 +1484,8 @@ static int list(int argc, char **argv, struct command *cmd, struct plugin *plugi
 		fprintf(stderr, "Failed to scan namespaces\n");
 		return err;
 	}
+	if (!cfg.sysfs_only)
+		nvme_topology_identify(&t);
 
 	nvme_show_list_items(&t, flags);
 	free_topology(&t);
@@ -1398,6 +1512,7 @@ int __id_ctrl(int argc, char **argv, struct command *cmd, struct plugin *plugin,
 		int raw_binary;
 		int human_readable;
 		char *output_format;
+		int via_daemon;
 	};
 
 	struct config cfg = {
@@ -1409,6 +1524,7 @@ int __id_ctrl(int argc, char **argv, struct command *cmd, struct plugin *plugin,
 		OPT_FMT("output-format",    'o', &cfg.output_format,   output_format),
 		OPT_FLAG("raw-binary",      'b', &cfg.raw_binary,      raw),
 		OPT_FLAG("human-readable",  'H', &cfg.human_readable,  human_readable),
+		OPT_FLAG("via-daemon",        0, &cfg.via_daemon,      via_daemon),
 		OPT_END()
 	};
 
@@ -1426,6 +1542,13 @@ int __id_ctrl(int argc, char **argv, struct command *cmd, struct plugin *plugin,
 	if (cfg.human_readable)
 		flags |= VERBOSE;
 
+	/* the daemon has no plugin to decode the vendor specific area */
+	if (cfg.via_daemon && !vs) {
+		err = nvme_daemon_query("id-ctrl", fd, flags, 0);
+		if (err != -ECONNREFUSED)
+			goto close_fd;
+	}
+
 	err = nvme_identify_ctrl(fd, &ctrl);
 	if (!err)
 		__nvme_show_id_ctrl(&ctrl, flags, vs);
@@ -4791,7 +4914,7 @@ static int connect_all_cmd(int argc, char **argv, struct command *command, struc
 static int connect_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
 {
 	const char *desc = "Connect to NVMeoF subsystem";
-	return connect(desc, argc, argv);
+	return fabrics_connect(desc, argc, argv);
 }
 
 static int disconnect_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
@@ -4806,6 +4929,105 @@ static int disconnect_all_cmd(int argc, char **argv, struct command *command, st
 	return disconnect_all(desc, argc, argv);
 }
 
+static int monitor_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Monitor NVMe controllers, namespaces and "\
+		"subsystems coming and going, and report each change as a "\
+		"JSON object on its own line.";
+	return monitor(desc, argc, argv);
+}
+
+static int ana_check_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Check the ANA state of every path to the "\
+		"namespaces of multipath subsystems against the ANA logs of "\
+		"their controllers, and flag namespaces without a good path.";
+	return ana_check(desc, argc, argv);
+}
+
+static int path_bench_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Send small I/Os to a namespace through each "\
+		"controller with a path to it, one path at a time, and "\
+		"report the latency of every path next to its ANA state.";
+	return path_bench(desc, argc, argv);
+}
+
+static int top_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Show the I/O rates, latency and queue depth of "\
+		"every NVMe controller and namespace, refreshed at an "\
+		"interval, with the temperature and critical warnings of the "\
+		"controllers. JSON output prints one object per sample.";
+	return top(desc, argc, argv);
+}
+
+static int history_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Record the SMART / Health log of a device into "\
+		"its history file, or show the samples recorded in a time "\
+		"range, optionally downsampled, as a table, JSON or CSV.";
+	return history(desc, argc, argv);
+}
+
+static int daemon_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Poll the Identify Controller data, SMART / Health, "\
+		"Error Information and ANA logs of every controller on a "\
+		"schedule, and serve them to --via-daemon queries over a "\
+		"Unix domain socket.";
+	return run_daemon(desc, argc, argv);
+}
+
+static int metrics_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Show the controller health nvme daemon --shm "\
+		"publishes in shared memory, without sending any command.";
+	return metrics(desc, argc, argv);
+}
+
+static int latency_stats_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Show command latency percentiles from the "\
+		"latency histogram the drive keeps, over its lifetime or "\
+		"each interval.";
+	return latency_stats(desc, argc, argv);
+}
+
+static int trace_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Trace the commands of every NVMe controller, or "\
+		"of the one given, through the nvme tracepoints of the kernel, "\
+		"and show their latency as the host sees it by controller, "\
+		"opcode and queue, with the slowest commands.";
+	return trace(desc, argc, argv);
+}
+
+static int irq_map_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Show how the queues of every NVMe controller, or "\
+		"of the one given, map to CPUs, interrupt vectors and NUMA "\
+		"nodes, and warn about remote, shared or overloaded vectors.";
+	return irq_map(desc, argc, argv);
+}
+
+static int pcie_health_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Show the PCIe link of every NVMe controller, or "\
+		"of the one given, against what the device and its port "\
+		"support, with its bandwidth, NUMA node and AER errors, and "\
+		"warn about degraded links.";
+	return pcie_health(desc, argc, argv);
+}
+
+static int export_metrics_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Collect the health and logs of every NVMe "\
+		"controller in the Prometheus text format, for the node "\
+		"exporter textfile collector.";
+	return export_metrics(desc, argc, argv);
+}
+
 void register_extension(struct plugin *plugin)
 {
 	plugin->parent = &nvme;
@@ -31,17 +31,28 @@ enum nvme_print_flags {
 	JSON	= 1 << 1,	/* display in json format */
 	VS	= 1 << 2,	/* hex dump vendor specific data areas */
 	BINARY	= 1 << 3,	/* binary dump raw bytes */
+	PROMETHEUS = 1 << 4,	/* Prometheus text exposition format */
 };
 
 struct nvme_subsystem;
 struct nvme_ctrl;
 
+/*
+ * The topology only holds what can be read from sysfs. The full identify
+ * data is fetched on first use by nvme_ns_get_id() and nvme_ctrl_get_id(),
+ * which also refresh the decoded fields from it.
+ */
 struct nvme_namespace {
 	char *name;
-	struct nvme_ctrl *ctrl;
+	struct nvme_ctrl *ctrl;		/* NULL if no controller is left */
 
 	unsigned nsid;
-	struct nvme_id_ns ns;
+	__u64 nsze;		/* in logical blocks */
+	__u64 nuse;		/* in logical blocks */
+	int lba_shift;
+	__u16 ms;
+
+	struct nvme_id_ns *id;
 };
 
 struct nvme_ctrl {
@@ -56,7 +67,11 @@ struct nvme_ctrl {
 	char *trsvcid;
 	char *host_traddr;
 
-	struct nvme_id_ctrl id;
+	char sn[21];
+	char mn[41];
+	char fr[9];
+
+	struct nvme_id_ctrl *id;
 
 	int    nr_namespaces;
 	struct nvme_namespace *namespaces;
@@ -65,6 +80,7 @@ struct nvme_ctrl {
 struct nvme_subsystem {
 	char *name;
 	char *subsysnqn;
+	struct nvme_topology *topology;
 
 	int    nr_ctrls;
 	struct nvme_ctrl *ctrls;
@@ -73,9 +89,13 @@ struct nvme_subsystem {
 	struct nvme_namespace *namespaces;
 };
 
+struct nvme_arena;
+
 struct nvme_topology {
 	int    nr_subsystems;
 	struct nvme_subsystem *subsystems;
+
+	struct nvme_arena *arena;	/* backs everything above */
 };
 
 #define SYS_NVME "/sys/class/nvme"
@@ -87,21 +107,54 @@ int parse_and_open(int argc, char **argv, const char *desc,
 extern const char *devicename;
 
 enum nvme_print_flags validate_output_format(char *format);
+enum nvme_print_flags validate_metrics_output_format(char *format);
 int __id_ctrl(int argc, char **argv, struct command *cmd,
 	struct plugin *plugin, void (*vs)(__u8 *vs, struct json_object *root));
 char *nvme_char_from_block(char *block);
 void *mmap_registers(const char *dev);
 
-extern int current_index;
 int scan_namespace_filter(const struct dirent *d);
 int scan_ctrl_paths_filter(const struct dirent *d);
 int scan_ctrls_filter(const struct dirent *d);
 int scan_subsys_filter(const struct dirent *d);
-int scan_dev_filter(const struct dirent *d);
 
 int scan_subsystems(struct nvme_topology *t, const char *subsysnqn,
 		    __u32 ns_instance);
 void free_topology(struct nvme_topology *t);
+struct nvme_id_ctrl *nvme_ctrl_get_id(struct nvme_ctrl *c);
+struct nvme_id_ns *nvme_ns_get_id(struct nvme_namespace *n);
+void nvme_topology_identify(struct nvme_topology *t);
+struct nvme_subsystem *nvme_topology_find_subsys(struct nvme_topology *t,
+						 const char *name);
+struct nvme_ctrl *nvme_topology_find_ctrl(struct nvme_topology *t,
+					  const char *name);
+struct nvme_namespace *nvme_topology_find_ns(struct nvme_topology *t,
+					     const char *name);
+struct nvme_subsystem *nvme_topology_add_subsys(struct nvme_topology *t,
+						const char *name,
+						const char *subsysnqn);
+struct nvme_ctrl *nvme_topology_add_ctrl(struct nvme_topology *t,
+					 struct nvme_subsystem *s,
+					 const char *name);
+struct nvme_namespace *nvme_topology_add_ns(struct nvme_topology *t,
+					    struct nvme_subsystem *s,
+					    struct nvme_ctrl *c,
+					    const char *name);
+void nvme_topology_remove_subsys(struct nvme_topology *t,
+				 struct nvme_subsystem *s);
+void nvme_topology_remove_ctrl(struct nvme_topology *t, struct nvme_ctrl *c);
+struct nvme_ctrl *nvme_topology_move_ctrl(struct nvme_topology *t,
+					  struct nvme_ctrl *c,
+					  struct nvme_subsystem *s);
+void nvme_topology_remove_ns(struct nvme_topology *t,
+			     struct nvme_namespace *n);
+int nvme_topology_refresh_subsys(struct nvme_topology *t,
+				 struct nvme_subsystem *s);
+int nvme_topology_refresh_ctrl(struct nvme_topology *t, struct nvme_ctrl *c);
+int nvme_topology_refresh_ns(struct nvme_namespace *n);
+int nvme_topology_compact(struct nvme_topology *t);
+char *nvme_topology_strdup(struct nvme_topology *t, const char *s);
+int nvme_ctrl_subsys_name(const char *ctrl, char *buf, size_t len);
 char *get_nvme_subsnqn(char *path);
 char *nvme_get_ctrl_attr(char *path, const char *attr);
 
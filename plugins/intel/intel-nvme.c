@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <inttypes.h>
 
@@ -11,6 +12,7 @@
 #include "nvme.h"
 #include "nvme-print.h"
 #include "nvme-ioctl.h"
+#include "nvme-latency.h"
 #include "json.h"
 #include "plugin.h"
 
@@ -211,6 +213,81 @@ static void show_intel_smart_log_jsn(struct nvme_additional_smart_log *smart,
 	json_free_object(root);
 }
 
+static void intel_prom_smart_item(struct nvme_prom *p, const char *name,
+		struct nvme_additional_smart_log_item *item)
+{
+	char labels[96];
+
+	snprintf(labels, sizeof(labels),
+		 "vendor=\"intel\",log=\"0xca\",attribute=\"%s\"", name);
+	nvme_prom_add(p, "nvme_vendor_smart_normalized", NVME_PROM_GAUGE,
+		      "Normalized value of a vendor specific SMART attribute",
+		      labels, "%u", item->norm);
+}
+
+static void show_intel_smart_log_prom(struct nvme_additional_smart_log *smart,
+		unsigned int nsid, const char *devname)
+{
+	struct nvme_prom *p = nvme_prom_begin(devname);
+	static const struct {
+		const char *name;
+		size_t offset;
+	} raw[] = {
+		{ "program_fail_count",
+		  offsetof(struct nvme_additional_smart_log, program_fail_cnt) },
+		{ "erase_fail_count",
+		  offsetof(struct nvme_additional_smart_log, erase_fail_cnt) },
+		{ "end_to_end_error_detection_count",
+		  offsetof(struct nvme_additional_smart_log, e2e_err_cnt) },
+		{ "crc_error_count",
+		  offsetof(struct nvme_additional_smart_log, crc_err_cnt) },
+		{ "timed_workload_host_reads",
+		  offsetof(struct nvme_additional_smart_log, timed_workload_host_reads) },
+		{ "timed_workload_timer",
+		  offsetof(struct nvme_additional_smart_log, timed_workload_timer) },
+		{ "retry_buffer_overflow_count",
+		  offsetof(struct nvme_additional_smart_log, retry_buffer_overflow_cnt) },
+		{ "pll_lock_loss_count",
+		  offsetof(struct nvme_additional_smart_log, pll_lock_loss_cnt) },
+		{ "nand_bytes_written",
+		  offsetof(struct nvme_additional_smart_log, nand_bytes_written) },
+		{ "host_bytes_written",
+		  offsetof(struct nvme_additional_smart_log, host_bytes_written) },
+	};
+	struct nvme_additional_smart_log_item *item;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(raw); i++) {
+		item = (void *)smart + raw[i].offset;
+		nvme_prom_vendor_smart(p, "intel", "0xca", raw[i].name,
+				       "%"PRIu64, int48_to_long(item->raw));
+		intel_prom_smart_item(p, raw[i].name, item);
+	}
+
+	item = &smart->wear_leveling_cnt;
+	nvme_prom_vendor_smart(p, "intel", "0xca", "wear_leveling_min", "%u",
+			       le16_to_cpu(item->wear_level.min));
+	nvme_prom_vendor_smart(p, "intel", "0xca", "wear_leveling_max", "%u",
+			       le16_to_cpu(item->wear_level.max));
+	nvme_prom_vendor_smart(p, "intel", "0xca", "wear_leveling_avg", "%u",
+			       le16_to_cpu(item->wear_level.avg));
+	intel_prom_smart_item(p, "wear_leveling", item);
+
+	item = &smart->timed_workload_media_wear;
+	nvme_prom_vendor_smart(p, "intel", "0xca", "timed_workload_media_wear",
+			       "%.3f", (double)int48_to_long(item->raw) / 1024);
+	intel_prom_smart_item(p, "timed_workload_media_wear", item);
+
+	item = &smart->thermal_throttle_status;
+	nvme_prom_vendor_smart(p, "intel", "0xca", "thermal_throttle_pct", "%u",
+			       item->thermal_throttle.pct);
+	nvme_prom_vendor_smart(p, "intel", "0xca", "thermal_throttle_count",
+			       "%u", item->thermal_throttle.count);
+	intel_prom_smart_item(p, "thermal_throttle_status", item);
+
+	nvme_prom_end(p);
+}
+
 static void show_intel_smart_log(struct nvme_additional_smart_log *smart,
 		unsigned int nsid, const char *devname)
 {
@@ -268,24 +345,29 @@ static int get_additional_smart_log(int argc, char **argv, struct command *cmd,
 	const char *namespace = "(optional) desired namespace";
 	const char *raw = "Dump output in binary format";
 	const char *json= "Dump output in json format";
+	const char *output_format = "Output format: normal|json|binary|prometheus";
 
 	struct nvme_additional_smart_log smart_log;
+	enum nvme_print_flags flags;
 	int err, fd;
 
 	struct config {
 		__u32 namespace_id;
 		int   raw_binary;
 		int   json;
+		char *output_format;
 	};
 
 	struct config cfg = {
 		.namespace_id = NVME_NSID_ALL,
+		.output_format = "normal",
 	};
 
 	OPT_ARGS(opts) = {
 		OPT_UINT("namespace-id", 'n', &cfg.namespace_id, namespace),
 		OPT_FLAG("raw-binary",   'b', &cfg.raw_binary,   raw),
 		OPT_FLAG("json",         'j', &cfg.json,         json),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
 		OPT_END()
 	};
 
@@ -293,11 +375,23 @@ static int get_additional_smart_log(int argc, char **argv, struct command *cmd,
 	if (fd < 0)
 		return fd;
 
+	flags = validate_metrics_output_format(cfg.output_format);
+	if (flags < 0) {
+		close(fd);
+		return flags;
+	}
+	if (flags & JSON)
+		cfg.json = 1;
+	else if (flags & BINARY)
+		cfg.raw_binary = 1;
+
 	err = nvme_get_log(fd, cfg.namespace_id, 0xca, false,
 			   sizeof(smart_log), &smart_log);
 	if (!err) {
 		if (cfg.json)
 			show_intel_smart_log_jsn(&smart_log, cfg.namespace_id, devicename);
+		else if (flags & PROMETHEUS)
+			show_intel_smart_log_prom(&smart_log, cfg.namespace_id, devicename);
 		else if (!cfg.raw_binary)
 			show_intel_smart_log(&smart_log, cfg.namespace_id, devicename);
 		else
@@ -408,12 +502,6 @@ static int get_temp_stats_log(int argc, char **argv, struct command *cmd, struct
 	return err;
 }
 
-struct intel_lat_stats {
-	__u16 maj;
-	__u16 min;
-	__u32 data[1216];
-};
-
 enum FormatUnit {
 	US,
 	MS,
@@ -12,6 +12,7 @@
 #include "nvme.h"
 #include "nvme-print.h"
 #include "nvme-ioctl.h"
+#include "nvme-prometheus.h"
 #include <sys/ioctl.h>
 
 #define CREATE_CMD
@@ -664,14 +665,53 @@ static int micron_clear_pcie_correctable_errors(int argc, char **argv,
 	return err;
 }
 
+static void micron_nand_stats_prom(unsigned int *extSmartLog,
+				   struct nvme_id_ctrl *ctrl)
+{
+	struct nvme_prom *p = nvme_prom_begin(devicename);
+	unsigned long long writes, prog_lo, erase;
+
+	writes = ((unsigned long long)extSmartLog[45] << 32) | extSmartLog[44];
+	prog_lo = ((unsigned long long)extSmartLog[37] << 32) | extSmartLog[36];
+	erase = ((unsigned long long)extSmartLog[25] << 32) | extSmartLog[24];
+
+	nvme_prom_vendor_smart(p, "micron", "0xd0", "nand_bytes_written",
+			       "%llu", writes);
+	/* the high 64 bits only matter past 2^64 failures */
+	nvme_prom_vendor_smart(p, "micron", "0xd0", "program_fail_count",
+			       "%llu", prog_lo);
+	nvme_prom_vendor_smart(p, "micron", "0xd0", "erase_fail_count",
+			       "%llu", erase);
+	nvme_prom_vendor_smart(p, "micron", "0xd0", "bad_block_count",
+			       "%u", extSmartLog[3]);
+	nvme_prom_vendor_smart(p, "micron", "0xd0", "xor_recovery_count",
+			       "%llu", extSmartLog[3] - (prog_lo + erase));
+	nvme_prom_vendor_smart(p, "micron", "0xd0", "nsze_change_supported",
+			       "%u", (ctrl->oacs >> 3) & 0x1);
+	nvme_prom_vendor_smart(p, "micron", "0xd0", "nsze_modifications",
+			       "%u", extSmartLog[1]);
+	nvme_prom_end(p);
+}
+
 static int micron_nand_stats(int argc, char **argv, struct command *cmd, struct plugin *plugin)
 {
 	const char *desc = "Retrieve Micron NAND stats for the given device ";
+	const char *fmt = "output format normal|prometheus";
 	unsigned int extSmartLog[64] = { 0 };
 	struct nvme_id_ctrl ctrl;
+	enum nvme_print_flags flags;
 	int fd, err;
 
+	struct config {
+		char *output_format;
+	};
+
+	struct config cfg = {
+		.output_format = "normal",
+	};
+
 	OPT_ARGS(opts) = {
+		OPT_FMT("output-format", 'o', &cfg.output_format, fmt),
 		OPT_END()
 	};
 
@@ -681,6 +721,13 @@ static int micron_nand_stats(int argc, char **argv, struct command *cmd, struct
 		return -1;
 	}
 
+	flags = validate_metrics_output_format(cfg.output_format);
+	if (flags != NORMAL && flags != PROMETHEUS) {
+		fprintf(stderr, "Invalid output format: %s\n", cfg.output_format);
+		err = -EINVAL;
+		goto out;
+	}
+
 	err = nvme_identify_ctrl(fd, &ctrl);
 	if (err)
 		goto out;
@@ -689,6 +736,11 @@ static int micron_nand_stats(int argc, char **argv, struct command *cmd, struct
 	if (err)
 		goto out;
 
+	if (flags == PROMETHEUS) {
+		micron_nand_stats_prom(extSmartLog, &ctrl);
+		goto out;
+	}
+
 	unsigned long long count = ((unsigned long long)extSmartLog[45] << 32) | extSmartLog[44];
 	printf("%-40s : 0x%llx\n", "NAND Writes (Bytes Written)", count);
 	printf("%-40s : ", "Program Failure Count");
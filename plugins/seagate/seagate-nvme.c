@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <ctype.h>
 #include "linux/nvme_ioctl.h"
+#include "common.h"
 #include "nvme.h"
 #include "nvme-print.h"
 #include "nvme-ioctl.h"
@@ -710,6 +711,144 @@ static void json_print_smart_log_CF(struct json_object *root,
 	*/
 }
 
+/*
+ * Attributes split in a LSB and a MSB half are reported once, joined, under
+ * the name of the LSB half without its "LSB of " prefix.
+ */
+static const struct {
+	__u8 lsb;
+	__u8 msb;
+} smart_wide_attrs[] = {
+	{ VS_ATTR_ID_GB_ERASED_LSB, VS_ATTR_ID_GB_ERASED_MSB },
+	{ VS_ATTR_ID_LIFETIME_WRITES_TO_FLASH_LSB, VS_ATTR_ID_LIFETIME_WRITES_TO_FLASH_MSB },
+	{ VS_ATTR_ID_LIFETIME_WRITES_FROM_HOST_LSB, VS_ATTR_ID_LIFETIME_WRITES_FROM_HOST_MSB },
+	{ VS_ATTR_ID_LIFETIME_READS_TO_HOST_LSB, VS_ATTR_ID_LIFETIME_READS_TO_HOST_MSB },
+	{ VS_ATTR_ID_TRIM_COUNT_LSB, VS_ATTR_ID_TRIM_COUNT_MSB },
+};
+
+/*
+ * The attribute names are for people; as label values they are lower
+ * case, with each run of other characters turned into one underscore.
+ */
+static char *prom_attr_name(const char *s, char *buf, size_t len)
+{
+	size_t n = 0;
+
+	for (; *s && n + 1 < len; s++) {
+		if (isalnum((unsigned char)*s))
+			buf[n++] = tolower((unsigned char)*s);
+		else if (n && buf[n - 1] != '_')
+			buf[n++] = '_';
+	}
+	while (n && buf[n - 1] == '_')
+		n--;
+	buf[n] = '\0';
+	return buf;
+}
+
+static void prom_print_smart_log(struct nvme_prom *p,
+				 EXTENDED_SMART_INFO_T *ExtdSMARTInfo)
+{
+	struct nvme_u128 wide[ARRAY_SIZE(smart_wide_attrs)] = { };
+	bool seen[ARRAY_SIZE(smart_wide_attrs)] = { };
+	SmartVendorSpecific *attr;
+	char name[48], num[40];
+	int index, i;
+
+	for (index = 0; index < NUMBER_EXTENDED_SMART_ATTRIBUTES; index++) {
+		attr = &ExtdSMARTInfo->vendorData[index];
+		if (!attr->AttributeNumber)
+			continue;
+
+		for (i = 0; i < ARRAY_SIZE(smart_wide_attrs); i++) {
+			if (attr->AttributeNumber == smart_wide_attrs[i].lsb)
+				wide[i].lo = smart_attribute_vs(ExtdSMARTInfo->Version, *attr);
+			else if (attr->AttributeNumber == smart_wide_attrs[i].msb)
+				wide[i].hi = smart_attribute_vs(ExtdSMARTInfo->Version, *attr);
+			else
+				continue;
+			seen[i] = true;
+			break;
+		}
+		if (i < ARRAY_SIZE(smart_wide_attrs))
+			continue;
+
+		/* unknown attributes would all share one name */
+		if (strcmp(print_ext_smart_id(attr->AttributeNumber), "Un-Known"))
+			prom_attr_name(print_ext_smart_id(attr->AttributeNumber),
+				       name, sizeof(name));
+		else
+			snprintf(name, sizeof(name), "attribute_%u",
+				 attr->AttributeNumber);
+		nvme_prom_vendor_smart(p, "seagate", "0xc4", name, "%"PRIu64,
+			(uint64_t)smart_attribute_vs(ExtdSMARTInfo->Version, *attr));
+	}
+
+	for (i = 0; i < ARRAY_SIZE(smart_wide_attrs); i++) {
+		if (!seen[i])
+			continue;
+		/* skip the "LSB of " of the name of the low half */
+		prom_attr_name(print_ext_smart_id(smart_wide_attrs[i].lsb) + 7,
+			       name, sizeof(name));
+		nvme_prom_vendor_smart(p, "seagate", "0xc4", name, "%s",
+			nvme_u128_to_string(wide[i], num, sizeof(num)));
+	}
+}
+
+static void prom_print_smart_log_CF(struct nvme_prom *p,
+				    vendor_log_page_CF *pLogPageCF)
+{
+	char num[40];
+
+	nvme_prom_vendor_smart(p, "seagate", "0xcf",
+		"super_cap_current_temperature", "%u",
+		le16_to_cpu(pLogPageCF->AttrCF.SuperCapCurrentTemperature));
+	nvme_prom_vendor_smart(p, "seagate", "0xcf",
+		"super_cap_maximum_temperature", "%u",
+		le16_to_cpu(pLogPageCF->AttrCF.SuperCapMaximumTemperature));
+	nvme_prom_vendor_smart(p, "seagate", "0xcf", "super_cap_status",
+		"%u", pLogPageCF->AttrCF.SuperCapStatus);
+	nvme_prom_vendor_smart(p, "seagate", "0xcf",
+		"data_units_read_to_dram_namespace", "%s",
+		nvme_u128_to_string(nvme_u128_from_le(
+			(__u8 *)&pLogPageCF->AttrCF.DataUnitsReadToDramNamespace),
+			num, sizeof(num)));
+	nvme_prom_vendor_smart(p, "seagate", "0xcf",
+		"data_units_written_to_dram_namespace", "%s",
+		nvme_u128_to_string(nvme_u128_from_le(
+			(__u8 *)&pLogPageCF->AttrCF.DataUnitsWrittenToDramNamespace),
+			num, sizeof(num)));
+	nvme_prom_vendor_smart(p, "seagate", "0xcf",
+		"dram_correctable_error_count", "%"PRIu64,
+		(uint64_t)le64_to_cpu(pLogPageCF->AttrCF.DramCorrectableErrorCount));
+	nvme_prom_vendor_smart(p, "seagate", "0xcf",
+		"dram_uncorrectable_error_count", "%"PRIu64,
+		(uint64_t)le64_to_cpu(pLogPageCF->AttrCF.DramUncorrectableErrorCount));
+}
+
+static int vs_smart_log_prom(int fd)
+{
+	EXTENDED_SMART_INFO_T ExtdSMARTInfo;
+	vendor_log_page_CF logPageCF;
+	struct nvme_prom *p;
+	int err;
+
+	err = nvme_get_log(fd, 1, 0xC4, false, sizeof(ExtdSMARTInfo), &ExtdSMARTInfo);
+	if (err) {
+		if (err > 0)
+			fprintf(stderr, "NVMe Status:%s(%x)\n",
+				nvme_status_to_string(err), err);
+		return err;
+	}
+
+	p = nvme_prom_begin(devicename);
+	prom_print_smart_log(p, &ExtdSMARTInfo);
+	if (!nvme_get_log(fd, 1, 0xCF, false, sizeof(logPageCF), &logPageCF))
+		prom_print_smart_log_CF(p, &logPageCF);
+	nvme_prom_end(p);
+	return 0;
+}
+
 static int vs_smart_log(int argc, char **argv, struct command *cmd, struct plugin *plugin)
 {
 	EXTENDED_SMART_INFO_T   ExtdSMARTInfo;
@@ -722,7 +861,7 @@ static int vs_smart_log(int argc, char **argv, struct command *cmd, struct plugi
 	lbafs = json_create_array();
 
 	const char *desc = "Retrieve Seagate Extended SMART information for the given device ";
-	const char *output_format = "output in binary format";
+	const char *output_format = "Output format: normal|json|prometheus";
 	int err, index=0;
 	struct config {
 		char *output_format;
@@ -738,6 +877,8 @@ static int vs_smart_log(int argc, char **argv, struct command *cmd, struct plugi
 	};
 
 	fd = parse_and_open(argc, argv, desc, opts);
+	if (!strcmp(cfg.output_format, "prometheus"))
+		return vs_smart_log_prom(fd);
 	if (strcmp(cfg.output_format,"json"))
 		printf("Seagate Extended SMART Information :\n");
 
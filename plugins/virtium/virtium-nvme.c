@@ -13,6 +13,7 @@
 #include "nvme.h"
 #include "nvme-print.h"
 #include "nvme-ioctl.h"
+#include "nvme-history.h"
 #include "plugin.h"
 #include "argconfig.h"
 #include "suffix.h"
@@ -295,6 +296,10 @@ static int vt_add_entry_to_log(const int fd, const char *path, const struct vtvi
 	vt_process_string(smart.raw_ctrl.mn, sizeof(smart.raw_ctrl.mn));
 
 	ret = vt_append_log(&smart, filename);
+
+	/* vtView reads the text log; nvme history keeps the long-term record */
+	if (nvme_history_record(fd, &smart.raw_smart, NULL, 0))
+		printf("Cannot add SMART data to %s\n", NVME_HISTORY_DIR);
 	return (ret);
 }
 
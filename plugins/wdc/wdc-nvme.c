@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <errno.h>
 #include <limits.h>
@@ -2681,7 +2682,42 @@ static void wdc_print_log_json(struct wdc_ssd_perf_stats *perf)
 	json_free_object(root);
 }
 
-static int wdc_print_log(struct wdc_ssd_perf_stats *perf, int fmt)
+static void wdc_print_log_prom(struct nvme_prom *prom,
+			       struct wdc_ssd_perf_stats *perf)
+{
+	static const struct {
+		const char *name;
+		size_t offset;
+	} stats[] = {
+		{ "host_read_commands", offsetof(struct wdc_ssd_perf_stats, hr_cmds) },
+		{ "host_read_blocks", offsetof(struct wdc_ssd_perf_stats, hr_blks) },
+		{ "host_read_cache_hit_commands", offsetof(struct wdc_ssd_perf_stats, hr_ch_cmds) },
+		{ "host_read_cache_hit_blocks", offsetof(struct wdc_ssd_perf_stats, hr_ch_blks) },
+		{ "host_read_commands_stalled", offsetof(struct wdc_ssd_perf_stats, hr_st_cmds) },
+		{ "host_write_commands", offsetof(struct wdc_ssd_perf_stats, hw_cmds) },
+		{ "host_write_blocks", offsetof(struct wdc_ssd_perf_stats, hw_blks) },
+		{ "host_write_odd_start_commands", offsetof(struct wdc_ssd_perf_stats, hw_os_cmds) },
+		{ "host_write_odd_end_commands", offsetof(struct wdc_ssd_perf_stats, hw_oe_cmds) },
+		{ "host_write_commands_stalled", offsetof(struct wdc_ssd_perf_stats, hw_st_cmds) },
+		{ "nand_read_commands", offsetof(struct wdc_ssd_perf_stats, nr_cmds) },
+		{ "nand_read_blocks", offsetof(struct wdc_ssd_perf_stats, nr_blks) },
+		{ "nand_write_commands", offsetof(struct wdc_ssd_perf_stats, nw_cmds) },
+		{ "nand_write_blocks", offsetof(struct wdc_ssd_perf_stats, nw_blks) },
+		{ "nand_read_before_write", offsetof(struct wdc_ssd_perf_stats, nrbw) },
+	};
+	__le64 v;
+	int i;
+
+	/* ratios and averages are left to the queries */
+	for (i = 0; i < ARRAY_SIZE(stats); i++) {
+		memcpy(&v, (__u8 *)perf + stats[i].offset, sizeof(v));
+		nvme_prom_vendor_smart(prom, "wdc", "0xc1", stats[i].name,
+				       "%"PRIu64, (uint64_t)le64_to_cpu(v));
+	}
+}
+
+static int wdc_print_log(struct wdc_ssd_perf_stats *perf, int fmt,
+		struct nvme_prom *prom)
 {
 	if (!perf) {
 		fprintf(stderr, "ERROR : WDC : Invalid buffer to read perf stats\n");
@@ -2694,6 +2730,14 @@ static int wdc_print_log(struct wdc_ssd_perf_stats *perf, int fmt)
 	case JSON:
 		wdc_print_log_json(perf);
 		break;
+	case PROMETHEUS:
+		/* only vs-smart-add-log collects the logs into a family */
+		if (!prom) {
+			fprintf(stderr, "ERROR : WDC : prometheus output not supported\n");
+			return -1;
+		}
+		wdc_print_log_prom(prom, perf);
+		break;
 	}
 	return 0;
 }
@@ -3076,7 +3120,137 @@ static void wdc_print_fw_act_history_log_json(struct wdc_fw_act_history_log_entr
 	json_free_object(root);
 }
 
-static int wdc_print_ca_log(struct wdc_ssd_ca_perf_stats *perf, int fmt)
+static void wdc_print_ca_log_prom(struct nvme_prom *prom,
+				  struct wdc_ssd_ca_perf_stats *perf)
+{
+	static const char *normalized[] = {
+		"nand_bad_block_count", "program_fail_count",
+		"user_data_erase_fail_count", "system_area_erase_fail_count",
+	};
+	__u64 counts[] = {
+		le64_to_cpu(perf->nand_bad_block),
+		le64_to_cpu(perf->program_fail),
+		le64_to_cpu(perf->user_erase_fail),
+		le64_to_cpu(perf->system_erase_fail),
+	};
+	char num[40], name[64];
+	int i;
+
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "nand_bytes_written",
+			       "%s", nvme_u128_to_string(nvme_u128_from_le(
+				(__u8 *)&perf->nand_bytes_wr_lo), num, sizeof(num)));
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "nand_bytes_read",
+			       "%s", nvme_u128_to_string(nvme_u128_from_le(
+				(__u8 *)&perf->nand_bytes_rd_lo), num, sizeof(num)));
+	for (i = 0; i < ARRAY_SIZE(normalized); i++) {
+		nvme_prom_vendor_smart(prom, "wdc", "0xca", normalized[i],
+				       "%"PRIu64, (uint64_t)(counts[i] >> 16));
+		snprintf(name, sizeof(name), "%s_normalized", normalized[i]);
+		nvme_prom_vendor_smart(prom, "wdc", "0xca", name,
+				       "%"PRIu64, (uint64_t)(counts[i] & 0xFFFF));
+	}
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "uncorrectable_read_count",
+			       "%"PRIu64, (uint64_t)le64_to_cpu(perf->uncorr_read_count));
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "soft_ecc_error_count",
+			       "%"PRIu64, (uint64_t)le64_to_cpu(perf->ecc_error_count));
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "end_to_end_detected_count",
+			       "%"PRIu32, (uint32_t)le32_to_cpu(perf->ssd_detect_count));
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "end_to_end_corrected_count",
+			       "%"PRIu32, (uint32_t)le32_to_cpu(perf->ssd_correct_count));
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "system_data_percent_used",
+			       "%u", perf->data_percent_used);
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "user_data_erase_count_max",
+			       "%"PRIu32, (uint32_t)le32_to_cpu(perf->data_erase_max));
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "user_data_erase_count_min",
+			       "%"PRIu32, (uint32_t)le32_to_cpu(perf->data_erase_min));
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "refresh_count",
+			       "%"PRIu64, (uint64_t)le64_to_cpu(perf->refresh_count));
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "thermal_throttling_status",
+			       "%u", perf->thermal_throttle_status);
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "thermal_throttling_count",
+			       "%u", perf->thermal_throttle_count);
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "pcie_correctable_error_count",
+			       "%"PRIu64, (uint64_t)le64_to_cpu(perf->pcie_corr_error));
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "incomplete_shutdown_count",
+			       "%"PRIu32, (uint32_t)le32_to_cpu(perf->incomplete_shutdown_count));
+	nvme_prom_vendor_smart(prom, "wdc", "0xca", "percent_free_blocks",
+			       "%u", perf->percent_free_blocks);
+}
+
+static void wdc_print_d0_log_prom(struct nvme_prom *prom,
+				  struct wdc_ssd_d0_smart_log *perf)
+{
+	static const struct {
+		const char *name;
+		size_t offset;
+		bool wide;
+	} stats[] = {
+		{ "lifetime_reallocated_erase_block_count",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_realloc_erase_block_count) },
+		{ "lifetime_power_on_hours",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_power_on_hours) },
+		{ "lifetime_uecc_count",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_uecc_count) },
+		{ "lifetime_write_amplification_factor",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_wrt_amp_factor) },
+		{ "trailing_hour_write_amplification_factor",
+		  offsetof(struct wdc_ssd_d0_smart_log, trailing_hr_wrt_amp_factor) },
+		{ "reserve_erase_block_count",
+		  offsetof(struct wdc_ssd_d0_smart_log, reserve_erase_block_count) },
+		{ "lifetime_program_fail_count",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_program_fail_count) },
+		{ "lifetime_block_erase_fail_count",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_block_erase_fail_count) },
+		{ "lifetime_die_failure_count",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_die_failure_count) },
+		{ "lifetime_link_rate_downgrade_count",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_link_rate_downgrade_count) },
+		{ "lifetime_clean_shutdown_count",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_clean_shutdown_count) },
+		{ "lifetime_unclean_shutdown_count",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_unclean_shutdown_count) },
+		{ "current_temperature",
+		  offsetof(struct wdc_ssd_d0_smart_log, current_temp) },
+		{ "max_recorded_temperature",
+		  offsetof(struct wdc_ssd_d0_smart_log, max_recorded_temp) },
+		{ "lifetime_retired_block_count",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_retired_block_count) },
+		{ "lifetime_read_disturb_reallocation_events",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_read_disturb_realloc_events) },
+		{ "lifetime_nand_writes",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_nand_writes), true },
+		{ "capacitor_health",
+		  offsetof(struct wdc_ssd_d0_smart_log, capacitor_health) },
+		{ "lifetime_user_writes",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_user_writes), true },
+		{ "lifetime_user_reads",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_user_reads), true },
+		{ "lifetime_thermal_throttle_activations",
+		  offsetof(struct wdc_ssd_d0_smart_log, lifetime_thermal_throttle_act) },
+		{ "percentage_pe_cycles_remaining",
+		  offsetof(struct wdc_ssd_d0_smart_log, percentage_pe_cycles_remaining) },
+	};
+	__le64 v64;
+	__le32 v32;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(stats); i++) {
+		if (stats[i].wide) {
+			memcpy(&v64, (__u8 *)perf + stats[i].offset, sizeof(v64));
+			nvme_prom_vendor_smart(prom, "wdc", "0xd0",
+					       stats[i].name, "%"PRIu64,
+					       (uint64_t)le64_to_cpu(v64));
+		} else {
+			memcpy(&v32, (__u8 *)perf + stats[i].offset, sizeof(v32));
+			nvme_prom_vendor_smart(prom, "wdc", "0xd0",
+					       stats[i].name, "%"PRIu32,
+					       (uint32_t)le32_to_cpu(v32));
+		}
+	}
+}
+
+static int wdc_print_ca_log(struct wdc_ssd_ca_perf_stats *perf, int fmt,
+		struct nvme_prom *prom)
 {
 	if (!perf) {
 		fprintf(stderr, "ERROR : WDC : Invalid buffer to read perf stats\n");
@@ -3089,11 +3263,20 @@ static int wdc_print_ca_log(struct wdc_ssd_ca_perf_stats *perf, int fmt)
 	case JSON:
 		wdc_print_ca_log_json(perf);
 		break;
+	case PROMETHEUS:
+		/* only vs-smart-add-log collects the logs into a family */
+		if (!prom) {
+			fprintf(stderr, "ERROR : WDC : prometheus output not supported\n");
+			return -1;
+		}
+		wdc_print_ca_log_prom(prom, perf);
+		break;
 	}
 	return 0;
 }
 
-static int wdc_print_d0_log(struct wdc_ssd_d0_smart_log *perf, int fmt)
+static int wdc_print_d0_log(struct wdc_ssd_d0_smart_log *perf, int fmt,
+		struct nvme_prom *prom)
 {
 	if (!perf) {
 		fprintf(stderr, "ERROR : WDC : Invalid buffer to read perf stats\n");
@@ -3106,6 +3289,14 @@ static int wdc_print_d0_log(struct wdc_ssd_d0_smart_log *perf, int fmt)
 	case JSON:
 		wdc_print_d0_log_json(perf);
 		break;
+	case PROMETHEUS:
+		/* only vs-smart-add-log collects the logs into a family */
+		if (!prom) {
+			fprintf(stderr, "ERROR : WDC : prometheus output not supported\n");
+			return -1;
+		}
+		wdc_print_d0_log_prom(prom, perf);
+		break;
 	}
 	return 0;
 }
@@ -3130,7 +3321,7 @@ static int wdc_print_fw_act_history_log(struct wdc_fw_act_history_log_entry *fw_
 	return 0;
 }
 
-static int wdc_get_ca_log_page(int fd, char *format)
+static int wdc_get_ca_log_page(int fd, char *format, struct nvme_prom *prom)
 {
 	int ret = 0;
 	int fmt = -1;
@@ -3139,7 +3330,7 @@ static int wdc_get_ca_log_page(int fd, char *format)
 
 	if (!wdc_check_device(fd))
 		return -1;
-	fmt = validate_output_format(format);
+	fmt = validate_metrics_output_format(format);
 	if (fmt < 0) {
 		fprintf(stderr, "ERROR : WDC : invalid output format\n");
 		return fmt;
@@ -3151,11 +3342,11 @@ static int wdc_get_ca_log_page(int fd, char *format)
 		return -1;
 	}
 
-	if ((data = (__u8*) malloc(sizeof (__u8) * WDC_CA_LOG_BUF_LEN)) == NULL) {
+	/* the log is shorter than the structure it is read through */
+	if ((data = (__u8*) calloc(1, sizeof(*perf))) == NULL) {
 		fprintf(stderr, "ERROR : WDC : malloc : %s\n", strerror(errno));
 		return -1;
 	}
-	memset(data, 0, sizeof (__u8) * WDC_CA_LOG_BUF_LEN);
 
 	ret = nvme_get_log(fd, 0xFFFFFFFF, WDC_NVME_GET_DEVICE_INFO_LOG_OPCODE,
 			   false, WDC_CA_LOG_BUF_LEN, data);
@@ -3165,7 +3356,7 @@ static int wdc_get_ca_log_page(int fd, char *format)
 	if (ret == 0) {
 		/* parse the data */
 		perf = (struct wdc_ssd_ca_perf_stats *)(data);
-		ret = wdc_print_ca_log(perf, fmt);
+		ret = wdc_print_ca_log(perf, fmt, prom);
 	} else {
 		fprintf(stderr, "ERROR : WDC : Unable to read CA Log Page data\n");
 		ret = -1;
@@ -3175,7 +3366,8 @@ static int wdc_get_ca_log_page(int fd, char *format)
 	return ret;
 }
 
-static int wdc_get_c1_log_page(int fd, char *format, uint8_t interval)
+static int wdc_get_c1_log_page(int fd, char *format, uint8_t interval,
+		struct nvme_prom *prom)
 {
 	int ret = 0;
 	int fmt = -1;
@@ -3190,7 +3382,7 @@ static int wdc_get_c1_log_page(int fd, char *format, uint8_t interval)
 
 	if (!wdc_check_device(fd))
 		return -1;
-	fmt = validate_output_format(format);
+	fmt = validate_metrics_output_format(format);
 	if (fmt < 0) {
 		fprintf(stderr, "ERROR : WDC : invalid output format\n");
 		return fmt;
@@ -3219,7 +3411,7 @@ static int wdc_get_c1_log_page(int fd, char *format, uint8_t interval)
 			if (sph->spcode == WDC_GET_LOG_PAGE_SSD_PERFORMANCE) {
 				if (sph->pcset == interval) {
 					perf = (struct wdc_ssd_perf_stats *) (p + 4);
-					ret = wdc_print_log(perf, fmt);
+					ret = wdc_print_log(perf, fmt, prom);
 					break;
 				}
 			}
@@ -3233,7 +3425,7 @@ static int wdc_get_c1_log_page(int fd, char *format, uint8_t interval)
 	return ret;
 }
 
-static int wdc_get_d0_log_page(int fd, char *format)
+static int wdc_get_d0_log_page(int fd, char *format, struct nvme_prom *prom)
 {
 	int ret = 0;
 	int fmt = -1;
@@ -3242,7 +3434,7 @@ static int wdc_get_d0_log_page(int fd, char *format)
 
 	if (!wdc_check_device(fd))
 		return -1;
-	fmt = validate_output_format(format);
+	fmt = validate_metrics_output_format(format);
 	if (fmt < 0) {
 		fprintf(stderr, "ERROR : WDC : invalid output format\n");
 		return fmt;
@@ -3268,7 +3460,7 @@ static int wdc_get_d0_log_page(int fd, char *format)
 	if (ret == 0) {
 		/* parse the data */
 		perf = (struct wdc_ssd_d0_smart_log *)(data);
-		ret = wdc_print_d0_log(perf, fmt);
+		ret = wdc_print_d0_log(perf, fmt, prom);
 	} else {
 		fprintf(stderr, "ERROR : WDC : Unable to read D0 Log Page data\n");
 		ret = -1;
@@ -3283,6 +3475,7 @@ static int wdc_vs_smart_add_log(int argc, char **argv, struct command *command,
 {
 	const char *desc = "Retrieve additional performance statistics.";
 	const char *interval = "Interval to read the statistics from [1, 15].";
+	struct nvme_prom *prom = NULL;
 	int fd;
 	int ret = 0;
 	__u64 capabilities = 0;
@@ -3300,7 +3493,7 @@ static int wdc_vs_smart_add_log(int argc, char **argv, struct command *command,
 
 	OPT_ARGS(opts) = {
 		OPT_UINT("interval", 'i', &cfg.interval, interval),
-		OPT_FMT("output-format", 'o', &cfg.output_format, "Output Format: normal|json"),
+		OPT_FMT("output-format", 'o', &cfg.output_format, "Output Format: normal|json|prometheus"),
 		OPT_END()
 	};
 
@@ -3309,6 +3502,8 @@ static int wdc_vs_smart_add_log(int argc, char **argv, struct command *command,
 		return fd;
 
 	capabilities = wdc_get_drive_capabilities(fd);
+	if (validate_metrics_output_format(cfg.output_format) == PROMETHEUS)
+		prom = nvme_prom_begin(devicename);
 
 	if ((capabilities & WDC_DRIVE_CAP_SMART_LOG_MASK) == 0) {
 		fprintf(stderr, "ERROR : WDC: unsupported device for this command\n");
@@ -3318,23 +3513,26 @@ static int wdc_vs_smart_add_log(int argc, char **argv, struct command *command,
 
 	if ((capabilities & (WDC_DRIVE_CAP_CA_LOG_PAGE)) == (WDC_DRIVE_CAP_CA_LOG_PAGE)) {
 		/* Get the CA Log Page */
-		ret = wdc_get_ca_log_page(fd, cfg.output_format);
+		ret = wdc_get_ca_log_page(fd, cfg.output_format, prom);
 		if (ret)
 			fprintf(stderr, "ERROR : WDC : Failure reading the CA Log Page, ret = %d\n", ret);
 	}
 	if ((capabilities & WDC_DRIVE_CAP_C1_LOG_PAGE) == WDC_DRIVE_CAP_C1_LOG_PAGE) {
 		/* Get the C1 Log Page */
-		ret = wdc_get_c1_log_page(fd, cfg.output_format, cfg.interval);
+		ret = wdc_get_c1_log_page(fd, cfg.output_format, cfg.interval,
+				prom);
 		if (ret)
 			fprintf(stderr, "ERROR : WDC : Failure reading the C1 Log Page, ret = %d\n", ret);
 	}
 	if ((capabilities & WDC_DRIVE_CAP_D0_LOG_PAGE) == WDC_DRIVE_CAP_D0_LOG_PAGE) {
 		/* Get the D0 Log Page */
-		ret = wdc_get_d0_log_page(fd, cfg.output_format);
+		ret = wdc_get_d0_log_page(fd, cfg.output_format, prom);
 		if (ret)
 			fprintf(stderr, "ERROR : WDC : Failure reading the D0 Log Page, ret = %d\n", ret);
 	}
 out:
+	if (prom)
+		nvme_prom_end(prom);
 	return ret;
 }
 
@@ -0,0 +1,102 @@
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+""" nvme ana-check test :-
+
+    1. Run ana-check against a copy of sysfs with one subsystem of two
+       TCP controllers, each with a path to the two multipath heads:
+       nvme0n1 optimized through nvme0 and non-optimized through nvme1,
+       nvme0n2 inaccessible through both.
+    2. Check that the paths of each head are found in the sysfs
+       directories of the controllers, with the state the kernel has for
+       them, and that only nvme0n2 is left without a usable path.
+
+    Needs no device: the copy is mounted over /sys, and an empty
+    directory over /dev, in a private user and mount namespace, so the
+    ANA logs cannot be read and the kernel's states are used instead.
+"""
+
+import os
+import json
+import unittest
+import subprocess
+
+
+SYSFS = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                     "fixtures", "ana-check", "sys")
+
+
+def nvme_bin():
+    """ The nvme binary of this tree if built, else the one in PATH. """
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "..", "nvme")
+    return os.path.abspath(path) if os.path.exists(path) else "nvme"
+
+
+class TestNVMeAnaCheck(unittest.TestCase):
+
+    """ Represents nvme ana-check test against a copy of sysfs """
+
+    def setUp(self):
+        """ Pre Section for TestNVMeAnaCheck """
+        if subprocess.call(["unshare", "-Urm", "true"],
+                           stderr=subprocess.DEVNULL) != 0:
+            self.skipTest("user and mount namespaces are not available")
+
+    def ana_check(self):
+        """ Runs ana-check on the copy of sysfs.
+            - Args:
+                - None
+            - Returns:
+                - the exit status and the report object.
+        """
+        script = ('dev=$(mktemp -d) && mount --bind "$1" /sys && '
+                  'mount --bind "$dev" /dev && exec "$2" ana-check '
+                  '--output-format=json')
+        proc = subprocess.run(["unshare", "-Urm", "sh", "-c", script, "sh",
+                               SYSFS, nvme_bin()],
+                              stdout=subprocess.PIPE,
+                              stderr=subprocess.DEVNULL)
+        return proc.returncode, json.loads(proc.stdout.decode())
+
+    def test_paths(self):
+        """ Testcase main """
+        ret, report = self.ana_check()
+        self.assertEqual(ret, 1)
+        self.assertEqual(len(report["subsystems"]), 1)
+
+        subsys = report["subsystems"][0]
+        self.assertEqual(subsys["nqn"], "nqn.2014-08.org.example:array")
+        self.assertEqual(subsys["iopolicy"], "numa")
+
+        ns = dict((n["name"], n) for n in subsys["namespaces"])
+        self.assertEqual(sorted(ns), ["nvme0n1", "nvme0n2"])
+        self.assertEqual([(p["path"], p["controller"],
+                           p["kernel_ana_state"], p["in_use"])
+                          for p in ns["nvme0n1"]["paths"]],
+                         [("nvme0c0n1", "nvme0", "optimized", 1),
+                          ("nvme0c1n1", "nvme1", "non-optimized", 0)])
+        self.assertEqual([(p["path"], p["controller"],
+                           p["kernel_ana_state"], p["in_use"])
+                          for p in ns["nvme0n2"]["paths"]],
+                         [("nvme0c0n2", "nvme0", "inaccessible", 0),
+                          ("nvme0c1n2", "nvme1", "inaccessible", 0)])
+        self.assertEqual(ns["nvme0n1"]["paths"][1]["address"],
+                         "traddr=192.168.0.11 trsvcid=4420")
+
+        problems = [(p.get("namespace"), p["problem"])
+                    for p in subsys["problems"]]
+        self.assertIn(("nvme0n2", "no usable path"), problems)
+        self.assertEqual([p for p in problems if p[0] == "nvme0n1"], [])
+
+
+if __name__ == "__main__":
+    unittest.main()
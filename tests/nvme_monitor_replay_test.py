@@ -0,0 +1,186 @@
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+""" nvme monitor replay test :-
+
+    1. Replay a recording of uevents in which a controller is added
+       before its subsystem, connects, reports an AEN and is recreated
+       under a new name after a connection loss.
+    2. Check the events reported, and that the recreated controller is
+       matched to the removed one to time the reconnect.
+    3. Replay with --live, against a copy of sysfs that changes between
+       events, the add event of a live controller not yet linked to its
+       subsystem, then the add event of the subsystem once it is.
+    4. Check that the controller is moved to the subsystem and that its
+       later events report it there.
+
+    Needs no device, the recording replaces the kernel. The copy of sysfs
+    is mounted over /sys, and an empty directory over /dev, in a private
+    user and mount namespace.
+"""
+
+import os
+import json
+import tempfile
+import unittest
+import subprocess
+
+
+FIXTURES = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "fixtures", "monitor")
+
+
+def nvme_bin():
+    """ The nvme binary of this tree if built, else the one in PATH. """
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "..", "nvme")
+    return os.path.abspath(path) if os.path.exists(path) else "nvme"
+
+
+def write_file(path, value):
+    """ Writes value and a newline to path, creating its directory. """
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, "w") as f:
+        f.write(value + "\n")
+
+
+class TestNVMeMonitorReplay(unittest.TestCase):
+
+    """ Represents nvme monitor --replay test """
+
+    def replay(self, name):
+        """ Replays a recording, returns the events reported.
+            - Args:
+                - name : recording in the fixtures directory.
+            - Returns:
+                - list of the event objects.
+        """
+        out = subprocess.check_output([nvme_bin(), "monitor", "--replay=" +
+                                       os.path.join(FIXTURES, name)])
+        return [json.loads(line) for line in out.decode().splitlines()]
+
+    def test_reconnect(self):
+        """ Testcase main """
+        events = self.replay("reconnect.uevents")
+        self.assertEqual([e["event"] for e in events],
+                         ["ctrl-add", "subsystem-add", "ctrl-event",
+                          "ctrl-state", "ns-add", "aen", "ctrl-remove",
+                          "ctrl-add", "ctrl-event", "ctrl-state",
+                          "ns-remove"])
+
+        # added before its subsystem, with no NQN to report
+        self.assertEqual(events[0]["device"], "nvme0")
+        self.assertNotIn("subsysnqn", events[0])
+        self.assertEqual(events[0]["transport"], "tcp")
+        self.assertEqual(events[0]["address"],
+                         "traddr=192.168.0.10 trsvcid=4420")
+        self.assertEqual(events[1]["device"], "nvme-subsys0")
+
+        self.assertEqual(events[3]["state"], "live")
+        self.assertNotIn("reconnect_ms", events[3])
+
+        self.assertEqual(events[4]["device"], "nvme0n1")
+        self.assertEqual(events[4]["subsystem"], "nvme-subsys0")
+        self.assertEqual(events[4]["nsid"], 1)
+
+        self.assertEqual(events[5]["type"], "notice")
+
+        # recreated as nvme1 2.5s after the removal of nvme0
+        self.assertEqual(events[7]["device"], "nvme1")
+        self.assertEqual(events[9]["device"], "nvme1")
+        self.assertEqual(events[9]["state"], "live")
+        self.assertEqual(events[9]["reconnect_ms"], 2500)
+
+        # UDEV events of the recording are skipped
+        self.assertEqual(len([e for e in events
+                              if e["timestamp"] == "100.002000"]), 0)
+
+    def test_live_refile(self):
+        """ Testcase main """
+        if subprocess.call(["unshare", "-Urm", "true"],
+                           stderr=subprocess.DEVNULL) != 0:
+            self.skipTest("user and mount namespaces are not available")
+
+        nqn = "nqn.2014-08.org.example:array"
+        with tempfile.TemporaryDirectory() as sysfs:
+            ctrl = os.path.join(sysfs, "class", "nvme", "nvme0")
+            subsys = os.path.join(sysfs, "class", "nvme-subsystem",
+                                  "nvme-subsys0")
+            write_file(os.path.join(ctrl, "state"), "live")
+            write_file(os.path.join(ctrl, "transport"), "tcp")
+            write_file(os.path.join(ctrl, "address"),
+                       "traddr=192.168.0.10,trsvcid=4420")
+            os.makedirs(os.path.dirname(subsys))
+
+            script = ('dev=$(mktemp -d) && mount --bind "$1" /sys && '
+                      'mount --bind "$dev" /dev && '
+                      'exec "$2" monitor --replay=- --live --interval=0')
+            proc = subprocess.Popen(["unshare", "-Urm", "sh", "-c", script,
+                                     "sh", sysfs, nvme_bin()],
+                                    stdin=subprocess.PIPE,
+                                    stdout=subprocess.PIPE,
+                                    universal_newlines=True)
+
+            def send(event):
+                """ Sends one event to the monitor. """
+                proc.stdin.write(event + "\n\n")
+                proc.stdin.flush()
+
+            try:
+                # the controller is there, but not linked to its subsystem
+                send("KERNEL[100.000100] add /devices/virtual/"
+                     "nvme-fabrics/ctl/nvme0 (nvme)\n"
+                     "ACTION=add\n"
+                     "DEVPATH=/devices/virtual/nvme-fabrics/ctl/nvme0\n"
+                     "SUBSYSTEM=nvme\n"
+                     "DEVNAME=nvme0")
+                event = json.loads(proc.stdout.readline())
+                self.assertEqual(event["event"], "ctrl-add")
+                self.assertEqual(event["subsystem"], "nvme0")
+                self.assertNotIn("subsysnqn", event)
+                self.assertEqual(event["state"], "live")
+
+                write_file(os.path.join(subsys, "subsysnqn"), nqn)
+                os.symlink("../../nvme/nvme0", os.path.join(subsys, "nvme0"))
+                send("KERNEL[100.000300] add /devices/virtual/"
+                     "nvme-subsystem/nvme-subsys0 (nvme-subsystem)\n"
+                     "ACTION=add\n"
+                     "DEVPATH=/devices/virtual/nvme-subsystem/nvme-subsys0\n"
+                     "SUBSYSTEM=nvme-subsystem")
+                send("KERNEL[100.010000] change /devices/virtual/"
+                     "nvme-fabrics/ctl/nvme0 (nvme)\n"
+                     "ACTION=change\n"
+                     "DEVPATH=/devices/virtual/nvme-fabrics/ctl/nvme0\n"
+                     "SUBSYSTEM=nvme\n"
+                     "NVME_EVENT=connected")
+                out = proc.communicate(timeout=10)[0]
+            finally:
+                if proc.poll() is None:
+                    proc.kill()
+                    proc.communicate()
+            events = [json.loads(line) for line in out.splitlines()]
+
+        self.assertEqual(proc.returncode, 0)
+        self.assertEqual([e["event"] for e in events],
+                         ["subsystem-add", "ctrl-subsystem", "ctrl-event"])
+        self.assertEqual(events[0]["device"], "nvme-subsys0")
+        self.assertEqual(events[0]["subsysnqn"], nqn)
+
+        # moved once the link shows up, and reported there from then on
+        self.assertEqual(events[1]["device"], "nvme0")
+        self.assertEqual(events[1]["subsystem"], "nvme-subsys0")
+        self.assertEqual(events[1]["subsysnqn"], nqn)
+        self.assertEqual(events[2]["device"], "nvme0")
+        self.assertEqual(events[2]["subsystem"], "nvme-subsys0")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,114 @@
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+""" nvme pcie-health --sysfs test :-
+
+    1. Read a copy of sysfs with three PCIe controllers and one over TCP,
+       on a system of two NUMA nodes:
+       - nvme0 trained at Gen3 x2 below the Gen4 x4 of both ends, with
+         AER counts and an AER capability latching errors in config space.
+       - nvme1 a Gen5 device behind a Gen4 port, of unknown NUMA node.
+       - nvme2 a healthy Gen3 link right off the root complex.
+    2. Check the links, bandwidths and warnings reported for each, that
+       the TCP controller is left out and that a controller can be named.
+
+    Needs no device, the copy replaces /sys.
+"""
+
+import os
+import json
+import unittest
+import subprocess
+
+
+SYSFS = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                     "fixtures", "pcie-health", "sys")
+
+
+def nvme_bin():
+    """ The nvme binary of this tree if built, else the one in PATH. """
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "..", "nvme")
+    return path if os.path.exists(path) else "nvme"
+
+
+class TestNVMePcieHealth(unittest.TestCase):
+
+    """ Represents nvme pcie-health --sysfs test """
+
+    def pcie_health(self, *args):
+        """ Reads the copy of sysfs, returns the controllers reported.
+            - Args:
+                - args : more arguments of the command.
+            - Returns:
+                - dict of the controller objects, by name.
+        """
+        out = subprocess.check_output([nvme_bin(), "pcie-health",
+                                       "--sysfs=" + SYSFS,
+                                       "--output-format=json"] +
+                                      list(args), stderr=subprocess.DEVNULL)
+        return dict((c["controller"], c)
+                    for c in json.loads(out.decode())["controllers"])
+
+    def test_all(self):
+        """ Testcase main """
+        ctrls = self.pcie_health()
+        self.assertEqual(sorted(ctrls), ["nvme0", "nvme1", "nvme2"])
+
+        ctrl = ctrls["nvme0"]
+        self.assertEqual(ctrl["address"], "0000:01:00.0")
+        self.assertEqual(ctrl["current_link_width"], 2)
+        self.assertEqual(ctrl["port_max_link_speed"], "16.0 GT/s PCIe")
+        self.assertEqual(ctrl["bandwidth_mbps"], 1969)
+        self.assertEqual(ctrl["max_bandwidth_mbps"], 7876)
+        self.assertEqual(ctrl["numa_node"], 0)
+        self.assertEqual(ctrl["aer"],
+                         {"correctable": 15, "nonfatal": 0, "fatal": 0})
+        self.assertEqual(ctrl["aer_status"],
+                         {"correctable": "RxErr BadTLP",
+                          "uncorrectable": "CmpltTO"})
+        self.assertEqual(len(ctrl["warnings"]), 4)
+        self.assertTrue(ctrl["warnings"][0].startswith(
+            "link trained at 8.0 GT/s PCIe (Gen3), below the 16.0 GT/s"))
+        self.assertEqual(ctrl["warnings"][1],
+                         "link trained at x2, below the x4 both ends support")
+        self.assertIn("(RxErr 12, BadTLP 3)", ctrl["warnings"][2])
+        self.assertIn("CmpltTO", ctrl["warnings"][3])
+
+        # limited by its port, which is not a link training problem
+        ctrl = ctrls["nvme1"]
+        self.assertEqual(ctrl["bandwidth_mbps"], ctrl["max_bandwidth_mbps"])
+        self.assertEqual(ctrl["numa_node"], -1)
+        self.assertEqual(ctrl["aer_status"],
+                         {"correctable": "none", "uncorrectable": "none"})
+        self.assertEqual(len(ctrl["warnings"]), 2)
+        self.assertTrue(ctrl["warnings"][0].startswith(
+            "the port supports only 16.0 GT/s PCIe"))
+        self.assertIn("system of 2 nodes", ctrl["warnings"][1])
+
+        # an older kernel's speed, no port above, no AER
+        ctrl = ctrls["nvme2"]
+        self.assertEqual(ctrl["current_link_speed"], "8 GT/s")
+        self.assertNotIn("port_max_link_speed", ctrl)
+        self.assertNotIn("aer", ctrl)
+        self.assertEqual(ctrl["bandwidth_mbps"], 3938)
+        self.assertEqual(ctrl["warnings"], [])
+
+    def test_one(self):
+        """ Testcase of a controller named on the command line """
+        self.assertEqual(sorted(self.pcie_health("/dev/nvme1")), ["nvme1"])
+        # a controller of another transport is an error when named
+        with self.assertRaises(subprocess.CalledProcessError):
+            self.pcie_health("nvme3")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,117 @@
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+""" nvme trace --input test :-
+
+    1. Read a saved trace of 200 I/O commands of nvme0, spread over
+       4 queues and split across 2 CPUs, with their setup and completion
+       on different CPUs, a padding event and an event of another kind.
+       A third CPU holds 10 admin commands of nvme1, a completion without
+       its setup, a command left in flight and a page that lost 5 events.
+    2. Check that every command is matched to its completion, the counts
+       and latencies per opcode and per queue, and the slowest commands.
+
+    Needs no device, the saved trace replaces tracefs.
+"""
+
+import os
+import json
+import unittest
+import subprocess
+
+
+FIXTURES = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "fixtures", "trace")
+
+
+def nvme_bin():
+    """ The nvme binary of this tree if built, else the one in PATH. """
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "..", "nvme")
+    return path if os.path.exists(path) else "nvme"
+
+
+class TestNVMeTraceInput(unittest.TestCase):
+
+    """ Represents nvme trace --input test """
+
+    def trace(self, name):
+        """ Reads a saved trace, returns the report.
+            - Args:
+                - name : saved trace in the fixtures directory.
+            - Returns:
+                - the report object, with the controllers by name.
+        """
+        out = subprocess.check_output([nvme_bin(), "trace", "--input=" +
+                                       os.path.join(FIXTURES, name),
+                                       "--outliers=3",
+                                       "--output-format=json"],
+                                      stderr=subprocess.DEVNULL)
+        report = json.loads(out.decode())
+        report["controllers"] = dict((c["controller"], c)
+                                     for c in report["controllers"])
+        return report
+
+    def test_io(self):
+        """ Testcase main """
+        report = self.trace("io")
+        self.assertEqual(report["lost_events"], 5)
+        self.assertEqual(sorted(report["controllers"]), ["nvme0", "nvme1"])
+
+        ctrl = report["controllers"]["nvme0"]
+        self.assertEqual(ctrl["commands"], 200)
+        self.assertEqual(ctrl["errors"], 1)
+        self.assertEqual(ctrl["unmatched_completions"], 0)
+        self.assertEqual(ctrl["in_flight"], 0)
+        self.assertEqual(ctrl["max_us"], 5000000)
+
+        opcodes = dict((o["command"], o) for o in ctrl["opcodes"])
+        self.assertEqual(sorted(opcodes), ["read", "write"])
+        self.assertEqual(opcodes["write"]["opcode"], 1)
+        self.assertEqual(opcodes["write"]["commands"], 67)
+        self.assertEqual(opcodes["write"]["errors"], 0)
+        self.assertEqual(opcodes["write"]["p50_us"], 20)
+        self.assertEqual(opcodes["write"]["max_us"], 5000000)
+        self.assertEqual(opcodes["read"]["opcode"], 2)
+        self.assertEqual(opcodes["read"]["commands"], 133)
+        self.assertEqual(opcodes["read"]["errors"], 1)
+        self.assertEqual(opcodes["read"]["p50_us"], 100)
+        self.assertEqual(opcodes["read"]["max_us"], 100)
+
+        queues = dict((q["qid"], q) for q in ctrl["queues"])
+        self.assertEqual(sorted(queues), [1, 2, 3, 4])
+        for qid in queues:
+            self.assertEqual(queues[qid]["commands"], 50)
+        self.assertEqual([queues[qid]["errors"] for qid in sorted(queues)],
+                         [0, 0, 0, 1])
+        self.assertEqual(queues[4]["max_us"], 5000000)
+
+        # slowest first, the read latencies grow with the command id
+        self.assertEqual([(o["cid"], o["qid"], o["command"], o["latency_us"])
+                          for o in ctrl["outliers"]],
+                         [(99, 4, "write", 5000000), (199, 4, "read", 100),
+                          (197, 2, "read", 100)])
+        self.assertEqual(ctrl["outliers"][0]["disk"], "nvme0n1")
+
+        ctrl = report["controllers"]["nvme1"]
+        self.assertEqual(ctrl["commands"], 10)
+        self.assertEqual(ctrl["unmatched_completions"], 1)
+        self.assertEqual(ctrl["in_flight"], 1)
+        self.assertEqual([(o["command"], o["admin"], o["commands"])
+                          for o in ctrl["opcodes"]],
+                         [("admin identify", 1, 10)])
+        self.assertEqual([(q["qid"], q["commands"]) for q in ctrl["queues"]],
+                         [(0, 10)])
+        self.assertEqual(ctrl["max_us"], 2000)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -405,3 +405,63 @@ static void json_print_value(struct json_value *value, void *out)
 		break;
 	}
 }
+
+static void json_print_compact_value(struct json_value *value);
+static void json_print_compact_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+/*
+ * Prints obj on a single line without padding, as used for newline
+ * delimited streams of objects. Strings are escaped.
+ */
+void json_print_object_compact(struct json_object *obj)
+{
+	int i;
+
+	putchar('{');
+	for (i = 0; i < obj->pair_cnt; i++) {
+		if (i > 0)
+			putchar(',');
+		json_print_compact_string(obj->pairs[i]->name);
+		putchar(':');
+		json_print_compact_value(obj->pairs[i]->value);
+	}
+	putchar('}');
+}
+
+static void json_print_compact_value(struct json_value *value)
+{
+	int i;
+
+	switch (value->type) {
+	case JSON_TYPE_STRING:
+		json_print_compact_string(value->string);
+		break;
+	case JSON_TYPE_OBJECT:
+		json_print_object_compact(value->object);
+		break;
+	case JSON_TYPE_ARRAY:
+		putchar('[');
+		for (i = 0; i < value->array->value_cnt; i++) {
+			if (i > 0)
+				putchar(',');
+			json_print_compact_value(value->array->values[i]);
+		}
+		putchar(']');
+		break;
+	default:
+		json_print_value(value, NULL);
+		break;
+	}
+}
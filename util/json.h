@@ -85,4 +85,5 @@ int json_array_add_value_type(struct json_array *array, int type, ...);
 	(obj->values[obj->value_cnt - 1]->object)
 
 void json_print_object(struct json_object *obj, void *);
+void json_print_object_compact(struct json_object *obj);
 #endif